@@ -1,6 +1,9 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <new>
 #include <vector>
 
 namespace wing {
@@ -28,4 +31,64 @@ class ArenaAllocator {
   size_t offset_{BlockSize + 1};
 };
 
+/**
+ * A thread-safe ArenaAllocator. The returned memory is aligned to 8 bytes.
+ *
+ * Allocations from the current block only bump an atomic offset. The mutex is
+ * taken when the current block is used up, or for a large allocation which
+ * gets a block of its own.
+ */
+class ConcurrentArenaAllocator {
+ public:
+  constexpr static size_t BlockSize = 64 * 1024;
+  constexpr static size_t Alignment = 8;
+
+  uint8_t* Allocate(size_t size) {
+    size = (size + Alignment - 1) / Alignment * Alignment;
+    if (size > BlockSize / 4) {
+      std::unique_lock lck(mu_);
+      return NewBlock(size)->data();
+    }
+    while (true) {
+      auto block = current_.load(std::memory_order_acquire);
+      if (block != nullptr) {
+        auto offset = block->offset_.fetch_add(size, std::memory_order_relaxed);
+        if (offset + size <= BlockSize) {
+          return block->data() + offset;
+        }
+      }
+      std::unique_lock lck(mu_);
+      /* Another thread may have replaced the block. */
+      if (current_.load(std::memory_order_relaxed) == block) {
+        current_.store(NewBlock(BlockSize), std::memory_order_release);
+      }
+    }
+  }
+
+  /* Require: no concurrent allocations. */
+  void Clear() {
+    std::unique_lock lck(mu_);
+    current_.store(nullptr, std::memory_order_relaxed);
+    blocks_.clear();
+  }
+
+ private:
+  struct Block {
+    std::atomic<size_t> offset_{0};
+    uint8_t* data() { return reinterpret_cast<uint8_t*>(this + 1); }
+  };
+  static_assert(sizeof(Block) % Alignment == 0);
+
+  // REQUIRES: this->mu_ held
+  Block* NewBlock(size_t size) {
+    blocks_.push_back(std::unique_ptr<uint64_t[]>(
+        new uint64_t[(sizeof(Block) + size) / sizeof(uint64_t)]));
+    return new (blocks_.back().get()) Block();
+  }
+
+  std::mutex mu_;
+  std::atomic<Block*> current_{nullptr};
+  std::vector<std::unique_ptr<uint64_t[]>> blocks_;
+};
+
 }  // namespace wing
@@ -2,6 +2,10 @@
 
 #include "common/serializer.hpp"
 
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
 namespace wing {
 
 namespace utils {
@@ -65,6 +69,123 @@ bool BloomFilter::Find(size_t h, std::string_view bloom_bits) {
   return true;
 }
 
+namespace {
+
+/* Odd multipliers which derive the probes from the lower 32 bits of a hash */
+alignas(32) constexpr uint32_t kProbeSalt[BlockedBloomFilter::kMaxProbes] = {
+    0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU, 0x705495c7U,
+    0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U};
+
+struct BlockedHeader {
+  size_t blocks;
+  size_t probes;
+};
+
+BlockedHeader ReadBlockedHeader(const char* bloom_bits) {
+  auto des = utils::Deserializer(bloom_bits);
+  size_t blocks = des.Read<uint64_t>();
+  size_t key_n = des.Read<uint64_t>();
+  size_t bits_per_key = des.Read<uint64_t>();
+  (void)key_n;
+  size_t probes = std::min<size_t>(BlockedBloomFilter::kMaxProbes,
+      std::max<size_t>(1, bits_per_key * 0.69));
+  return {blocks, probes};
+}
+
+/* Map the upper 32 bits of the hash to [0, blocks) without a division. */
+size_t BlockIndex(size_t h, size_t blocks) {
+  return ((h >> 32) * blocks) >> 32;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2"))) bool FindAVX2(
+    const char* block, uint32_t h, size_t probes) {
+  const __m256i salt =
+      _mm256_load_si256(reinterpret_cast<const __m256i*>(kProbeSalt));
+  __m256i x = _mm256_mullo_epi32(_mm256_set1_epi32(h), salt);
+  __m256i pos = _mm256_and_si256(
+      _mm256_srli_epi32(x, 23), _mm256_set1_epi32(31));
+  __m256i bits = _mm256_sllv_epi32(_mm256_set1_epi32(1), pos);
+  __m256i active = _mm256_cmpgt_epi32(_mm256_set1_epi32(probes),
+      _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+  bits = _mm256_and_si256(bits, active);
+  /* Gather word x >> 28 of the block. Its top bit is the sign bit of x. */
+  __m256i word = _mm256_srli_epi32(x, 28);
+  __m256i lo = _mm256_permutevar8x32_epi32(
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block)), word);
+  __m256i hi = _mm256_permutevar8x32_epi32(
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + 32)), word);
+  __m256i words = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(lo),
+      _mm256_castsi256_ps(hi), _mm256_castsi256_ps(x)));
+  return _mm256_testc_si256(words, bits);
+}
+
+bool HasAVX2() {
+  static const bool has_avx2 = [] {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+  }();
+  return has_avx2;
+}
+#endif
+
+}  // namespace
+
+void BlockedBloomFilter::Create(
+    size_t key_n, size_t bits_per_key, std::string& bloom_bits) {
+  size_t bits = key_n * bits_per_key;
+  size_t blocks = std::max<size_t>(1, (bits + 511) / 512);
+  bloom_bits.resize(kHeaderSize + blocks * kBlockSize, 0);
+  utils::Serializer(bloom_bits.data())
+      .Write<uint64_t>(blocks)
+      .Write<uint64_t>(key_n)
+      .Write<uint64_t>(bits_per_key);
+}
+
+void BlockedBloomFilter::Add(std::string_view key, std::string& bloom_bits) {
+  Add(BloomHash(key), bloom_bits);
+}
+
+void BlockedBloomFilter::Add(size_t h, std::string& bloom_bits) {
+  auto [blocks, probes] = ReadBlockedHeader(bloom_bits.data());
+  auto* block = reinterpret_cast<uint32_t*>(
+      bloom_bits.data() + kHeaderSize + BlockIndex(h, blocks) * kBlockSize);
+  for (size_t i = 0; i < probes; i++) {
+    uint32_t x = static_cast<uint32_t>(h) * kProbeSalt[i];
+    block[x >> 28] |= 1U << ((x >> 23) & 31);
+  }
+}
+
+bool BlockedBloomFilter::Find(
+    std::string_view key, std::string_view bloom_bits) {
+  return Find(BloomHash(key), bloom_bits);
+}
+
+bool BlockedBloomFilter::Find(size_t h, std::string_view bloom_bits) {
+#if defined(__x86_64__)
+  if (HasAVX2()) {
+    auto [blocks, probes] = ReadBlockedHeader(bloom_bits.data());
+    return FindAVX2(bloom_bits.data() + kHeaderSize +
+                        BlockIndex(h, blocks) * kBlockSize,
+        static_cast<uint32_t>(h), probes);
+  }
+#endif
+  return FindScalar(h, bloom_bits);
+}
+
+bool BlockedBloomFilter::FindScalar(size_t h, std::string_view bloom_bits) {
+  auto [blocks, probes] = ReadBlockedHeader(bloom_bits.data());
+  auto* block = reinterpret_cast<const uint32_t*>(
+      bloom_bits.data() + kHeaderSize + BlockIndex(h, blocks) * kBlockSize);
+  for (size_t i = 0; i < probes; i++) {
+    uint32_t x = static_cast<uint32_t>(h) * kProbeSalt[i];
+    if (!(block[x >> 28] & (1U << ((x >> 23) & 31)))) {
+      return false;
+    }
+  }
+  return true;
+}
+
 }  // namespace utils
 
 }  // namespace wing
@@ -1,11 +1,25 @@
 #pragma once
 
+#include <cstdint>
+
 #include "common/murmurhash.hpp"
 
 namespace wing {
 
 namespace utils {
 
+/**
+ * The layout of a bloom filter buffer.
+ * kStandard: BloomFilter. The probes of a key are spread over the whole
+ * filter.
+ * kBlocked: BlockedBloomFilter. All probes of a key land in one 64-byte
+ * block, i.e. one cache line.
+ */
+enum class BloomFilterFormat : uint8_t {
+  kStandard = 0,
+  kBlocked = 1,
+};
+
 class BloomFilter {
  public:
   static size_t BloomHash(std::string_view key) {
@@ -25,8 +39,52 @@ class BloomFilter {
   /* Check if a key may be added */
   static bool Find(std::string_view key, std::string_view bloom_bits);
 
-  /* Check if a key (i.e. BloomHash(key)) may be added */
+  /* Check if a key may be added */
+  static bool Find(size_t hash1, std::string_view bloom_bits);
+};
+
+/**
+ * A bloom filter made of 64-byte blocks. The upper 32 bits of the hash pick
+ * the block, and the lower 32 bits derive up to 8 probes inside it, so a
+ * lookup touches one cache line instead of one per probe. Each probe picks
+ * one of the 16 32-bit words of the block and one bit in it, so that Find can
+ * test all probes at once with AVX2.
+ *
+ * The buffer is | number of blocks | key_n | bits_per_key | padding | blocks |,
+ * and the header is 64 bytes, so the blocks are cache-line aligned if the
+ * buffer is.
+ */
+class BlockedBloomFilter {
+ public:
+  static constexpr size_t kBlockSize = 64;
+  static constexpr size_t kHeaderSize = 64;
+  static constexpr size_t kMaxProbes = 8;
+
+  static size_t BloomHash(std::string_view key) {
+    return BloomFilter::BloomHash(key);
+  }
+
+  /* Create a bloom filter buffer */
+  static void Create(
+      size_t key_n, size_t bits_per_key, std::string& bloom_bits);
+
+  /* Add a key to the bloom filter */
+  static void Add(std::string_view key, std::string& bloom_bits);
+
+  /* Add a key hash (i.e. BloomHash(key)) to the bloom filter */
+  static void Add(size_t hash1, std::string& bloom_bits);
+
+  /* Check if a key may be added */
+  static bool Find(std::string_view key, std::string_view bloom_bits);
+
+  /**
+   * Check if a key hash may be added. It uses the AVX2 probe if the CPU
+   * supports it, and FindScalar otherwise.
+   */
   static bool Find(size_t hash1, std::string_view bloom_bits);
+
+  /* The portable version of Find. */
+  static bool FindScalar(size_t hash1, std::string_view bloom_bits);
 };
 
 }  // namespace utils
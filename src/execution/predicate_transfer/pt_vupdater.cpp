@@ -49,12 +49,13 @@ void PtVecUpdater::Execute(
         if (tuple.GetElemType(i) == LogicalType::INT ||
             tuple.GetElemType(i) == LogicalType::FLOAT) {
           uint64_t data = tuple[i].ReadInt();
-          hash = utils::BloomFilter::BloomHash(std::string_view(
+          hash = utils::BlockedBloomFilter::BloomHash(std::string_view(
               reinterpret_cast<const char*>(&data), sizeof(uint64_t)));
         } else if (tuple.GetElemType(i) == LogicalType::STRING) {
-          hash = utils::BloomFilter::BloomHash(tuple[i].ReadStringView());
+          hash = utils::BlockedBloomFilter::BloomHash(
+              tuple[i].ReadStringView());
         }
-        if (!utils::BloomFilter::Find(hash, bf)) {
+        if (!utils::BlockedBloomFilter::Find(hash, bf)) {
           hash_found = false;
           break;
         }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <unordered_map>
 #include <vector>
 
 #include "catalog/db.hpp"
@@ -45,19 +46,82 @@ class FKChecker {
           x.Read<StaticFieldRef>(fk_schema_[i].index_ * sizeof(StaticFieldRef));
       auto key_view = StaticFieldRef::GetView(
           &key, fk_schema_[i].type_, fk_schema_[i].size_);
+      if (_merge_ref(i, key, key_view)) {
+        continue;
+      }
       if (auto ret = fk_check_in_refcounts_[i]->Search(key_view); ret) {
         size_t value =
             SingleTuple(ret).Read<size_t>(Tuple::GetOffsetOfStaticField(0)) + 1;
         _update(i, key, fk_schema_[i].type_, fk_schema_[i].size_, key_view,
-            value, false);
+            value, WriteMode::kUpdate);
         continue;
       }
       if (!fk_check_[i]->Search(key_view)) {
         throw DBException("Primary key does not exist.");
       }
       // Create a new entry.
-      _update(
-          i, key, fk_schema_[i].type_, fk_schema_[i].size_, key_view, 1, true);
+      _update(i, key, fk_schema_[i].type_, fk_schema_[i].size_, key_view, 1,
+          WriteMode::kInsert);
+    }
+  }
+
+  /**
+   * Same as calling InsertCheck for each tuple, but the tuples are serialized
+   * and the keys of each foreign key are searched in one batch. Each distinct
+   * key is updated once.
+   */
+  void InsertCheck(const std::vector<std::string_view>& raw_tuples) {
+    for (uint32_t i = 0; i < fk_schema_.size(); i++) {
+      // The number of new references to each distinct key.
+      std::unordered_map<std::string_view, size_t> new_refs;
+      std::vector<std::string_view> keys;
+      for (auto raw_x : raw_tuples) {
+        auto key_view = Tuple::GetFieldView(raw_x.data(), fk_offsets_[i],
+            fk_schema_[i].type_, fk_schema_[i].size_);
+        if (new_refs[key_view]++ == 0) {
+          keys.push_back(key_view);
+        }
+      }
+      if (fk_update_refcounts_[i]->SupportsMerge()) {
+        // Check all the keys, since the refcounts are not read.
+        fk_check_[i]->MultiSearch(keys, [&](size_t, const uint8_t* ret) {
+          if (!ret) {
+            throw DBException("Primary key does not exist.");
+          }
+        });
+        for (auto key_view : keys) {
+          auto key = _key_ref(i, key_view);
+          _update(i, key, fk_schema_[i].type_, fk_schema_[i].size_, key_view,
+              new_refs[key_view], WriteMode::kMerge);
+        }
+        continue;
+      }
+      std::vector<size_t> refcounts(keys.size(), 0);
+      std::vector<bool> referenced(keys.size(), false);
+      std::vector<std::string_view> unreferenced;
+      fk_check_in_refcounts_[i]->MultiSearch(
+          keys, [&](size_t j, const uint8_t* ret) {
+            if (ret) {
+              referenced[j] = true;
+              refcounts[j] =
+                  SingleTuple(ret).Read<size_t>(Tuple::GetOffsetOfStaticField(0));
+            } else {
+              unreferenced.push_back(keys[j]);
+            }
+          });
+      fk_check_[i]->MultiSearch(
+          unreferenced, [&](size_t, const uint8_t* ret) {
+            if (!ret) {
+              throw DBException("Primary key does not exist.");
+            }
+          });
+      for (size_t j = 0; j < keys.size(); j++) {
+        auto key = _key_ref(i, keys[j]);
+        // Create a new entry if the key is not referenced yet.
+        _update(i, key, fk_schema_[i].type_, fk_schema_[i].size_, keys[j],
+            refcounts[j] + new_refs[keys[j]],
+            referenced[j] ? WriteMode::kUpdate : WriteMode::kInsert);
+      }
     }
   }
 
@@ -65,21 +129,23 @@ class FKChecker {
     for (uint32_t i = 0; i < fk_schema_.size(); i++) {
       auto key_view = Tuple::GetFieldView(raw_x.Data(), fk_offsets_[i],
           fk_schema_[i].type_, fk_schema_[i].size_);
-      auto key =
-          StaticFieldRef::CreateFromStringView(key_view, fk_schema_[i].type_);
+      auto key = _key_ref(i, key_view);
+      if (_merge_ref(i, key, key_view)) {
+        continue;
+      }
       if (auto ret = fk_check_in_refcounts_[i]->Search(key_view); ret) {
         size_t value =
             SingleTuple(ret).Read<size_t>(Tuple::GetOffsetOfStaticField(0)) + 1;
         _update(i, key, fk_schema_[i].type_, fk_schema_[i].size_, key_view,
-            value, false);
+            value, WriteMode::kUpdate);
         continue;
       }
       if (!fk_check_[i]->Search(key_view)) {
         throw DBException("Primary key does not exist.");
       }
       // Create a new entry.
-      _update(
-          i, key, fk_schema_[i].type_, fk_schema_[i].size_, key_view, 1, true);
+      _update(i, key, fk_schema_[i].type_, fk_schema_[i].size_, key_view, 1,
+          WriteMode::kInsert);
     }
   }
 
@@ -101,7 +167,7 @@ class FKChecker {
           fk_update_refcounts_[i]->Delete(key_view);
         } else {
           _update(i, key, fk_schema_[i].type_, fk_schema_[i].size_, key_view,
-              value, false);
+              value, WriteMode::kUpdate);
         }
       } else {
         // This case is incorrect. If this tuple was inserted before, then
@@ -112,9 +178,45 @@ class FKChecker {
   }
 
  private:
+  // How _update writes the refcount. kMerge adds it to the stored one.
+  enum class WriteMode { kUpdate, kInsert, kMerge };
+
+  /**
+   * The ref of the key of foreign key i viewed by Tuple::GetFieldView. The
+   * view of a string is its content, which follows the StaticStringField
+   * header in the tuple.
+   */
+  StaticFieldRef _key_ref(uint32_t i, std::string_view key_view) {
+    auto type = fk_schema_[i].type_;
+    if (type == FieldType::CHAR || type == FieldType::VARCHAR) {
+      return StaticFieldRef::CreateStringRef(
+          reinterpret_cast<const StaticStringField*>(
+              key_view.data() - sizeof(uint32_t)));
+    }
+    return StaticFieldRef::CreateFromStringView(key_view, type);
+  }
+
+  /**
+   * Add a reference to the key by a blind write of a merge operand, if the
+   * refcount table supports it. Then the referred key is checked instead of
+   * the refcount. Return false if it is not supported.
+   */
+  bool _merge_ref(
+      uint32_t i, StaticFieldRef key, std::string_view key_view) {
+    if (!fk_update_refcounts_[i]->SupportsMerge()) {
+      return false;
+    }
+    if (!fk_check_[i]->Search(key_view)) {
+      throw DBException("Primary key does not exist.");
+    }
+    _update(i, key, fk_schema_[i].type_, fk_schema_[i].size_, key_view, 1,
+        WriteMode::kMerge);
+    return true;
+  }
+
   void _update(uint32_t i, StaticFieldRef key, FieldType key_type,
       uint32_t key_size, std::string_view key_view, size_t new_value,
-      bool is_insert) {
+      WriteMode mode) {
     StaticFieldRef value[2];
     value[0] = StaticFieldRef::CreateInt(new_value);
     value[1] = key;
@@ -125,8 +227,17 @@ class FKChecker {
     // Tuple is not big.
     char data[size];
     Tuple::Serialize(data, value, cs, shu);
-    !is_insert ? fk_update_refcounts_[i]->Update(key_view, {data, size})
-               : fk_update_refcounts_[i]->Insert(key_view, {data, size});
+    switch (mode) {
+      case WriteMode::kUpdate:
+        fk_update_refcounts_[i]->Update(key_view, {data, size});
+        break;
+      case WriteMode::kInsert:
+        fk_update_refcounts_[i]->Insert(key_view, {data, size});
+        break;
+      case WriteMode::kMerge:
+        fk_update_refcounts_[i]->Merge(key_view, {data, size});
+        break;
+    }
   }
   std::vector<ForeignKeySchema> fk_schema_;
   TableSchema table_;
@@ -56,23 +56,26 @@ class InsertExecutor : public Executor {
           temp_[i + 1] =
               ch_ret.Read<StaticFieldRef>(i * sizeof(StaticFieldRef));
         }
-        fk_checker_.InsertCheck(temp_);
         insert_rows_.push_back(Serialize(temp_));
       } else {
-        fk_checker_.InsertCheck(ch_ret);
         insert_rows_.push_back(Serialize(ch_ret));
       }
       ch_ret = ch_->Next();
     }
     // Release the iterator
     ch_ = nullptr;
-    // Insert the tuples
+    // Check the foreign keys of all the tuples in one batch
+    fk_checker_.InsertCheck(insert_rows_);
+    // Insert the tuples in one batch
+    std::vector<std::pair<std::string_view, std::string_view>> kvs;
+    kvs.reserve(insert_rows_.size());
     for (auto& row : insert_rows_) {
       auto key_view =
           Tuple::GetFieldView(row.data(), pk_offset_, pk_type_, pk_size_);
-      if (!handle_->Insert(key_view, row)) {
-        throw DBException("Insert error: duplicate key!");
-      }
+      kvs.emplace_back(key_view, row);
+    }
+    if (!handle_->InsertBatch(kvs)) {
+      throw DBException("Insert error: duplicate key!");
     }
     insert_row_counts_.data_.int_data = insert_rows_.size();
     return reinterpret_cast<const uint8_t*>(&insert_row_counts_);
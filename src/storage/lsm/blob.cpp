@@ -0,0 +1,174 @@
+#include "storage/lsm/blob.hpp"
+
+#include "common/exception.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+BlobFile::~BlobFile() {
+  if (obsolete_) {
+    file_.reset();
+    std::filesystem::remove(filename_);
+  }
+}
+
+void BlobFile::Read(uint64_t offset, uint64_t size, std::string* value) {
+  value->resize(size);
+  if (size > 0 && file_->Read(value->data(), size, offset) != ssize_t(size)) {
+    throw DBException("Cannot read {} bytes at {} from {}", size, offset,
+        filename_);
+  }
+}
+
+BlobIndex BlobFileBuilder::Add(Slice value) {
+  BlobIndex index{number_, writer_.size(), value.size()};
+  writer_.AppendString(value);
+  return index;
+}
+
+void BlobFileBuilder::Finish() {
+  writer_.Flush();
+  std::unique_lock lck(set_->mu_);
+  auto& meta = set_->files_[number_];
+  meta.total_bytes_ = writer_.size();
+  meta.finished_ = true;
+  set_->TryRemove(number_, meta);
+}
+
+std::unique_ptr<BlobFileBuilder> BlobFileSet::NewFile(uint64_t number) {
+  std::unique_lock lck(mu_);
+  /* Forget the obsolete files which have been removed. */
+  std::erase_if(files_, [](const auto& file) {
+    return file.second.obsolete_ && file.second.file_.expired();
+  });
+  files_[number] = Meta();
+  return std::make_unique<BlobFileBuilder>(
+      this, number, FileName(number), write_buffer_size_);
+}
+
+std::shared_ptr<BlobFile> BlobFileSet::Get(uint64_t number) {
+  std::unique_lock lck(mu_);
+  auto [it, inserted] = files_.try_emplace(number);
+  auto& meta = it->second;
+  if (inserted) {
+    /* The metadata of the file was not saved, e.g. after a crash. */
+    meta.total_bytes_ = std::filesystem::file_size(FileName(number));
+    meta.finished_ = true;
+  }
+  if (auto file = meta.file_.lock(); file) {
+    return file;
+  }
+  if (meta.obsolete_) {
+    DB_ERR("Blob file {} has been removed.", number);
+  }
+  auto file = std::make_shared<BlobFile>(number, FileName(number));
+  meta.file_ = file;
+  return file;
+}
+
+void BlobFileSet::Read(Slice index, std::string* value) {
+  auto blob_index = BlobIndex::Decode(index);
+  Get(blob_index.file_number_)
+      ->Read(blob_index.offset_, blob_index.size_, value);
+}
+
+void BlobFileSet::AddGarbage(const BlobIndex& index) {
+  std::unique_lock lck(mu_);
+  auto it = files_.find(index.file_number_);
+  if (it == files_.end() || it->second.obsolete_) {
+    return;
+  }
+  it->second.garbage_bytes_ += index.size_;
+  TryRemove(it->first, it->second);
+}
+
+bool BlobFileSet::NeedsGC(const BlobIndex& index) {
+  if (gc_garbage_ratio_ <= 0) {
+    return false;
+  }
+  std::unique_lock lck(mu_);
+  auto it = files_.find(index.file_number_);
+  if (it == files_.end() || !it->second.finished_) {
+    return false;
+  }
+  return it->second.garbage_bytes_ >=
+         gc_garbage_ratio_ * it->second.total_bytes_;
+}
+
+std::pair<uint64_t, uint64_t> BlobFileSet::GetUsage(uint64_t number) {
+  std::unique_lock lck(mu_);
+  auto it = files_.find(number);
+  if (it == files_.end() || it->second.obsolete_) {
+    return {0, 0};
+  }
+  return {it->second.total_bytes_, it->second.garbage_bytes_};
+}
+
+void BlobFileSet::TryRemove(uint64_t number, Meta& meta) {
+  if (!meta.finished_ || meta.garbage_bytes_ < meta.total_bytes_) {
+    return;
+  }
+  meta.obsolete_ = true;
+  /* The SSTables of old versions may still read it. */
+  if (auto file = meta.file_.lock(); file) {
+    file->SetObsolete();
+  } else {
+    std::filesystem::remove(FileName(number));
+  }
+}
+
+void BlobFileSet::DropAll() {
+  std::unique_lock lck(mu_);
+  for (auto& [number, meta] : files_) {
+    if (meta.obsolete_) {
+      continue;
+    }
+    meta.finished_ = true;
+    meta.garbage_bytes_ = meta.total_bytes_;
+    TryRemove(number, meta);
+  }
+}
+
+void BlobFileSet::Save() {
+  std::unique_lock lck(mu_);
+  FileWriter writer(
+      std::make_unique<SeqWriteFile>(db_path_.string() + "/blob_metadata",
+          false),
+      1 << 20);
+  size_t count = 0;
+  for (auto& [number, meta] : files_) {
+    count += meta.finished_ && !meta.obsolete_;
+  }
+  writer.AppendValue<uint64_t>(count);
+  for (auto& [number, meta] : files_) {
+    if (meta.finished_ && !meta.obsolete_) {
+      writer.AppendValue<uint64_t>(number)
+          .AppendValue<uint64_t>(meta.total_bytes_)
+          .AppendValue<uint64_t>(meta.garbage_bytes_);
+    }
+  }
+  writer.Flush();
+}
+
+void BlobFileSet::Load() {
+  auto filename = db_path_.string() + "/blob_metadata";
+  if (!std::filesystem::exists(filename)) {
+    return;
+  }
+  std::unique_lock lck(mu_);
+  auto file = std::make_unique<ReadFile>(filename, false);
+  FileReader reader(file.get(), 1 << 20, 0);
+  auto count = reader.ReadValue<uint64_t>();
+  for (uint64_t i = 0; i < count; i++) {
+    auto number = reader.ReadValue<uint64_t>();
+    auto& meta = files_[number];
+    meta.total_bytes_ = reader.ReadValue<uint64_t>();
+    meta.garbage_bytes_ = reader.ReadValue<uint64_t>();
+    meta.finished_ = true;
+  }
+}
+
+}  // namespace lsm
+
+}  // namespace wing
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "storage/lsm/file.hpp"
+#include "storage/lsm/format.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+/**
+ * The value of a record of type RecordType::BlobIndex. It points to the
+ * value stored in a blob file.
+ */
+struct BlobIndex {
+  /* The number of the blob file. */
+  uint64_t file_number_;
+  /* The offset of the value in the blob file. */
+  uint64_t offset_;
+  /* The size of the value. */
+  uint64_t size_;
+
+  std::string Encode() const {
+    return std::string(reinterpret_cast<const char*>(this), sizeof(BlobIndex));
+  }
+
+  static BlobIndex Decode(Slice s) {
+    BlobIndex index;
+    memcpy(&index, s.data(), sizeof(BlobIndex));
+    return index;
+  }
+};
+
+/**
+ * An append-only file of values, which are referenced by BlobIndex in
+ * SSTables. The SSTables referencing it share the object, so it is alive as
+ * long as some version may read it. If it is obsolete, i.e. all its values
+ * are garbage, the file is removed when the object is destroyed.
+ */
+class BlobFile {
+ public:
+  BlobFile(uint64_t number, std::string filename)
+    : number_(number),
+      filename_(std::move(filename)),
+      file_(std::make_unique<ReadFile>(filename_, false)) {}
+
+  ~BlobFile();
+
+  /* Read the value at the offset. */
+  void Read(uint64_t offset, uint64_t size, std::string* value);
+
+  void SetObsolete() { obsolete_ = true; }
+
+  uint64_t GetNumber() const { return number_; }
+
+ private:
+  uint64_t number_;
+  std::string filename_;
+  std::unique_ptr<ReadFile> file_;
+  std::atomic<bool> obsolete_{false};
+};
+
+class BlobFileSet;
+
+/* Append values to a new blob file. */
+class BlobFileBuilder {
+ public:
+  BlobFileBuilder(BlobFileSet* set, uint64_t number, std::string filename,
+      size_t write_buffer_size)
+    : set_(set),
+      number_(number),
+      writer_(std::make_unique<SeqWriteFile>(filename, false),
+          write_buffer_size) {}
+
+  /* Append the value and return its index. */
+  BlobIndex Add(Slice value);
+
+  /* Flush the file. Its values can be read after it finishes. */
+  void Finish();
+
+  size_t size() const { return writer_.size(); }
+
+ private:
+  BlobFileSet* set_;
+  uint64_t number_;
+  FileWriter writer_;
+};
+
+/**
+ * The blob files of a database. It tracks the total size of the values of
+ * each blob file and the size of its garbage, i.e. the values whose
+ * references are dropped by compactions. Blob files with all values being
+ * garbage are obsolete and removed.
+ */
+class BlobFileSet {
+ public:
+  /**
+   * min_blob_size: The values of at least min_blob_size bytes are stored in
+   * blob files. 0 disables blob files.
+   * blob_file_size: The target size of a blob file.
+   * gc_garbage_ratio: The compactions move the values out of the blob files
+   * whose ratio of garbage is at least gc_garbage_ratio.
+   */
+  BlobFileSet(std::filesystem::path db_path, size_t min_blob_size,
+      size_t blob_file_size, double gc_garbage_ratio, size_t write_buffer_size)
+    : db_path_(std::move(db_path)),
+      min_blob_size_(min_blob_size),
+      blob_file_size_(blob_file_size),
+      gc_garbage_ratio_(gc_garbage_ratio),
+      write_buffer_size_(write_buffer_size) {}
+
+  /* Whether the value should be stored in a blob file. */
+  bool IsBlob(Slice value) const {
+    return min_blob_size_ > 0 && value.size() >= min_blob_size_;
+  }
+
+  size_t blob_file_size() const { return blob_file_size_; }
+
+  /* Create a blob file with the number. */
+  std::unique_ptr<BlobFileBuilder> NewFile(uint64_t number);
+
+  /* Get the blob file. It is opened if no SSTable references it. */
+  std::shared_ptr<BlobFile> Get(uint64_t number);
+
+  /* Read the value which the encoded BlobIndex points to. */
+  void Read(Slice index, std::string* value);
+
+  /**
+   * Called when a compaction drops the reference to the value. The blob file
+   * becomes obsolete if all its values are garbage.
+   */
+  void AddGarbage(const BlobIndex& index);
+
+  /**
+   * Whether a compaction should move the value to a new blob file, which is
+   * true if the blob file has too much garbage.
+   */
+  bool NeedsGC(const BlobIndex& index);
+
+  /* The total size of the values and the garbage in the blob file. */
+  std::pair<uint64_t, uint64_t> GetUsage(uint64_t number);
+
+  /* Make all blob files obsolete. */
+  void DropAll();
+
+  /* Save and load the sizes of the blob files. */
+  void Save();
+
+  void Load();
+
+ private:
+  friend class BlobFileBuilder;
+
+  struct Meta {
+    /* The total size of the values. */
+    uint64_t total_bytes_{0};
+    /* The total size of the values whose references are dropped. */
+    uint64_t garbage_bytes_{0};
+    /* The file is being written if it is false. */
+    bool finished_{false};
+    bool obsolete_{false};
+    /* It is set when the file is opened. */
+    std::weak_ptr<BlobFile> file_;
+  };
+
+  std::string FileName(uint64_t number) const {
+    return fmt::format("{}/{}.blob", db_path_.string(), number);
+  }
+
+  /* Remove the file if it is obsolete. It is called with mu_ held. */
+  void TryRemove(uint64_t number, Meta& meta);
+
+  std::filesystem::path db_path_;
+  size_t min_blob_size_;
+  size_t blob_file_size_;
+  double gc_garbage_ratio_;
+  size_t write_buffer_size_;
+  std::mutex mu_;
+  std::map<uint64_t, Meta> files_;
+};
+
+}  // namespace lsm
+
+}  // namespace wing
@@ -1,83 +1,263 @@
 #include "storage/lsm/block.hpp"
-#include <iostream>
+
+#include <algorithm>
+#include <cstring>
+
+#include "storage/lsm/compression.hpp"
+
 namespace wing {
 
 namespace lsm {
 
+namespace {
+
+/* The maximum size of a varint32. */
+constexpr size_t kMaxVarint32Size = 5;
+
+char* EncodeVarint32(char* dst, uint32_t v) {
+  while (v >= 0x80) {
+    *dst++ = static_cast<char>(v | 0x80);
+    v >>= 7;
+  }
+  *dst++ = static_cast<char>(v);
+  return dst;
+}
+
+const char* DecodeVarint32(const char* p, uint32_t* v) {
+  uint32_t result = 0;
+  for (uint32_t shift = 0; shift <= 28; shift += 7) {
+    uint32_t byte = static_cast<uint8_t>(*p++);
+    result |= (byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      break;
+    }
+  }
+  *v = result;
+  return p;
+}
+
+offset_t DecodeOffset(const char* p) {
+  offset_t x;
+  std::memcpy(&x, p, sizeof(offset_t));
+  return x;
+}
+
+}  // namespace
+
 bool BlockBuilder::Append(ParsedKey key, Slice value) {
-  offset_t key_length = key.size();
-  offset_t value_length = value.size();
-  size_t append_size = key_length + sizeof(offset_t) + value_length + sizeof(offset_t) + sizeof(offset_t);
-  if (current_size_ + append_size > block_size_) {
-    return false;
-  }
-  offsets_.push_back(offset_);
-  offset_ += append_size - sizeof(offset_t);
-  file_->AppendValue<offset_t>(key_length);
   auto ikey = InternalKey(key);
-  file_->AppendString(ikey.GetSlice());
-  file_->AppendValue<offset_t>(value_length);
-  file_->AppendString(value);
-  current_size_ += append_size;
-  if (offsets_.size() <= 1 || ParsedKey(largest_key) < key){
+  Slice ikey_slice = ikey.GetSlice();
+  if (format() == BlockFormat::kPlain) {
+    offset_t key_length = ikey_slice.size();
+    offset_t value_length = value.size();
+    size_t append_size = key_length + value_length + 3 * sizeof(offset_t);
+    if (count_ > 0 && size() + append_size > block_size_) {
+      return false;
+    }
+    offsets_.push_back(offset_);
+    offset_ += append_size - sizeof(offset_t);
+    WriteOffset(key_length);
+    Write(ikey_slice);
+    WriteOffset(value_length);
+    Write(value);
+  } else {
+    bool restart = count_ % restart_interval_ == 0;
+    size_t shared = 0;
+    if (!restart) {
+      size_t n = std::min(last_key_.size(), ikey_slice.size());
+      while (shared < n && last_key_[shared] == ikey_slice[shared]) {
+        shared++;
+      }
+    }
+    char header[3 * kMaxVarint32Size];
+    char* p = EncodeVarint32(header, shared);
+    p = EncodeVarint32(p, ikey_slice.size() - shared);
+    p = EncodeVarint32(p, value.size());
+    size_t append_size = (p - header) + ikey_slice.size() - shared +
+                         value.size() + (restart ? sizeof(offset_t) : 0);
+    if (count_ > 0 && size() + append_size > block_size_) {
+      return false;
+    }
+    if (restart) {
+      offsets_.push_back(offset_);
+    }
+    offset_ += append_size - (restart ? sizeof(offset_t) : 0);
+    Write(Slice(header, p - header));
+    Write(ikey_slice.substr(shared));
+    Write(value);
+    last_key_ = ikey_slice;
+  }
+  count_ += 1;
+  if (count_ <= 1 || ParsedKey(largest_key) < key) {
     largest_key = std::move(ikey);
-  } 
-  // if (offsets_.size() <= 1 || ParsedKey(smallest_key) > key){
-  //   smallest_key = ikey;
-  // }
-  // file_->Flush();
+  }
   return true;
 }
 
 void BlockBuilder::Finish() {
   for (auto offset : offsets_) {
-    file_->AppendValue<offset_t>(offset);
+    WriteOffset(offset);
+  }
+  if (format() == BlockFormat::kPrefix) {
+    WriteOffset(offsets_.size());
+  }
+  stored_size_ = size();
+  stored_codec_ = BlockCodec::kNone;
+  if (codec_ == BlockCodec::kNone) {
+    return;
   }
-  // file_->Flush();
+  std::string compressed;
+  if (CompressBlock(codec_, buffer_, &compressed)) {
+    file_->AppendString(compressed);
+    stored_size_ = compressed.size();
+    stored_codec_ = codec_;
+  } else {
+    file_->AppendString(buffer_);
+  }
+}
+
+BlockIterator::BlockIterator(
+    const char* data, BlockHandle handle, BlockFormat format)
+  : data_(data), handle_(handle), format_(format) {
+  if (format_ == BlockFormat::kPlain) {
+    num_offsets_ = handle_.count_;
+    end_ = handle_.size_ - num_offsets_ * sizeof(offset_t);
+  } else {
+    num_offsets_ = DecodeOffset(data_ + handle_.size_ - sizeof(offset_t));
+    end_ = handle_.size_ - (num_offsets_ + 1) * sizeof(offset_t);
+  }
+  offsets_ = data_ + end_;
+  SeekToFirst();
+}
+
+void BlockIterator::SeekToFirst() {
+  next_ = 0;
+  key_.clear();
+  ParseNextRecord();
 }
 
 void BlockIterator::Seek(Slice user_key, seq_t seq) {
-  char* offset_iter = const_cast<char*>(data_) + handle_.size_ - handle_.count_ * sizeof(offset_t);
-  for (size_t i = 0; i < handle_.count_; i++) {
-    offset_t offset = *reinterpret_cast<const offset_t*>(offset_iter + i * sizeof(offset_t));
-    offset_t key_length = *reinterpret_cast<const offset_t*>(data_ + offset);
-    Slice key = Slice(data_ + offset + sizeof(offset_t), key_length);
-    if (ParsedKey(key) >= ParsedKey(user_key, seq, RecordType::Value)) {
-      current_ = const_cast<char*>(data_ + offset);
-      count_ = i;
-      return;
+  ParsedKey target(user_key, seq, RecordType::Value);
+  if (format_ == BlockFormat::kPlain) {
+    /* Find the first record >= target. */
+    size_t lo = 0, hi = num_offsets_;
+    while (lo < hi) {
+      size_t mid = (lo + hi) / 2;
+      if (ParsedKey(KeyAt(mid)) < target) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
     }
+    next_ = lo < num_offsets_ ? DecodeOffset(offsets_ + lo * sizeof(offset_t))
+                              : end_;
+    ParseNextRecord();
+    return;
+  }
+  if (num_offsets_ == 0) {
+    next_ = end_;
+    ParseNextRecord();
+    return;
+  }
+  /* Find the last restart point < target, or the first one. */
+  size_t lo = 0, hi = num_offsets_ - 1;
+  while (lo < hi) {
+    size_t mid = (lo + hi + 1) / 2;
+    if (ParsedKey(KeyAt(mid)) < target) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  next_ = DecodeOffset(offsets_ + lo * sizeof(offset_t));
+  key_.clear();
+  ParseNextRecord();
+  while (Valid() && ParsedKey(key_) < target) {
+    Next();
+  }
+}
+
+void BlockIterator::SeekToLast() { SeekBefore(end_); }
+
+void BlockIterator::SeekForPrev(Slice user_key, seq_t seq) {
+  Seek(user_key, seq);
+  if (!Valid()) {
+    SeekToLast();
+  } else if (ParsedKey(user_key, seq, RecordType::Value) < ParsedKey(key_)) {
+    Prev();
   }
 }
 
-void BlockIterator::SeekToFirst() { current_ = const_cast<char*>(data_); count_ = 0;}
+void BlockIterator::Next() { ParseNextRecord(); }
 
-Slice BlockIterator::key() const {
-  if (data_ == nullptr || current_ == nullptr) return "INVALID";
-  offset_t key_length = *reinterpret_cast<const offset_t*>(current_);
-  return Slice(current_ + sizeof(offset_t), key_length);
+void BlockIterator::Prev() { SeekBefore(current_); }
+
+void BlockIterator::SeekBefore(offset_t offset) {
+  /* Find the number of offsets < offset. They are increasing. */
+  size_t lo = 0, hi = num_offsets_;
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (OffsetAt(mid) < offset) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo == 0) {
+    /* There is no record before offset. */
+    current_ = next_ = end_;
+    return;
+  }
+  next_ = OffsetAt(lo - 1);
+  key_.clear();
+  ParseNextRecord();
+  while (next_ < offset) {
+    ParseNextRecord();
+  }
 }
 
-Slice BlockIterator::value() const {
-  if (data_ == nullptr || current_ == nullptr) return "INVALID";
-  offset_t key_length = *reinterpret_cast<const offset_t*>(current_);
-  offset_t value_length = *reinterpret_cast<const offset_t*>(current_ + sizeof(offset_t) + key_length);
-  return Slice(current_ + sizeof(offset_t) + key_length + sizeof(offset_t), value_length);
+void BlockIterator::ParseNextRecord() {
+  current_ = next_;
+  if (current_ >= end_) {
+    return;
+  }
+  const char* p = data_ + current_;
+  if (format_ == BlockFormat::kPlain) {
+    offset_t key_length = DecodeOffset(p);
+    p += sizeof(offset_t);
+    key_.assign(p, key_length);
+    p += key_length;
+    offset_t value_length = DecodeOffset(p);
+    p += sizeof(offset_t);
+    value_ = Slice(p, value_length);
+  } else {
+    uint32_t shared, non_shared, value_length;
+    p = DecodeVarint32(p, &shared);
+    p = DecodeVarint32(p, &non_shared);
+    p = DecodeVarint32(p, &value_length);
+    key_.resize(shared);
+    key_.append(p, non_shared);
+    p += non_shared;
+    value_ = Slice(p, value_length);
+  }
+  next_ = value_.data() + value_.size() - data_;
 }
 
-void BlockIterator::Next() {
-  offset_t key_length = *reinterpret_cast<const offset_t*>(current_);
-  offset_t value_length = *reinterpret_cast<const offset_t*>(current_ + sizeof(offset_t) + key_length);
-  current_ += sizeof(offset_t) + key_length + sizeof(offset_t) + value_length;
-  count_++;
+offset_t BlockIterator::OffsetAt(size_t i) const {
+  return DecodeOffset(offsets_ + i * sizeof(offset_t));
 }
 
-bool BlockIterator::Valid() {
-  // if (data_ == nullptr || current_ == nullptr) return false;
-  // offset_t key_length = *reinterpret_cast<const offset_t*>(current_);
-  // Slice key = Slice(current_ + sizeof(offset_t), key_length);
-  // return (ParsedKey(key).type_ == RecordType::Value);
-  return count_ < handle_.count_;
+Slice BlockIterator::KeyAt(size_t i) const {
+  const char* p = data_ + OffsetAt(i);
+  if (format_ == BlockFormat::kPlain) {
+    return Slice(p + sizeof(offset_t), DecodeOffset(p));
+  }
+  /* The key of a restart point is not prefix compressed. */
+  uint32_t shared, non_shared, value_length;
+  p = DecodeVarint32(p, &shared);
+  p = DecodeVarint32(p, &non_shared);
+  p = DecodeVarint32(p, &value_length);
+  return Slice(p, non_shared);
 }
 
 }  // namespace lsm
@@ -10,14 +10,27 @@ namespace lsm {
 
 class BlockBuilder {
  public:
-  BlockBuilder(size_t block_size, FileWriter* file)
-    : block_size_(block_size), file_(file) {}
+  /**
+   * restart_interval: The number of records between two restart points.
+   * If it is 0, the block is written in the BlockFormat::kPlain format.
+   * Otherwise, it is written in the BlockFormat::kPrefix format.
+   * codec: The codec which compresses the block. If it is not
+   * BlockCodec::kNone, the block is buffered until Finish.
+   */
+  BlockBuilder(size_t block_size, FileWriter* file,
+      size_t restart_interval = kDefaultBlockRestartInterval,
+      BlockCodec codec = BlockCodec::kNone)
+    : block_size_(block_size),
+      file_(file),
+      restart_interval_(restart_interval),
+      codec_(codec) {}
 
   /**
    * It appends key and value to the end of the block
    *
    * If it appends successfully, return true.
    * Otherwise, return false, and you need to append it to a new block.
+   * The first record is always appended even if it exceeds the block size.
    */
   bool Append(ParsedKey key, Slice value);
 
@@ -26,19 +39,35 @@ class BlockBuilder {
    *
    * It is called when the block is full,
    * or there is no more key value pairs.
-   * It writes all the offsets to the end of the block.
+   * It writes all the offsets (or restart points) to the end of the block.
    * */
   void Finish();
 
   /* The size of the block (including key, value and the offsets)*/
-  size_t size() const { return current_size_; }
+  size_t size() const {
+    return offset_ + offsets_.size() * sizeof(offset_t) +
+           (format() == BlockFormat::kPrefix ? sizeof(offset_t) : 0);
+  }
 
   /* The number of key-value pairs. */
-  size_t count() const { return offsets_.size(); }
+  size_t count() const { return count_; }
+
+  /* The size of the block in the file. It is valid after Finish. */
+  size_t stored_size() const { return stored_size_; }
+
+  /* The codec of the block in the file. It is valid after Finish. */
+  BlockCodec stored_codec() const { return stored_codec_; }
+
+  BlockFormat format() const {
+    return restart_interval_ == 0 ? BlockFormat::kPlain : BlockFormat::kPrefix;
+  }
 
   void Clear() {
-    current_size_ = offset_ = 0;
+    offset_ = 0;
+    count_ = 0;
     offsets_.clear();
+    last_key_.clear();
+    buffer_.clear();
   }
 
   InternalKey largest_key, smallest_key;
@@ -46,14 +75,40 @@ class BlockBuilder {
  private:
   /* The maximum size of a block */
   size_t block_size_{0};
-  /* The current used size of the block. */
-  size_t current_size_{0};
   /* The current offset of the key value region */
   offset_t offset_{0};
   /* The writer. */
   FileWriter* file_{nullptr};
+  /* The number of records between two restart points. */
+  size_t restart_interval_{0};
+  /* The number of records in the block. */
+  size_t count_{0};
+  /* The last appended internal key, for prefix compression. */
+  std::string last_key_;
+  /* The codec which compresses the block. */
+  BlockCodec codec_{BlockCodec::kNone};
+  /* The uncompressed block if it is compressed. */
+  std::string buffer_;
+  size_t stored_size_{0};
+  BlockCodec stored_codec_{BlockCodec::kNone};
+
+  /* Write the data to the file, or to the buffer if it is compressed. */
+  void Write(Slice data) {
+    if (codec_ == BlockCodec::kNone) {
+      file_->AppendString(data);
+    } else {
+      buffer_.append(data);
+    }
+  }
+
+  void WriteOffset(offset_t x) {
+    Write(Slice(reinterpret_cast<const char*>(&x), sizeof(x)));
+  }
 
-  /* The offsets of the records in the block. */
+  /**
+   * The offsets of the records in the block. In the kPrefix format, they are
+   * the offsets of the restart points.
+   */
   std::vector<offset_t> offsets_;
 };
 
@@ -62,29 +117,66 @@ class BlockIterator final : public Iterator {
   BlockIterator() = default;
 
   /* data is a pointer to the beginning of the block. */
-  BlockIterator(const char* data, BlockHandle handle) : data_(data), handle_(handle) {
-    current_ = const_cast<char*>(data_);
-  }
+  BlockIterator(const char* data, BlockHandle handle,
+      BlockFormat format = BlockFormat::kPrefix);
 
   /* Move the the beginning */
   void SeekToFirst();
 
-  /* Find the first record >= (user_key, seq) */
+  /**
+   * Find the first record >= (user_key, seq). It binary searches the offsets
+   * (or the restart points), so at most restart interval records are parsed
+   * after the binary search.
+   */
   void Seek(Slice user_key, seq_t seq);
 
-  Slice key() const override;
+  /* Move to the last record. */
+  void SeekToLast();
+
+  /* Find the last record <= (user_key, seq). */
+  void SeekForPrev(Slice user_key, seq_t seq);
 
-  Slice value() const override;
+  Slice key() const override { return key_; }
+
+  Slice value() const override { return value_; }
 
   void Next() override;
 
-  bool Valid() override;
+  /**
+   * The records can only be parsed forward, so it parses from the last
+   * offset (or restart point) before the current record.
+   */
+  void Prev() override;
+
+  bool Valid() override { return current_ < end_; }
+
+ private:
+  /* Parse the record at next_ and move to it. */
+  void ParseNextRecord();
+
+  /* Move to the last record which begins before offset. */
+  void SeekBefore(offset_t offset);
+
+  /* The i-th offset (or restart point). */
+  offset_t OffsetAt(size_t i) const;
+
+  /* The full key of the i-th offset (or restart point). */
+  Slice KeyAt(size_t i) const;
 
-  private:
   const char* data_{nullptr};
-  char* current_{nullptr};
-  int count_{0};
-  BlockHandle handle_;
+  BlockHandle handle_{};
+  BlockFormat format_{BlockFormat::kPrefix};
+  /* The offsets array, or the restarts array in the kPrefix format. */
+  const char* offsets_{nullptr};
+  size_t num_offsets_{0};
+  /* The end of the records. */
+  offset_t end_{0};
+  /* The offset of the current record and the next record. */
+  offset_t current_{0};
+  offset_t next_{0};
+  /* The key is rebuilt from the shared prefix, so it is stored here. */
+  std::string key_;
+  Slice value_;
 };
 
 }  // namespace lsm
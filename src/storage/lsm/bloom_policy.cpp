@@ -0,0 +1,91 @@
+#include "storage/lsm/bloom_policy.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace wing {
+
+namespace lsm {
+
+std::vector<double> AllocateBloomBits(const std::vector<size_t>& entries,
+    const std::vector<size_t>& runs, double memory_bits) {
+  const double ln2_2 = std::log(2) * std::log(2);
+  std::vector<double> bits(entries.size(), 0);
+  /**
+   * With the rate of level i being lambda * entries[i] / runs[i], it has
+   * max(0, -(log(lambda) + c[i])) / ln(2)^2 bits per key.
+   */
+  std::vector<double> c(entries.size(), 0);
+  double total = 0, lo = 0, hi = 0;
+  bool first = true;
+  for (size_t i = 0; i < entries.size(); i++) {
+    if (entries[i] == 0) {
+      continue;
+    }
+    c[i] = std::log(entries[i] / (double)std::max<size_t>(runs[i], 1));
+    total += entries[i];
+    /* All levels have 0 bits when log(lambda) >= hi, and have the most bits
+     * when log(lambda) <= lo. */
+    hi = first ? -c[i] : std::max(hi, -c[i]);
+    lo = first ? -c[i] : std::min(lo, -c[i]);
+    first = false;
+  }
+  lo -= kMaxBloomBitsPerKey * ln2_2;
+  auto allocate = [&](double log_lambda) {
+    double memory = 0;
+    for (size_t i = 0; i < entries.size(); i++) {
+      bits[i] = entries[i] == 0
+                    ? 0
+                    : std::clamp(-(log_lambda + c[i]) / ln2_2, 0.0,
+                          kMaxBloomBitsPerKey);
+      memory += bits[i] * entries[i];
+    }
+    return memory;
+  };
+  if (total == 0) {
+    return bits;
+  }
+  /* The memory decreases as lambda increases. */
+  for (int iter = 0; iter < 100; iter++) {
+    double mid = (lo + hi) / 2;
+    if (allocate(mid) > memory_bits) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  allocate(hi);
+  return bits;
+}
+
+size_t BloomBitsPerKey(const Options& options, const Version& version,
+    size_t level, size_t new_entries) {
+  if (options.bloom_filter_memory_budget == 0) {
+    auto& bits = options.bloom_bits_per_key_per_level;
+    if (bits.empty()) {
+      return options.bloom_bits_per_key;
+    }
+    return bits[std::min(level, bits.size() - 1)];
+  }
+  auto& levels = version.GetLevels();
+  size_t num = std::max(levels.size(), level + 1);
+  std::vector<size_t> entries(num, 0), runs(num, 0);
+  for (size_t i = 0; i < levels.size(); i++) {
+    for (auto& run : levels[i].GetRuns()) {
+      for (auto& sst : run->GetSSTs()) {
+        entries[i] += sst->GetSSTInfo().count_;
+      }
+    }
+    runs[i] = levels[i].GetRuns().size();
+  }
+  entries[level] += new_entries;
+  /* A flush adds a new sorted run to Level 0. */
+  runs[level] += level == 0 || runs[level] == 0;
+  auto bits = AllocateBloomBits(
+      entries, runs, options.bloom_filter_memory_budget * 8.0);
+  return std::llround(bits[level]);
+}
+
+}  // namespace lsm
+
+}  // namespace wing
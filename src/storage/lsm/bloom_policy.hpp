@@ -0,0 +1,39 @@
+#pragma once
+
+#include <vector>
+
+#include "storage/lsm/options.hpp"
+#include "storage/lsm/version.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+/* The largest number of bloom filter bits per key given to a level. */
+constexpr double kMaxBloomBitsPerKey = 64;
+
+/**
+ * Allocate memory_bits bloom filter bits to the levels, such that the
+ * expected number of sorted runs read by a lookup of a missing key is
+ * minimized (Monkey). Level i has entries[i] records in runs[i] sorted runs.
+ * A filter with b bits per key has a false positive rate of about
+ * exp(-b * ln(2)^2), and the sum of the rates of all runs is minimized when
+ * the rate of level i is proportional to entries[i] / runs[i]. So smaller
+ * levels get more bits per key. It returns the bits per key of each level,
+ * which are in [0, kMaxBloomBitsPerKey].
+ */
+std::vector<double> AllocateBloomBits(const std::vector<size_t>& entries,
+    const std::vector<size_t>& runs, double memory_bits);
+
+/**
+ * The number of bloom filter bits per key of the SSTables written to the
+ * level. new_entries is the number of records being written, which are
+ * counted in the level when the bits are allocated by
+ * Options::bloom_filter_memory_budget.
+ */
+size_t BloomBitsPerKey(const Options& options, const Version& version,
+    size_t level, size_t new_entries);
+
+}  // namespace lsm
+
+}  // namespace wing
@@ -11,69 +11,91 @@ namespace wing {
 
 namespace lsm {
 
-void Cache::unref_block(CacheKey cache_key) {
-  std::unique_lock<std::mutex> lock(mu_);
-  auto it = cache_.find(cache_key);
-  wing_assert(it != cache_.end());
-  size_t ori = it->second.refcount.fetch_sub(1, std::memory_order_relaxed);
-  if (ori == 1) {
-    auto lru_it = lru_list_.insert(lru_list_.end(), cache_key);
-    auto ret = lru_map_.insert(std::make_pair(cache_key, lru_it));
-    wing_assert(ret.second == true);
+Cache::Cache(const CacheOptions &options)
+  : num_shard_bits_(options.num_shard_bits) {
+  wing_assert(num_shard_bits_ < 32, "Too many cache shards!");
+  size_t num_shards = size_t(1) << num_shard_bits_;
+  shards_ = std::make_unique<std::unique_ptr<Shard>[]>(num_shards);
+  for (size_t i = 0; i < num_shards; i++) {
+    shards_[i] = std::make_unique<Shard>(options.capacity / num_shards);
   }
 }
 
-void Cache::evict() {
-  wing_assert(size_ >= capacity_);
-  do {
-    wing_assert(lru_list_.empty(), "Cache capacity too small!");
-    auto it = lru_list_.begin();
-    const CacheKey &cache_key = *it;
-    wing_assert(lru_map_.erase(cache_key) == 1);
-    auto it2 = cache_.find(cache_key);
-    wing_assert(it2 != cache_.end());
-    size_t refcount = it2->second.refcount.load(std::memory_order_relaxed);
-    wing_assert_eq(refcount, (size_t)0);
-    size_ -= it2->second.block.size();
-    cache_.erase(it2);
-    lru_list_.erase(it);
-  } while (size_ >= capacity_);
+Cache::Shard &Cache::GetShard(const CacheKey &key) {
+  if (num_shard_bits_ == 0) {
+    return *shards_[0];
+  }
+  /* Mix the bits, since CacheKey::Hash is almost the identity. */
+  uint64_t h = CacheKey::Hash()(key) * 0x9E3779B97F4A7C15ull;
+  return *shards_[h >> (64 - num_shard_bits_)];
 }
 
 std::optional<Cache::Handle> Cache::get(
     uint64_t sstable_id, BlockHandle block) {
   CacheKey cache_key(sstable_id, block.offset_);
-  std::unique_lock<std::mutex> lock(mu_);
-  auto it = cache_.find(cache_key);
-  if (it == cache_.end()) {
-    return std::nullopt;
-  }
-  size_t ori_refcount =
-      it->second.refcount.fetch_add(1, std::memory_order_relaxed);
-  if (ori_refcount == 0) {
-    auto map_it = lru_map_.find(cache_key);
-    wing_assert(map_it != lru_map_.end());
-    lru_list_.erase(map_it->second);
-    lru_map_.erase(map_it);
-  }
-  return Handle(*this, cache_key, it->second.block);
+  return GetShard(cache_key).get(cache_key);
 }
 
 Cache::Handle Cache::insert(
     uint64_t sstable_id, BlockHandle block, std::string &&content) {
   CacheKey cache_key(sstable_id, block.offset_);
-  size_t size = content.size();
-  std::unique_lock<std::mutex> lock(mu_);
-  auto ret =
-      cache_.emplace(std::piecewise_construct, std::forward_as_tuple(cache_key),
-          std::forward_as_tuple(std::move(content), 1));
-  if (ret.second) {
-    size_ += size;
-    if (size_ > capacity_) {
-      evict();
+  return GetShard(cache_key).insert(cache_key, std::move(content));
+}
+
+std::optional<Cache::Handle> Cache::Shard::get(const CacheKey &key) {
+  std::shared_lock lock(mu_);
+  auto it = index_.find(key);
+  if (it == index_.end()) {
+    return std::nullopt;
+  }
+  Entry &entry = *it->second;
+  entry.refcount.fetch_add(1, std::memory_order_relaxed);
+  /* Avoid writing the shared cache line if it is already set. */
+  if (!entry.referenced.load(std::memory_order_relaxed)) {
+    entry.referenced.store(true, std::memory_order_relaxed);
+  }
+  return Handle(&entry);
+}
+
+Cache::Handle Cache::Shard::insert(const CacheKey &key, std::string &&content) {
+  std::unique_lock lock(mu_);
+  auto it = index_.find(key);
+  if (it != index_.end()) {
+    /* Another thread has inserted the block. */
+    it->second->refcount.fetch_add(1, std::memory_order_relaxed);
+    return Handle(&*it->second);
+  }
+  size_ += content.size();
+  auto entry_it = entries_.emplace(hand_, key, std::move(content), 1);
+  index_.emplace(key, entry_it);
+  if (size_ > capacity_) {
+    evict();
+  }
+  return Handle(&*entry_it);
+}
+
+void Cache::Shard::evict() {
+  /**
+   * The first round clears the referenced bits, and the second round evicts.
+   * Pinned blocks cannot be evicted, so the cache may exceed its capacity.
+   */
+  size_t steps = 2 * entries_.size();
+  while (size_ > capacity_ && steps > 0) {
+    steps -= 1;
+    if (hand_ == entries_.end()) {
+      hand_ = entries_.begin();
+    }
+    Entry &entry = *hand_;
+    /* Pins are only taken with mu_ held, so this does not race with them. */
+    if (entry.refcount.load(std::memory_order_acquire) > 0 ||
+        entry.referenced.exchange(false, std::memory_order_relaxed)) {
+      ++hand_;
+      continue;
     }
+    size_ -= entry.block.size();
+    index_.erase(entry.key);
+    hand_ = entries_.erase(hand_);
   }
-  return Handle(*this, std::move(cache_key), ret.first->second.block);
 }
 
 }  // namespace lsm
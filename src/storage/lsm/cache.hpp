@@ -3,8 +3,10 @@
 #include <atomic>
 #include <functional>
 #include <list>
+#include <memory>
 #include <mutex>
 #include <optional>
+#include <shared_mutex>
 #include <unordered_map>
 
 #include "storage/lsm/format.hpp"
@@ -15,6 +17,11 @@ namespace lsm {
 
 struct CacheOptions {
   size_t capacity = 8 * 1024 * 1024;  // 8MiB
+  /**
+   * The cache is split into 2^num_shard_bits shards by the hash of the block.
+   * Each shard has its own lock and 1/2^num_shard_bits of the capacity.
+   */
+  size_t num_shard_bits = 4;
 };
 
 class CacheKey {
@@ -37,69 +44,92 @@ class CacheKey {
   offset_t offset_;
 };
 
+/**
+ * A sharded block cache using CLOCK eviction.
+ *
+ * A lookup takes the shared lock of its shard, so concurrent hits do not
+ * block each other. Releasing a Handle only decrements the reference count of
+ * the block and does not take any lock. A block that is referenced by a Handle
+ * is pinned and never evicted.
+ *
+ * A newly inserted block is not marked as referenced, so it is evicted in the
+ * first sweep of the clock hand unless it is hit again. Blocks read once by a
+ * long scan therefore do not push out the blocks that are hit repeatedly.
+ */
 class Cache {
+ private:
+  struct Entry {
+    CacheKey key;
+    std::string block;
+    std::atomic<size_t> refcount;
+    /* Set on a hit, and cleared when the clock hand passes the block. */
+    std::atomic<bool> referenced{false};
+
+    Entry(CacheKey k, std::string &&b, size_t rc)
+      : key(k), block(std::move(b)), refcount(rc) {}
+  };
+
  public:
   class Handle {
    public:
     Handle(const Handle &) = delete;
     Handle &operator=(const Handle &) = delete;
-    Handle(Handle &&rhs)
-      : cache_(rhs.cache_), block_id_(rhs.block_id_), block_(rhs.block_) {
-      rhs.block_ = std::string_view();
-    }
+    Handle(Handle &&rhs) : entry_(rhs.entry_) { rhs.entry_ = nullptr; }
     Handle &operator=(Handle &&rhs) {
-      this->~Handle();
-      cache_ = rhs.cache_;
-      block_id_ = rhs.block_id_;
-      block_ = rhs.block_;
-      rhs.block_ = std::string_view();
+      if (this != &rhs) {
+        this->~Handle();
+        entry_ = rhs.entry_;
+        rhs.entry_ = nullptr;
+      }
       return *this;
     }
     ~Handle() {
-      if (block_.data() != nullptr)
-        cache_.get().unref_block(block_id_);
+      if (entry_ != nullptr)
+        entry_->refcount.fetch_sub(1, std::memory_order_release);
     }
 
-    std::string_view block() const { return block_; }
+    std::string_view block() const { return entry_->block; }
 
    private:
-    Handle(Cache &cache, CacheKey block_id, std::string_view block)
-      : cache_(cache), block_id_(block_id), block_(block) {}
+    Handle(Entry *entry) : entry_(entry) {}
 
-    std::reference_wrapper<Cache> cache_;
-    CacheKey block_id_;
-    std::string_view block_;
+    Entry *entry_;
 
     friend class Cache;
   };
 
-  Cache(const CacheOptions &options) : capacity_(options.capacity), size_(0) {}
+  Cache(const CacheOptions &options);
 
   std::optional<Cache::Handle> get(uint64_t sstable_id, BlockHandle block);
   Handle insert(uint64_t sstable_id, BlockHandle block, std::string &&content);
 
  private:
-  struct BlockInfo {
-    std::string block;
-    std::atomic<size_t> refcount;
-
-    BlockInfo(std::string &&b, size_t rc) : block(std::move(b)), refcount(rc) {}
-  };
+  class Shard {
+   public:
+    Shard(size_t capacity) : capacity_(capacity) {}
 
-  void unref_block(CacheKey block_id);
-  // REQUIRES: this->mu_ held
-  void evict();
+    std::optional<Cache::Handle> get(const CacheKey &key);
+    Handle insert(const CacheKey &key, std::string &&content);
 
-  const size_t capacity_;
+   private:
+    // REQUIRES: this->mu_ held exclusively
+    void evict();
+
+    const size_t capacity_;
+    /* Shared for lookups, exclusive for insertions and evictions. */
+    std::shared_mutex mu_;
+    size_t size_{0};
+    /* The clock. New blocks are inserted right behind the hand. */
+    std::list<Entry> entries_;
+    std::list<Entry>::iterator hand_{entries_.end()};
+    std::unordered_map<CacheKey, std::list<Entry>::iterator, CacheKey::Hash>
+        index_;
+  };
 
-  std::mutex mu_;
-  std::unordered_map<CacheKey, BlockInfo, CacheKey::Hash> cache_;
-  size_t size_;
-  std::unordered_map<CacheKey, std::list<CacheKey>::iterator, CacheKey::Hash>
-      lru_map_;
-  std::list<CacheKey> lru_list_;
+  Shard &GetShard(const CacheKey &key);
 
-  friend class Block;
+  const size_t num_shard_bits_;
+  std::unique_ptr<std::unique_ptr<Shard>[]> shards_;
 };
 
 }  // namespace lsm
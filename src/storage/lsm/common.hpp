@@ -10,6 +10,11 @@ enum class GetResult : uint8_t {
   kFound = 0,
   kNotFound,
   kDelete,
+  /**
+   * The record is a merge operand, so the value depends on the older records
+   * as well. The value is not set.
+   */
+  kMerge,
 };
 
 using offset_t = uint32_t;
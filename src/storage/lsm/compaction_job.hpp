@@ -1,7 +1,12 @@
 #pragma once
 
-#include "storage/lsm/sst.hpp"
 #include <iostream>
+#include <limits>
+#include <optional>
+
+#include "storage/lsm/blob.hpp"
+#include "storage/lsm/merge_operator.hpp"
+#include "storage/lsm/sst.hpp"
 
 namespace wing {
 
@@ -10,38 +15,112 @@ namespace lsm {
 class CompactionJob {
  public:
   CompactionJob(FileNameGenerator* gen, size_t block_size, size_t sst_size,
-      size_t write_buffer_size, size_t bloom_bits_per_key, bool use_direct_io)
+      size_t write_buffer_size, size_t bloom_bits_per_key, bool use_direct_io,
+      size_t block_restart_interval = kDefaultBlockRestartInterval,
+      utils::BloomFilterFormat filter_format =
+          utils::BloomFilterFormat::kBlocked,
+      size_t range_filter_prefix_length = 0,
+      BlockCodec codec = BlockCodec::kNone, BlobFileSet* blob_files = nullptr,
+      std::vector<seq_t> snapshots = {},
+      const MergeOperator* merge_operator = nullptr)
     : file_gen_(gen),
       block_size_(block_size),
       sst_size_(sst_size),
       write_buffer_size_(write_buffer_size),
       bloom_bits_per_key_(bloom_bits_per_key),
-      use_direct_io_(use_direct_io) {}
+      use_direct_io_(use_direct_io),
+      block_restart_interval_(block_restart_interval),
+      filter_format_(filter_format),
+      range_filter_prefix_length_(range_filter_prefix_length),
+      codec_(codec),
+      blob_files_(blob_files),
+      snapshots_(std::move(snapshots)),
+      merge_operator_(merge_operator) {}
 
   /**
    * It receives an iterator and returns a list of SSTable
+   * If end is given, it stops at the first record whose user key >= end,
+   * so that a subcompaction only writes the records in its key range.
+   * It keeps the latest version of each key visible to each snapshot, and
+   * drops the other versions.
+   * The records covered by the range tombstones are dropped, and the
+   * tombstones are stored in the last SSTable, since they may cover records
+   * which are not merged here. If there are no records left, an SSTable with
+   * only a deletion at the beginning of the first tombstone is written.
+   * The tombstones are dropped instead if they have nothing to hide (see
+   * SetBottommost).
+   * The merge operands of a key seen by the same snapshot are folded with
+   * the older records which are merged here. They are folded into a value if
+   * a value or a deletion is among them, and kept as one operand otherwise.
    */
   template <typename IterT>
-  std::vector<SSTInfo> Run(IterT&& it) {
+  std::vector<SSTInfo> Run(IterT&& it,
+      const std::optional<std::string>& end = std::nullopt,
+      const RangeTombstoneList& tombstones = RangeTombstoneList()) {
     std::vector<SSTInfo> sst_list;
     std::string last_user_key;
     seq_t last_seq = 0;
+    /* The snapshot which the last written record belongs to. */
+    seq_t last_snapshot = 0;
     auto file_info_pair = file_gen_->Generate();
     std::vector<std::unique_ptr<SSTableBuilder>> builders;
-    builders.emplace_back(std::make_unique<SSTableBuilder>(std::make_unique<FileWriter>(std::make_unique<SeqWriteFile>(file_info_pair.first, use_direct_io_), write_buffer_size_), block_size_, bloom_bits_per_key_));
+    builders.emplace_back(std::make_unique<SSTableBuilder>(std::make_unique<FileWriter>(std::make_unique<SeqWriteFile>(file_info_pair.first, use_direct_io_), write_buffer_size_), block_size_, bloom_bits_per_key_, block_restart_interval_, filter_format_, range_filter_prefix_length_, codec_));
     // int count10 = 0;
     // int count11 = 0;
     // int count12 = 0;
     while (it.Valid()){
       // count10++;
       auto pkey = ParsedKey(it.key());
+      if (end && pkey.user_key_ >= *end) {
+        break;
+      }
       std::string current_user_key = std::string(pkey.user_key_);
       seq_t current_seq = pkey.seq_;
-      if (current_user_key == last_user_key && current_seq < last_seq) {
+      /**
+       * A record is dropped if a newer record of the same key or a range
+       * tombstone hides it from the earliest snapshot which sees it.
+       */
+      seq_t snapshot = EarliestSnapshot(current_seq);
+      if ((current_user_key == last_user_key && current_seq < last_seq &&
+              snapshot == last_snapshot) ||
+          tombstones.Covers(pkey, snapshot)) {
+        if (pkey.type_ == RecordType::BlobIndex && blob_files_) {
+          blob_files_->AddGarbage(BlobIndex::Decode(it.value()));
+        }
         it.Next();
         continue;
       }
-      size_t append_size = it.key().size() + it.value().size() + 3 * sizeof(offset_t);
+      auto type = pkey.type_;
+      Slice value = it.value();
+      std::string blob_index;
+      /* Whether it is moved to the record after the folded operands. */
+      bool folded = false;
+      std::string merged;
+      if (type == RecordType::Merge && merge_operator_) {
+        type = FoldOperands(it, pkey.user_key_, snapshot, tombstones, &merged);
+        value = merged;
+        folded = true;
+      }
+      if (type == RecordType::Value && blob_files_ &&
+          blob_files_->IsBlob(value)) {
+        type = RecordType::BlobIndex;
+        blob_index = AddBlob(value).Encode();
+        value = blob_index;
+      } else if (type == RecordType::BlobIndex && blob_files_) {
+        /* Move the value out of a blob file with too much garbage. */
+        auto index = BlobIndex::Decode(value);
+        if (blob_files_->NeedsGC(index)) {
+          std::string blob;
+          blob_files_->Read(value, &blob);
+          blob_index = AddBlob(blob).Encode();
+          value = blob_index;
+          blob_files_->AddGarbage(index);
+        }
+      }
+      /* it may be moved by FoldOperands, so the key is not read from it. */
+      size_t append_size = current_user_key.size() + sizeof(seq_t) +
+                           sizeof(RecordType) + value.size() +
+                           3 * sizeof(offset_t);
       if (builders.back()->GetIndexOffset() + append_size > sst_size_) {
         builders.back()->Finish();
         SSTInfo sst_info;
@@ -53,14 +132,15 @@ class CompactionJob {
         sst_info.filename_ = file_info_pair.first;
         sst_list.emplace_back(sst_info);
         file_info_pair = file_gen_->Generate();
-        builders.emplace_back(std::make_unique<SSTableBuilder>(std::make_unique<FileWriter>(std::make_unique<SeqWriteFile>(file_info_pair.first, use_direct_io_), write_buffer_size_), block_size_, bloom_bits_per_key_));
+        builders.emplace_back(std::make_unique<SSTableBuilder>(std::make_unique<FileWriter>(std::make_unique<SeqWriteFile>(file_info_pair.first, use_direct_io_), write_buffer_size_), block_size_, bloom_bits_per_key_, block_restart_interval_, filter_format_, range_filter_prefix_length_, codec_));
         // count11 += sst_info.count_;
         // std::cout << "count10: " << count10 << " count11: " << count11 << " count12: " << count12 << "\n";
       }
-      if (pkey.type_ == RecordType::Value) {
-        builders.back()->Append(ParsedKey(current_user_key, current_seq, RecordType::Value), it.value());  
+      if (type == RecordType::Value || type == RecordType::BlobIndex ||
+          type == RecordType::Merge) {
+        builders.back()->Append(ParsedKey(current_user_key, current_seq, type), value);
         // count12 ++;    
-      } else if (pkey.type_ == RecordType::Deletion) {
+      } else if (type == RecordType::Deletion) {
         builders.back()->Append(ParsedKey(current_user_key, current_seq, RecordType::Deletion), it.value());
         // count12++;
       } else {
@@ -68,9 +148,37 @@ class CompactionJob {
       }
       last_user_key = current_user_key;
       last_seq = current_seq;
-      it.Next();
+      last_snapshot = snapshot;
+      if (!folded) {
+        it.Next();
+      }
+    }
+    /**
+     * In the last level, a tombstone seen by every snapshot has dropped all
+     * the records it covers, so there is nothing left for it to hide.
+     */
+    std::vector<const RangeTombstone*> kept;
+    for (auto& tombstone : tombstones.GetTombstones()) {
+      if (!bottommost_ ||
+          EarliestSnapshot(tombstone.seq_) != EarliestSnapshot(0)) {
+        kept.push_back(&tombstone);
+      }
+    }
+    if (!kept.empty()) {
+      if (builders.back()->count() == 0) {
+        auto& first = *kept[0];
+        builders.back()->Append(
+            ParsedKey(first.begin_, first.seq_, RecordType::Deletion), "");
+      }
+      for (auto tombstone : kept) {
+        builders.back()->AddRangeTombstone(*tombstone);
+      }
     }
     builders.back()->Finish();
+    if (blob_builder_) {
+      blob_builder_->Finish();
+      blob_builder_.reset();
+    }
     if (builders.back()->count() == 0) {
       // std::cout << "count10: " << count10 << " count11: " << count11 << " count12: " << count12 << "\n";
       return sst_list;
@@ -89,7 +197,96 @@ class CompactionJob {
     return sst_list;
   }
 
+  /**
+   * Set the range tombstones of the version, which may cover the records
+   * merged here even if they are not in the inputs. The merge operands
+   * covered by them are deleted, so they are not folded into the newer
+   * operands.
+   */
+  void SetLiveTombstones(RangeTombstoneList tombstones) {
+    live_tombstones_ = std::move(tombstones);
+  }
+
+  /**
+   * Set whether the outputs are in the last level and the inputs hold all
+   * the records the range tombstones may cover. Then the tombstones older
+   * than every snapshot are dropped.
+   */
+  void SetBottommost(bool bottommost) { bottommost_ = bottommost; }
+
  private:
+  /**
+   * Fold the merge operand at it with the older records of user_key seen by
+   * snapshot into result, and return the type of the result. It stops at
+   * the first record which is not an operand, or not folded here, so the
+   * older records are dropped as usual.
+   */
+  template <typename IterT>
+  RecordType FoldOperands(IterT& it, Slice user_key, seq_t snapshot,
+      const RangeTombstoneList& tombstones, std::string* result) {
+    std::string key(user_key);
+    /* The operands from the newest to the oldest, and the value before. */
+    std::vector<std::string> operands;
+    std::optional<std::string> base;
+    /* Deleted records, or a value, are before the operands. */
+    bool complete = false;
+    for (; it.Valid(); it.Next()) {
+      ParsedKey pkey(it.key());
+      if (pkey.user_key_ != key || EarliestSnapshot(pkey.seq_) != snapshot) {
+        break;
+      }
+      /**
+       * A deleted value is not the base, and nothing older is folded. Run
+       * drops the records covered by the tombstones of the inputs, but not
+       * by the live ones, so the first operand is kept even if they cover it.
+       */
+      if (tombstones.Covers(pkey, snapshot) ||
+          (!operands.empty() && live_tombstones_.Covers(pkey, snapshot))) {
+        complete = true;
+        break;
+      }
+      complete = pkey.type_ != RecordType::Merge;
+      if (complete) {
+        if (pkey.type_ == RecordType::Value) {
+          base.emplace(it.value());
+        } else if (pkey.type_ == RecordType::BlobIndex) {
+          wing_assert(blob_files_ != nullptr, "No blob files to read value");
+          blob_files_->Read(it.value(), &base.emplace());
+        }
+        break;
+      }
+      operands.emplace_back(it.value());
+    }
+    merge_operator_->FullMerge(base ? &*base : nullptr, operands, result);
+    return complete ? RecordType::Value : RecordType::Merge;
+  }
+
+  /**
+   * The smallest snapshot >= seq, which is the earliest one seeing the
+   * records with sequence number seq. The latest state is treated as a
+   * snapshot at the largest sequence number.
+   */
+  seq_t EarliestSnapshot(seq_t seq) const {
+    auto it = std::lower_bound(snapshots_.begin(), snapshots_.end(), seq);
+    return it == snapshots_.end() ? std::numeric_limits<seq_t>::max() : *it;
+  }
+
+  /**
+   * Append the value to the current blob file, which is finished and
+   * replaced once it reaches the target size.
+   */
+  BlobIndex AddBlob(Slice value) {
+    if (blob_builder_ &&
+        blob_builder_->size() >= blob_files_->blob_file_size()) {
+      blob_builder_->Finish();
+      blob_builder_.reset();
+    }
+    if (!blob_builder_) {
+      blob_builder_ = blob_files_->NewFile(file_gen_->Generate().second);
+    }
+    return blob_builder_->Add(value);
+  }
+
   /* Generate new SSTable file name */
   FileNameGenerator* file_gen_;
   /* The target block size */
@@ -102,6 +299,26 @@ class CompactionJob {
   size_t bloom_bits_per_key_;
   /* Use O_DIRECT or not */
   bool use_direct_io_;
+  /* The number of records between two restart points in a data block */
+  size_t block_restart_interval_;
+  /* The format of bloom filter */
+  utils::BloomFilterFormat filter_format_;
+  /* The length of the key prefixes in the range filter, 0 if disabled */
+  size_t range_filter_prefix_length_;
+  /* The codec of the data blocks */
+  BlockCodec codec_;
+  /* The blob files. If it is nullptr, values are not separated. */
+  BlobFileSet* blob_files_;
+  /* The blob file being written */
+  std::unique_ptr<BlobFileBuilder> blob_builder_;
+  /* The sequence numbers of the live snapshots in ascending order */
+  std::vector<seq_t> snapshots_;
+  /* The operator folding the merge operands. They are kept if it is null. */
+  const MergeOperator* merge_operator_;
+  /* See SetLiveTombstones. */
+  RangeTombstoneList live_tombstones_;
+  /* See SetBottommost. */
+  bool bottommost_{false};
 };
 
 }  // namespace lsm
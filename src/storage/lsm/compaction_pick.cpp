@@ -5,11 +5,61 @@ namespace wing {
 
 namespace lsm {
 
+namespace {
+
+/* Whether a running compaction reads or writes the level. */
+bool InCompaction(const Level& level) {
+  for (auto& run : level.GetRuns()) {
+    if (run->GetCompactionInProcess()) {
+      return true;
+    }
+    for (auto& sst : run->GetSSTs()) {
+      if (sst->GetCompactionInProcess()) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+bool AnyInCompaction(const std::vector<Level>& levels) {
+  for (auto& level : levels) {
+    if (InCompaction(level)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace
+
 std::unique_ptr<Compaction> LeveledCompactionPicker::Get(Version* version) {
   std::vector<Level> levels = version->GetLevels();
   if (levels.size() == 0) return nullptr; 
+  /**
+   * Whether the level below is over its size limit, but cannot be compacted
+   * now. Nothing is compacted into such a level, or it keeps growing and
+   * every compaction into it rewrites more data.
+   */
+  bool below_waiting = false;
+  /**
+   * Whether any level is over its size limit. Level 0 waits for them, as it
+   * does with a single compaction thread: a compaction from Level 0 rewrites
+   * the whole Level 1, so it is cheaper with more runs.
+   */
+  bool any_oversized = false;
   for (int i = levels.size() - 1; i >= 1; i--) {
-    if (levels[i].size() > base_level_size_ * std::pow(ratio_, i)) {
+    bool oversized = levels[i].size() > base_level_size_ * std::pow(ratio_, i);
+    any_oversized = any_oversized || oversized;
+    /* Compactions on different levels can run concurrently. */
+    if (InCompaction(levels[i]) ||
+        (size_t(i) + 1 < levels.size() && InCompaction(levels[i + 1])) ||
+        below_waiting) {
+      below_waiting = oversized;
+      continue;
+    }
+    below_waiting = false;
+    if (oversized) {
       auto input_runs = levels[i].GetRuns();
       if (i == levels.size() - 1 || levels[i + 1].GetRuns().size() == 0 ||
          levels[i + 1].GetRuns()[0]->GetSSTs().size() == 0 || levels[i + 1].GetRuns()[0]->GetSSTs()[0] == nullptr) {
@@ -20,7 +70,13 @@ std::unique_ptr<Compaction> LeveledCompactionPicker::Get(Version* version) {
       }
       auto target_runs = levels[i + 1].GetRuns();
       std::vector<std::shared_ptr<SSTable>> input_tables;
-      int smallest_overlap = std::numeric_limits<int>::max();
+      /**
+       * The SSTable with the smallest ratio of the overlapping bytes in the
+       * next level to its own size, which rewrites the fewest bytes for each
+       * byte moved down. The SSTables differ in size, so the number of the
+       * overlapping SSTables is not a good estimate.
+       */
+      double smallest_overlap = std::numeric_limits<double>::max();
       std::shared_ptr<SSTable> smallest_overlap_sst = input_runs[0]->GetSSTs()[0];
       size_t cursor = 0;
       for (auto& sst : input_runs[0]->GetSSTs()) {
@@ -29,7 +85,7 @@ std::unique_ptr<Compaction> LeveledCompactionPicker::Get(Version* version) {
           smallest_overlap = 0;
           break;
         }
-        int overlap_count = 0;
+        size_t overlap_bytes = 0;
         for (int i = cursor; i < target_runs[0]->GetSSTs().size(); i++) {
           if (sst->GetSmallestKey().user_key_ > target_runs[0]->GetSSTs()[i]->GetLargestKey().user_key_) {
             cursor++;
@@ -37,11 +93,12 @@ std::unique_ptr<Compaction> LeveledCompactionPicker::Get(Version* version) {
           } else if (sst->GetLargestKey().user_key_ < target_runs[0]->GetSSTs()[i]->GetSmallestKey().user_key_) {
             break;
           }
-          overlap_count++;
+          overlap_bytes += target_runs[0]->GetSSTs()[i]->GetSSTInfo().size_;
         }
-        // DB_INFO("{}, {}", cursor, overlap_count);
-        if (overlap_count < smallest_overlap) {
-          smallest_overlap = overlap_count;
+        double overlap =
+            overlap_bytes / std::max<double>(sst->GetSSTInfo().size_, 1);
+        if (overlap < smallest_overlap) {
+          smallest_overlap = overlap;
           smallest_overlap_sst = std::shared_ptr<SSTable>(sst);
         }
       }
@@ -49,6 +106,10 @@ std::unique_ptr<Compaction> LeveledCompactionPicker::Get(Version* version) {
       return std::make_unique<Compaction>(input_tables, input_runs, i, i + 1, target_runs[0], false);
     }
   }
+  if (InCompaction(levels[0]) ||
+      (levels.size() > 1 && InCompaction(levels[1])) || any_oversized) {
+    return nullptr;
+  }
   if (levels[0].GetRuns().size() > level0_compaction_trigger_) {
     auto input_runs = levels[0].GetRuns();
     std::vector<std::shared_ptr<SSTable>> input_tables;
@@ -72,6 +133,8 @@ std::unique_ptr<Compaction> TieredCompactionPicker::Get(Version* version) {
 std::unique_ptr<Compaction> FluidCompactionPicker::Get(Version* version) {
   std::vector<Level> levels = version->GetLevels();
   if (levels.size() == 0) return nullptr;
+  /* It moves whole levels, so it waits for the running compaction. */
+  if (AnyInCompaction(levels)) return nullptr;
   if (levels.size() == 1) {
     std::vector<std::shared_ptr<SortedRun>> input_runs;
     input_runs.push_back(levels.back().GetRuns()[0]);
@@ -118,6 +181,8 @@ std::unique_ptr<Compaction> LazyLevelingCompactionPicker::Get(
     Version* version) {
   std::vector<Level> levels = version->GetLevels();
   if (levels.size() == 0) return nullptr;
+  /* It moves whole levels, so it waits for the running compaction. */
+  if (AnyInCompaction(levels)) return nullptr;
   if (levels.size() == 1) {
     std::vector<std::shared_ptr<SortedRun>> input_runs;
     input_runs.push_back(levels.back().GetRuns()[0]);
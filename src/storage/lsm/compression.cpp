@@ -0,0 +1,257 @@
+#include "storage/lsm/compression.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "common/exception.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+namespace {
+
+/* The shortest match of kLZ. */
+constexpr size_t kMinMatch = 4;
+/* The last bytes of a block are always literals. */
+constexpr size_t kLastLiterals = 5;
+/* The largest offset of a match. */
+constexpr size_t kMaxOffset = 65535;
+constexpr size_t kHashLog = 12;
+/* The number of integers in a frame of kDeltaFOR. */
+constexpr size_t kFrameSize = 128;
+
+uint32_t Load32(const char* p) {
+  uint32_t x;
+  std::memcpy(&x, p, sizeof(x));
+  return x;
+}
+
+void ThrowCorrupted() { throw DBException("Corrupted compressed block."); }
+
+/* Write len - 15 for a length field that overflows 4 bits, as in LZ4. */
+void PutLength(std::string* out, size_t len) {
+  for (; len >= 255; len -= 255) {
+    out->push_back(static_cast<char>(255));
+  }
+  out->push_back(static_cast<char>(len));
+}
+
+size_t GetLength(const char*& p, const char* end) {
+  size_t len = 0;
+  uint8_t byte;
+  do {
+    if (p >= end) ThrowCorrupted();
+    byte = static_cast<uint8_t>(*p++);
+    len += byte;
+  } while (byte == 255);
+  return len;
+}
+
+void PutSequence(std::string* out, const char* literals, size_t literal_len,
+    size_t offset, size_t match_len) {
+  size_t ml = match_len > 0 ? match_len - kMinMatch : 0;
+  out->push_back(static_cast<char>(
+      std::min<size_t>(literal_len, 15) << 4 | std::min<size_t>(ml, 15)));
+  if (literal_len >= 15) PutLength(out, literal_len - 15);
+  out->append(literals, literal_len);
+  if (match_len == 0) return;
+  out->push_back(static_cast<char>(offset & 0xff));
+  out->push_back(static_cast<char>(offset >> 8));
+  if (ml >= 15) PutLength(out, ml - 15);
+}
+
+void CompressLZ(Slice in, std::string* out) {
+  const char* base = in.data();
+  size_t n = in.size();
+  /* The last positions of the hashes of 4-byte sequences, plus 1. */
+  std::vector<uint32_t> table(1 << kHashLog, 0);
+  size_t anchor = 0, i = 0;
+  size_t limit = n > kLastLiterals + kMinMatch ? n - kLastLiterals - kMinMatch
+                                                : 0;
+  while (i < limit) {
+    uint32_t seq = Load32(base + i);
+    uint32_t h = (seq * 2654435761u) >> (32 - kHashLog);
+    size_t candidate = table[h];
+    table[h] = i + 1;
+    if (candidate == 0 || i + 1 - candidate > kMaxOffset ||
+        Load32(base + candidate - 1) != seq) {
+      i++;
+      continue;
+    }
+    candidate--;
+    size_t len = kMinMatch;
+    while (i + len < n - kLastLiterals &&
+           base[candidate + len] == base[i + len]) {
+      len++;
+    }
+    PutSequence(out, base + anchor, i - anchor, i - candidate, len);
+    i += len;
+    anchor = i;
+  }
+  PutSequence(out, base + anchor, n - anchor, 0, 0);
+}
+
+void DecompressLZ(Slice in, char* out, size_t size) {
+  const char* p = in.data();
+  const char* end = p + in.size();
+  size_t op = 0;
+  while (p < end) {
+    uint8_t token = static_cast<uint8_t>(*p++);
+    size_t literal_len = token >> 4;
+    if (literal_len == 15) literal_len += GetLength(p, end);
+    if (literal_len > size_t(end - p) || literal_len > size - op) {
+      ThrowCorrupted();
+    }
+    std::memcpy(out + op, p, literal_len);
+    p += literal_len;
+    op += literal_len;
+    if (p == end) break;
+    if (end - p < 2) ThrowCorrupted();
+    size_t offset = static_cast<uint8_t>(p[0]) |
+                    static_cast<size_t>(static_cast<uint8_t>(p[1])) << 8;
+    p += 2;
+    size_t match_len = token & 15;
+    if (match_len == 15) match_len += GetLength(p, end);
+    match_len += kMinMatch;
+    if (offset == 0 || offset > op || match_len > size - op) {
+      ThrowCorrupted();
+    }
+    /* The match may overlap the bytes it produces. */
+    if (offset >= match_len) {
+      std::memcpy(out + op, out + op - offset, match_len);
+    } else {
+      for (size_t j = 0; j < match_len; j++) {
+        out[op + j] = out[op + j - offset];
+      }
+    }
+    op += match_len;
+  }
+  if (op != size) ThrowCorrupted();
+}
+
+uint32_t ZigZag(uint32_t x) {
+  return (x << 1) ^ static_cast<uint32_t>(static_cast<int32_t>(x) >> 31);
+}
+
+uint32_t UnZigZag(uint32_t x) { return (x >> 1) ^ (0u - (x & 1)); }
+
+void CompressDeltaFOR(Slice in, std::string* out) {
+  size_t words = in.size() / sizeof(uint32_t);
+  std::vector<uint32_t> deltas(kFrameSize);
+  uint32_t prev = 0;
+  for (size_t begin = 0; begin < words; begin += kFrameSize) {
+    size_t count = std::min(kFrameSize, words - begin);
+    for (size_t i = 0; i < count; i++) {
+      uint32_t x = Load32(in.data() + (begin + i) * sizeof(uint32_t));
+      deltas[i] = ZigZag(x - prev);
+      prev = x;
+    }
+    uint32_t ref = *std::min_element(deltas.begin(), deltas.begin() + count);
+    uint32_t range = 0;
+    for (size_t i = 0; i < count; i++) {
+      range |= deltas[i] - ref;
+    }
+    uint8_t width = range == 0 ? 0 : 32 - __builtin_clz(range);
+    out->append(reinterpret_cast<const char*>(&ref), sizeof(ref));
+    out->push_back(static_cast<char>(width));
+    uint64_t acc = 0;
+    size_t bits = 0;
+    for (size_t i = 0; i < count; i++) {
+      acc |= static_cast<uint64_t>(deltas[i] - ref) << bits;
+      bits += width;
+      while (bits >= 8) {
+        out->push_back(static_cast<char>(acc & 0xff));
+        acc >>= 8;
+        bits -= 8;
+      }
+    }
+    if (bits > 0) {
+      out->push_back(static_cast<char>(acc & 0xff));
+    }
+  }
+  out->append(in.substr(words * sizeof(uint32_t)));
+}
+
+void DecompressDeltaFOR(Slice in, char* out, size_t size) {
+  size_t words = size / sizeof(uint32_t);
+  const char* p = in.data();
+  const char* end = p + in.size();
+  uint32_t prev = 0;
+  for (size_t begin = 0; begin < words; begin += kFrameSize) {
+    size_t count = std::min(kFrameSize, words - begin);
+    if (end - p < 5) ThrowCorrupted();
+    uint32_t ref = Load32(p);
+    uint8_t width = static_cast<uint8_t>(p[4]);
+    p += 5;
+    if (width > 32 || size_t(end - p) < (count * width + 7) / 8) {
+      ThrowCorrupted();
+    }
+    uint64_t acc = 0;
+    size_t bits = 0;
+    uint64_t mask = (uint64_t(1) << width) - 1;
+    for (size_t i = 0; i < count; i++) {
+      while (bits < width) {
+        acc |= static_cast<uint64_t>(static_cast<uint8_t>(*p++)) << bits;
+        bits += 8;
+      }
+      uint32_t delta = static_cast<uint32_t>(acc & mask) + ref;
+      acc >>= width;
+      bits -= width;
+      prev += UnZigZag(delta);
+      std::memcpy(out + (begin + i) * sizeof(uint32_t), &prev, sizeof(prev));
+    }
+  }
+  size_t tail = size - words * sizeof(uint32_t);
+  if (size_t(end - p) != tail) ThrowCorrupted();
+  std::memcpy(out + words * sizeof(uint32_t), p, tail);
+}
+
+}  // namespace
+
+bool CompressBlock(BlockCodec codec, Slice block, std::string* out) {
+  out->clear();
+  switch (codec) {
+    case BlockCodec::kNone:
+      return false;
+    case BlockCodec::kLZ:
+      CompressLZ(block, out);
+      break;
+    case BlockCodec::kDeltaFOR:
+      CompressDeltaFOR(block, out);
+      break;
+    default:
+      DB_ERR("Unknown block codec {}", static_cast<uint32_t>(codec));
+  }
+  return out->size() < block.size() - block.size() / 8;
+}
+
+void DecompressBlock(
+    BlockCodec codec, Slice compressed, char* out, size_t size) {
+  switch (codec) {
+    case BlockCodec::kNone:
+      if (compressed.size() != size) ThrowCorrupted();
+      std::memcpy(out, compressed.data(), size);
+      return;
+    case BlockCodec::kLZ:
+      DecompressLZ(compressed, out, size);
+      return;
+    case BlockCodec::kDeltaFOR:
+      DecompressDeltaFOR(compressed, out, size);
+      return;
+  }
+  auto id = static_cast<uint32_t>(codec);
+  throw DBException("Unknown block codec {}", id);
+}
+
+BlockCodec BlockCodecForLevel(const Options& options, size_t level) {
+  if (options.compression_per_level.empty()) {
+    return options.compression;
+  }
+  return options.compression_per_level[std::min(
+      level, options.compression_per_level.size() - 1)];
+}
+
+}  // namespace lsm
+
+}  // namespace wing
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+
+#include "storage/lsm/format.hpp"
+#include "storage/lsm/options.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+/**
+ * Compress the block with the codec. It returns false, and out is
+ * unspecified, if the codec is BlockCodec::kNone or the block does not shrink
+ * by at least 1/8, in which case the block should be stored as is.
+ */
+bool CompressBlock(BlockCodec codec, Slice block, std::string* out);
+
+/**
+ * Decompress the block into out, which has the size of the block before
+ * compression. It throws DBException if the block is corrupted.
+ */
+void DecompressBlock(
+    BlockCodec codec, Slice compressed, char* out, size_t size);
+
+/* The codec of the data blocks written to the level. */
+BlockCodec BlockCodecForLevel(const Options& options, size_t level);
+
+}  // namespace lsm
+
+}  // namespace wing
@@ -2,6 +2,20 @@
 
 #include <fcntl.h>
 #include <unistd.h>
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#define WING_LSM_IO_URING
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <vector>
 
 #include "common/exception.hpp"
 #include "storage/lsm/stats.hpp"
@@ -10,7 +24,166 @@ namespace wing {
 
 namespace lsm {
 
-ReadFile::ReadFile(const std::string& filename, bool use_direct_io)
+namespace {
+
+#ifdef WING_LSM_IO_URING
+
+/**
+ * A minimal io_uring which only submits reads. It uses the system calls
+ * directly, so it does not depend on liburing. Each thread has its own ring,
+ * so submissions need no synchronization.
+ */
+class IOUring {
+ public:
+  static constexpr unsigned kEntries = 64;
+
+  IOUring() = default;
+  IOUring(const IOUring&) = delete;
+  IOUring& operator=(const IOUring&) = delete;
+
+  ~IOUring() {
+    if (sqes_ != nullptr) {
+      ::munmap(sqes_, sqes_size_);
+    }
+    if (cq_ring_ != nullptr && cq_ring_ != sq_ring_) {
+      ::munmap(cq_ring_, cq_ring_size_);
+    }
+    if (sq_ring_ != nullptr) {
+      ::munmap(sq_ring_, sq_ring_size_);
+    }
+    if (fd_ >= 0) {
+      ::close(fd_);
+    }
+  }
+
+  /* Return false if io_uring is not supported or not permitted. */
+  bool Init() {
+    io_uring_params p;
+    std::memset(&p, 0, sizeof(p));
+    fd_ = ::syscall(__NR_io_uring_setup, kEntries, &p);
+    if (fd_ < 0) {
+      return false;
+    }
+    entries_ = p.sq_entries;
+    sq_ring_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_ring_size_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+      sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    }
+    sq_ring_ = Map(sq_ring_size_, IORING_OFF_SQ_RING);
+    if (sq_ring_ == nullptr) {
+      return false;
+    }
+    cq_ring_ = single_mmap ? sq_ring_ : Map(cq_ring_size_, IORING_OFF_CQ_RING);
+    sqes_size_ = p.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = static_cast<io_uring_sqe*>(Map(sqes_size_, IORING_OFF_SQES));
+    if (cq_ring_ == nullptr || sqes_ == nullptr) {
+      return false;
+    }
+    auto sq = static_cast<char*>(sq_ring_);
+    auto cq = static_cast<char*>(cq_ring_);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+    return true;
+  }
+
+  /* The maximum number of reads in one Submit. */
+  size_t capacity() const { return entries_; }
+
+  /**
+   * Submit the reads and wait for all of them. res[i] is the result of
+   * reqs[i], i.e. the number of bytes read or -errno.
+   */
+  void Submit(const ReadRequest* const* reqs, size_t n, int* res) {
+    unsigned tail = *sq_tail_;
+    for (size_t i = 0; i < n; i++) {
+      unsigned index = (tail + i) & sq_mask_;
+      io_uring_sqe* sqe = &sqes_[index];
+      std::memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode = IORING_OP_READ;
+      sqe->fd = reqs[i]->file_->fd();
+      sqe->addr = reinterpret_cast<uint64_t>(reqs[i]->data_);
+      sqe->len = reqs[i]->n_;
+      sqe->off = reqs[i]->offset_;
+      sqe->user_data = i;
+      sq_array_[index] = index;
+    }
+    std::atomic_ref<unsigned>(*sq_tail_).store(
+        tail + n, std::memory_order_release);
+    size_t to_submit = n, done = 0;
+    while (done < n) {
+      int ret = ::syscall(__NR_io_uring_enter, fd_, to_submit, n - done,
+          IORING_ENTER_GETEVENTS, nullptr, 0);
+      if (ret < 0) {
+        if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+          continue;
+        }
+        throw DBException("::io_uring_enter Error! Error: {}", errno);
+      }
+      to_submit -= ret;
+      unsigned head = *cq_head_;
+      unsigned cq_tail =
+          std::atomic_ref<unsigned>(*cq_tail_).load(std::memory_order_acquire);
+      for (; head != cq_tail; head++, done++) {
+        io_uring_cqe* cqe = &cqes_[head & cq_mask_];
+        res[cqe->user_data] = cqe->res;
+      }
+      std::atomic_ref<unsigned>(*cq_head_).store(
+          head, std::memory_order_release);
+    }
+  }
+
+ private:
+  void* Map(size_t size, off_t offset) {
+    void* ret = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, fd_, offset);
+    return ret == MAP_FAILED ? nullptr : ret;
+  }
+
+  int fd_{-1};
+  unsigned entries_{0};
+  void* sq_ring_{nullptr};
+  size_t sq_ring_size_{0};
+  void* cq_ring_{nullptr};
+  size_t cq_ring_size_{0};
+  io_uring_sqe* sqes_{nullptr};
+  size_t sqes_size_{0};
+  unsigned* sq_tail_{nullptr};
+  unsigned sq_mask_{0};
+  unsigned* sq_array_{nullptr};
+  unsigned* cq_head_{nullptr};
+  unsigned* cq_tail_{nullptr};
+  unsigned cq_mask_{0};
+  io_uring_cqe* cqes_{nullptr};
+};
+
+/* Return the ring of this thread, or nullptr if io_uring is unavailable. */
+IOUring* GetIOUring() {
+  static std::atomic<bool> unavailable{false};
+  thread_local std::unique_ptr<IOUring> ring;
+  if (ring == nullptr && !unavailable.load(std::memory_order_relaxed)) {
+    auto new_ring = std::make_unique<IOUring>();
+    if (new_ring->Init()) {
+      ring = std::move(new_ring);
+    } else {
+      unavailable.store(true, std::memory_order_relaxed);
+    }
+  }
+  return ring.get();
+}
+
+#endif
+
+}  // namespace
+
+ReadFile::ReadFile(
+    const std::string& filename, bool use_direct_io, bool use_mmap)
   : filename_(filename), use_direct_io_(use_direct_io) {
   auto flag = O_RDONLY;
 #if defined(__linux__)
@@ -24,11 +197,36 @@ ReadFile::ReadFile(const std::string& filename, bool use_direct_io)
   if (fd_ < 0) {
     throw DBException("::open file {} error! Error: {}", filename, errno);
   }
+#if defined(__linux__)
+  struct stat st;
+  if (use_mmap && ::fstat(fd_, &st) == 0 && st.st_size > 0) {
+    void* map = ::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd_, 0);
+    if (map != MAP_FAILED) {
+      /* Most accesses are point lookups. Do not read ahead. */
+      ::madvise(map, st.st_size, MADV_RANDOM);
+      map_ = static_cast<const char*>(map);
+      map_size_ = st.st_size;
+    }
+  }
+#endif
 }
 
-ReadFile::~ReadFile() { ::close(fd_); }
+ReadFile::~ReadFile() {
+#if defined(__linux__)
+  if (map_ != nullptr) {
+    ::munmap(const_cast<char*>(map_), map_size_);
+  }
+#endif
+  ::close(fd_);
+}
 
 ssize_t ReadFile::Read(char* data, size_t n, offset_t offset) {
+  if (map_ != nullptr) {
+    n = offset < map_size_ ? std::min<size_t>(n, map_size_ - offset) : 0;
+    std::memcpy(data, map_ + offset, n);
+    GetStatsContext()->total_read_bytes.fetch_add(n, std::memory_order_relaxed);
+    return n;
+  }
 #if defined(__linux__)
   ssize_t ret = ::pread(fd_, data, n, offset);
 #elif defined(__MINGW64__)
@@ -42,6 +240,47 @@ ssize_t ReadFile::Read(char* data, size_t n, offset_t offset) {
   return ret;
 }
 
+void ReadFile::MultiRead(std::span<ReadRequest> reqs) {
+#ifdef WING_LSM_IO_URING
+  std::vector<const ReadRequest*> pending;
+  for (auto& req : reqs) {
+    if (req.file_->data() != nullptr) {
+      req.file_->Read(req.data_, req.n_, req.offset_);
+    } else {
+      pending.push_back(&req);
+    }
+  }
+  IOUring* ring = pending.size() > 1 ? GetIOUring() : nullptr;
+  if (ring == nullptr) {
+    for (auto req : pending) {
+      req->file_->Read(req->data_, req->n_, req->offset_);
+    }
+    return;
+  }
+  std::vector<int> res(pending.size());
+  for (size_t i = 0; i < pending.size(); i += ring->capacity()) {
+    ring->Submit(pending.data() + i,
+        std::min(ring->capacity(), pending.size() - i), res.data() + i);
+  }
+  for (size_t i = 0; i < pending.size(); i++) {
+    auto req = pending[i];
+    if (res[i] == static_cast<int>(req->n_)) {
+      GetStatsContext()->total_read_bytes.fetch_add(
+          req->n_, std::memory_order_relaxed);
+    } else if (res[i] >= 0 || res[i] == -EINVAL || res[i] == -EOPNOTSUPP) {
+      /* A short read, or IORING_OP_READ is not supported. Retry with pread. */
+      req->file_->Read(req->data_, req->n_, req->offset_);
+    } else {
+      throw DBException("io_uring read Error! Error: {}", -res[i]);
+    }
+  }
+#else
+  for (auto& req : reqs) {
+    req.file_->Read(req.data_, req.n_, req.offset_);
+  }
+#endif
+}
+
 SeqWriteFile::SeqWriteFile(const std::string& filename, bool use_direct_io)
   : filename_(filename), use_direct_io_(use_direct_io) {
   auto flag = O_WRONLY | O_CREAT | O_TRUNC;
@@ -100,6 +339,20 @@ void FileReader::Read(char* data, size_t n) {
 
 void FileReader::Seek(size_t new_offset) { offset_ = new_offset; }
 
+void SyncFileSystem(const std::string& path) {
+#if defined(__linux__)
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw DBException("::open file {} error! Error: {}", path, errno);
+  }
+  int ret = ::syncfs(fd);
+  ::close(fd);
+  if (ret < 0) {
+    throw DBException("::syncfs Error! Error: {}", errno);
+  }
+#endif
+}
+
 }  // namespace lsm
 
 }  // namespace wing
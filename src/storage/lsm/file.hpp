@@ -1,6 +1,7 @@
 #pragma once
 
 #include <atomic>
+#include <span>
 
 #include "common/logging.hpp"
 #include "common/util.hpp"
@@ -11,9 +12,25 @@ namespace wing {
 
 namespace lsm {
 
+class ReadFile;
+
+/* Read n_ bytes at offset_ of file_ into data_. */
+struct ReadRequest {
+  ReadFile* file_;
+  char* data_;
+  size_t n_;
+  offset_t offset_;
+};
+
 class ReadFile {
  public:
-  ReadFile(const std::string& filename, bool use_direct_io);
+  /**
+   * If use_mmap is true, the whole file is mapped read-only into memory, and
+   * data() points to the mapping. It falls back to pread if mmap fails or the
+   * platform does not support it.
+   */
+  ReadFile(const std::string& filename, bool use_direct_io,
+      bool use_mmap = false);
 
   ReadFile(const ReadFile&) = delete;
   ReadFile(ReadFile&&) = delete;
@@ -25,10 +42,24 @@ class ReadFile {
   ssize_t Read(char* data, size_t n, offset_t offset);
   bool use_direct_io() const { return use_direct_io_; }
 
+  /**
+   * Submit all the reads at once and wait for all of them to complete, so the
+   * reads overlap with each other. It uses io_uring if the kernel supports it,
+   * and falls back to pread otherwise.
+   */
+  static void MultiRead(std::span<ReadRequest> reqs);
+
+  /* The mapped file content, or nullptr if the file is not mapped. */
+  const char* data() const { return map_; }
+
+  int fd() const { return fd_; }
+
  private:
   int fd_;
   std::string filename_;
   bool use_direct_io_;
+  const char* map_{nullptr};
+  size_t map_size_{0};
 };
 
 class SeqWriteFile {
@@ -121,6 +152,13 @@ class FileReader {
   AlignedBuffer buffer_;
 };
 
+/**
+ * Write the data of all the files in the file system of path to disk, e.g.
+ * the SSTables and the blob files written by a flush. It does nothing if the
+ * platform does not support it.
+ */
+void SyncFileSystem(const std::string& path);
+
 class FileNameGenerator {
  public:
   FileNameGenerator(std::string_view prefix, size_t id_begin)
@@ -16,6 +16,18 @@ using PinnableSlice = std::string;
 enum class RecordType : uint8_t {
   Deletion = 0,
   Value,
+  /* The value is a BlobIndex which points to the value in a blob file. */
+  BlobIndex,
+  /**
+   * A range tombstone in the WAL. The user key is the beginning of the range
+   * and the value is the end. See lsm/range_tombstone.hpp.
+   */
+  RangeDeletion,
+  /**
+   * A merge operand written by DBImpl::Merge. It is folded into the older
+   * records of the key by Options::merge_operator.
+   */
+  Merge,
 };
 
 class ParsedKey;
@@ -101,6 +113,69 @@ struct ParsedKey {
 inline InternalKey::InternalKey(ParsedKey key)
   : InternalKey(key.user_key_, key.seq_, key.type_) {}
 
+/**
+ * The format of the data blocks in an SSTable.
+ *
+ * kPlain: | key length | key | value length | value | ... | offsets |.
+ * Each record stores the full internal key, and the offsets array has an
+ * entry for every record.
+ *
+ * kPrefix: | shared | non_shared | value length | key delta | value | ... |
+ * restarts | restart count |. The lengths are varint32. A record only stores
+ * the part of its key after the prefix shared with the previous record,
+ * except every restart interval records, which store the full key and whose
+ * offsets are in the restarts array.
+ */
+enum class BlockFormat : uint8_t {
+  kPlain = 0,
+  kPrefix = 1,
+};
+
+/* The default number of records between two restart points. */
+constexpr size_t kDefaultBlockRestartInterval = 16;
+
+/**
+ * The codec of a data block in the file (see lsm/compression.hpp).
+ *
+ * kLZ: An LZ77 codec in the LZ4 block format.
+ *
+ * kDeltaFOR: The block is viewed as little-endian 32-bit integers. The
+ * differences between consecutive integers are bit-packed as offsets from the
+ * smallest one in every frame of 128 integers (frame of reference). It suits
+ * blocks of fixed-width integer fields.
+ *
+ * It is 32-bit so that BlockHandle has no padding.
+ */
+enum class BlockCodec : uint32_t {
+  kNone = 0,
+  kLZ = 1,
+  kDeltaFOR = 2,
+};
+
+/**
+ * An SSTable whose blocks are not in the kPlain format, whose bloom filter is
+ * not in the utils::BloomFilterFormat::kStandard format, which has a range
+ * filter, which references blob files, which has range tombstones, or whose
+ * index has the block codecs ends with
+ * kSSTFooterMagic | kSSTHasBlockCodecs | kSSTHasRangeTombstones |
+ * filter format << 4 | kSSTHasRangeFilter | kSSTHasBlobRefs | block format.
+ * Other SSTables end with the number of records, as written by older
+ * versions.
+ */
+constexpr uint64_t kSSTFooterMagic = 0x57494e474c534d00ull;
+constexpr uint64_t kSSTHasRangeFilter = 0x8;
+constexpr uint64_t kSSTHasBlobRefs = 0x4;
+constexpr uint64_t kSSTBlockFormatMask = 0x3;
+constexpr uint64_t kSSTHasBlockCodecs = 0x80;
+constexpr uint64_t kSSTHasRangeTombstones = 0x40;
+constexpr uint64_t kSSTFilterFormatMask = 0x3;
+
+/**
+ * The largest number of key prefixes probed in a range filter by a range
+ * lookup. Longer ranges are assumed to overlap the SSTable.
+ */
+constexpr size_t kMaxRangeFilterProbes = 16;
+
 struct BlockHandle {
   /* The offset of the block. */
   offset_t offset_;
@@ -108,8 +183,18 @@ struct BlockHandle {
   offset_t size_;
   /* The number of entries in the block. */
   offset_t count_;
+  /* The size of the block in the file, which is smaller if it is compressed. */
+  offset_t stored_size_{0};
+  /* The codec of the block in the file. */
+  BlockCodec codec_{BlockCodec::kNone};
 };
 
+/**
+ * The size of a BlockHandle in the SSTables without kSSTHasBlockCodecs,
+ * which only store the first three fields.
+ */
+constexpr size_t kLegacyBlockHandleSize = 3 * sizeof(offset_t);
+
 struct IndexValue {
   /* The largest key in the corresponding data block. */
   InternalKey key_;
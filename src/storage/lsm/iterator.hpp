@@ -21,6 +21,12 @@ class Iterator {
 
   /* Move it to the next entry. It must be valid iterator. */
   virtual void Next() = 0;
+
+  /**
+   * Move it to the previous entry. It must be valid iterator. It is invalid
+   * after moving before the first entry.
+   */
+  virtual void Prev() = 0;
 };
 
 }  // namespace lsm
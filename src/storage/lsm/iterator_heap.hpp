@@ -3,6 +3,7 @@
 #include <queue>
 #include <functional>
 
+#include "common/logging.hpp"
 #include "storage/lsm/format.hpp"
 #include "storage/lsm/iterator.hpp"
 
@@ -50,6 +51,9 @@ class IteratorHeap final : public Iterator {
     }
   }
 
+  /* The heap only merges forward. See LoserTree for both directions. */
+  void Prev() override { DB_ERR("IteratorHeap does not support Prev."); }
+
   void Clear() {
     while (!heap_.empty()) {
         heap_.pop();
@@ -1,4 +1,7 @@
 #include "storage/lsm/level.hpp"
+
+#include <map>
+
 #include <iostream>
 
 namespace wing {
@@ -15,23 +18,96 @@ GetResult SortedRun::Get(Slice key, uint64_t seq, std::string* value, seq_t* lat
   return sst_index->get()->Get(key, seq, value, latest_seq);
 }
 
-SortedRunIterator SortedRun::Seek(Slice key, uint64_t seq) {
+void SortedRun::MultiGet(std::span<const Slice> keys, uint64_t seq,
+    std::span<GetResult> results, std::string* values, uint64_t* seqs_found) {
+  std::vector<BlockRead> reads;
+  /* (the index of the key, the index of its block in reads) */
+  std::vector<std::pair<size_t, size_t>> lookups;
+  /* Keys in the same block share one read. */
+  std::map<std::pair<SSTable*, offset_t>, size_t> read_ids;
+  for (size_t i = 0; i < keys.size(); i++) {
+    results[i] = GetResult::kNotFound;
+    if (seqs_found) seqs_found[i] = 0;
+    auto key = keys[i];
+    const auto sst_index = std::lower_bound(ssts_.begin(), ssts_.end(), key,
+        [&](const std::shared_ptr<SSTable>& sst1, const Slice& key) {
+          return sst1->GetLargestKey() < ParsedKey(key, seq, RecordType::Value);
+        });
+    if (sst_index == ssts_.end()) {
+      continue;
+    }
+    auto sst = sst_index->get();
+    auto reader = sst->GetReader();
+    if (!reader->MayContain(key)) {
+      continue;
+    }
+    auto block_id = reader->FindBlock(key, seq);
+    if (block_id == reader->BlockCount()) {
+      continue;
+    }
+    auto handle = reader->IndexHandle(block_id);
+    auto [it, inserted] =
+        read_ids.emplace(std::make_pair(sst, handle.offset_), reads.size());
+    if (inserted) {
+      reads.push_back(BlockRead{sst, std::move(reader), handle, PinnedBlock()});
+    }
+    lookups.emplace_back(i, it->second);
+  }
+  SSTable::ReadBlocks(reads);
+  for (auto [i, read_id] : lookups) {
+    auto& r = reads[read_id];
+    results[i] = r.sst_->GetFromBlock(r.block_.data(), r.handle_, keys[i],
+        seq, &values[i], seqs_found ? &seqs_found[i] : nullptr);
+  }
+}
+
+SortedRunIterator SortedRun::Seek(Slice key, uint64_t seq, bool fill_cache) {
   const auto sst_index = std::lower_bound(ssts_.begin(), ssts_.end(), key, [&](const std::shared_ptr<SSTable>& sst1, const Slice& key) {
     return sst1->GetLargestKey() < ParsedKey(key, seq, RecordType::Value);
   });
   if (sst_index == ssts_.end()) {
-    return Begin();
+    return Begin(fill_cache);
+  }
+  auto iter = sst_index->get()->Seek(key, seq, fill_cache);
+  return SortedRunIterator(
+      this, std::move(iter), sst_index - ssts_.begin(), fill_cache);
+}
+
+std::optional<SortedRunIterator> SortedRun::SeekRange(
+    Slice lower, Slice upper, uint64_t seq, bool fill_cache) {
+  auto sst_index = std::lower_bound(ssts_.begin(), ssts_.end(), lower,
+      [&](const std::shared_ptr<SSTable>& sst1, const Slice& key) {
+        return sst1->GetLargestKey() < ParsedKey(key, seq, RecordType::Value);
+      });
+  for (; sst_index != ssts_.end(); ++sst_index) {
+    if ((*sst_index)->GetSmallestKey().user_key_ > upper) {
+      break;
+    }
+    if ((*sst_index)->MayContainRange(lower, upper)) {
+      return SortedRunIterator(this,
+          (*sst_index)->Seek(lower, seq, fill_cache),
+          sst_index - ssts_.begin(), fill_cache);
+    }
   }
-  auto iter = sst_index->get()->Seek(key, seq);
-  return SortedRunIterator(this, std::move(iter), sst_index - ssts_.begin());
+  return std::nullopt;
+}
+
+SortedRunIterator SortedRun::Begin(bool fill_cache) {
+  return SortedRunIterator(this, ssts_[0]->Begin(fill_cache), 0, fill_cache);
 }
 
-SortedRunIterator SortedRun::Begin() {
-  SortedRunIterator iter(this, ssts_[0]->Begin(), 0);
-  iter.SeekToFirst();
+SortedRunIterator SortedRun::SeekForPrev(
+    Slice key, uint64_t seq, bool fill_cache) {
+  SortedRunIterator iter(this, SSTableIterator(), 0, fill_cache);
+  iter.SeekForPrev(key, seq);
   return iter;
 }
 
+SortedRunIterator SortedRun::Last(bool fill_cache) {
+  return SortedRunIterator(this, ssts_.back()->Last(fill_cache),
+      ssts_.size() - 1, fill_cache);
+}
+
 SortedRun::~SortedRun() {
   if (remove_tag_) {
     for (auto sst : ssts_) {
@@ -41,7 +117,7 @@ SortedRun::~SortedRun() {
 }
 
 void SortedRunIterator::SeekToFirst() {
-  sst_it_ = run_->GetSSTs()[0]->Begin();
+  sst_it_ = run_->GetSSTs()[0]->Begin(fill_cache_);
   sst_id_ = 0;
 }
 
@@ -54,7 +130,32 @@ void SortedRunIterator::Seek(Slice key, uint64_t seq) {
     return;
   }
   sst_id_ = sst_index - run_->GetSSTs().begin();
-  sst_it_ = run_->GetSSTs()[sst_id_]->Seek(key, seq);
+  sst_it_ = run_->GetSSTs()[sst_id_]->Seek(key, seq, fill_cache_);
+}
+
+void SortedRunIterator::SeekToLast() {
+  sst_id_ = run_->GetSSTs().size() - 1;
+  sst_it_ = run_->GetSSTs()[sst_id_]->Last(fill_cache_);
+}
+
+void SortedRunIterator::SeekForPrev(Slice key, uint64_t seq) {
+  auto& ssts = run_->GetSSTs();
+  /* The first SSTable whose largest key >= (key, seq). */
+  auto sst_index = std::lower_bound(ssts.begin(), ssts.end(), key,
+      [&](const std::shared_ptr<SSTable>& sst1, const Slice& key) {
+        return sst1->GetLargestKey() < ParsedKey(key, seq, RecordType::Value);
+      });
+  if (sst_index == ssts.end()) {
+    SeekToLast();
+    return;
+  }
+  sst_id_ = sst_index - ssts.begin();
+  sst_it_ = ssts[sst_id_]->SeekForPrev(key, seq, fill_cache_);
+  /* All the records of the SSTable may be larger. */
+  if (!sst_it_.Valid() && sst_id_ > 0) {
+    sst_id_--;
+    sst_it_ = ssts[sst_id_]->Last(fill_cache_);
+  }
 }
 
 bool SortedRunIterator::Valid() { return sst_it_.Valid(); }
@@ -68,24 +169,66 @@ void SortedRunIterator::Next() {
   if (sst_it_.Valid()) return;
   if (sst_id_ >= run_->GetSSTs().size() - 1) return;
   sst_id_++;
-  sst_it_ = run_->GetSSTs()[sst_id_]->Begin();
+  sst_it_ = run_->GetSSTs()[sst_id_]->Begin(fill_cache_);
+}
+
+void SortedRunIterator::Prev() {
+  sst_it_.Prev();
+  if (sst_it_.Valid() || sst_id_ == 0) return;
+  sst_id_--;
+  sst_it_ = run_->GetSSTs()[sst_id_]->Last(fill_cache_);
 }
 
-GetResult Level::Get(Slice key, uint64_t seq, std::string* value) {
+GetResult Level::Get(
+    Slice key, uint64_t seq, std::string* value, seq_t* seq_found) {
+  /**
+   * The sorted runs of a level may overlap, and they are not always ordered
+   * by age, so the record with the largest sequence number wins.
+   */
   seq_t latest_seq = 0;
   GetResult ret = GetResult::kNotFound;
+  std::string run_value;
   for (int i = runs_.size() - 1; i >= 0; --i) {
-    auto res = runs_[i]->Get(key, seq, value, &latest_seq);
-    if (res != GetResult::kNotFound) {
-      if (seq > latest_seq) {
-        latest_seq = seq;
-        ret = res;
+    seq_t run_seq = 0;
+    auto res = runs_[i]->Get(key, seq, &run_value, &run_seq);
+    if (res != GetResult::kNotFound &&
+        (ret == GetResult::kNotFound || run_seq > latest_seq)) {
+      latest_seq = run_seq;
+      ret = res;
+      if (res == GetResult::kFound) {
+        *value = std::move(run_value);
       }
     }
   }
+  if (seq_found) *seq_found = latest_seq;
   return ret;
 }
 
+void Level::MultiGet(std::span<const Slice> keys, uint64_t seq,
+    std::span<GetResult> results, std::string* values) {
+  std::vector<seq_t> latest_seqs(keys.size(), 0);
+  std::vector<GetResult> run_results(keys.size());
+  std::vector<std::string> run_values(keys.size());
+  std::vector<seq_t> run_seqs(keys.size());
+  std::fill(results.begin(), results.end(), GetResult::kNotFound);
+  for (int r = runs_.size() - 1; r >= 0; --r) {
+    runs_[r]->MultiGet(
+        keys, seq, run_results, run_values.data(), run_seqs.data());
+    for (size_t i = 0; i < keys.size(); i++) {
+      auto res = run_results[i];
+      if (res != GetResult::kNotFound &&
+          (results[i] == GetResult::kNotFound ||
+              run_seqs[i] > latest_seqs[i])) {
+        latest_seqs[i] = run_seqs[i];
+        results[i] = res;
+        if (res == GetResult::kFound) {
+          values[i] = std::move(run_values[i]);
+        }
+      }
+    }
+  }
+}
+
 void Level::Append(std::vector<std::shared_ptr<SortedRun>> runs) {
   for (auto& run : runs) {
     size_ += run->size();
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <optional>
+
 #include "storage/lsm/sst.hpp"
 
 namespace wing {
@@ -10,13 +12,20 @@ class SortedRunIterator;
 
 class SortedRun {
  public:
-  SortedRun(
-      const std::vector<SSTInfo>& ssts, size_t block_size, bool use_direct_io)
+  /**
+   * cache: The block cache shared by the SSTables. It can be nullptr.
+   * use_mmap: Map the SSTable files into memory or not.
+   * blob_files: The blob files referenced by the SSTables.
+   * table_cache: The cache of the open SSTable readers. It can be nullptr.
+   */
+  SortedRun(const std::vector<SSTInfo>& ssts, size_t block_size,
+      bool use_direct_io, Cache* cache = nullptr, bool use_mmap = false,
+      BlobFileSet* blob_files = nullptr, TableCache* table_cache = nullptr)
     : block_size_(block_size), use_direct_io_(use_direct_io) {
     size_ = 0;
     for (auto& sst : ssts) {
-      ssts_.push_back(
-          std::make_shared<SSTable>(sst, block_size_, use_direct_io_));
+      ssts_.push_back(std::make_shared<SSTable>(sst, block_size_,
+          use_direct_io_, cache, use_mmap, blob_files, table_cache));
       size_ += sst.size_;
     }
   }
@@ -40,14 +49,45 @@ class SortedRun {
    * If the record has type RecordType::Deletion, then it does nothing to the
    * value, and returns GetResult::kDelete If there is no such record, it
    * returns GetResult::kNotFound.
+   * If the record has type RecordType::Merge, then it does nothing to the
+   * value, and returns GetResult::kMerge.
    * */
   GetResult Get(Slice key, uint64_t seq, std::string* value, uint64_t* seq_found = nullptr);
 
-  /* Return an iterator positioned at the first record >= (key, seq). */
-  SortedRunIterator Seek(Slice key, uint64_t seq);
+  /**
+   * Get all the keys as Get does. The result of keys[i] is stored in
+   * results[i], values[i] and seqs_found[i]. The data blocks of all the keys
+   * are read at once by SSTable::ReadBlocks.
+   */
+  void MultiGet(std::span<const Slice> keys, uint64_t seq,
+      std::span<GetResult> results, std::string* values,
+      uint64_t* seqs_found = nullptr);
+
+  /**
+   * Return an iterator positioned at the first record >= (key, seq).
+   * If fill_cache is false, the blocks it reads are not inserted into the
+   * block cache.
+   */
+  SortedRunIterator Seek(Slice key, uint64_t seq, bool fill_cache = true);
+
+  /**
+   * Same as Seek(lower, seq), but return std::nullopt if no user key in
+   * [lower, upper] is in the run, according to the key ranges and the range
+   * filters of the SSTables (see SSTable::MayContainRange). The SSTables
+   * ruled out before the first one which may contain such a key are skipped.
+   */
+  std::optional<SortedRunIterator> SeekRange(
+      Slice lower, Slice upper, uint64_t seq, bool fill_cache = true);
 
   /* Return an iterator positioned at the beginning of the SSTable */
-  SortedRunIterator Begin();
+  SortedRunIterator Begin(bool fill_cache = true);
+
+  /* Return an iterator positioned at the last record <= (key, seq). */
+  SortedRunIterator SeekForPrev(
+      Slice key, uint64_t seq, bool fill_cache = true);
+
+  /* Return an iterator positioned at the last record of the sorted run. */
+  SortedRunIterator Last(bool fill_cache = true);
 
   /* Get the number of SSTables. */
   size_t SSTCount() const { return ssts_.size(); }
@@ -96,13 +136,22 @@ class SortedRunIterator final : public Iterator {
  public:
   SortedRunIterator() = default;
 
-  SortedRunIterator(SortedRun* run, SSTableIterator sst_it, int sst_id)
-    : run_(run), sst_it_(std::move(sst_it)), sst_id_(sst_id) {}
+  SortedRunIterator(SortedRun* run, SSTableIterator sst_it, int sst_id,
+      bool fill_cache = true)
+    : run_(run),
+      sst_it_(std::move(sst_it)),
+      sst_id_(sst_id),
+      fill_cache_(fill_cache) {}
 
   void SeekToFirst();
 
   void Seek(Slice key, uint64_t seq);
 
+  void SeekToLast();
+
+  /* Find the last record <= (key, seq). */
+  void SeekForPrev(Slice key, uint64_t seq);
+
   bool Valid() override;
 
   Slice key() const override;
@@ -111,12 +160,16 @@ class SortedRunIterator final : public Iterator {
 
   void Next() override;
 
+  void Prev() override;
+
   /* The referenced sorted run */
   SortedRun* run_;
   /* The SSTable iterator of the current SSTable */
   SSTableIterator sst_it_;
   /* The index of the current SSTable */
   size_t sst_id_{0};
+  /* Whether the blocks read by the iterator are inserted into the cache. */
+  bool fill_cache_{true};
 };
 
 class Level {
@@ -135,7 +188,16 @@ class Level {
     return runs_;
   }
 
-  GetResult Get(Slice key, uint64_t seq, std::string* value);
+  /**
+   * Get the latest record of key among the sorted runs. If seq_found is not
+   * nullptr, it is set to the sequence number of the record.
+   */
+  GetResult Get(Slice key, uint64_t seq, std::string* value,
+      seq_t* seq_found = nullptr);
+
+  /* Get all the keys as Get does. See SortedRun::MultiGet. */
+  void MultiGet(std::span<const Slice> keys, uint64_t seq,
+      std::span<GetResult> results, std::string* values);
 
   /* Get the level id */
   int GetID() const { return level_id_; }
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <utility>
+#include <vector>
+
+#include "storage/lsm/format.hpp"
+#include "storage/lsm/iterator.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+/**
+ * A merging iterator over sorted iterators using a tournament (loser) tree.
+ * It returns the records of all the children in ascending order of
+ * ParsedKey. If two children have the same key, the one pushed first wins.
+ *
+ * The key of each child is decoded once when the child moves, and cached.
+ * The loser tree keeps the winner of each subtree's match at its root, so
+ * advancing the winner replays one leaf-to-root path, which costs log(n)
+ * comparisons instead of the pop and push of a binary heap.
+ *
+ * The runner-up, which is the best of the losers on the path of the winner,
+ * is remembered too. As long as the winner's next key is still smaller, the
+ * winner keeps winning and the tree is not touched, so a run of consecutive
+ * keys from one child (e.g. a large sorted run among small ones) costs one
+ * comparison per key.
+ *
+ * Push all the children, and then call Build before using it. If it is
+ * built in reverse, it returns the records in descending order, and moves
+ * by Prev instead of Next.
+ */
+template <typename T>
+class LoserTree final : public Iterator {
+ public:
+  LoserTree() = default;
+
+  void Push(T* it) { children_.push_back(Child{it}); }
+
+  /* Start the tournament. */
+  void Build(bool reverse = false) {
+    reverse_ = reverse;
+    size_ = 1;
+    while (size_ < children_.size()) {
+      size_ *= 2;
+    }
+    for (size_t i = 0; i < children_.size(); i++) {
+      Refresh(i);
+    }
+    tree_.assign(size_, kNone);
+    winner_ = Play(1);
+    UpdateRunnerUp();
+  }
+
+  bool Valid() override {
+    return winner_ < children_.size() && children_[winner_].valid_;
+  }
+
+  Slice key() const override { return children_[winner_].key_; }
+
+  Slice value() const override { return children_[winner_].it_->value(); }
+
+  void Next() override {
+    children_[winner_].it_->Next();
+    Advance();
+  }
+
+  void Prev() override {
+    children_[winner_].it_->Prev();
+    Advance();
+  }
+
+  void Clear() {
+    children_.clear();
+    tree_.clear();
+    winner_ = runner_up_ = kNone;
+  }
+
+ private:
+  static constexpr size_t kNone = static_cast<size_t>(-1);
+
+  struct Child {
+    T* it_;
+    bool valid_{false};
+    /* The key of the current record, and its decoded form. */
+    Slice key_;
+    ParsedKey parsed_key_;
+  };
+
+  void Refresh(size_t i) {
+    auto& child = children_[i];
+    child.valid_ = child.it_->Valid();
+    if (child.valid_) {
+      child.key_ = child.it_->key();
+      child.parsed_key_ = ParsedKey(child.key_);
+    }
+  }
+
+  /* The winner has moved. */
+  void Advance() {
+    Refresh(winner_);
+    if (Less(winner_, runner_up_)) {
+      return;
+    }
+    Replay(winner_);
+  }
+
+  /**
+   * Whether child a goes before child b. Exhausted children, the padding
+   * leaves and kNone go after all the others.
+   */
+  bool Less(size_t a, size_t b) const {
+    if (a >= children_.size() || !children_[a].valid_) {
+      return false;
+    }
+    if (b >= children_.size() || !children_[b].valid_) {
+      return true;
+    }
+    auto cmp = reverse_
+                   ? children_[b].parsed_key_ <=> children_[a].parsed_key_
+                   : children_[a].parsed_key_ <=> children_[b].parsed_key_;
+    return cmp < 0 || (cmp == 0 && a < b);
+  }
+
+  /* Play the matches of the subtree, and return its winner. */
+  size_t Play(size_t node) {
+    if (node >= size_) {
+      return node - size_;
+    }
+    size_t a = Play(2 * node), b = Play(2 * node + 1);
+    if (Less(b, a)) {
+      std::swap(a, b);
+    }
+    tree_[node] = b;
+    return a;
+  }
+
+  /* Replay the matches on the path of leaf i, whose key has changed. */
+  void Replay(size_t i) {
+    size_t winner = i;
+    for (size_t node = (i + size_) / 2; node > 0; node /= 2) {
+      if (Less(tree_[node], winner)) {
+        std::swap(tree_[node], winner);
+      }
+    }
+    winner_ = winner;
+    UpdateRunnerUp();
+  }
+
+  void UpdateRunnerUp() {
+    runner_up_ = kNone;
+    for (size_t node = (winner_ + size_) / 2; node > 0; node /= 2) {
+      if (Less(tree_[node], runner_up_)) {
+        runner_up_ = tree_[node];
+      }
+    }
+  }
+
+  std::vector<Child> children_;
+  /* Whether the records are returned in descending order. */
+  bool reverse_{false};
+  /* The number of leaves, which is a power of 2. */
+  size_t size_{1};
+  /* tree_[node] is the loser of the match at node, for 1 <= node < size_. */
+  std::vector<size_t> tree_;
+  size_t winner_{kNone};
+  size_t runner_up_{kNone};
+};
+
+}  // namespace lsm
+
+}  // namespace wing
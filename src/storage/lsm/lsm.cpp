@@ -1,9 +1,15 @@
 #include "storage/lsm/lsm.hpp"
 
+#include <algorithm>
+#include <cctype>
 #include <fstream>
+#include <future>
 
+#include "common/exception.hpp"
 #include "common/stopwatch.hpp"
+#include "storage/lsm/bloom_policy.hpp"
 #include "storage/lsm/compaction_job.hpp"
+#include "storage/lsm/compression.hpp"
 #include "storage/lsm/stats.hpp"
 
 namespace wing {
@@ -11,14 +17,28 @@ namespace wing {
 namespace lsm {
 
 DBImpl::DBImpl(const Options& options)
-  : options_(options), cache_(options_.cache) {
+  : options_(options),
+    cache_(options_.cache),
+    table_cache_(options_.max_open_files,
+        options_.cache_index_and_filter_blocks ? &cache_ : nullptr) {
+  blob_files_ = std::make_unique<BlobFileSet>(options_.db_path,
+      options_.min_blob_size, options_.blob_file_size,
+      options_.blob_gc_garbage_ratio, options_.write_buffer_size);
   if (options_.create_new) {
-    seq_ = 0;
-    sv_ = std::make_shared<SuperVersion>(std::make_shared<MemTable>(),
+    seq_.store(0, std::memory_order_relaxed);
+    sv_ = std::make_shared<SuperVersion>(NewMemTable(),
         std::make_shared<std::vector<std::shared_ptr<MemTable>>>(),
         std::make_shared<Version>());
     filename_gen_ =
         std::make_unique<FileNameGenerator>(options_.db_path.string() + "/", 0);
+    /* Logs left in the directory belong to an old database. */
+    for (auto& entry : std::filesystem::directory_iterator(options_.db_path)) {
+      if (entry.is_regular_file() && entry.path().extension() == ".log") {
+        std::filesystem::remove(entry.path());
+      }
+    }
+    NewLog(sv_->GetMt().get());
+    CheckpointManifest(*sv_->GetVersion(), seq_.load());
   } else {
     LoadMetadata();
   }
@@ -44,35 +64,124 @@ DBImpl::DBImpl(const Options& options)
         options_.level0_compaction_trigger);
   }
 
+  if (options_.max_subcompactions > 1) {
+    subcompaction_pool_ =
+        std::make_unique<ThreadPool>(options_.max_subcompactions - 1);
+  }
+  if (options_.max_background_flushes > 1) {
+    flush_pool_ =
+        std::make_unique<ThreadPool>(options_.max_background_flushes - 1);
+  }
   threads_.emplace_back([&]() { FlushThread(); });
-  threads_.emplace_back([&]() { CompactionThread(); });
+  size_t compaction_threads =
+      std::max<size_t>(options_.max_background_compactions, 1);
+  for (size_t i = 0; i < compaction_threads; i++) {
+    threads_.emplace_back([&]() { CompactionThread(); });
+  }
 }
 
 DBImpl::~DBImpl() {
   FlushAll();
-  stop_signal_ = true;
+  {
+    /* Set it with the mutex so that no thread misses the notification. */
+    std::unique_lock lck(db_mutex_);
+    stop_signal_ = true;
+  }
   flush_cv_.notify_all();
   compact_cv_.notify_all();
+  bg_work_cv_.notify_all();
   for (auto& thread : threads_) {
     thread.join();
   }
   Save();
 }
 
-void DBImpl::StopWrite() {
-  db_mutex_.unlock();
-  std::this_thread::sleep_for(std::chrono::milliseconds(100));
-  db_mutex_.lock();
+double DBImpl::WritePressure(const Version& version) const {
+  auto& levels = version.GetLevels();
+  if (levels.empty()) {
+    return 0;
+  }
+  double pressure = 0;
+  size_t l0_runs = levels[0].GetRuns().size();
+  size_t slowdown = options_.level0_slowdown_writes_trigger;
+  size_t stop = options_.level0_stop_writes_trigger;
+  if (l0_runs >= stop) {
+    return 1;
+  } else if (l0_runs >= slowdown) {
+    pressure = (l0_runs - slowdown + 1) / double(stop - slowdown + 1);
+  }
+  /**
+   * The bytes beyond the target size of each level. Only leveling bounds the
+   * size of each level, while the other strategies keep runs larger than
+   * these targets on purpose, so their compactions never reduce them.
+   */
+  if (options_.compaction_strategy_name != "leveled") {
+    return pressure;
+  }
+  uint64_t pending = 0;
+  if (l0_runs >= options_.level0_compaction_trigger) {
+    pending += levels[0].size();
+  }
+  uint64_t target = options_.level0_compaction_trigger * options_.sst_file_size;
+  for (size_t i = 1; i < levels.size(); i++) {
+    target *= options_.compaction_size_ratio;
+    if (levels[i].size() > target) {
+      pending += levels[i].size() - target;
+    }
+  }
+  uint64_t soft = options_.soft_pending_compaction_bytes_limit;
+  uint64_t hard = options_.hard_pending_compaction_bytes_limit;
+  if (hard > 0 && pending >= hard) {
+    return 1;
+  } else if (soft > 0 && pending > soft) {
+    pressure = std::max(pressure,
+        hard > soft ? (pending - soft) / double(hard - soft) : 0.0);
+  }
+  return pressure;
+}
+
+void DBImpl::DelayWrite(size_t bytes) {
+  double pressure = write_pressure_.load(std::memory_order_relaxed);
+  if (pressure <= 0) {
+    return;
+  }
+  StopWatch sw;
+  if (pressure >= 1) {
+    std::unique_lock lck(db_mutex_);
+    bg_work_cv_.wait(lck, [&]() {
+      pressure = write_pressure_.load(std::memory_order_relaxed);
+      return pressure < 1 || stop_signal_;
+    });
+    GetStatsContext()->write_stall_micros.fetch_add(
+        sw.GetTimeInSeconds() * 1e6, std::memory_order_relaxed);
+    if (pressure <= 0) {
+      return;
+    }
+    sw.Reset();
+  }
+  /* Keep a small rate, so that a write is never delayed for too long. */
+  double rate = options_.delayed_write_rate * std::max(1 - pressure, 0.01);
+  std::this_thread::sleep_for(
+      std::chrono::microseconds(uint64_t(bytes * 1e6 / rate)));
+  GetStatsContext()->write_delay_micros.fetch_add(
+      sw.GetTimeInSeconds() * 1e6, std::memory_order_relaxed);
 }
 
 void DBImpl::SwitchMemtable(bool force) {
   std::unique_lock db_lck(db_mutex_);
-  auto old_sv = GetSV();
-  while (old_sv->GetImms()->size() >= options_.max_immutable_count) {
-    old_sv.reset();
-    StopWrite();
-    old_sv = GetSV();
+  if (GetSV()->GetImms()->size() >= options_.max_immutable_count) {
+    StopWatch sw;
+    bg_work_cv_.wait(db_lck, [&]() {
+      return GetSV()->GetImms()->size() < options_.max_immutable_count ||
+             stop_signal_;
+    });
+    GetStatsContext()->write_stall_micros.fetch_add(
+        sw.GetTimeInSeconds() * 1e6, std::memory_order_relaxed);
+    if (stop_signal_) {
+      return;
+    }
   }
+  auto old_sv = GetSV();
   if ((force && old_sv->GetMt()->size() > 0) ||
       old_sv->GetMt()->size() > options_.sst_file_size) {
     auto mt = old_sv->GetMt();
@@ -81,7 +190,8 @@ void DBImpl::SwitchMemtable(bool force) {
     new_imm->push_back(mt);
     new_imm->insert(
         new_imm->end(), old_sv->GetImms()->begin(), old_sv->GetImms()->end());
-    auto new_mt = std::make_shared<MemTable>();
+    auto new_mt = NewMemTable();
+    NewLog(new_mt.get());
     auto new_sv = std::make_shared<SuperVersion>(new_mt, new_imm, version);
     InstallSV(new_sv);
     DB_INFO("{}", new_sv->ToString());
@@ -90,143 +200,713 @@ void DBImpl::SwitchMemtable(bool force) {
 }
 
 void DBImpl::Put(Slice key, Slice value) {
-  std::unique_lock lck(write_mutex_);
-  auto seq = ++seq_;
-  auto sv = GetSV();
-  sv->GetMt()->Put(key, seq, value);
-  if (sv->GetMt()->size() > options_.sst_file_size) {
-    SwitchMemtable();
+  Writer w;
+  w.key_ = ParsedKey(key, 0, RecordType::Value);
+  w.value_ = value;
+  WriteImpl(&w);
+}
+
+void DBImpl::Merge(Slice key, Slice operand) {
+  if (!options_.merge_operator) {
+    throw DBException("There is no merge operator.");
   }
+  Writer w;
+  w.key_ = ParsedKey(key, 0, RecordType::Merge);
+  w.value_ = operand;
+  WriteImpl(&w);
 }
 
 void DBImpl::Del(Slice key) {
-  std::unique_lock lck(write_mutex_);
-  auto seq = ++seq_;
+  Writer w;
+  w.key_ = ParsedKey(key, 0, RecordType::Deletion);
+  WriteImpl(&w);
+}
+
+void DBImpl::DeleteRange(Slice begin, Slice end) {
+  if (begin >= end) {
+    return;
+  }
+  Writer w;
+  w.key_ = ParsedKey(begin, 0, RecordType::RangeDeletion);
+  w.value_ = end;
+  WriteImpl(&w);
+}
+
+void DBImpl::Write(const WriteBatch& batch) {
+  if (batch.Empty()) {
+    return;
+  }
+  for (size_t i = 0; !options_.merge_operator && i < batch.Count(); i++) {
+    if (batch.Get(i).type_ == RecordType::Merge) {
+      throw DBException("There is no merge operator.");
+    }
+  }
+  Writer w;
+  w.batch_ = &batch;
+  WriteImpl(&w);
+}
+
+void DBImpl::WriteImpl(Writer* w) {
+  if (!WaitForLeader(w)) {
+    return;
+  }
+  /* w is the leader. It groups the writers behind it until a barrier. */
+  std::vector<Writer*> group;
+  {
+    std::unique_lock lck(write_mutex_);
+    for (auto writer : writers_) {
+      if (writer->barrier_) {
+        break;
+      }
+      group.push_back(writer);
+    }
+  }
+  size_t bytes = 0;
+  for (auto writer : group) {
+    bytes += writer->batch_
+                 ? writer->batch_->size()
+                 : writer->key_.user_key_.size() + writer->value_.size();
+  }
+  DelayWrite(bytes);
+  /**
+   * New writers can join the queue while the leader writes the log. Only
+   * the leader of the queue writes seq_.
+   */
+  seq_t seq = seq_.load(std::memory_order_relaxed);
+  std::string records;
+  for (auto writer : group) {
+    writer->key_.seq_ = seq + 1;
+    if (writer->batch_) {
+      seq += writer->batch_->Count();
+      if (log_) {
+        LogWriter::EncodeBatch(&records, *writer->batch_, writer->key_.seq_);
+      }
+    } else {
+      seq += 1;
+      if (log_) {
+        LogWriter::EncodeRecord(&records, writer->key_, writer->value_);
+      }
+    }
+  }
+  if (log_) {
+    log_->AddRecords(records);
+  }
   auto sv = GetSV();
-  sv->GetMt()->Del(key, seq);
+  auto mt = sv->GetMt().get();
+  if (mt->AllowConcurrentInsert() && group.size() > 1) {
+    {
+      std::unique_lock lck(write_mutex_);
+      w->pending_ = group.size() - 1;
+      for (size_t i = 1; i < group.size(); i++) {
+        group[i]->mt_ = mt;
+        group[i]->leader_ = w;
+        group[i]->cv_.notify_one();
+      }
+    }
+    InsertInto(mt, *w);
+    std::unique_lock lck(write_mutex_);
+    while (w->pending_ > 0) {
+      w->cv_.wait(lck);
+    }
+  } else {
+    for (auto writer : group) {
+      InsertInto(mt, *writer);
+    }
+  }
+  /**
+   * Readers see the records after all of them are inserted. The followers
+   * have finished their inserts before they notify the leader.
+   */
+  seq_.store(seq, std::memory_order_release);
   if (sv->GetMt()->size() > options_.sst_file_size) {
+    sv.reset();
     SwitchMemtable();
   }
+  FinishWriters(group.size());
+}
+
+bool DBImpl::WaitForLeader(Writer* w) {
+  std::unique_lock lck(write_mutex_);
+  writers_.push_back(w);
+  while (!w->done_ && w != writers_.front()) {
+    if (w->mt_ != nullptr) {
+      /* The leader has written the log. Insert the record in parallel. */
+      lck.unlock();
+      InsertInto(w->mt_, *w);
+      lck.lock();
+      w->mt_ = nullptr;
+      if (--w->leader_->pending_ == 0) {
+        w->leader_->cv_.notify_one();
+      }
+      continue;
+    }
+    w->cv_.wait(lck);
+  }
+  return !w->done_;
+}
+
+void DBImpl::InsertInto(MemTable* mt, const Writer& w) {
+  if (w.batch_) {
+    for (size_t i = 0; i < w.batch_->Count(); i++) {
+      auto record = w.batch_->Get(i);
+      InsertInto(mt, ParsedKey(record.key_, w.key_.seq_ + i, record.type_),
+          record.value_);
+    }
+  } else {
+    InsertInto(mt, w.key_, w.value_);
+  }
+}
+
+void DBImpl::InsertInto(MemTable* mt, ParsedKey key, Slice value) {
+  switch (key.type_) {
+    case RecordType::Value:
+      mt->Put(key.user_key_, key.seq_, value);
+      break;
+    case RecordType::Deletion:
+      mt->Del(key.user_key_, key.seq_);
+      break;
+    case RecordType::Merge:
+      mt->Merge(key.user_key_, key.seq_, value);
+      break;
+    case RecordType::RangeDeletion:
+      mt->DeleteRange(key.user_key_, value, key.seq_);
+      break;
+    case RecordType::BlobIndex:
+      DB_ERR("Blob indexes are not written by users!");
+  }
+}
+
+void DBImpl::FinishWriters(size_t n) {
+  std::unique_lock lck(write_mutex_);
+  for (size_t i = 0; i < n; i++) {
+    auto writer = writers_.front();
+    writers_.pop_front();
+    /* The leader is the first writer and it does not wait. */
+    if (i > 0) {
+      writer->done_ = true;
+      writer->cv_.notify_one();
+    }
+  }
+  if (!writers_.empty()) {
+    writers_.front()->cv_.notify_one();
+  }
+}
+
+void DBImpl::NewLog(MemTable* mt) {
+  if (!options_.enable_wal) {
+    return;
+  }
+  log_number_ += 1;
+  log_ = std::make_unique<LogWriter>(
+      LogFileName(options_.db_path.string(), log_number_), options_.sync_wal);
+  mt->SetLogNumber(log_number_);
+}
+
+void DBImpl::RemoveLog(const MemTable& mt) {
+  if (mt.GetLogNumber() == 0) {
+    return;
+  }
+  std::filesystem::remove(
+      LogFileName(options_.db_path.string(), mt.GetLogNumber()));
+}
+
+void DBImpl::RecoverLogs() {
+  std::vector<size_t> log_numbers;
+  for (auto& entry : std::filesystem::directory_iterator(options_.db_path)) {
+    auto stem = entry.path().stem().string();
+    if (entry.is_regular_file() && entry.path().extension() == ".log" &&
+        !stem.empty() &&
+        std::all_of(
+            stem.begin(), stem.end(), [](char c) { return isdigit(c); })) {
+      log_numbers.push_back(std::stoull(stem));
+    }
+  }
+  std::sort(log_numbers.begin(), log_numbers.end());
+  auto mt = sv_->GetMt();
+  for (auto number : log_numbers) {
+    LogReader reader(LogFileName(options_.db_path.string(), number));
+    ParsedKey key;
+    Slice value;
+    while (reader.ReadRecord(&key, &value)) {
+      InsertInto(mt.get(), key, value);
+      seq_.store(std::max(seq_.load(std::memory_order_relaxed), key.seq_),
+          std::memory_order_relaxed);
+    }
+  }
+  if (!log_numbers.empty()) {
+    log_number_ = log_numbers.back();
+    DB_INFO("Recover {} bytes from {} logs", mt->size(), log_numbers.size());
+  }
+  /* Write the recovered records to a new log before removing the old logs. */
+  NewLog(mt.get());
+  if (log_ && mt->size() > 0) {
+    std::string records;
+    for (auto it = mt->Begin(); it.Valid(); it.Next()) {
+      LogWriter::EncodeRecord(&records, ParsedKey(it.key()), it.value());
+    }
+    auto tombstones = mt->GetRangeTombstones();
+    for (auto& t : tombstones.GetTombstones()) {
+      LogWriter::EncodeRecord(&records,
+          ParsedKey(t.begin_, t.seq_, RecordType::RangeDeletion), t.end_);
+    }
+    log_->AddRecords(records);
+  }
+  for (auto number : log_numbers) {
+    std::filesystem::remove(LogFileName(options_.db_path.string(), number));
+  }
 }
 
 void DBImpl::DropAll() {
   WaitForFlushAndCompaction();
-  std::unique_lock db_lck(db_mutex_);
-  auto sv = GetSV();
-  auto new_sv = std::make_shared<SuperVersion>(std::make_shared<MemTable>(),
-      std::make_shared<std::vector<std::shared_ptr<MemTable>>>(),
-      std::make_shared<Version>());
-  auto version = sv->GetVersion();
-  for (auto& level : version->GetLevels()) {
-    for (auto& sr : level.GetRuns()) {
-      sr->SetRemoveTag(true);
+  Writer w;
+  w.barrier_ = true;
+  WaitForLeader(&w);
+  {
+    std::unique_lock db_lck(db_mutex_);
+    auto sv = GetSV();
+    auto new_sv = std::make_shared<SuperVersion>(NewMemTable(),
+        std::make_shared<std::vector<std::shared_ptr<MemTable>>>(),
+        std::make_shared<Version>());
+    NewLog(new_sv->GetMt().get());
+    auto version = sv->GetVersion();
+    for (auto& level : version->GetLevels()) {
+      for (auto& sr : level.GetRuns()) {
+        sr->SetRemoveTag(true);
+      }
+    }
+    RemoveLog(*sv->GetMt());
+    for (auto& imm : *sv->GetImms()) {
+      RemoveLog(*imm);
     }
+    blob_files_->DropAll();
+    InstallSV(new_sv);
   }
-  InstallSV(new_sv);
+  FinishWriters(1);
 }
 
-bool DBImpl::Get(Slice key, std::string* value) {
+bool DBImpl::Get(Slice key, std::string* value, const Snapshot* snapshot) {
   auto sv = GetSV();
-  auto seq = seq_;
-  return sv->Get(key, seq, value);
+  auto seq = ReadSeq(snapshot);
+  auto res = sv->Lookup(key, seq, value);
+  if (res == GetResult::kMerge) {
+    return GetMerged(std::move(sv), seq, key, value);
+  }
+  return res == GetResult::kFound;
 }
 
-void DBImpl::SaveMetadata() {
-  auto metadata_file = options_.db_path.string() + "/metadata";
-  FileWriter writer(
-      std::make_unique<SeqWriteFile>(metadata_file, options_.use_direct_io),
-      1 << 20);
+bool DBImpl::GetMerged(std::shared_ptr<SuperVersion> sv, seq_t seq,
+    Slice key, std::string* value) {
+  DBIterator it(std::move(sv), seq, true, blob_files_.get(),
+      options_.merge_operator.get());
+  it.Seek(key);
+  if (!it.Valid() || it.key() != key) {
+    return false;
+  }
+  *value = it.value();
+  return true;
+}
+
+std::vector<bool> DBImpl::MultiGet(std::span<const Slice> keys,
+    std::vector<std::string>* values, const Snapshot* snapshot) {
   auto sv = GetSV();
-  auto version = sv->GetVersion();
-  writer.AppendValue<uint64_t>(seq_)
-      .AppendValue<uint64_t>(filename_gen_->GetID())
-      .AppendValue<uint64_t>(version->GetLevels().size());
-  for (auto& level : version->GetLevels()) {
-    writer.AppendValue<uint64_t>(level.GetID())
-        .AppendValue<uint64_t>(level.GetRuns().size());
-    for (auto& run : level.GetRuns()) {
-      writer.AppendValue<uint64_t>(run->GetSSTs().size());
-      for (auto& sst : run->GetSSTs()) {
-        auto& info = sst->GetSSTInfo();
-        writer.AppendValue<uint64_t>(info.count_)
-            .AppendValue<uint64_t>(info.size_)
-            .AppendValue<uint64_t>(info.sst_id_)
-            .AppendValue<uint64_t>(info.index_offset_)
-            .AppendValue<uint64_t>(info.bloom_filter_offset_)
-            .AppendValue<uint64_t>(info.filename_.size())
-            .AppendString(info.filename_);
-      }
+  auto seq = ReadSeq(snapshot);
+  auto results = sv->MultiGet(keys, seq, values);
+  std::vector<bool> found(keys.size());
+  for (size_t i = 0; i < keys.size(); i++) {
+    if (results[i] == GetResult::kMerge) {
+      found[i] = GetMerged(sv, seq, keys[i], &(*values)[i]);
+    } else {
+      found[i] = results[i] == GetResult::kFound;
+    }
+  }
+  return found;
+}
+
+const Snapshot* DBImpl::GetSnapshot() {
+  std::unique_lock lck(snapshot_mutex_);
+  return &snapshots_.emplace_back(seq_.load(std::memory_order_acquire));
+}
+
+void DBImpl::ReleaseSnapshot(const Snapshot* snapshot) {
+  std::unique_lock lck(snapshot_mutex_);
+  auto it = std::find_if(snapshots_.begin(), snapshots_.end(),
+      [&](const Snapshot& s) { return &s == snapshot; });
+  wing_assert(it != snapshots_.end(), "The snapshot is not live");
+  snapshots_.erase(it);
+}
+
+std::vector<seq_t> DBImpl::GetSnapshotSeqs() {
+  std::unique_lock lck(snapshot_mutex_);
+  std::vector<seq_t> ret;
+  for (auto& snapshot : snapshots_) {
+    if (ret.empty() || ret.back() != snapshot.GetSeq()) {
+      ret.push_back(snapshot.GetSeq());
     }
   }
-  writer.Flush();
+  return ret;
+}
+
+void DBImpl::SaveMetadata() {
+  {
+    std::unique_lock lck(db_mutex_);
+    CheckpointManifest(*GetSV()->GetVersion(), seq_.load());
+  }
+  blob_files_->Save();
+}
+
+void DBImpl::CheckpointManifest(const Version& version, seq_t seq) {
+  auto filename = ManifestFileName(options_.db_path.string());
+  auto tmp_filename = filename + ".tmp";
+  auto manifest =
+      std::make_unique<ManifestWriter>(tmp_filename, options_.sync_wal);
+  manifest->AddEdit(nullptr, version, seq, filename_gen_->GetID());
+  /* The rename is atomic, so a crash leaves the old or the new manifest. */
+  std::filesystem::rename(tmp_filename, filename);
+  manifest_ = std::move(manifest);
+  /* The metadata written by older versions is replaced by the manifest. */
+  std::filesystem::remove(options_.db_path.string() + "/metadata");
 }
 
 void DBImpl::LoadMetadata() {
+  auto manifest_filename = ManifestFileName(options_.db_path.string());
   auto metadata_filename = options_.db_path.string() + "/metadata";
-  auto file =
-      std::make_unique<ReadFile>(metadata_filename, options_.use_direct_io);
-  FileReader reader(file.get(), 1 << 20, 0);
-  seq_ = reader.ReadValue<uint64_t>();
-  auto latest_file_id = reader.ReadValue<uint64_t>();
-  auto num_levels = reader.ReadValue<uint64_t>();
+  ManifestState state;
+  if (std::filesystem::exists(manifest_filename)) {
+    state = ReplayManifest(manifest_filename);
+  } else if (std::filesystem::exists(metadata_filename)) {
+    /* The metadata written by older versions at shutdown. */
+    auto file =
+        std::make_unique<ReadFile>(metadata_filename, options_.use_direct_io);
+    FileReader reader(file.get(), 1 << 20, 0);
+    state.seq_ = reader.ReadValue<uint64_t>();
+    state.next_file_id_ = reader.ReadValue<uint64_t>();
+    auto num_levels = reader.ReadValue<uint64_t>();
+    for (uint64_t i = 0; i < num_levels; i++) {
+      auto& level = state.levels_.emplace_back();
+      level.id_ = reader.ReadValue<uint64_t>();
+      level.runs_.resize(reader.ReadValue<uint64_t>());
+      for (auto& run : level.runs_) {
+        auto num_sst = reader.ReadValue<uint64_t>();
+        for (uint64_t k = 0; k < num_sst; k++) {
+          SSTInfo info;
+          info.count_ = reader.ReadValue<uint64_t>();
+          info.size_ = reader.ReadValue<uint64_t>();
+          info.sst_id_ = reader.ReadValue<uint64_t>();
+          info.index_offset_ = reader.ReadValue<uint64_t>();
+          info.bloom_filter_offset_ = reader.ReadValue<uint64_t>();
+          auto len = reader.ReadValue<uint64_t>();
+          info.filename_ = reader.ReadString(len);
+          run.push_back(std::move(info));
+        }
+      }
+    }
+  }
+  /* If there is neither, the database crashed before any SSTable. */
+  blob_files_->Load();
+  seq_.store(state.seq_, std::memory_order_relaxed);
   std::vector<Level> levels;
-  for (uint64_t i = 0; i < num_levels; i++) {
-    auto id = reader.ReadValue<uint64_t>();
-    auto num_run = reader.ReadValue<uint64_t>();
+  for (auto& level : state.levels_) {
     std::vector<std::shared_ptr<SortedRun>> runs;
-    for (uint64_t j = 0; j < num_run; j++) {
-      auto num_sst = reader.ReadValue<uint64_t>();
-      std::vector<SSTInfo> ssts;
-      for (uint64_t k = 0; k < num_sst; k++) {
-        SSTInfo info;
-        info.count_ = reader.ReadValue<uint64_t>();
-        info.size_ = reader.ReadValue<uint64_t>();
-        info.sst_id_ = reader.ReadValue<uint64_t>();
-        info.index_offset_ = reader.ReadValue<uint64_t>();
-        info.bloom_filter_offset_ = reader.ReadValue<uint64_t>();
-        auto len = reader.ReadValue<uint64_t>();
-        info.filename_ = reader.ReadString(len);
-        ssts.push_back(info);
-      }
+    for (auto& ssts : level.runs_) {
       runs.push_back(std::make_shared<SortedRun>(
-          ssts, options_.block_size, options_.use_direct_io));
+          ssts, options_.block_size, options_.use_direct_io, &cache_,
+          options_.use_mmap_reads, blob_files_.get(), &table_cache_));
     }
-    levels.emplace_back(id, std::move(runs));
+    levels.emplace_back(level.id_, std::move(runs));
   }
   auto version = std::make_shared<Version>(std::move(levels));
-  sv_ = std::make_shared<SuperVersion>(std::make_shared<MemTable>(),
+  sv_ = std::make_shared<SuperVersion>(NewMemTable(),
       std::make_shared<std::vector<std::shared_ptr<MemTable>>>(),
       std::move(version));
   DB_INFO("SuperVersion: {}", sv_->ToString());
   filename_gen_ = std::make_unique<FileNameGenerator>(
-      options_.db_path.string() + "/", latest_file_id);
+      options_.db_path.string() + "/", state.next_file_id_);
+  RecoverLogs();
+  CheckpointManifest(*sv_->GetVersion(), seq_.load());
 }
 
 void DBImpl::Save() { SaveMetadata(); }
 
 void DBImpl::FlushAll() {
-  SwitchMemtable(true);
-  while (true) {
-    {
-      auto sv = GetSV();
-      if (sv->GetMt()->size() == 0 && sv->GetImms()->size() == 0) {
-        break;
-      }
-    }
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  {
+    Writer w;
+    w.barrier_ = true;
+    WaitForLeader(&w);
+    SwitchMemtable(true);
+    FinishWriters(1);
   }
+  std::unique_lock lck(db_mutex_);
+  bg_work_cv_.wait(lck, [&]() {
+    auto sv = GetSV();
+    return sv->GetMt()->size() == 0 && sv->GetImms()->size() == 0;
+  });
 }
 
 void DBImpl::WaitForFlushAndCompaction() {
+  std::unique_lock lck(db_mutex_);
+  bg_work_cv_.wait(lck, [&]() {
+    return !flush_flag_ && running_compactions_ == 0 && !compaction_scheduled_;
+  });
+}
+
+bool DBImpl::Ingest(const std::function<bool(Slice*, Slice*)>& next) {
+  /**
+   * Stay at the front of the writer queue until the records are visible, so
+   * no write made meanwhile is older than them, and no snapshot taken
+   * meanwhile sees them.
+   */
+  Writer w;
+  w.barrier_ = true;
+  WaitForLeader(&w);
+  bool ingested;
+  try {
+    ingested = IngestImpl(next);
+  } catch (...) {
+    FinishWriters(1);
+    throw;
+  }
+  FinishWriters(1);
+  return ingested;
+}
+
+bool DBImpl::IngestImpl(const std::function<bool(Slice*, Slice*)>& next) {
+  /* It is published after the records are installed. */
+  seq_t seq = seq_.load(std::memory_order_relaxed) + 1;
+  size_t level = 0;
+  {
+    std::unique_lock lck(db_mutex_);
+    /* Most ingested SSTables go to the last level. */
+    auto& levels = GetSV()->GetVersion()->GetLevels();
+    level = std::max<size_t>(levels.size(), 1) - 1;
+  }
+  /**
+   * Fill a MemTable per SSTable, and write a batch of them in parallel, so
+   * at most max_background_flushes SSTables are buffered at once.
+   */
+  size_t batch_size = std::max<size_t>(options_.max_background_flushes, 1);
+  std::vector<SSTInfo> infos;
+  std::string first, last;
+  size_t count = 0;
+  bool end = false;
+  bool sorted = true;
+  while (!end) {
+    std::vector<std::shared_ptr<MemTable>> mts;
+    size_t entries = 0;
+    while (mts.size() < batch_size && !end) {
+      auto mt = NewMemTable();
+      Slice key, value;
+      while (mt->size() < options_.sst_file_size) {
+        if (!next(&key, &value)) {
+          end = true;
+          break;
+        }
+        if (count > 0 && key <= last) {
+          sorted = false;
+          end = true;
+          break;
+        }
+        if (count == 0) {
+          first = key;
+        }
+        last = key;
+        mt->Put(key, seq, value);
+        count += 1;
+      }
+      if (mt->count() > 0) {
+        entries += mt->count();
+        mts.push_back(std::move(mt));
+      }
+    }
+    if (!sorted) {
+      break;
+    }
+    size_t bloom_bits_per_key = 0;
+    {
+      std::unique_lock lck(db_mutex_);
+      bloom_bits_per_key =
+          BloomBitsPerKey(options_, *GetSV()->GetVersion(), level, entries);
+    }
+    std::vector<std::vector<SSTInfo>> outputs(mts.size());
+    RunTasks(flush_pool_.get(), mts.size(), [&](size_t i) {
+      CompactionJob worker(filename_gen_.get(), options_.block_size,
+          options_.sst_file_size, options_.write_buffer_size,
+          bloom_bits_per_key, options_.use_direct_io,
+          options_.block_restart_interval, options_.bloom_filter_format,
+          options_.range_filter_prefix_length,
+          BlockCodecForLevel(options_, level), blob_files_.get(),
+          GetSnapshotSeqs());
+      outputs[i] = worker.Run(mts[i]->Begin());
+    });
+    for (auto& output : outputs) {
+      infos.insert(infos.end(), output.begin(), output.end());
+    }
+  }
+  if (infos.empty() && sorted) {
+    return true;
+  }
+  auto run = std::make_shared<SortedRun>(infos, options_.block_size,
+      options_.use_direct_io, &cache_, options_.use_mmap_reads,
+      blob_files_.get(), &table_cache_);
+  /* Remove the SSTables, and the blobs they reference. */
+  auto discard = [&]() {
+    run->SetRemoveTag(true);
+    for (auto& sst : run->GetSSTs()) {
+      for (auto it = sst->Begin(false); it.Valid(); it.Next()) {
+        if (ParsedKey(it.key()).type_ == RecordType::BlobIndex) {
+          blob_files_->AddGarbage(BlobIndex::Decode(it.value()));
+        }
+      }
+    }
+  };
+  if (!sorted) {
+    discard();
+    throw DBException("The keys to ingest are not in ascending order.");
+  }
+  auto overlaps_mt = [&](MemTable& mt) {
+    auto it = mt.Seek(first, std::numeric_limits<seq_t>::max());
+    return it.Valid() && ParsedKey(it.key()).user_key_ <= Slice(last);
+  };
+  auto level_overlaps = [&](const Level& l) {
+    for (auto& r : l.GetRuns()) {
+      for (auto& sst : r->GetSSTs()) {
+        if (sst->GetSmallestKey().user_key_ <= Slice(last) &&
+            Slice(first) <= sst->GetLargestKey().user_key_) {
+          return true;
+        }
+      }
+    }
+    return false;
+  };
+  std::unique_lock lck(db_mutex_);
+  std::shared_ptr<SuperVersion> old_sv;
+  size_t target = 0;
+  bool overlaps = false;
   while (true) {
-    db_mutex_.lock();
-    if (!flush_flag_ && !compact_flag_) {
-      db_mutex_.unlock();
-      return;
+    /* A running compaction installs the levels it read, so wait for it. */
+    bg_work_cv_.wait(lck, [&]() { return running_compactions_ == 0; });
+    old_sv = GetSV();
+    overlaps = overlaps_mt(*old_sv->GetMt());
+    for (auto& imm : *old_sv->GetImms()) {
+      overlaps = overlaps || overlaps_mt(*imm);
     }
-    db_mutex_.unlock();
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    if (overlaps) {
+      break;
+    }
+    /**
+     * The deepest level which no level above it overlaps. Level 0 may
+     * overlap, since the ingested run is the newest one there.
+     */
+    auto& levels = old_sv->GetVersion()->GetLevels();
+    target = 0;
+    while (target + 1 < levels.size() && !level_overlaps(levels[target]) &&
+           !level_overlaps(levels[target + 1])) {
+      target += 1;
+    }
+    auto& version = *old_sv->GetVersion();
+    size_t bloom_bits_per_key =
+        BloomBitsPerKey(options_, version, target, count);
+    auto codec = BlockCodecForLevel(options_, target);
+    if (target == level ||
+        (bloom_bits_per_key ==
+                BloomBitsPerKey(options_, version, level, count) &&
+            codec == BlockCodecForLevel(options_, level))) {
+      break;
+    }
+    /**
+     * The SSTables are built for another level, whose bloom filters or
+     * codec differ, so rewrite them for the target level. The levels may
+     * change meanwhile, so the target is checked again.
+     */
+    lck.unlock();
+    CompactionJob worker(filename_gen_.get(), options_.block_size,
+        options_.sst_file_size, options_.write_buffer_size,
+        bloom_bits_per_key, options_.use_direct_io,
+        options_.block_restart_interval, options_.bloom_filter_format,
+        options_.range_filter_prefix_length, codec, blob_files_.get(),
+        GetSnapshotSeqs());
+    auto rebuilt = std::make_shared<SortedRun>(worker.Run(run->Begin(false)),
+        options_.block_size, options_.use_direct_io, &cache_,
+        options_.use_mmap_reads, blob_files_.get(), &table_cache_);
+    /* The blobs are referenced by the new SSTables. */
+    run->SetRemoveTag(true);
+    run = std::move(rebuilt);
+    level = target;
+    lck.lock();
+  }
+  if (overlaps) {
+    lck.unlock();
+    /**
+     * The MemTables are newer than the SSTables, so insert the records into
+     * the MemTable and the log instead. They keep the sequence number, which
+     * is still older than any other write.
+     */
+    std::string records, value;
+    for (auto it = run->Begin(false); it.Valid(); it.Next()) {
+      ParsedKey key(it.key());
+      Slice record_value = it.value();
+      if (key.type_ == RecordType::BlobIndex) {
+        blob_files_->Read(it.value(), &value);
+        record_value = value;
+      }
+      ParsedKey record(key.user_key_, seq, RecordType::Value);
+      if (log_) {
+        LogWriter::EncodeRecord(&records, record, record_value);
+      }
+      auto sv = GetSV();
+      InsertInto(sv->GetMt().get(), record, record_value);
+      if (sv->GetMt()->size() > options_.sst_file_size) {
+        /* The records must be logged before the log is replaced. */
+        if (log_) {
+          log_->AddRecords(records);
+          records.clear();
+        }
+        sv.reset();
+        SwitchMemtable();
+      }
+    }
+    if (log_ && !records.empty()) {
+      log_->AddRecords(records);
+    }
+    seq_.store(seq, std::memory_order_release);
+    discard();
+    return false;
   }
+  std::vector<Level> new_levels = old_sv->GetVersion()->GetLevels();
+  if (new_levels.empty()) {
+    new_levels.emplace_back(0);
+  }
+  auto& runs = new_levels[target].GetRuns();
+  if (target > 0 && runs.size() == 1) {
+    /* Keep one sorted run in the level, e.g. for leveled compactions. */
+    std::vector<std::shared_ptr<SSTable>> ssts;
+    auto& old_ssts = runs[0]->GetSSTs();
+    auto pos = std::find_if(old_ssts.begin(), old_ssts.end(), [&](auto& sst) {
+      return Slice(last) < sst->GetSmallestKey().user_key_;
+    });
+    ssts.insert(ssts.end(), old_ssts.begin(), pos);
+    ssts.insert(ssts.end(), run->GetSSTs().begin(), run->GetSSTs().end());
+    ssts.insert(ssts.end(), pos, old_ssts.end());
+    new_levels[target] = Level(target, {std::make_shared<SortedRun>(
+        ssts, options_.block_size, options_.use_direct_io)});
+  } else {
+    auto new_runs = runs;
+    new_runs.push_back(run);
+    new_levels[target] = Level(target, std::move(new_runs));
+  }
+  GetStatsContext()->total_input_bytes.fetch_add(
+      run->size(), std::memory_order_relaxed);
+  auto new_sv = std::make_shared<SuperVersion>(old_sv->GetMt(),
+      old_sv->GetImms(), std::make_shared<Version>(std::move(new_levels)));
+  DB_INFO("Ingest {} records into Level {}", count, target);
+  /**
+   * The manifest records seq, so the ingested records stay visible after a
+   * recovery. Readers see them once seq_ is published.
+   */
+  InstallSV(std::move(new_sv), seq);
+  seq_.store(seq, std::memory_order_release);
+  compaction_scheduled_ = true;
+  compact_cv_.notify_one();
+  return true;
 }
 
 void DBImpl::FlushThread() {
@@ -239,44 +919,73 @@ void DBImpl::FlushThread() {
     }
     /* Pick the memtables that require flushing */
     std::vector<std::shared_ptr<MemTable>> imms;
+    size_t bloom_bits_per_key = 0;
     {
-      auto old_sv = GetSV();
-      while (old_sv->GetVersion()->GetLevels().size() > 0 &&
-             old_sv->GetVersion()->GetLevels()[0].GetRuns().size() >=
-                 options_.level0_stop_writes_trigger) {
-        old_sv.reset();
-        StopWrite();
-        old_sv = GetSV();
+      /* Wait for the compactions if there are too many runs in Level 0. */
+      bg_work_cv_.wait(lck, [&]() {
+        auto version = GetSV()->GetVersion();
+        auto& levels = version->GetLevels();
+        return stop_signal_ || levels.empty() ||
+               levels[0].GetRuns().size() < options_.level0_stop_writes_trigger;
+      });
+      if (stop_signal_) {
+        flush_flag_ = false;
+        return;
       }
       imms = PickMemTables();
       if (imms.empty()) {
-        old_sv.reset();
         flush_flag_ = false;
+        bg_work_cv_.notify_all();
         flush_cv_.wait(lck);
         continue;
       }
 
+      size_t entries = 0;
       for (auto& imm : imms) {
         imm->SetFlushInProgress(true);
+        entries += imm->count();
       }
       flush_flag_ = true;
+      bloom_bits_per_key =
+          BloomBitsPerKey(options_, *GetSV()->GetVersion(), 0, entries);
     }
-    /* Flush the memtables */
+    /* Flush the memtables in parallel */
     std::vector<std::shared_ptr<SortedRun>> runs;
     {
       db_mutex_.unlock();
-      for (auto& imm : imms) {
+      std::vector<std::shared_ptr<SortedRun>> flushed(imms.size());
+      RunTasks(flush_pool_.get(), imms.size(), [&](size_t i) {
         CompactionJob worker(filename_gen_.get(), options_.block_size,
             options_.sst_file_size, options_.write_buffer_size,
-            options_.bloom_bits_per_key, options_.use_direct_io);
-        auto ssts = worker.Run(imm->Begin());
+            bloom_bits_per_key, options_.use_direct_io,
+            options_.block_restart_interval, options_.bloom_filter_format,
+            options_.range_filter_prefix_length,
+            BlockCodecForLevel(options_, 0), blob_files_.get(),
+            GetSnapshotSeqs(), options_.merge_operator.get());
+        auto ssts = worker.Run(
+            imms[i]->Begin(), std::nullopt, imms[i]->GetRangeTombstones());
         if (ssts.empty()) {
-          continue;
+          return;
         }
-        runs.push_back(std::make_shared<SortedRun>(
-            ssts, options_.block_size, options_.use_direct_io));
+        flushed[i] = std::make_shared<SortedRun>(ssts, options_.block_size,
+            options_.use_direct_io, &cache_, options_.use_mmap_reads,
+            blob_files_.get(), &table_cache_);
         GetStatsContext()->total_input_bytes.fetch_add(
-            runs.back()->size(), std::memory_order_relaxed);
+            flushed[i]->size(), std::memory_order_relaxed);
+      });
+      /* Keep the order of the memtables. */
+      for (auto& run : flushed) {
+        if (run != nullptr) {
+          runs.push_back(std::move(run));
+        }
+      }
+      /**
+       * The logs are removed once the manifest records the new SSTables.
+       * If the logs are synced, the SSTables are synced before that, or a
+       * power failure may lose the records in both.
+       */
+      if (options_.enable_wal && options_.sync_wal) {
+        SyncFileSystem(options_.db_path.string());
       }
       db_mutex_.lock();
     }
@@ -301,6 +1010,11 @@ void DBImpl::FlushThread() {
           std::make_shared<SuperVersion>(std::move(mt), new_imm, new_version);
       DB_INFO("{}", new_sv->ToString());
       InstallSV(std::move(new_sv));
+      /* The flushed records are in the SSTables now. */
+      for (auto& imm : imms) {
+        RemoveLog(*imm);
+      }
+      compaction_scheduled_ = true;
       compact_cv_.notify_one();
     }
   }
@@ -312,32 +1026,24 @@ void DBImpl::CompactionThread() {
     // Check if it has to stop. 
     // It has to stop when the LSM-tree shutdowns.
     if (stop_signal_) {
-      compact_flag_ = false;
       return;
     }
     std::unique_ptr<Compaction> compaction = compaction_picker_->Get(sv_->GetVersion().get());
     if (!compaction) {
-      compact_flag_ = false;
+      compaction_scheduled_ = false;
+      bg_work_cv_.notify_all();
       compact_cv_.wait(lck);
       continue;
     }
     // DB_INFO("Compaction: {}, {}, {} -> {}", compaction->input_runs().size(), compaction->input_ssts().size(), compaction->src_level(), compaction->target_level());
-    compact_flag_ = true;
-    // Do some other things
-    db_mutex_.unlock();
-    // Do compaction
+    running_compactions_ += 1;
     // int count1 = 0;
     // int count2 = 0;
-    CompactionJob worker(filename_gen_.get(), options_.block_size,
-        options_.sst_file_size, options_.write_buffer_size,
-        options_.bloom_bits_per_key, options_.use_direct_io);
-    IteratorHeap<Iterator> heap;
-    std::vector<std::shared_ptr<SSTableIterator>> iters;
-    std::shared_ptr<SortedRunIterator> run_iter;
+    std::vector<SSTable*> input_tables;
+    SortedRun* input_run = nullptr;
     if (compaction->input_ssts().size() > 0) {
       for (auto& sst: compaction->input_ssts()) {
-        iters.push_back(std::make_shared<SSTableIterator>(sst.get()));
-        heap.Push(iters.back().get());
+        input_tables.push_back(sst.get());
         sst->SetCompactionInProcess(true);
         // count1 += sst->GetSSTInfo().count_;
       }
@@ -349,53 +1055,83 @@ void DBImpl::CompactionThread() {
         for (auto& sst: compaction->target_sorted_run()->GetSSTs()) {
           if (sst->GetLargestKey().user_key_ < compaction->input_ssts()[0]->GetSmallestKey().user_key_) continue;
           else if (sst->GetSmallestKey().user_key_ > compaction->input_ssts()[0]->GetLargestKey().user_key_) break;
-          iters.push_back(std::make_shared<SSTableIterator>(sst.get()));
-          heap.Push(iters.back().get());
+          input_tables.push_back(sst.get());
           overlap_count++;
           sst->SetCompactionInProcess(true);
           sst->SetRemoveTag(true);
           // count1 += sst->GetSSTInfo().count_;
         }
-        // DB_INFO("{}", iters.size());
+        // DB_INFO("{}", input_tables.size());
       } else {
-        run_iter = std::make_shared<SortedRunIterator>(compaction->target_sorted_run().get(),
-          SSTableIterator(compaction->target_sorted_run()->GetSSTs()[0].get()), 0);
-        heap.Push(run_iter.get());
+        input_run = compaction->target_sorted_run().get();
         for (auto& sst: compaction->target_sorted_run()->GetSSTs()) {
           sst->SetCompactionInProcess(true);
           sst->SetRemoveTag(true);
         }
       }
     } else if (compaction->target_sorted_run() && compaction->type == "lazy") {
-      run_iter = std::make_shared<SortedRunIterator>(compaction->target_sorted_run().get(),
-        SSTableIterator(compaction->target_sorted_run()->GetSSTs()[0].get()), 0);
-      heap.Push(run_iter.get());
+      input_run = compaction->target_sorted_run().get();
       for (auto& sst: compaction->target_sorted_run()->GetSSTs()) {
         sst->SetCompactionInProcess(true);
         sst->SetRemoveTag(true);
       }
     }
+    /**
+     * The compaction pickers skip the levels of the runs, so the other
+     * compaction threads do not pick them. They are marked before releasing
+     * the mutex.
+     */
+    for (auto& run : compaction->input_runs()) {
+      run->SetCompactionInProcess(true);
+    }
+    if (compaction->target_sorted_run()) {
+      compaction->target_sorted_run()->SetCompactionInProcess(true);
+    }
+    size_t input_entries = 0;
+    for (auto sst : input_tables) {
+      input_entries += sst->GetSSTInfo().count_;
+    }
+    if (input_run != nullptr) {
+      for (auto& sst : input_run->GetSSTs()) {
+        input_entries += sst->GetSSTInfo().count_;
+      }
+    }
+    size_t bloom_bits_per_key = BloomBitsPerKey(options_,
+        *sv_->GetVersion(), compaction->target_level(), input_entries);
+    auto codec = BlockCodecForLevel(options_, compaction->target_level());
+    bool bottommost = IsBottommost(*sv_->GetVersion(), input_tables,
+        input_run, compaction->target_level());
+    db_mutex_.unlock();
+    // Do compaction
     std::vector<std::shared_ptr<SSTable>> ssts;
     // StopWatch sw;
     if (compaction->type == "level") {
       if (compaction->target_sorted_run() && overlap_count > 0){
         std::vector<SSTInfo> sst_infos;
-        sst_infos = worker.Run(heap);
+        sst_infos =
+            RunCompaction(input_tables, input_run, bloom_bits_per_key, codec,
+                bottommost);
         for (auto& sst: compaction->input_ssts()) {
           sst->SetCompactionInProcess(true);
           sst->SetRemoveTag(true);
         }
-        SortedRun run(sst_infos, options_.block_size, options_.use_direct_io);
+        SortedRun run(sst_infos, options_.block_size, options_.use_direct_io,
+            &cache_, options_.use_mmap_reads, blob_files_.get(),
+            &table_cache_);
         ssts = run.GetSSTs();
         // for (auto& sst: ssts) count2 += sst.count_;
       } else if (compaction->src_level() == 0) {
         std::vector<SSTInfo> sst_infos;
-        sst_infos = worker.Run(heap);
+        sst_infos =
+            RunCompaction(input_tables, input_run, bloom_bits_per_key, codec,
+                bottommost);
         for (auto& sst: compaction->input_ssts()) {
           sst->SetCompactionInProcess(true);
           sst->SetRemoveTag(true);
         }
-        SortedRun run(sst_infos, options_.block_size, options_.use_direct_io);
+        SortedRun run(sst_infos, options_.block_size, options_.use_direct_io,
+            &cache_, options_.use_mmap_reads, blob_files_.get(),
+            &table_cache_);
         ssts = run.GetSSTs();
       } else {
         ssts = compaction->input_ssts();
@@ -403,12 +1139,16 @@ void DBImpl::CompactionThread() {
     } else if (compaction->type == "lazy") {
       if (compaction->trivial_move() == false) {
         std::vector<SSTInfo> sst_infos;
-        sst_infos = worker.Run(heap);
+        sst_infos =
+            RunCompaction(input_tables, input_run, bloom_bits_per_key, codec,
+                bottommost);
         for (auto& sst: compaction->input_ssts()) {
           sst->SetCompactionInProcess(true);
           sst->SetRemoveTag(true);
         }
-        SortedRun run(sst_infos, options_.block_size, options_.use_direct_io);
+        SortedRun run(sst_infos, options_.block_size, options_.use_direct_io,
+            &cache_, options_.use_mmap_reads, blob_files_.get(),
+            &table_cache_);
         ssts = run.GetSSTs();
       }
     }
@@ -513,7 +1253,9 @@ void DBImpl::CompactionThread() {
               inputs.push_back(sst);
             }
             // std::cout << "count: " << count << std::endl;
-            new_version->Append(i, std::make_shared<SortedRun>(inputs, options_.block_size, options_.use_direct_io));
+            /* The level is empty if its only SSTable is moved down. */
+            if (inputs.size() != 0)
+              new_version->Append(i, std::make_shared<SortedRun>(inputs, options_.block_size, options_.use_direct_io));
             // DB_INFO("Cost source level {}s", sw.GetTimeInSeconds());
           } else {
             new_version->Append(i, sv_->GetVersion()->GetLevels()[i].GetRuns());
@@ -600,8 +1342,170 @@ void DBImpl::CompactionThread() {
       for (auto& sst: compaction->target_sorted_run()->GetSSTs()) {
         sst->SetCompactionInProcess(false);
       }
+      compaction->target_sorted_run()->SetCompactionInProcess(false);
+    }
+    for (auto& run : compaction->input_runs()) {
+      run->SetCompactionInProcess(false);
     }
     InstallSV(new_sv);
+    running_compactions_ -= 1;
+    /* The levels are free, so the waiting threads may pick them. */
+    compaction_scheduled_ = true;
+    compact_cv_.notify_all();
+  }
+}
+
+bool DBImpl::IsBottommost(const Version& version,
+    const std::vector<SSTable*>& ssts, SortedRun* run, size_t target_level) {
+  if (target_level + 1 < version.GetLevels().size()) {
+    return false;
+  }
+  std::vector<const SSTable*> inputs(ssts.begin(), ssts.end());
+  RangeTombstoneList tombstones;
+  for (auto sst : ssts) {
+    tombstones.Add(sst->GetRangeTombstones());
+  }
+  if (run != nullptr) {
+    for (auto& sst : run->GetSSTs()) {
+      inputs.push_back(sst.get());
+      tombstones.Add(sst->GetRangeTombstones());
+    }
+  }
+  for (auto& level : version.GetLevels()) {
+    for (auto& r : level.GetRuns()) {
+      for (auto& sst : r->GetSSTs()) {
+        if (std::find(inputs.begin(), inputs.end(), sst.get()) !=
+            inputs.end()) {
+          continue;
+        }
+        for (auto& t : tombstones.GetTombstones()) {
+          if (sst->GetSmallestKey().user_key_ < t.end_ &&
+              t.begin_ <= sst->GetLargestKey().user_key_) {
+            return false;
+          }
+        }
+      }
+    }
+  }
+  return true;
+}
+
+std::vector<SSTInfo> DBImpl::RunCompaction(const std::vector<SSTable*>& ssts,
+    SortedRun* run, size_t bloom_bits_per_key, BlockCodec codec,
+    bool bottommost) {
+  /* The candidate split points are the smallest keys of the SSTables. */
+  std::vector<std::string> bounds;
+  if (subcompaction_pool_ != nullptr) {
+    for (auto sst : ssts) {
+      bounds.emplace_back(sst->GetSmallestKey().user_key_);
+    }
+    if (run != nullptr) {
+      for (auto& sst : run->GetSSTs()) {
+        bounds.emplace_back(sst->GetSmallestKey().user_key_);
+      }
+    }
+    std::sort(bounds.begin(), bounds.end());
+    bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+  }
+  /* bounds[0] is the smallest key, which does not split the range. */
+  size_t num = std::min(options_.max_subcompactions, bounds.size());
+  if (num <= 1) {
+    return RunSubcompaction(ssts, run, std::nullopt, std::nullopt,
+        bloom_bits_per_key, codec, bottommost);
+  }
+  /* Subcompaction i merges the keys in [starts[i], starts[i + 1]). */
+  std::vector<std::optional<std::string>> starts(num + 1);
+  for (size_t i = 1; i < num; i++) {
+    starts[i] = std::move(bounds[i * bounds.size() / num]);
+  }
+  std::vector<std::vector<SSTInfo>> outputs(num);
+  RunTasks(subcompaction_pool_.get(), num, [&](size_t i) {
+    outputs[i] = RunSubcompaction(ssts, run, starts[i], starts[i + 1],
+        bloom_bits_per_key, codec, bottommost);
+  });
+  std::vector<SSTInfo> ret;
+  for (auto& output : outputs) {
+    ret.insert(ret.end(), output.begin(), output.end());
+  }
+  return ret;
+}
+
+std::vector<SSTInfo> DBImpl::RunSubcompaction(
+    const std::vector<SSTable*>& ssts, SortedRun* run,
+    const std::optional<std::string>& start,
+    const std::optional<std::string>& end, size_t bloom_bits_per_key,
+    BlockCodec codec, bool bottommost) {
+  constexpr seq_t kMaxSeq = std::numeric_limits<seq_t>::max();
+  auto overlaps = [&](ParsedKey smallest, ParsedKey largest) {
+    return !(start && largest.user_key_ < *start) &&
+           !(end && smallest.user_key_ >= *end);
+  };
+  /**
+   * The range tombstones of all the inputs are kept, even if the SSTables
+   * holding them are out of the key range, because the inputs are removed.
+   */
+  RangeTombstoneList tombstones;
+  for (auto sst : ssts) {
+    tombstones.Add(sst->GetRangeTombstones());
+  }
+  if (run != nullptr) {
+    for (auto& sst : run->GetSSTs()) {
+      tombstones.Add(sst->GetRangeTombstones());
+    }
+  }
+  LoserTree<Iterator> heap;
+  std::vector<std::unique_ptr<SSTableIterator>> iters;
+  for (auto sst : ssts) {
+    if (!overlaps(sst->GetSmallestKey(), sst->GetLargestKey())) {
+      continue;
+    }
+    iters.push_back(std::make_unique<SSTableIterator>(
+        start ? sst->Seek(*start, kMaxSeq, false) : sst->Begin(false)));
+    if (iters.back()->Valid()) {
+      heap.Push(iters.back().get());
+    }
+  }
+  std::unique_ptr<SortedRunIterator> run_iter;
+  if (run != nullptr &&
+      overlaps(run->GetSmallestKey(), run->GetLargestKey())) {
+    run_iter = std::make_unique<SortedRunIterator>(
+        start ? run->Seek(*start, kMaxSeq, false) : run->Begin(false));
+    if (run_iter->Valid()) {
+      heap.Push(run_iter.get());
+    }
+  }
+  CompactionJob worker(filename_gen_.get(), options_.block_size,
+      options_.sst_file_size, options_.write_buffer_size,
+      bloom_bits_per_key, options_.use_direct_io,
+      options_.block_restart_interval, options_.bloom_filter_format,
+      options_.range_filter_prefix_length, codec, blob_files_.get(),
+      GetSnapshotSeqs(), options_.merge_operator.get());
+  worker.SetLiveTombstones(GetSV()->GetVersion()->GetRangeTombstones());
+  worker.SetBottommost(bottommost);
+  heap.Build();
+  return worker.Run(heap, end, tombstones.Clip(start, end));
+}
+
+void DBImpl::RunTasks(ThreadPool* pool, size_t n,
+    const std::function<void(size_t)>& task) {
+  std::vector<std::future<void>> done;
+  for (size_t i = 0; i < n; i++) {
+    auto f = std::make_shared<std::packaged_task<void()>>(
+        [&task, i]() { task(i); });
+    done.push_back(f->get_future());
+    /* The calling thread runs the last one itself. */
+    if (pool != nullptr && i + 1 < n) {
+      pool->Push([f]() { (*f)(); });
+    } else {
+      (*f)();
+    }
+  }
+  /* Wait for all of them before rethrowing, since they refer to the stack. */
+  for (auto& f : done) {
+    f.wait();
+  }
+  for (auto& f : done) {
+    f.get();
   }
 }
 
@@ -621,53 +1525,281 @@ std::shared_ptr<SuperVersion> DBImpl::GetSV() {
   return new_sv;
 }
 
-void DBImpl::InstallSV(std::shared_ptr<SuperVersion> sv) {
-  std::unique_lock lck(sv_mutex_);
-  sv_ = std::move(sv);
+void DBImpl::InstallSV(std::shared_ptr<SuperVersion> sv, seq_t seq) {
+  write_pressure_.store(
+      WritePressure(*sv->GetVersion()), std::memory_order_relaxed);
+  auto base = GetSV()->GetVersion();
+  if (manifest_ && sv->GetVersion() != base) {
+    /* Record the edit before the removed SSTables and logs are deleted. */
+    if (manifest_->edit_count() >= options_.manifest_checkpoint_interval) {
+      CheckpointManifest(*sv->GetVersion(), seq);
+    } else {
+      manifest_->AddEdit(
+          base.get(), *sv->GetVersion(), seq, filename_gen_->GetID());
+    }
+  }
+  {
+    std::unique_lock lck(sv_mutex_);
+    sv_ = std::move(sv);
+  }
+  bg_work_cv_.notify_all();
 }
 
-DBIterator DBImpl::Begin() {
-  DBIterator it(GetSV(), seq_);
+DBIterator DBImpl::Begin(bool fill_cache, const Snapshot* snapshot) {
+  DBIterator it(GetSV(), ReadSeq(snapshot), fill_cache, blob_files_.get(),
+      options_.merge_operator.get());
   it.SeekToFirst();
   return it;
 }
 
-DBIterator DBImpl::Seek(Slice key) {
-  DBIterator it(GetSV(), seq_);
+DBIterator DBImpl::Seek(Slice key, bool fill_cache, const Snapshot* snapshot) {
+  DBIterator it(GetSV(), ReadSeq(snapshot), fill_cache, blob_files_.get(),
+      options_.merge_operator.get());
   it.Seek(key);
   return it;
 }
 
-void DBIterator::SeekToFirst() {
-  it_.SeekToFirst();
-  if (it_.Valid()) {
-    current_key_ = ParsedKey(it_.key());
-    if (current_key_.record_type() == RecordType::Deletion ||
-        current_key_.seq() > seq_) {
-      Next();
+DBIterator DBImpl::Seek(Slice lower, Slice upper, bool fill_cache,
+    const Snapshot* snapshot) {
+  return DBIterator(GetSV(), ReadSeq(snapshot), lower, upper, fill_cache,
+      blob_files_.get(), options_.merge_operator.get());
+}
+
+DBIterator DBImpl::Last(bool fill_cache, const Snapshot* snapshot) {
+  DBIterator it(GetSV(), ReadSeq(snapshot), fill_cache, blob_files_.get(),
+      options_.merge_operator.get());
+  it.SeekToLast();
+  return it;
+}
+
+DBIterator DBImpl::SeekForPrev(
+    Slice key, bool fill_cache, const Snapshot* snapshot) {
+  DBIterator it(GetSV(), ReadSeq(snapshot), fill_cache, blob_files_.get(),
+      options_.merge_operator.get());
+  it.SeekForPrev(key);
+  return it;
+}
+
+std::vector<DBIterator> DBImpl::PartitionScan(size_t n, Slice lower,
+    std::optional<Slice> upper, bool fill_cache, const Snapshot* snapshot) {
+  wing_assert(n > 0, "There must be at least one partition.");
+  auto sv = GetSV();
+  auto seq = ReadSeq(snapshot);
+  /* The largest user key and the size of each SSTable in the range. */
+  std::vector<std::pair<std::string, size_t>> ends;
+  size_t total_size = 0;
+  for (auto& level : sv->GetVersion()->GetLevels()) {
+    for (auto& run : level.GetRuns()) {
+      for (auto& sst : run->GetSSTs()) {
+        Slice largest = sst->GetLargestKey().user_key_;
+        if (largest < lower ||
+            (upper && sst->GetSmallestKey().user_key_ > *upper)) {
+          continue;
+        }
+        ends.emplace_back(largest, sst->GetSSTInfo().size_);
+        total_size += sst->GetSSTInfo().size_;
+      }
     }
   }
+  std::sort(ends.begin(), ends.end());
+  /* The inclusive upper bound of each partition except the last one. */
+  std::vector<std::string> splits;
+  size_t acc = 0;
+  for (auto& [key, size] : ends) {
+    acc += size;
+    if (splits.size() + 1 >= n) {
+      break;
+    }
+    if (acc * n < total_size * (splits.size() + 1) ||
+        (upper && key >= *upper) ||
+        (!splits.empty() && key <= splits.back())) {
+      continue;
+    }
+    splits.push_back(key);
+  }
+  /* The iterators point into themselves, so they are never relocated. */
+  std::vector<DBIterator> its;
+  its.reserve(splits.size() + 1);
+  std::string begin(lower);
+  for (auto& split : splits) {
+    its.emplace_back(sv, seq, begin, split, fill_cache, blob_files_.get(),
+        options_.merge_operator.get());
+    /* The smallest user key after split. */
+    begin = split + std::string(1, '\0');
+  }
+  if (upper) {
+    its.emplace_back(sv, seq, begin, *upper, fill_cache, blob_files_.get(),
+        options_.merge_operator.get());
+  } else {
+    its.emplace_back(sv, seq, fill_cache, blob_files_.get(),
+        options_.merge_operator.get());
+    its.back().Seek(begin);
+  }
+  return its;
+}
+
+DBIterator::DBIterator(std::shared_ptr<SuperVersion> sv, seq_t seq,
+    Slice lower, Slice upper, bool fill_cache, BlobFileSet* blob_files,
+    const MergeOperator* merge_operator)
+  : sv_(std::move(sv)),
+    it_(sv_.get(), lower, upper, seq, fill_cache),
+    seq_(seq),
+    upper_(upper),
+    lower_(lower),
+    blob_files_(blob_files),
+    merge_operator_(merge_operator) {
+  SkipInvisible();
+}
+
+void DBIterator::SeekToFirst() {
+  reverse_ = false;
+  it_.SeekToFirst();
+  SkipInvisible();
 }
 
 void DBIterator::Seek(Slice key) {
+  reverse_ = false;
   it_.Seek(key, seq_);
+  SkipInvisible();
+}
+
+void DBIterator::SeekToLast() {
+  reverse_ = true;
+  if (upper_) {
+    /* (upper, 0) is after all the records of upper. */
+    it_.SeekForPrev(*upper_, 0);
+  } else {
+    it_.SeekToLast();
+  }
+  FindPrevUserEntry();
+}
+
+void DBIterator::SeekForPrev(Slice key) {
+  if (upper_ && *upper_ < key) {
+    SeekToLast();
+    return;
+  }
+  reverse_ = true;
+  it_.SeekForPrev(key, 0);
+  FindPrevUserEntry();
+}
+
+void DBIterator::FindPrevUserEntry() {
+  blob_value_.reset();
+  reverse_valid_ = false;
+  while (it_.Valid()) {
+    ParsedKey key(it_.key());
+    /* The records before lower may be incomplete. */
+    if (lower_ && key.user_key_ < *lower_) {
+      break;
+    }
+    if (key.seq_ <= seq_) {
+      if (reverse_valid_ && key.user_key_ < current_key_.user_key()) {
+        break;
+      }
+      /* If it is still valid, saved_value_ is an older value of the key. */
+      bool has_base = reverse_valid_;
+      auto base_type = current_key_.record_type();
+      current_key_ = key;
+      reverse_valid_ =
+          key.type_ != RecordType::Deletion && !IsCovered();
+      if (reverse_valid_ && key.type_ == RecordType::Merge && has_base) {
+        wing_assert(merge_operator_ != nullptr, "No merge operator");
+        std::string base;
+        if (base_type == RecordType::BlobIndex) {
+          blob_files_->Read(saved_value_, &base);
+        } else {
+          base.swap(saved_value_);
+        }
+        merge_operator_->Merge(base, it_.value(), &saved_value_);
+      } else if (reverse_valid_) {
+        saved_value_ = it_.value();
+      }
+    }
+    it_.Prev();
+  }
+}
+
+void DBIterator::SkipInvisible() {
+  blob_value_.reset();
   if (it_.Valid()) {
     current_key_ = ParsedKey(it_.key());
     if (current_key_.record_type() == RecordType::Deletion ||
-        current_key_.seq() > seq_) {
+        current_key_.seq() > seq_ || IsCovered()) {
       Next();
+    } else if (current_key_.record_type() == RecordType::Merge) {
+      FoldOperands();
     }
   }
 }
 
-bool DBIterator::Valid() { return it_.Valid(); }
+void DBIterator::FoldOperands() {
+  wing_assert(merge_operator_ != nullptr, "No merge operator");
+  /* The operands from the newest to the oldest, and the value before them. */
+  std::vector<std::string> operands;
+  std::optional<std::string> base;
+  for (; it_.Valid(); it_.Next()) {
+    ParsedKey key(it_.key());
+    if (key.user_key_ != current_key_.user_key() ||
+        key.type_ == RecordType::Deletion ||
+        it_.GetRangeTombstones().Covers(key, seq_)) {
+      break;
+    }
+    if (key.type_ == RecordType::Merge) {
+      operands.emplace_back(it_.value());
+      continue;
+    }
+    if (key.type_ == RecordType::BlobIndex) {
+      wing_assert(blob_files_ != nullptr, "No blob files to read the value");
+      blob_files_->Read(it_.value(), &base.emplace());
+    } else {
+      base.emplace(it_.value());
+    }
+    break;
+  }
+  merge_operator_->FullMerge(base ? &*base : nullptr, operands, &saved_value_);
+  it_.Seek(current_key_.user_key(), current_key_.seq());
+}
+
+bool DBIterator::IsCovered() const {
+  return it_.GetRangeTombstones().Covers(ParsedKey(current_key_), seq_);
+}
+
+bool DBIterator::Valid() {
+  if (reverse_) {
+    return reverse_valid_;
+  }
+  return it_.Valid() && (!upper_ || current_key_.user_key() <= *upper_);
+}
 
 Slice DBIterator::key() const { return current_key_.user_key(); }
 
-Slice DBIterator::value() const { return it_.value(); }
+Slice DBIterator::value() const {
+  Slice value = reverse_ || current_key_.record_type() == RecordType::Merge
+                    ? Slice(saved_value_)
+                    : it_.value();
+  if (current_key_.record_type() != RecordType::BlobIndex) {
+    return value;
+  }
+  if (!blob_value_) {
+    wing_assert(blob_files_ != nullptr, "No blob files to read the value");
+    blob_files_->Read(value, &blob_value_.emplace());
+  }
+  return *blob_value_;
+}
 
 void DBIterator::Next() {
-  it_.Next();
+  blob_value_.reset();
+  if (reverse_) {
+    /**
+     * it_ is before the records of the current user key. Move to them, and
+     * they are skipped below.
+     */
+    reverse_ = false;
+    it_.Seek(current_key_.user_key(), seq_);
+  } else {
+    it_.Next();
+  }
   while (true) {
     while (it_.Valid() && (seq_ < ParsedKey(it_.key()).seq_ ||
                               (current_key_.seq() <= seq_ &&
@@ -677,15 +1809,35 @@ void DBIterator::Next() {
     }
     if (it_.Valid()) {
       current_key_ = ParsedKey(it_.key());
-      if (current_key_.record_type() == RecordType::Deletion) {
+      /* The records after upper may be incomplete. */
+      if (upper_ && current_key_.user_key() > *upper_) {
+        break;
+      }
+      if (current_key_.record_type() == RecordType::Deletion ||
+          IsCovered()) {
         it_.Next();
         continue;
       }
+      if (current_key_.record_type() == RecordType::Merge) {
+        FoldOperands();
+      }
     }
     break;
   }
 }
 
+void DBIterator::Prev() {
+  if (!reverse_) {
+    /* Move it_ before the records of the current user key. */
+    reverse_ = true;
+    do {
+      it_.Prev();
+    } while (it_.Valid() &&
+             ParsedKey(it_.key()).user_key_ == current_key_.user_key());
+  }
+  FindPrevUserEntry();
+}
+
 }  // namespace lsm
 
 }  // namespace wing
@@ -1,22 +1,32 @@
 #pragma once
 
+#include <atomic>
 #include <cassert>
 #include <condition_variable>
 #include <deque>
+#include <functional>
 #include <limits>
+#include <list>
 #include <map>
 #include <mutex>
+#include <optional>
 #include <set>
 #include <shared_mutex>
 #include <thread>
 #include <utility>
 #include <variant>
 
+#include "common/threadpool.hpp"
+#include "storage/lsm/blob.hpp"
 #include "storage/lsm/cache.hpp"
 #include "storage/lsm/compaction_pick.hpp"
+#include "storage/lsm/manifest.hpp"
 #include "storage/lsm/memtable.hpp"
 #include "storage/lsm/options.hpp"
+#include "storage/lsm/table_cache.hpp"
 #include "storage/lsm/version.hpp"
+#include "storage/lsm/wal.hpp"
+#include "storage/lsm/write_batch.hpp"
 
 namespace wing {
 
@@ -24,6 +34,21 @@ namespace lsm {
 
 class DBIterator;
 
+/**
+ * A consistent view of the database at a sequence number, which is created
+ * by DBImpl::GetSnapshot. Compactions keep the records it sees until it is
+ * released by DBImpl::ReleaseSnapshot. Snapshots are not persisted.
+ */
+class Snapshot {
+ public:
+  explicit Snapshot(seq_t seq) : seq_(seq) {}
+
+  seq_t GetSeq() const { return seq_; }
+
+ private:
+  seq_t seq_;
+};
+
 class DBImpl {
  public:
   DBImpl(const Options &options);
@@ -35,60 +60,349 @@ class DBImpl {
 
   void Put(Slice key, Slice value);
   void Del(Slice key);
+  /**
+   * Merge the operand into the value of key with Options::merge_operator,
+   * without reading it. The operand is folded when the key is read, and by
+   * the flushes and compactions.
+   */
+  void Merge(Slice key, Slice operand);
+  /**
+   * Delete the keys in [begin, end) with one range tombstone, which is
+   * written in O(1) no matter how many keys it covers. The covered records
+   * are dropped by compactions.
+   */
+  void DeleteRange(Slice begin, Slice end);
+  /**
+   * Apply all the records in the batch atomically. They get consecutive
+   * sequence numbers, and readers see either all of them or none of them.
+   */
+  void Write(const WriteBatch &batch);
+  /**
+   * Bulk load the records returned by next, which sets the key and the value
+   * of the next record and returns true, or returns false at the end. The
+   * keys must be in strictly ascending order, and the slices must stay valid
+   * until the next call.
+   *
+   * The records get one sequence number. They are written to SSTables by the
+   * flush workers, and the SSTables are installed by one new version into
+   * the deepest level such that no level above it overlaps them. So they
+   * skip the WAL, the MemTable and the compactions of the upper levels. If
+   * the key range overlaps the MemTables, the records are inserted into the
+   * MemTable and the WAL instead, and it returns false. The other writes
+   * wait until it returns, and the records are visible to the reads and the
+   * snapshots after that.
+   */
+  bool Ingest(const std::function<bool(Slice *, Slice *)> &next);
   // Return true if kFound, false if not
-  bool Get(Slice key, std::string *value);
+  // If snapshot is not nullptr, it reads the value seen by the snapshot.
+  bool Get(Slice key, std::string *value,
+      const Snapshot *snapshot = nullptr);
+  /**
+   * Get a batch of keys from the same snapshot. (*values)[i] is the value of
+   * keys[i] if the i-th returned flag is true. The data blocks needed by the
+   * keys are read in one batch for each level, so the reads overlap.
+   * If snapshot is nullptr, it reads the latest state.
+   */
+  std::vector<bool> MultiGet(std::span<const Slice> keys,
+      std::vector<std::string> *values, const Snapshot *snapshot = nullptr);
+  /**
+   * Pin the current sequence number. The reads given the snapshot see the
+   * records written before it, even after they are overwritten or deleted
+   * and compacted. It must be released by ReleaseSnapshot.
+   */
+  const Snapshot *GetSnapshot();
+  void ReleaseSnapshot(const Snapshot *snapshot);
   void Save();
   void FlushAll();
   void WaitForFlushAndCompaction();
-  size_t CurrentSeq() const { return seq_; }
+  size_t CurrentSeq() const { return seq_.load(std::memory_order_acquire); }
   /* Delete all things */
   void DropAll();
 
-  DBIterator Begin();
-  DBIterator Seek(Slice key);
+  /**
+   * If fill_cache is false, the data blocks read by the iterator are not
+   * inserted into the block cache, so a long scan does not evict the blocks
+   * used by point lookups.
+   * If snapshot is nullptr, the iterator reads the state when it is created.
+   */
+  DBIterator Begin(
+      bool fill_cache = true, const Snapshot *snapshot = nullptr);
+  DBIterator Seek(
+      Slice key, bool fill_cache = true, const Snapshot *snapshot = nullptr);
+  /**
+   * Return an iterator over the user keys in [lower, upper]. It is invalid
+   * after upper. The SSTables and sorted runs whose key ranges or range
+   * filters rule out the range are not read, so a short range scan does not
+   * pay for a seek in every sorted run.
+   */
+  DBIterator Seek(Slice lower, Slice upper, bool fill_cache = true,
+      const Snapshot *snapshot = nullptr);
+  /**
+   * Return an iterator positioned at the last user key, or the last one
+   * <= key, which is moved backward by Prev.
+   */
+  DBIterator Last(
+      bool fill_cache = true, const Snapshot *snapshot = nullptr);
+  DBIterator SeekForPrev(
+      Slice key, bool fill_cache = true, const Snapshot *snapshot = nullptr);
+  /**
+   * Split the user keys in [lower, upper] into at most n partitions of about
+   * the same size, and return an iterator over each of them, in key order.
+   * If upper is std::nullopt, the last partition has no upper bound. The
+   * split keys are the largest keys of the SSTables, picked by their sizes,
+   * so the records in the MemTables are not considered. All the iterators
+   * read the same SuperVersion and sequence number, so together they see one
+   * consistent state. They are independent, and can be used by different
+   * threads.
+   */
+  std::vector<DBIterator> PartitionScan(size_t n, Slice lower = "",
+      std::optional<Slice> upper = std::nullopt, bool fill_cache = true,
+      const Snapshot *snapshot = nullptr);
   std::shared_ptr<SuperVersion> GetSV();
   const Options &GetOptions() const { return options_; }
 
  private:
+  /* A write waiting in the writer queue. */
+  struct Writer {
+    /* The record. Its sequence number is assigned by the leader. */
+    ParsedKey key_;
+    Slice value_;
+    /**
+     * If it is not nullptr, the writer writes the batch instead of the record,
+     * and key_.seq_ is the sequence number of the first record in the batch.
+     */
+    const WriteBatch *batch_{nullptr};
+    /**
+     * A barrier carries no record. The writers behind it wait until its owner
+     * leaves the queue, e.g. FlushAll and DropAll switch the MemTable.
+     */
+    bool barrier_{false};
+    /* Whether the record has been written by a leader. */
+    bool done_{false};
+    /**
+     * Set by the leader if the MemTable allows concurrent inserts. The writer
+     * inserts its own record into it, and decrements pending_ of leader_.
+     */
+    MemTable *mt_{nullptr};
+    Writer *leader_{nullptr};
+    /* The number of writers in the group which are still inserting. */
+    size_t pending_{0};
+    std::condition_variable cv_;
+  };
+
+  /**
+   * Append a write to the writer queue. The writer at the front of the queue
+   * is the leader. It writes the records of all the writers queued behind it
+   * to the WAL using one write (and one sync if sync_wal is set), and inserts
+   * them into the MemTable. If the MemTable allows concurrent inserts, each
+   * writer of the group inserts its own record in parallel instead.
+   */
+  void WriteImpl(Writer *w);
+  /**
+   * Wait until w is at the front of the writer queue.
+   * Return false if it has been written by another leader.
+   */
+  bool WaitForLeader(Writer *w);
+  /**
+   * The body of Ingest, which runs at the front of the writer queue. The
+   * SSTables are rebuilt if the level they are installed into uses other
+   * bloom filter bits or another codec than the level they are built for.
+   */
+  bool IngestImpl(const std::function<bool(Slice *, Slice *)> &next);
+  /* Insert the record of w into the MemTable. */
+  static void InsertInto(MemTable *mt, const Writer &w);
+  /* Insert a record written by users, e.g. replayed from the WAL. */
+  static void InsertInto(MemTable *mt, ParsedKey key, Slice value);
+  std::shared_ptr<MemTable> NewMemTable() const {
+    return std::make_shared<MemTable>(options_.use_skiplist_memtable);
+  }
+  /* Pop the first n writers of the queue and wake up the next leader. */
+  void FinishWriters(size_t n);
+  /* Create a new log for the MemTable. Require: at the front of the queue */
+  void NewLog(MemTable *mt);
+  /* Remove the log of the MemTable. */
+  void RemoveLog(const MemTable &mt);
+  /* Replay the logs left by the last run into the current MemTable. */
+  void RecoverLogs();
+
   void SwitchMemtable(bool force = false);
   void FlushThread();
   void CompactionThread();
+  /**
+   * Merge the SSTables and the sorted run (if it is not nullptr) of a
+   * compaction, and return the output SSTables in key order. The key range
+   * is split at the smallest keys of the input SSTables into at most
+   * max_subcompactions subranges, which are merged in parallel. The bloom
+   * filters of the outputs have bloom_bits_per_key bits per key, which
+   * depends on the target level (see lsm/bloom_policy.hpp), and their data
+   * blocks are compressed by codec. If bottommost, the range tombstones
+   * older than every snapshot are dropped (see IsBottommost).
+   */
+  std::vector<SSTInfo> RunCompaction(const std::vector<SSTable *> &ssts,
+      SortedRun *run, size_t bloom_bits_per_key, BlockCodec codec,
+      bool bottommost);
+  /**
+   * Whether a compaction of the SSTables and the sorted run (if it is not
+   * nullptr) into target_level writes the last level of version, and no
+   * other SSTable overlaps the range tombstones of the inputs. Then the
+   * records covered by the tombstones are all in the inputs.
+   */
+  static bool IsBottommost(const Version &version,
+      const std::vector<SSTable *> &ssts, SortedRun *run,
+      size_t target_level);
+  /**
+   * Run task(0), ..., task(n - 1) on the pool and the calling thread, and
+   * wait for all of them. If the pool is nullptr, they run one by one.
+   */
+  static void RunTasks(ThreadPool *pool, size_t n,
+      const std::function<void(size_t)> &task);
+  /* Merge the records whose user keys are in [start, end). */
+  std::vector<SSTInfo> RunSubcompaction(const std::vector<SSTable *> &ssts,
+      SortedRun *run, const std::optional<std::string> &start,
+      const std::optional<std::string> &end, size_t bloom_bits_per_key,
+      BlockCodec codec, bool bottommost);
   std::vector<std::shared_ptr<MemTable>> PickMemTables();
-  void InstallSV(std::shared_ptr<SuperVersion> sv);
+  /* The sequence numbers of the live snapshots in ascending order. */
+  std::vector<seq_t> GetSnapshotSeqs();
+  /* The sequence number read by snapshot, or the latest one if nullptr. */
+  seq_t ReadSeq(const Snapshot *snapshot) const {
+    return snapshot ? snapshot->GetSeq()
+                    : seq_.load(std::memory_order_acquire);
+  }
+  /**
+   * Get the value of key whose latest record is a merge operand, by folding
+   * the records of key with a DBIterator.
+   */
+  bool GetMerged(std::shared_ptr<SuperVersion> sv, seq_t seq, Slice key,
+      std::string *value);
+  /**
+   * Install a new SuperVersion. If its version is new, the edit from the
+   * old version is appended to the manifest with the sequence number seq,
+   * which is seq_ if not given. Require: db_mutex_ is held.
+   */
+  void InstallSV(std::shared_ptr<SuperVersion> sv) {
+    InstallSV(std::move(sv), seq_.load());
+  }
+  void InstallSV(std::shared_ptr<SuperVersion> sv, seq_t seq);
+  /**
+   * Replace the manifest with a checkpoint of the version at the sequence
+   * number seq.
+   * Require: db_mutex_ is held, or no background threads are running.
+   */
+  void CheckpointManifest(const Version &version, seq_t seq);
   void SaveMetadata();
   void LoadMetadata();
 
-  // Require: DB Mutex held
-  void StopWrite();
+  /**
+   * How close the version is to stopping writes, in [0, 1]. It is
+   * determined by the number of sorted runs in Level 0 and the estimated
+   * pending compaction bytes. Writes are delayed if it is positive, and
+   * stopped if it is 1.
+   */
+  double WritePressure(const Version &version) const;
+  /**
+   * Called by the leader before writing a group of records of the given size.
+   * It waits while writes are stopped, and sleeps as long as writing the
+   * bytes takes at the delayed write rate if writes are delayed.
+   */
+  void DelayWrite(size_t bytes);
 
   Options options_;
   Cache cache_;
-  size_t seq_;
+  /* It is destroyed after the SSTables, and before the block cache. */
+  TableCache table_cache_;
+  /**
+   * The sequence number of the last visible record. The leader of the
+   * writers stores it with release after the records are inserted, and the
+   * readers load it with acquire.
+   */
+  std::atomic<seq_t> seq_;
 
   std::vector<std::thread> threads_;
   std::condition_variable flush_cv_;
   std::condition_variable compact_cv_;
   bool stop_signal_{false};
-  bool compact_flag_{false};
+  /* The number of compactions which are running, protected by db_mutex_. */
+  size_t running_compactions_{0};
   bool flush_flag_{false};
 
   std::mutex write_mutex_;
+  /* The writer queue, protected by write_mutex_ */
+  std::deque<Writer *> writers_;
+  /* The log of the current MemTable */
+  std::unique_ptr<LogWriter> log_;
+  /* The latest log number. 0 means that a MemTable does not have a log. */
+  size_t log_number_{0};
   std::mutex db_mutex_;
+  /**
+   * Signalled with db_mutex_ when the background threads make progress: a
+   * new SuperVersion is installed, or a background thread becomes idle.
+   */
+  std::condition_variable bg_work_cv_;
+  /**
+   * Whether a compaction may be pickable. It is set when a version is
+   * installed and cleared when a compaction thread finds nothing to pick.
+   * Protected by db_mutex_.
+   */
+  bool compaction_scheduled_{true};
+  /* The write pressure of the current version. */
+  std::atomic<double> write_pressure_{0};
+  std::mutex snapshot_mutex_;
+  /**
+   * The live snapshots, protected by snapshot_mutex_. They are in ascending
+   * order of sequence numbers, since they are appended in order.
+   */
+  std::list<Snapshot> snapshots_;
   std::shared_mutex sv_mutex_;
   std::shared_ptr<SuperVersion> sv_;
   std::unique_ptr<FileNameGenerator> filename_gen_;
+  /* The manifest recording the versions, protected by db_mutex_. */
+  std::unique_ptr<ManifestWriter> manifest_;
+  /* The blob files. It is created before the SSTables are loaded. */
+  std::unique_ptr<BlobFileSet> blob_files_;
   std::unique_ptr<CompactionPicker> compaction_picker_;
+  /* The workers of subcompactions. It is nullptr if they are disabled. */
+  std::unique_ptr<ThreadPool> subcompaction_pool_;
+  /* The workers flushing MemTables. It is nullptr if there is only one. */
+  std::unique_ptr<ThreadPool> flush_pool_;
 };
 
 class DBIterator final : public Iterator {
  public:
-  DBIterator(std::shared_ptr<SuperVersion> sv, seq_t seq)
-    : sv_(std::move(sv)), it_(sv_.get()), seq_(seq) {}
+  /**
+   * blob_files: The blob files which the values of type RecordType::BlobIndex
+   * are read from. It can be nullptr if there are no such values.
+   * merge_operator: The operator folding the records of type
+   * RecordType::Merge. It can be nullptr if there are no such records.
+   */
+  DBIterator(std::shared_ptr<SuperVersion> sv, seq_t seq,
+      bool fill_cache = true, BlobFileSet *blob_files = nullptr,
+      const MergeOperator *merge_operator = nullptr)
+    : sv_(std::move(sv)),
+      it_(sv_.get(), fill_cache),
+      seq_(seq),
+      blob_files_(blob_files),
+      merge_operator_(merge_operator) {}
+
+  /**
+   * An iterator over the user keys in [lower, upper], which is positioned at
+   * the first one. It is invalid after upper and before lower, and Seek and
+   * SeekForPrev only accept keys in the range.
+   */
+  DBIterator(std::shared_ptr<SuperVersion> sv, seq_t seq, Slice lower,
+      Slice upper, bool fill_cache = true, BlobFileSet *blob_files = nullptr,
+      const MergeOperator *merge_operator = nullptr);
 
   void SeekToFirst();
 
   void Seek(Slice key);
 
+  /* Move to the last user key. */
+  void SeekToLast();
+
+  /* Move to the last user key <= key. */
+  void SeekForPrev(Slice key);
+
   bool Valid() override;
 
   Slice key() const override;
@@ -97,11 +411,48 @@ class DBIterator final : public Iterator {
 
   void Next() override;
 
+  void Prev() override;
+
  private:
+  /* Skip the current record if it is deleted or invisible. */
+  void SkipInvisible();
+  /**
+   * Move backward to the latest visible record of the previous user key
+   * which is not deleted. The older records of a user key are met first, so
+   * it stops at the record before them.
+   */
+  void FindPrevUserEntry();
+  /**
+   * Fold the current record, which is a merge operand, with the older records
+   * of its user key into saved_value_. it_ is moved back to the current
+   * record after reading them.
+   */
+  void FoldOperands();
+  /* Whether the current record is deleted by a range tombstone. */
+  bool IsCovered() const;
+
   std::shared_ptr<SuperVersion> sv_;
   SuperVersionIterator it_;
   seq_t seq_;
   InternalKey current_key_;
+  /* The largest user key of the iterator. There is no bound if it is empty. */
+  std::optional<std::string> upper_;
+  /* The smallest user key of the iterator. */
+  std::optional<std::string> lower_;
+  /**
+   * Whether it moves backward. If so, it_ is positioned before the records
+   * of the current user key, so the value is copied to saved_value_, and
+   * reverse_valid_ tells whether there is a current user key.
+   * saved_value_ is also the folded value if the current record is a merge
+   * operand.
+   */
+  bool reverse_{false};
+  bool reverse_valid_{false};
+  std::string saved_value_;
+  BlobFileSet *blob_files_{nullptr};
+  const MergeOperator *merge_operator_{nullptr};
+  /* The value of the current record if it is read from a blob file. */
+  mutable std::optional<std::string> blob_value_;
 };
 
 }  // namespace lsm
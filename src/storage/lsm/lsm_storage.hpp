@@ -1,10 +1,33 @@
 #pragma once
 
+#include <cstring>
+#include <unordered_set>
+
 #include "storage/lsm/lsm.hpp"
 #include "storage/storage.hpp"
 
 namespace wing {
 
+/**
+ * The merge operator of the tables, see ModifyHandle::Merge. The counter at
+ * the beginning of the operand is added to that of the existing value.
+ */
+class CounterMergeOperator : public lsm::MergeOperator {
+ public:
+  void Merge(lsm::Slice existing, lsm::Slice operand,
+      std::string* result) const override {
+    wing_assert(existing.size() >= sizeof(int64_t) &&
+                    operand.size() >= sizeof(int64_t),
+        "The values to merge do not start with a counter");
+    int64_t count, delta;
+    std::memcpy(&count, existing.data(), sizeof(count));
+    std::memcpy(&delta, operand.data(), sizeof(delta));
+    count += delta;
+    result->assign(existing);
+    std::memcpy(result->data(), &count, sizeof(count));
+  }
+};
+
 class LSMStorage : public Storage {
  public:
   static std::unique_ptr<Storage> Open(std::filesystem::path&& path,
@@ -27,7 +50,7 @@ class LSMStorage : public Storage {
     db->schema_ = std::get<0>(db_schema_result);
     for (uint32_t i = 0; i < db->schema_.GetTables().size(); i++) {
       auto name = db->schema_.GetTables()[i].GetName();
-      lsm::Options options0 = options;
+      lsm::Options options0 = db->options_;
       options0.create_new = false;
       options0.db_path = fmt::format("{}/tables/t'{}'", path.string(), name);
       auto lsm = std::make_unique<lsm::DBImpl>(options0);
@@ -88,6 +111,31 @@ class LSMStorage : public Storage {
       table_.lsm_->Put(key, new_value);
       return true;
     }
+    /**
+     * The pairs are written by one lsm::WriteBatch. Nothing is inserted if a
+     * key exists in the table or appears twice in the batch.
+     */
+    bool InsertBatch(const std::vector<std::pair<std::string_view,
+            std::string_view>>& kvs) override {
+      std::unordered_set<std::string_view> keys;
+      lsm::WriteBatch batch;
+      std::string v0;
+      for (auto& [key, value] : kvs) {
+        if (!keys.insert(key).second || table_.lsm_->Get(key, &v0)) {
+          return false;
+        }
+        batch.Put(key, value);
+      }
+      table_.lsm_->Write(batch);
+      table_.tick_ += kvs.size();
+      return true;
+    }
+    bool SupportsMerge() const override { return true; }
+    /* A blind write of a merge operand, see CounterMergeOperator. */
+    bool Merge(std::string_view key, std::string_view operand) override {
+      table_.lsm_->Merge(key, operand);
+      return true;
+    }
 
    private:
     Table& table_;
@@ -104,17 +152,27 @@ class LSMStorage : public Storage {
       }
       return reinterpret_cast<const uint8_t*>(value_.data());
     }
+    /* The keys are looked up by one lsm::DBImpl::MultiGet. */
+    void MultiSearch(std::span<const std::string_view> keys,
+        const std::function<void(size_t, const uint8_t*)>& f) override {
+      auto found = lsm_->MultiGet(keys, &values_);
+      for (size_t i = 0; i < keys.size(); i++) {
+        f(i, found[i] ? reinterpret_cast<const uint8_t*>(values_[i].data())
+                      : nullptr);
+      }
+    }
 
    private:
     lsm::DBImpl* lsm_;
     std::string value_;
+    std::vector<std::string> values_;
   };
 
   class LSMIterator : public wing::Iterator<const uint8_t*> {
    public:
     LSMIterator(lsm::DBImpl* lsm, std::tuple<std::string_view, bool, bool> L,
         std::tuple<std::string_view, bool, bool> R)
-      : it_(std::get<1>(L) ? lsm->Begin() : lsm->Seek(std::get<0>(L))) {
+      : it_(Seek(lsm, L, R)) {
       if (!std::get<1>(L) && !std::get<2>(L) && it_.Valid() &&
           it_.key() == std::get<0>(L)) {
         it_.Next();
@@ -122,6 +180,9 @@ class LSMStorage : public Storage {
       first_flag_ = true;
       R_ = R;
     }
+    /* Iterate over it until it is invalid. */
+    LSMIterator(lsm::DBIterator it)
+      : it_(std::move(it)), R_("", true, false) {}
     void Init() override {}
     const uint8_t* Next() override {
       if (first_flag_) {
@@ -140,11 +201,81 @@ class LSMStorage : public Storage {
     }
 
    private:
+    /**
+     * A range scan may be long. Do not let it evict the cached blocks.
+     * If it has an upper bound, the sorted runs without keys in the range
+     * are skipped.
+     */
+    static lsm::DBIterator Seek(lsm::DBImpl* lsm,
+        std::tuple<std::string_view, bool, bool> L,
+        std::tuple<std::string_view, bool, bool> R) {
+      if (!std::get<1>(R)) {
+        return lsm->Seek(
+            std::get<1>(L) ? "" : std::get<0>(L), std::get<0>(R), false);
+      }
+      return std::get<1>(L) ? lsm->Begin(false)
+                            : lsm->Seek(std::get<0>(L), false);
+    }
+
     bool first_flag_{true};
     lsm::DBIterator it_;
     std::tuple<std::string, bool, bool> R_;
   };
 
+  /**
+   * Iterate over the same interval as LSMIterator, but in descending order.
+   * It starts from the upper bound and moves backward, so reading the last
+   * n keys of an interval costs about n records instead of the whole scan.
+   */
+  class LSMReverseIterator : public wing::Iterator<const uint8_t*> {
+   public:
+    LSMReverseIterator(lsm::DBImpl* lsm,
+        std::tuple<std::string_view, bool, bool> L,
+        std::tuple<std::string_view, bool, bool> R)
+      : it_(SeekForPrev(lsm, L, R)) {
+      if (!std::get<1>(R) && !std::get<2>(R) && it_.Valid() &&
+          it_.key() == std::get<0>(R)) {
+        it_.Prev();
+      }
+      first_flag_ = true;
+      L_ = L;
+    }
+    void Init() override {}
+    const uint8_t* Next() override {
+      if (first_flag_) {
+        first_flag_ = false;
+      } else {
+        if (it_.Valid())
+          it_.Prev();
+      }
+      if (!it_.Valid() ||
+          (!std::get<1>(L_) &&
+              (std::get<2>(L_) ? it_.key() < std::get<0>(L_)
+                               : it_.key() <= std::get<0>(L_)))) {
+        return nullptr;
+      }
+      return reinterpret_cast<const uint8_t*>(it_.value().data());
+    }
+
+   private:
+    /* See LSMIterator::Seek. */
+    static lsm::DBIterator SeekForPrev(lsm::DBImpl* lsm,
+        std::tuple<std::string_view, bool, bool> L,
+        std::tuple<std::string_view, bool, bool> R) {
+      if (!std::get<1>(R)) {
+        auto it = lsm->Seek(
+            std::get<1>(L) ? "" : std::get<0>(L), std::get<0>(R), false);
+        it.SeekToLast();
+        return it;
+      }
+      return lsm->Last(false);
+    }
+
+    bool first_flag_{true};
+    lsm::DBIterator it_;
+    std::tuple<std::string, bool, bool> L_;
+  };
+
   void Create(const TableSchema& schema) override {
     auto table_name = schema.GetName();
     lsm::Options option = options_;
@@ -187,6 +318,57 @@ class LSMStorage : public Storage {
     return std::make_unique<LSMIterator>(GetTable(table_name).lsm_.get(), L, R);
   }
 
+  /**
+   * Split the table into at most n key ranges of about the same size, and
+   * return an iterator over each of them, in key order (see
+   * lsm::DBImpl::PartitionScan). They read the same state of the table, and
+   * can be used by different threads, e.g. to run a sequential scan on every
+   * core.
+   */
+  std::vector<std::unique_ptr<Iterator<const uint8_t*>>>
+  GetPartitionedIterators(std::string_view table_name, size_t n) {
+    std::vector<std::unique_ptr<Iterator<const uint8_t*>>> ret;
+    /* A partition may be long. Do not let it evict the cached blocks. */
+    auto its = GetTable(table_name).lsm_->PartitionScan(
+        n, "", std::nullopt, false);
+    for (auto& it : its) {
+      ret.push_back(std::make_unique<LSMIterator>(std::move(it)));
+    }
+    return ret;
+  }
+
+  /**
+   * Load the rows returned by next in ascending order of the keys, e.g. to
+   * build a table from sorted data. The SSTables are written directly (see
+   * lsm::DBImpl::Ingest). The rows replace the existing rows with the same
+   * keys. Return the number of rows.
+   */
+  size_t BulkLoad(std::string_view table_name,
+      const std::function<bool(std::string_view*, std::string_view*)>& next) {
+    auto& table = GetTable(table_name);
+    size_t count = 0;
+    table.lsm_->Ingest([&](lsm::Slice* key, lsm::Slice* value) {
+      if (!next(key, value)) {
+        return false;
+      }
+      count += 1;
+      return true;
+    });
+    table.tick_ += count;
+    return count;
+  }
+
+  /**
+   * The same as GetRangeIterator, but the keys are returned in descending
+   * order, e.g. for ORDER BY the key DESC with a LIMIT.
+   */
+  std::unique_ptr<Iterator<const uint8_t*>> GetReverseRangeIterator(
+      std::string_view table_name, std::tuple<std::string_view, bool, bool> L,
+      std::tuple<std::string_view, bool, bool> R) {
+    return std::make_unique<LSMReverseIterator>(
+        GetTable(table_name).lsm_.get(), L, R);
+  }
+
   std::unique_ptr<ModifyHandle> GetModifyHandle(
       std::unique_ptr<TxnExecCtx> ctx) override {
     return std::make_unique<LSMModifyHandle>(GetTable(ctx->table_name_));
@@ -202,6 +384,9 @@ class LSMStorage : public Storage {
   LSMStorage(const std::filesystem::path& path, const lsm::Options& options) {
     db_path_ = path.string();
     options_ = options;
+    if (!options_.merge_operator) {
+      options_.merge_operator = std::make_shared<CounterMergeOperator>();
+    }
   }
   Table& GetTable(std::string_view table_name) {
     auto it = tables_.find(table_name);
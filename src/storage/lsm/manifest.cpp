@@ -0,0 +1,189 @@
+#include "storage/lsm/manifest.hpp"
+
+#include <cstring>
+#include <map>
+#include <tuple>
+
+#include "common/exception.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+namespace {
+
+/* The kinds of the segments of a sorted run. */
+constexpr uint8_t kOldSegment = 0;
+constexpr uint8_t kNewSSTable = 1;
+
+template <typename T>
+void Append(std::string* rep, T value) {
+  rep->append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+class EditReader {
+ public:
+  EditReader(Slice rep) : ptr_(rep.data()), end_(rep.data() + rep.size()) {}
+
+  template <typename T>
+  T Read() {
+    Check(sizeof(T));
+    T value;
+    memcpy(&value, ptr_, sizeof(T));
+    ptr_ += sizeof(T);
+    return value;
+  }
+
+  std::string ReadString() {
+    auto len = Read<uint64_t>();
+    Check(len);
+    std::string ret(ptr_, len);
+    ptr_ += len;
+    return ret;
+  }
+
+ private:
+  void Check(size_t n) const {
+    if (static_cast<size_t>(end_ - ptr_) < n) {
+      throw DBException("The manifest is corrupted.");
+    }
+  }
+
+  const char* ptr_;
+  const char* end_;
+};
+
+}  // namespace
+
+void ManifestWriter::AddEdit(const Version* base, const Version& version,
+    seq_t seq, uint64_t next_file_id) {
+  /* The position of each SSTable in base: (level, run, index in the run). */
+  std::map<const SSTable*, std::tuple<uint32_t, uint32_t, uint32_t>> pos;
+  if (base != nullptr) {
+    auto& levels = base->GetLevels();
+    for (uint32_t l = 0; l < levels.size(); l++) {
+      auto& runs = levels[l].GetRuns();
+      for (uint32_t r = 0; r < runs.size(); r++) {
+        auto& ssts = runs[r]->GetSSTs();
+        for (uint32_t i = 0; i < ssts.size(); i++) {
+          pos.emplace(ssts[i].get(), std::make_tuple(l, r, i));
+        }
+      }
+    }
+  }
+  std::string rep;
+  Append<uint64_t>(&rep, next_file_id);
+  Append<uint64_t>(&rep, version.GetLevels().size());
+  for (auto& level : version.GetLevels()) {
+    Append<uint64_t>(&rep, level.GetID());
+    Append<uint64_t>(&rep, level.GetRuns().size());
+    for (auto& run : level.GetRuns()) {
+      /* A segment is ended by an SSTable which does not follow it in base. */
+      std::string segments;
+      uint64_t segment_count = 0;
+      std::tuple<uint32_t, uint32_t, uint32_t> last;
+      uint32_t length = 0;
+      auto end_segment = [&]() {
+        if (length > 0) {
+          auto [l, r, i] = last;
+          Append<uint8_t>(&segments, kOldSegment);
+          Append<uint32_t>(&segments, l);
+          Append<uint32_t>(&segments, r);
+          Append<uint32_t>(&segments, i + 1 - length);
+          Append<uint32_t>(&segments, length);
+          segment_count += 1;
+          length = 0;
+        }
+      };
+      for (auto& sst : run->GetSSTs()) {
+        auto it = pos.find(sst.get());
+        if (it == pos.end()) {
+          end_segment();
+          auto& info = sst->GetSSTInfo();
+          Append<uint8_t>(&segments, kNewSSTable);
+          Append<uint64_t>(&segments, info.count_);
+          Append<uint64_t>(&segments, info.size_);
+          Append<uint64_t>(&segments, info.sst_id_);
+          Append<uint64_t>(&segments, info.index_offset_);
+          Append<uint64_t>(&segments, info.bloom_filter_offset_);
+          Append<uint64_t>(&segments, info.filename_.size());
+          segments.append(info.filename_);
+          segment_count += 1;
+          continue;
+        }
+        auto [l, r, i] = it->second;
+        if (length > 0 && std::get<0>(last) == l && std::get<1>(last) == r &&
+            std::get<2>(last) + 1 == i) {
+          last = it->second;
+          length += 1;
+          continue;
+        }
+        end_segment();
+        last = it->second;
+        length = 1;
+      }
+      end_segment();
+      Append<uint64_t>(&rep, segment_count);
+      rep.append(segments);
+    }
+  }
+  std::string record;
+  LogWriter::EncodeRecord(
+      &record, ParsedKey("", seq, RecordType::Value), rep);
+  log_.AddRecords(record);
+  edit_count_ += 1;
+}
+
+ManifestState ReplayManifest(const std::string& filename) {
+  ManifestState state;
+  LogReader reader(filename);
+  ParsedKey key;
+  Slice value;
+  while (reader.ReadRecord(&key, &value)) {
+    EditReader edit(value);
+    std::vector<ManifestLevel> levels;
+    state.seq_ = key.seq_;
+    state.next_file_id_ = edit.Read<uint64_t>();
+    auto level_count = edit.Read<uint64_t>();
+    for (uint64_t l = 0; l < level_count; l++) {
+      auto& level = levels.emplace_back();
+      level.id_ = edit.Read<uint64_t>();
+      level.runs_.resize(edit.Read<uint64_t>());
+      for (auto& run : level.runs_) {
+        auto segment_count = edit.Read<uint64_t>();
+        for (uint64_t s = 0; s < segment_count; s++) {
+          if (edit.Read<uint8_t>() == kNewSSTable) {
+            SSTInfo info;
+            info.count_ = edit.Read<uint64_t>();
+            info.size_ = edit.Read<uint64_t>();
+            info.sst_id_ = edit.Read<uint64_t>();
+            info.index_offset_ = edit.Read<uint64_t>();
+            info.bloom_filter_offset_ = edit.Read<uint64_t>();
+            info.filename_ = edit.ReadString();
+            run.push_back(std::move(info));
+            continue;
+          }
+          auto old_level = edit.Read<uint32_t>();
+          auto old_run = edit.Read<uint32_t>();
+          auto start = edit.Read<uint32_t>();
+          auto length = edit.Read<uint32_t>();
+          if (old_level >= state.levels_.size() ||
+              old_run >= state.levels_[old_level].runs_.size() ||
+              start + length >
+                  state.levels_[old_level].runs_[old_run].size()) {
+            throw DBException("The manifest is corrupted.");
+          }
+          auto& ssts = state.levels_[old_level].runs_[old_run];
+          run.insert(run.end(), ssts.begin() + start,
+              ssts.begin() + start + length);
+        }
+      }
+    }
+    state.levels_ = std::move(levels);
+  }
+  return state;
+}
+
+}  // namespace lsm
+
+}  // namespace wing
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "storage/lsm/format.hpp"
+#include "storage/lsm/version.hpp"
+#include "storage/lsm/wal.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+/* The SSTables of a level, run by run, as recorded in the manifest. */
+struct ManifestLevel {
+  uint64_t id_;
+  std::vector<std::vector<SSTInfo>> runs_;
+};
+
+/* The state of the LSM tree replayed from the manifest. */
+struct ManifestState {
+  std::vector<ManifestLevel> levels_;
+  /* The sequence number when the last edit was written. */
+  seq_t seq_{0};
+  /* The next ID of the file name generator. */
+  uint64_t next_file_id_{0};
+};
+
+/**
+ * The manifest is an append-only log of version edits. An edit describes
+ * the new version in terms of the previous one: each sorted run is a list of
+ * segments, and a segment is either a slice of a sorted run of the previous
+ * version, or an SSTable added by the edit. The SSTables which are not
+ * referenced anymore are removed. So an edit costs O(levels * runs + added
+ * SSTables), no matter how many SSTables are kept.
+ *
+ * A checkpoint is an edit from the empty version, which is written to a new
+ * file that replaces the manifest, so that the manifest does not grow
+ * forever. Each edit is stored as one record of the write-ahead log format
+ * (see LogWriter), so a torn edit at the tail is ignored in replay.
+ */
+class ManifestWriter {
+ public:
+  /* Create or truncate the manifest file. */
+  ManifestWriter(const std::string& filename, bool sync)
+    : log_(filename, sync) {}
+
+  /**
+   * Append the edit which turns base into version. If base is nullptr, the
+   * edit is a checkpoint of version.
+   */
+  void AddEdit(const Version* base, const Version& version, seq_t seq,
+      uint64_t next_file_id);
+
+  /* The number of edits in the file. */
+  size_t edit_count() const { return edit_count_; }
+
+ private:
+  LogWriter log_;
+  size_t edit_count_{0};
+};
+
+/**
+ * Replay all the edits in the manifest file. The first edit in the file is
+ * a checkpoint.
+ */
+ManifestState ReplayManifest(const std::string& filename);
+
+/* The path of the manifest of the database. */
+inline std::string ManifestFileName(std::string_view db_path) {
+  return fmt::format("{}/MANIFEST", db_path);
+}
+
+}  // namespace lsm
+
+}  // namespace wing
@@ -14,41 +14,107 @@ void MemTable::Add(ParsedKey key, Slice value) {
       .Write(key.seq_)
       .Write(key.type_)
       .WriteString(value);
-  size_ += key.size() + value.size() + sizeof(offset_t) * 2;
+  size_.fetch_add(key.size() + value.size() + sizeof(offset_t) * 2,
+      std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
   auto parsed_key =
       ParsedKey(Slice(ptr, key.user_key_.size()), key.seq_, key.type_);
   auto copied_value = Slice(ptr + key.size(), value.size());
-  table_.emplace(parsed_key, copied_value);
+  if (skiplist_) {
+    skiplist_->Insert(parsed_key, copied_value);
+  } else {
+    std::unique_lock<std::shared_mutex> lck(mu_);
+    table_.emplace(parsed_key, copied_value);
+  }
 }
 
 void MemTable::Put(Slice user_key, seq_t seq, Slice value) {
-  std::unique_lock<std::shared_mutex> lck(mu_);
   Add(ParsedKey(user_key, seq, RecordType::Value), value);
 }
 
+void MemTable::Merge(Slice user_key, seq_t seq, Slice operand) {
+  Add(ParsedKey(user_key, seq, RecordType::Merge), operand);
+}
+
 void MemTable::Del(Slice user_key, seq_t seq) {
-  std::unique_lock<std::shared_mutex> lck(mu_);
   Add(ParsedKey(user_key, seq, RecordType::Deletion), Slice());
 }
 
+void MemTable::DeleteRange(Slice begin, Slice end, seq_t seq) {
+  std::unique_lock<std::shared_mutex> lck(mu_);
+  range_tombstones_.Add(RangeTombstone{
+      std::string(begin), std::string(end), seq});
+  has_range_tombstones_.store(true, std::memory_order_release);
+  size_.fetch_add(begin.size() + end.size() + sizeof(seq_t),
+      std::memory_order_relaxed);
+}
+
+seq_t MemTable::MaxCoveringSeq(Slice user_key, seq_t seq) {
+  if (!has_range_tombstones_.load(std::memory_order_acquire)) {
+    return 0;
+  }
+  std::shared_lock<std::shared_mutex> lck(mu_);
+  return range_tombstones_.MaxCoveringSeq(user_key, seq);
+}
+
+RangeTombstoneList MemTable::GetRangeTombstones() {
+  std::shared_lock<std::shared_mutex> lck(mu_);
+  return range_tombstones_;
+}
+
 void MemTable::Clear() {
   std::unique_lock<std::shared_mutex> lck(mu_);
+  if (skiplist_) {
+    skiplist_->Clear();
+  }
   table_.clear();
+  range_tombstones_ = RangeTombstoneList();
+  has_range_tombstones_ = false;
+  alloc_.Clear();
+  size_ = 0;
+  count_ = 0;
 }
 
-GetResult MemTable::Get(Slice user_key, seq_t seq, std::string *value) {
-  std::shared_lock<std::shared_mutex> lock(mu_);
-  auto it = table_.lower_bound(ParsedKey(user_key, seq, RecordType::Value));
-  if (it == table_.end() || it->first.user_key_ != user_key) {
-    return GetResult::kNotFound;
+GetResult MemTable::Get(
+    Slice user_key, seq_t seq, std::string *value, seq_t *seq_found) {
+  ParsedKey target(user_key, seq, RecordType::Value);
+  if (seq_found) *seq_found = 0;
+  const ParsedKey *key;
+  Slice found_value;
+  if (skiplist_) {
+    auto node = skiplist_->FindGreaterOrEqual(target);
+    if (node == nullptr) {
+      return GetResult::kNotFound;
+    }
+    key = &node->key_;
+    found_value = node->value_;
   } else {
-    switch (it->first.type_) {
-      case RecordType::Deletion:
-        return GetResult::kDelete;
-      case RecordType::Value:
-        *value = it->second;
-        return GetResult::kFound;
+    std::shared_lock<std::shared_mutex> lock(mu_);
+    auto it = table_.lower_bound(target);
+    if (it == table_.end()) {
+      return GetResult::kNotFound;
     }
+    /* Nodes of std::map are stable, so the key is valid after unlocking. */
+    key = &it->first;
+    found_value = it->second;
+  }
+  if (key->user_key_ != user_key) {
+    return GetResult::kNotFound;
+  }
+  if (seq_found) *seq_found = key->seq_;
+  switch (key->type_) {
+    case RecordType::Deletion:
+      return GetResult::kDelete;
+    case RecordType::Value:
+      *value = found_value;
+      return GetResult::kFound;
+    case RecordType::Merge:
+      return GetResult::kMerge;
+    case RecordType::BlobIndex:
+      /* Values are moved to blob files when they are flushed. */
+    case RecordType::RangeDeletion:
+      /* Range tombstones are not stored as records. */
+      break;
   }
   DB_ERR("Incorrect key value!");
 }
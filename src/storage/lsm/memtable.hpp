@@ -1,6 +1,8 @@
 #pragma once
 
+#include <atomic>
 #include <map>
+#include <memory>
 #include <shared_mutex>
 #include <string>
 
@@ -9,6 +11,8 @@
 #include "storage/lsm/format.hpp"
 #include "storage/lsm/iterator.hpp"
 #include "storage/lsm/options.hpp"
+#include "storage/lsm/range_tombstone.hpp"
+#include "storage/lsm/skiplist.hpp"
 
 namespace wing {
 
@@ -18,16 +22,50 @@ class MemTableIterator;
 
 class MemTable {
  public:
-  MemTable() : size_(0) {}
+  /**
+   * use_skiplist: Store the records in a concurrent skiplist, which supports
+   * concurrent Put/Del and lock-free Get/iteration. Otherwise, the records
+   * are stored in a std::map protected by a shared_mutex.
+   */
+  MemTable(bool use_skiplist = true)
+    : size_(0),
+      skiplist_(
+          use_skiplist ? std::make_unique<SkipList>(&alloc_) : nullptr) {}
 
   void Put(Slice user_key, seq_t seq, Slice value);
 
+  void Merge(Slice user_key, seq_t seq, Slice operand);
+
   void Del(Slice user_key, seq_t seq);
 
-  /* Find a record with the same key and the largest sequence number <= seq */
-  GetResult Get(Slice user_key, seq_t seq, std::string* value);
+  /* Delete the user keys in [begin, end) whose records are older than seq. */
+  void DeleteRange(Slice begin, Slice end, seq_t seq);
+
+  /**
+   * The largest sequence number <= seq of the range tombstones covering
+   * user_key, or 0 if there are none.
+   */
+  seq_t MaxCoveringSeq(Slice user_key, seq_t seq);
+
+  /* A copy of the range tombstones. */
+  RangeTombstoneList GetRangeTombstones();
+
+  /**
+   * Find a record with the same key and the largest sequence number <= seq.
+   * If seq_found is not nullptr, it is set to the sequence number of the
+   * record, or 0 if there is none. It returns GetResult::kMerge if the
+   * record is a merge operand.
+   */
+  GetResult Get(Slice user_key, seq_t seq, std::string* value,
+      seq_t* seq_found = nullptr);
+
+  size_t size() const { return size_.load(std::memory_order_relaxed); }
 
-  size_t size() const { return size_; }
+  /* The number of records. */
+  size_t count() const { return count_.load(std::memory_order_relaxed); }
+
+  /* Whether Put and Del can be called by multiple threads in parallel. */
+  bool AllowConcurrentInsert() const { return skiplist_ != nullptr; }
 
   std::map<ParsedKey, Slice>& GetTable() { return table_; }
 
@@ -43,6 +81,11 @@ class MemTable {
 
   bool GetFlushComplete() const { return flush_complete_; }
 
+  void SetLogNumber(size_t log_number) { log_number_ = log_number; }
+
+  /* The number of the write-ahead log which records this MemTable. */
+  size_t GetLogNumber() const { return log_number_; }
+
   void Clear();
 
  private:
@@ -50,37 +93,105 @@ class MemTable {
 
   std::shared_mutex mu_;
   std::map<ParsedKey, Slice> table_;
-  uint64_t size_;
-  ArenaAllocator alloc_;
+  std::atomic<uint64_t> size_;
+  std::atomic<uint64_t> count_{0};
+  ConcurrentArenaAllocator alloc_;
+  /* It is nullptr if the records are stored in table_. */
+  std::unique_ptr<SkipList> skiplist_;
+  /* The range tombstones, protected by mu_. */
+  RangeTombstoneList range_tombstones_;
+  /* Whether range_tombstones_ is not empty, so Get can skip the lock. */
+  std::atomic<bool> has_range_tombstones_{false};
   bool flush_in_progress_{false};
   bool flush_complete_{false};
+  size_t log_number_{0};
 
   friend class MemTableIterator;
 };
 
 class MemTableIterator final : public Iterator {
  public:
-  MemTableIterator(MemTable* table) : table_(table) {}
+  MemTableIterator(MemTable* table)
+    : table_(table), skiplist_it_(table->skiplist_.get()) {}
 
   void Seek(Slice key, seq_t seq) {
-    it_ = table_->table_.lower_bound(ParsedKey(key, seq, RecordType::Value));
+    if (table_->skiplist_) {
+      skiplist_it_.Seek(ParsedKey(key, seq, RecordType::Value));
+    } else {
+      it_ =
+          table_->table_.lower_bound(ParsedKey(key, seq, RecordType::Value));
+    }
+  }
+
+  void SeekToFirst() {
+    if (table_->skiplist_) {
+      skiplist_it_.SeekToFirst();
+    } else {
+      it_ = table_->table_.begin();
+    }
   }
 
-  void SeekToFirst() { it_ = table_->table_.begin(); }
+  void SeekToLast() {
+    if (table_->skiplist_) {
+      skiplist_it_.SeekToLast();
+    } else if (table_->table_.empty()) {
+      it_ = table_->table_.end();
+    } else {
+      it_ = std::prev(table_->table_.end());
+    }
+  }
 
-  bool Valid() override { return it_ != table_->table_.end(); }
+  /* Find the last record <= (key, seq). */
+  void SeekForPrev(Slice key, seq_t seq) {
+    Seek(key, seq);
+    if (!Valid()) {
+      SeekToLast();
+    } else if (ParsedKey(key, seq, RecordType::Value) <
+               ParsedKey(this->key())) {
+      Prev();
+    }
+  }
+
+  bool Valid() override {
+    if (table_->skiplist_) {
+      return skiplist_it_.Valid();
+    }
+    return it_ != table_->table_.end();
+  }
 
+  /* The key and the record type are stored contiguously in the arena. */
   Slice key() const override {
-    return Slice(it_->first.user_key_.data(), it_->first.size());
+    const ParsedKey& key =
+        table_->skiplist_ ? skiplist_it_.node()->key_ : it_->first;
+    return Slice(key.user_key_.data(), key.size());
   }
 
-  Slice value() const override { return it_->second; }
+  Slice value() const override {
+    return table_->skiplist_ ? skiplist_it_.node()->value_ : it_->second;
+  }
+
+  void Next() override {
+    if (table_->skiplist_) {
+      skiplist_it_.Next();
+    } else {
+      it_++;
+    }
+  }
 
-  void Next() override { it_++; }
+  void Prev() override {
+    if (table_->skiplist_) {
+      skiplist_it_.Prev();
+    } else if (it_ == table_->table_.begin()) {
+      it_ = table_->table_.end();
+    } else {
+      it_--;
+    }
+  }
 
  private:
   MemTable* table_;
   std::map<ParsedKey, Slice>::iterator it_;
+  SkipList::Iterator skiplist_it_;
 };
 
 }  // namespace lsm
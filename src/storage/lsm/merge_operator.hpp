@@ -0,0 +1,56 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "storage/lsm/format.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+/**
+ * An associative merge operator, which folds the operands written by
+ * DBImpl::Merge into the value of a key. The value after the operands a, b
+ * and c, in the order they are written, is Merge(Merge(a, b), c), and it
+ * must equal Merge(a, Merge(b, c)), so that a compaction can fold the
+ * operands it reads without the older records of the key. If there is a
+ * value v before the operands, v is folded first, as if it were an operand.
+ * If there is nothing, or a deletion, before them, the oldest operand is
+ * the initial value.
+ */
+class MergeOperator {
+ public:
+  virtual ~MergeOperator() = default;
+
+  /* Fold the newer operand into the existing value (or operand). */
+  virtual void Merge(
+      Slice existing, Slice operand, std::string* result) const = 0;
+
+  /**
+   * Fold the operands, which are ordered from the newest to the oldest, into
+   * the base value. If base is nullptr, the oldest operand is the initial
+   * value, and the result is empty if there are no operands either.
+   */
+  void FullMerge(const std::string* base,
+      const std::vector<std::string>& operands, std::string* result) const {
+    auto it = operands.rbegin();
+    if (base != nullptr) {
+      *result = *base;
+    } else if (it != operands.rend()) {
+      *result = *it++;
+    } else {
+      result->clear();
+      return;
+    }
+    std::string merged;
+    for (; it != operands.rend(); ++it) {
+      Merge(*result, *it, &merged);
+      result->swap(merged);
+    }
+  }
+};
+
+}  // namespace lsm
+
+}  // namespace wing
@@ -1,8 +1,12 @@
 #pragma once
 
 #include <filesystem>
+#include <memory>
+#include <vector>
 
+#include "common/bloomfilter.hpp"
 #include "storage/lsm/cache.hpp"
+#include "storage/lsm/merge_operator.hpp"
 
 namespace wing {
 
@@ -17,32 +21,173 @@ struct Options {
   size_t block_size = 4 * 1024;
   /* The size of write buffer */
   size_t write_buffer_size = 1024 * 1024;
+  /**
+   * The number of records between two restart points in a data block.
+   * Keys are prefix compressed between restart points. If it is 0, data
+   * blocks store full keys (BlockFormat::kPlain).
+   */
+  size_t block_restart_interval = kDefaultBlockRestartInterval;
   /* Use O_DIRECT or not */
   bool use_direct_io = false;
+  /**
+   * Map SSTable files into memory and read data blocks from the mapping,
+   * instead of copying them with pread. The block cache is bypassed, since
+   * the page cache already keeps the blocks. Compressed blocks still go
+   * through the cache, which keeps them decompressed. It ignores
+   * use_direct_io for data blocks.
+   */
+  bool use_mmap_reads = false;
   /* Use bloom filter or not*/
   bool enable_bloom_filter = true;
+  /* Record every write in the write-ahead log or not */
+  bool enable_wal = true;
+  /**
+   * Sync the write-ahead log (fdatasync) before a write returns or not.
+   * Concurrent writes are grouped so that they share one sync. The manifest
+   * and the flushed SSTables are then synced before the logs are removed.
+   */
+  bool sync_wal = false;
+  /**
+   * Use the concurrent skiplist MemTable or not. The writes grouped by the
+   * write leader are inserted into it in parallel. Otherwise, it uses the
+   * MemTable based on std::map.
+   */
+  bool use_skiplist_memtable = true;
   /* Whether we create a new database in the directory */
   bool create_new = true;
+  /**
+   * The number of version edits in the manifest after which it is replaced
+   * by a checkpoint of the current version. See lsm/manifest.hpp.
+   */
+  size_t manifest_checkpoint_interval = 1024;
   /* The maximum number of immutable MemTables. */
   size_t max_immutable_count = 4;
+  /* The number of threads flushing the immutable MemTables in parallel. */
+  size_t max_background_flushes = 2;
+  /**
+   * The number of compaction threads. A compaction picker does not pick the
+   * levels which are being compacted, so compactions on different levels run
+   * concurrently.
+   */
+  size_t max_background_compactions = 2;
   /* The name of compaction strategy. */
   std::string compaction_strategy_name = "leveled";
   /* The minimum number of sorted runs for triggering compaction in Level 0*/
   size_t level0_compaction_trigger = 4;
+  /**
+   * It starts delaying writes when the number of sorted runs in Level 0
+   * reaches this limit. The delay grows as it approaches the stop trigger.
+   */
+  size_t level0_slowdown_writes_trigger = 12;
   /**
    * The maximum number of sorted runs in Level 0.
    * It stops writes when the number of sorted runs reaches this limit.
    */
   size_t level0_stop_writes_trigger = 20;
+  /**
+   * The limits of the estimated bytes that compactions have to rewrite to
+   * bring every level under its target size. Writes are delayed beyond the
+   * soft limit, and stopped beyond the hard limit. 0 disables a limit.
+   * Only the leveled strategy has target sizes, so the others ignore them.
+   */
+  uint64_t soft_pending_compaction_bytes_limit = 64ull << 30;
+  uint64_t hard_pending_compaction_bytes_limit = 256ull << 30;
+  /**
+   * The write rate (bytes per second) when writes start to be delayed. It
+   * drops linearly to 0 as the stop limits are approached.
+   */
+  uint64_t delayed_write_rate = 16 << 20;
+  /**
+   * The maximum number of subcompactions of a compaction. The key range of a
+   * compaction is split at the boundaries of its input SSTables, and the
+   * subranges are merged into separate SSTables in parallel. 1 disables it.
+   */
+  size_t max_subcompactions = 4;
   /* The default size ratio used in tiering/leveling compaction strategy. */
   size_t compaction_size_ratio = 10;
   /* The number of bits per key in bloom filter, by default */
   size_t bloom_bits_per_key = 10;
+  /**
+   * The number of bits per key in the bloom filters of the SSTables written
+   * to Level i is bloom_bits_per_key_per_level[i]. The deeper levels use the
+   * last element. If it is empty, all levels use bloom_bits_per_key.
+   */
+  std::vector<size_t> bloom_bits_per_key_per_level;
+  /**
+   * The total size of the bloom filters in bytes. If it is not 0, it is
+   * allocated to the levels to minimize the expected number of sorted runs
+   * read by lookups of missing keys (see lsm/bloom_policy.hpp), and the two
+   * options above are ignored. The allocation is based on the LSM-tree when
+   * an SSTable is written, so SSTables written when the tree was smaller
+   * keep larger filters until they are compacted.
+   */
+  size_t bloom_filter_memory_budget = 0;
+  /**
+   * The format of the bloom filters in new SSTables. kBlocked probes a single
+   * cache line per lookup, at a slightly higher false positive rate.
+   */
+  utils::BloomFilterFormat bloom_filter_format =
+      utils::BloomFilterFormat::kBlocked;
+  /**
+   * The length of the key prefixes in the range filters of SSTables, which
+   * let DBImpl::Seek(lower, upper) skip the SSTables without keys in the
+   * range. It should be chosen such that a short range scan covers a few
+   * prefixes. If it is 0, there are no range filters.
+   */
+  size_t range_filter_prefix_length = 0;
+  /**
+   * The codec of the data blocks in new SSTables. A block is stored as is if
+   * it does not shrink by at least 1/8. The block cache keeps decompressed
+   * blocks.
+   */
+  BlockCodec compression = BlockCodec::kNone;
+  /**
+   * The codec of the data blocks written to Level i is
+   * compression_per_level[i]. The deeper levels use the last element. If it
+   * is empty, all levels use compression. For example, {kNone, kNone, kLZ}
+   * compresses the cold levels only.
+   */
+  std::vector<BlockCodec> compression_per_level;
+  /**
+   * The values of at least min_blob_size bytes are written to blob files by
+   * flushes and compactions, and the SSTables store their BlobIndex (see
+   * lsm/blob.hpp) instead, so that compactions do not rewrite them. If it is
+   * 0, all values are stored in SSTables.
+   */
+  size_t min_blob_size = 0;
+  /* The target size of blob file */
+  uint64_t blob_file_size = 256 * 1024 * 1024;
+  /**
+   * A compaction moves the values it reads out of the blob files whose ratio
+   * of garbage is at least blob_gc_garbage_ratio, so that the blob files can
+   * be removed. If it is 0, values are never moved, and a blob file is
+   * removed only after all its values are dropped.
+   */
+  double blob_gc_garbage_ratio = 0.5;
   /* The target scan length in part3 */
   double target_scan_length_part3 = 0;
   /* The target alpha in part3 */
   double target_alpha_part3 = 0;
   CacheOptions cache{};
+  /**
+   * The maximum number of SSTable readers kept open by the table cache (see
+   * lsm/table_cache.hpp). A reader holds the file descriptor, the index block
+   * and the bloom filter of an SSTable. If it is 0, the readers are never
+   * closed.
+   */
+  size_t max_open_files = 1024;
+  /**
+   * Store the index blocks and the bloom filters of the open readers in the
+   * block cache, so that they count against its capacity. They are pinned
+   * while the readers are open, and may stay cached after they are closed.
+   */
+  bool cache_index_and_filter_blocks = false;
+  /**
+   * The operator which folds the operands written by DBImpl::Merge. It must
+   * be given to use DBImpl::Merge, and to open a database with merge
+   * operands.
+   */
+  std::shared_ptr<MergeOperator> merge_operator;
 };
 
 }  // namespace lsm
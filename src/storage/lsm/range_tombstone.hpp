@@ -0,0 +1,103 @@
+#pragma once
+
+#include <algorithm>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "storage/lsm/format.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+/**
+ * A range tombstone deletes the records whose user keys are in [begin_, end_)
+ * and whose sequence numbers are smaller than seq_. It is written by
+ * DBImpl::DeleteRange in O(1) instead of one deletion for each key.
+ */
+struct RangeTombstone {
+  std::string begin_;
+  std::string end_;
+  seq_t seq_;
+};
+
+/**
+ * A list of range tombstones sorted by begin_. The tombstones may overlap.
+ * DeleteRange is expected to be rare, so a lookup scans the tombstones
+ * which begin before the key.
+ */
+class RangeTombstoneList {
+ public:
+  void Add(RangeTombstone tombstone) {
+    auto it = std::upper_bound(tombstones_.begin(), tombstones_.end(),
+        tombstone.begin_, [](const std::string& begin, const auto& t) {
+          return begin < t.begin_;
+        });
+    tombstones_.insert(it, std::move(tombstone));
+  }
+
+  void Add(const RangeTombstoneList& list) {
+    for (auto& tombstone : list.tombstones_) {
+      Add(tombstone);
+    }
+  }
+
+  /**
+   * The largest sequence number <= seq of the tombstones covering user_key.
+   * Return 0 if there are no such tombstones.
+   */
+  seq_t MaxCoveringSeq(Slice user_key, seq_t seq) const {
+    seq_t ret = 0;
+    for (auto& t : tombstones_) {
+      if (user_key < t.begin_) {
+        break;
+      }
+      if (user_key < t.end_ && t.seq_ <= seq) {
+        ret = std::max(ret, t.seq_);
+      }
+    }
+    return ret;
+  }
+
+  /* Whether the record is deleted by a tombstone visible at seq. */
+  bool Covers(ParsedKey key, seq_t seq) const {
+    return !tombstones_.empty() &&
+           key.seq_ < MaxCoveringSeq(key.user_key_, seq);
+  }
+
+  /**
+   * The tombstones clipped to [start, end), e.g. for a subcompaction. A
+   * missing bound does not clip.
+   */
+  RangeTombstoneList Clip(const std::optional<std::string>& start,
+      const std::optional<std::string>& end) const {
+    RangeTombstoneList ret;
+    for (auto t : tombstones_) {
+      if (start && t.begin_ < *start) {
+        t.begin_ = *start;
+      }
+      if (end && *end < t.end_) {
+        t.end_ = *end;
+      }
+      if (t.begin_ < t.end_) {
+        ret.tombstones_.push_back(std::move(t));
+      }
+    }
+    /* The tombstones moved to start are still the first ones. */
+    return ret;
+  }
+
+  bool empty() const { return tombstones_.empty(); }
+
+  const std::vector<RangeTombstone>& GetTombstones() const {
+    return tombstones_;
+  }
+
+ private:
+  std::vector<RangeTombstone> tombstones_;
+};
+
+}  // namespace lsm
+
+}  // namespace wing
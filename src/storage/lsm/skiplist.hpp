@@ -0,0 +1,201 @@
+#pragma once
+
+#include <atomic>
+#include <random>
+
+#include "common/allocator.hpp"
+#include "storage/lsm/format.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+/**
+ * A skiplist of (ParsedKey, value) supporting concurrent insertions and
+ * lock-free reads. Nodes are allocated from an arena and never removed.
+ *
+ * An insertion links the new node level by level from the bottom using
+ * compare-and-swap, so a node reachable from a higher level is always
+ * reachable from the lower levels. Readers only follow the next pointers.
+ *
+ * The keys and values are not copied. They must outlive the skiplist.
+ */
+class SkipList {
+ public:
+  static constexpr int kMaxHeight = 12;
+  static constexpr int kBranching = 4;
+
+  struct Node {
+    ParsedKey key_;
+    Slice value_;
+
+    Node* Next(int level) const {
+      return next_[level].load(std::memory_order_acquire);
+    }
+    bool CASNext(int level, Node* expected, Node* x) {
+      return next_[level].compare_exchange_strong(
+          expected, x, std::memory_order_release, std::memory_order_relaxed);
+    }
+    void NoBarrierSetNext(int level, Node* x) {
+      next_[level].store(x, std::memory_order_relaxed);
+    }
+
+    /* The node is allocated with height pointers. */
+    std::atomic<Node*> next_[1];
+  };
+
+  class Iterator {
+   public:
+    Iterator() = default;
+
+    Iterator(const SkipList* list) : list_(list) {}
+
+    bool Valid() const { return node_ != nullptr; }
+
+    const Node* node() const { return node_; }
+
+    void Next() { node_ = node_->Next(0); }
+
+    /* Move to the first node >= key */
+    void Seek(const ParsedKey& key) { node_ = list_->FindGreaterOrEqual(key); }
+
+    void SeekToFirst() { node_ = list_->head_->Next(0); }
+
+    /**
+     * The nodes are not linked backward, so it searches for the last node
+     * < the current key from the top, which costs O(log n).
+     */
+    void Prev() { node_ = list_->FindLessThan(node_->key_); }
+
+    void SeekToLast() { node_ = list_->FindLast(); }
+
+   private:
+    const SkipList* list_{nullptr};
+    Node* node_{nullptr};
+  };
+
+  SkipList(ConcurrentArenaAllocator* alloc)
+    : alloc_(alloc), head_(NewNode(ParsedKey(), Slice(), kMaxHeight)) {}
+
+  /* Thread-safe. */
+  void Insert(ParsedKey key, Slice value) {
+    int height = RandomHeight();
+    Node* x = NewNode(key, value, height);
+    int max_height = max_height_.load(std::memory_order_relaxed);
+    while (height > max_height) {
+      if (max_height_.compare_exchange_weak(max_height, height)) {
+        max_height = height;
+        break;
+      }
+    }
+    Node* prev[kMaxHeight];
+    Node* next[kMaxHeight];
+    Node* before = head_;
+    for (int level = max_height - 1; level >= 0; level--) {
+      FindSpliceForLevel(key, before, level, &prev[level], &next[level]);
+      before = prev[level];
+    }
+    for (int level = 0; level < height; level++) {
+      while (true) {
+        x->NoBarrierSetNext(level, next[level]);
+        if (prev[level]->CASNext(level, next[level], x)) {
+          break;
+        }
+        /* Another node is inserted between prev and next. Search again. */
+        FindSpliceForLevel(
+            key, prev[level], level, &prev[level], &next[level]);
+      }
+    }
+  }
+
+  /* Return the first node >= key, or nullptr if there is no such node. */
+  Node* FindGreaterOrEqual(const ParsedKey& key) const {
+    Node* x = head_;
+    Node* next = nullptr;
+    for (int level = max_height_.load(std::memory_order_relaxed) - 1;
+         level >= 0; level--) {
+      while ((next = x->Next(level)) != nullptr && next->key_ < key) {
+        x = next;
+      }
+    }
+    return next;
+  }
+
+  /* Return the last node < key, or nullptr if there is no such node. */
+  Node* FindLessThan(const ParsedKey& key) const {
+    Node* x = head_;
+    Node* next = nullptr;
+    for (int level = max_height_.load(std::memory_order_relaxed) - 1;
+         level >= 0; level--) {
+      while ((next = x->Next(level)) != nullptr && next->key_ < key) {
+        x = next;
+      }
+    }
+    return x == head_ ? nullptr : x;
+  }
+
+  /* Return the last node, or nullptr if the skiplist is empty. */
+  Node* FindLast() const {
+    Node* x = head_;
+    Node* next = nullptr;
+    for (int level = max_height_.load(std::memory_order_relaxed) - 1;
+         level >= 0; level--) {
+      while ((next = x->Next(level)) != nullptr) {
+        x = next;
+      }
+    }
+    return x == head_ ? nullptr : x;
+  }
+
+  /* Require: no concurrent accesses. */
+  void Clear() {
+    for (int level = 0; level < kMaxHeight; level++) {
+      head_->NoBarrierSetNext(level, nullptr);
+    }
+    max_height_.store(1, std::memory_order_relaxed);
+  }
+
+ private:
+  Node* NewNode(ParsedKey key, Slice value, int height) {
+    auto ptr = alloc_->Allocate(
+        sizeof(Node) + sizeof(std::atomic<Node*>) * (height - 1));
+    Node* x = new (ptr) Node();
+    x->key_ = key;
+    x->value_ = value;
+    for (int level = 1; level < height; level++) {
+      new (&x->next_[level]) std::atomic<Node*>(nullptr);
+    }
+    return x;
+  }
+
+  /* Find prev < key <= next in the level, starting from before. */
+  void FindSpliceForLevel(const ParsedKey& key, Node* before, int level,
+      Node** prev, Node** next) const {
+    while (true) {
+      Node* x = before->Next(level);
+      if (x == nullptr || !(x->key_ < key)) {
+        *prev = before;
+        *next = x;
+        return;
+      }
+      before = x;
+    }
+  }
+
+  static int RandomHeight() {
+    thread_local std::minstd_rand rgen(std::random_device{}());
+    int height = 1;
+    while (height < kMaxHeight && rgen() % kBranching == 0) {
+      height++;
+    }
+    return height;
+  }
+
+  ConcurrentArenaAllocator* alloc_;
+  Node* const head_;
+  std::atomic<int> max_height_{1};
+};
+
+}  // namespace lsm
+
+}  // namespace wing
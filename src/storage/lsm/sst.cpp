@@ -5,9 +5,13 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <cstring>
 #include <fstream>
 
 #include "common/bloomfilter.hpp"
+#include "storage/lsm/compression.hpp"
+#include "storage/lsm/stats.hpp"
+#include "storage/lsm/table_cache.hpp"
 
 #include <iostream>
 
@@ -15,117 +19,443 @@ namespace wing {
 
 namespace lsm {
 
-SSTable::SSTable(SSTInfo sst_info, size_t block_size, bool use_direct_io)
-  : sst_info_(std::move(sst_info)), block_size_(block_size) {
-  file_ = std::make_unique<ReadFile>(sst_info_.filename_, use_direct_io);
-  std::vector<size_t> index_offset;
-  FileReader fr = FileReader(file_.get(), sst_info_.size_, sst_info_.index_offset_);
+namespace {
+
+/**
+ * The prefix of the key in the range filter. Shorter keys are padded with
+ * zeros, so that the prefixes are in the same order as the keys.
+ */
+std::string RangeFilterPrefix(Slice key, size_t len) {
+  std::string prefix(key.substr(0, len));
+  prefix.resize(len, '\0');
+  return prefix;
+}
+
+template <typename T>
+T DecodeValue(const char* data) {
+  T x;
+  memcpy(&x, data, sizeof(T));
+  return x;
+}
+
+}  // namespace
+
+SSTableReader::SSTableReader(const SSTable& sst, Cache* charge_cache)
+  : file_(std::make_unique<ReadFile>(
+        sst.sst_info_.filename_, sst.use_direct_io_, sst.use_mmap_)),
+    handle_size_(sst.handle_size_),
+    filter_format_(sst.filter_format_) {
+  auto load = [&](offset_t offset, offset_t size, std::string_view* view,
+                  std::string* buf, std::optional<Cache::Handle>* handle) {
+    if (charge_cache != nullptr) {
+      BlockHandle block{offset, size, 0, size};
+      auto cached = charge_cache->get(sst.sst_info_.sst_id_, block);
+      if (!cached) {
+        std::string content(size, 0);
+        file_->Read(content.data(), size, offset);
+        cached = charge_cache->insert(
+            sst.sst_info_.sst_id_, block, std::move(content));
+      }
+      *view = cached->block();
+      *handle = std::move(cached);
+    } else if (file_->data() != nullptr) {
+      *view = std::string_view(file_->data() + offset, size);
+    } else {
+      buf->resize(size);
+      file_->Read(buf->data(), size, offset);
+      *view = *buf;
+    }
+  };
+  load(sst.index_offset_, sst.index_size_, &index_, &index_buf_,
+      &index_handle_);
+  load(sst.bloom_filter_offset_, sst.bloom_filter_size_, &bloom_filter_,
+      &bloom_filter_buf_, &bloom_filter_handle_);
+  block_count_ = DecodeValue<size_t>(index_.data());
+}
+
+size_t SSTableReader::EntryOffset(size_t i) const {
+  auto offsets = index_.data() + sizeof(size_t);
+  return (block_count_ + 2) * sizeof(size_t) +
+         DecodeValue<size_t>(offsets + i * sizeof(size_t)) -
+         DecodeValue<size_t>(offsets);
+}
+
+ParsedKey SSTableReader::IndexKey(size_t i) const {
+  auto begin = EntryOffset(i);
+  auto len = EntryOffset(i + 1) - begin - handle_size_;
+  return ParsedKey(index_.substr(begin, len));
+}
+
+BlockHandle SSTableReader::IndexHandle(size_t i) const {
+  auto data = index_.data() + EntryOffset(i + 1) - handle_size_;
+  if (handle_size_ == sizeof(BlockHandle)) {
+    return DecodeValue<BlockHandle>(data);
+  }
+  BlockHandle handle;
+  handle.offset_ = DecodeValue<offset_t>(data);
+  handle.size_ = DecodeValue<offset_t>(data + sizeof(offset_t));
+  handle.count_ = DecodeValue<offset_t>(data + 2 * sizeof(offset_t));
+  handle.stored_size_ = handle.size_;
+  return handle;
+}
+
+size_t SSTableReader::FindBlock(Slice key, seq_t seq) const {
+  ParsedKey target(key, seq, RecordType::Value);
+  size_t lo = 0, hi = block_count_;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (IndexKey(mid) < target) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+bool SSTableReader::MayContain(Slice key) const {
+  if (filter_format_ == utils::BloomFilterFormat::kBlocked) {
+    return utils::BlockedBloomFilter::Find(key, bloom_filter_);
+  }
+  return utils::BloomFilter::Find(key, bloom_filter_);
+}
+
+SSTable::SSTable(SSTInfo sst_info, size_t block_size, bool use_direct_io,
+    Cache* cache, bool use_mmap, BlobFileSet* blob_files,
+    TableCache* table_cache)
+  : sst_info_(std::move(sst_info)),
+    block_size_(block_size),
+    use_direct_io_(use_direct_io),
+    use_mmap_(use_mmap),
+    table_cache_(table_cache),
+    cache_(cache) {
+  /* The index block and the bloom filter are read by the reader. */
+  ReadFile file(sst_info_.filename_, use_direct_io);
+  FileReader fr = FileReader(&file, 4096, sst_info_.index_offset_);
+  fr.Seek(sst_info_.size_ - sizeof(uint64_t));
+  uint64_t footer = fr.ReadValue<uint64_t>();
+  bool has_range_filter = false, has_blob_refs = false;
+  bool has_range_tombstones = false;
+  if ((footer & ~uint64_t(0xff)) == kSSTFooterMagic) {
+    block_format_ = static_cast<BlockFormat>(footer & kSSTBlockFormatMask);
+    filter_format_ = static_cast<utils::BloomFilterFormat>(
+        (footer >> 4) & kSSTFilterFormatMask);
+    has_range_filter = footer & kSSTHasRangeFilter;
+    has_blob_refs = footer & kSSTHasBlobRefs;
+    has_range_tombstones = footer & kSSTHasRangeTombstones;
+    if (footer & kSSTHasBlockCodecs) {
+      handle_size_ = sizeof(BlockHandle);
+    }
+  }
+  /**
+   * The index block is | block count | offsets of the entries and of their
+   * end | entries |. Only its size is needed here.
+   */
+  index_offset_ = sst_info_.index_offset_;
+  fr.Seek(index_offset_);
   size_t block_count = fr.ReadValue<size_t>();
-  for (size_t i = 0; i < block_count + 1; i++) {
-    index_offset.push_back(fr.ReadValue<size_t>());
-  }
-  for (size_t i = 0; i < block_count; i++) {
-    IndexValue index_value;
-    size_t len = index_offset[i + 1] - index_offset[i] - sizeof(BlockHandle);
-    index_value.key_ = InternalKey(fr.ReadString(len));
-    index_value.block_ = fr.ReadValue<BlockHandle>();
-    index_.push_back(index_value); 
-  }
-  // std::sort(index_.begin(), index_.end(), [](const IndexValue& a, const IndexValue& b) {
-  //   return ParsedKey(a.key_) < ParsedKey(b.key_);
-  // });
-  size_t bloom_len = fr.ReadValue<size_t>();
-  
-  bloom_filter_ = fr.ReadString(bloom_len);
+  size_t first_entry = fr.ReadValue<size_t>();
+  fr.Seek(index_offset_ + (block_count + 1) * sizeof(size_t));
+  size_t entries_end = fr.ReadValue<size_t>();
+  index_size_ =
+      (block_count + 2) * sizeof(size_t) + entries_end - first_entry;
+  fr.Seek(index_offset_ + index_size_);
+  bloom_filter_size_ = fr.ReadValue<size_t>();
+  bloom_filter_offset_ = index_offset_ + index_size_ + sizeof(size_t);
+  fr.Seek(bloom_filter_offset_ + bloom_filter_size_);
   size_t max_len = fr.ReadValue<size_t>();
   largest_key_ = InternalKey(fr.ReadString(max_len));
   size_t min_len = fr.ReadValue<size_t>();
   smallest_key_ = InternalKey(fr.ReadString(min_len));
+  if (has_range_filter) {
+    range_filter_prefix_length_ = fr.ReadValue<size_t>();
+    size_t range_filter_len = fr.ReadValue<size_t>();
+    range_filter_ = fr.ReadString(range_filter_len);
+  }
+  if (has_blob_refs) {
+    wing_assert(blob_files != nullptr, "The SSTable references blob files");
+    size_t blob_file_count = fr.ReadValue<size_t>();
+    for (size_t i = 0; i < blob_file_count; i++) {
+      blob_files_.push_back(blob_files->Get(fr.ReadValue<uint64_t>()));
+    }
+  }
+  if (has_range_tombstones) {
+    size_t tombstone_count = fr.ReadValue<size_t>();
+    for (size_t i = 0; i < tombstone_count; i++) {
+      RangeTombstone tombstone;
+      tombstone.begin_ = fr.ReadString(fr.ReadValue<size_t>());
+      tombstone.end_ = fr.ReadString(fr.ReadValue<size_t>());
+      tombstone.seq_ = fr.ReadValue<seq_t>();
+      range_tombstones_.Add(std::move(tombstone));
+    }
+  }
+  if (table_cache_ == nullptr) {
+    reader_ = std::make_shared<SSTableReader>(*this, nullptr);
+  }
 }
 
 SSTable::~SSTable() {
+  reader_.reset();
+  if (table_cache_ != nullptr) {
+    table_cache_->Erase(sst_info_.sst_id_);
+  }
   if (remove_tag_) {
-    file_.reset();
     std::filesystem::remove(sst_info_.filename_);
   }
 }
 
+std::shared_ptr<SSTableReader> SSTable::GetReader() const {
+  if (table_cache_ == nullptr) {
+    return reader_;
+  }
+  return table_cache_->Get(*this);
+}
+
 GetResult SSTable::Get(Slice key, uint64_t seq, std::string* value, uint64_t* seq_found) {
-  utils::BloomFilter filter;
-  if (!filter.Find(key, bloom_filter_)) {
-    // std::cout << "Negative with key: " << key << "\n";
+  if (seq_found) *seq_found = 0;
+  auto reader = GetReader();
+  if (!reader->MayContain(key)) {
     return GetResult::kNotFound;
   }
-  const auto block_index = std::lower_bound(index_.begin(), index_.end(), key, [&](const IndexValue& index_value, const Slice& key) {
-    return ParsedKey(index_value.key_) < ParsedKey(key, seq, RecordType::Value);
-  });
-  if (block_index == index_.end()) return GetResult::kNotFound;
-  FileReader fr(file_.get(), 2 * block_size_, block_index->block_.offset_);
-  AlignedBuffer buf(block_size_, 4096);
-  fr.Read(buf.data(), block_index->block_.size_);
-  BlockIterator block_it(buf.data(), block_index->block_);
-  seq_t latest_seq = 0;
-  GetResult ret = GetResult::kNotFound;
-  for (size_t i = 0; i < block_index->block_.count_; i++) {
-    if (ParsedKey(block_it.key()).user_key_ == key && ParsedKey(block_it.key()).seq_ <= seq) {
-      if (ParsedKey(block_it.key()).seq_ > latest_seq) {
-        latest_seq = ParsedKey(block_it.key()).seq_;
-        if (ParsedKey(block_it.key()).type_ == RecordType::Value) {
-          *value = block_it.value();
-          ret = GetResult::kFound;
-        } else if (ParsedKey(block_it.key()).type_ == RecordType::Deletion) {
-          ret = GetResult::kDelete;
-        }
+  auto block_id = reader->FindBlock(key, seq);
+  if (block_id == reader->BlockCount()) return GetResult::kNotFound;
+  auto handle = reader->IndexHandle(block_id);
+  auto block = ReadBlock(reader, handle);
+  return GetFromBlock(block.data(), handle, key, seq, value, seq_found);
+}
+
+bool SSTable::MayContain(Slice key) const {
+  return GetReader()->MayContain(key);
+}
+
+bool SSTable::MayContainRange(Slice lower, Slice upper) const {
+  if (upper < GetSmallestKey().user_key_ || GetLargestKey().user_key_ < lower) {
+    return false;
+  }
+  if (range_filter_.empty()) {
+    return true;
+  }
+  auto prefix = RangeFilterPrefix(lower, range_filter_prefix_length_);
+  auto last = RangeFilterPrefix(upper, range_filter_prefix_length_);
+  for (size_t i = 0; i < kMaxRangeFilterProbes; i++) {
+    if (utils::BlockedBloomFilter::Find(prefix, range_filter_)) {
+      return true;
+    }
+    if (prefix >= last) {
+      return false;
+    }
+    /* The next prefix, as a big-endian number. */
+    size_t j = prefix.size();
+    while (j > 0 && ++prefix[j - 1] == '\0') {
+      j--;
+    }
+  }
+  return true;
+}
+
+GetResult SSTable::GetFromBlock(const char* block, BlockHandle handle,
+    Slice key, uint64_t seq, std::string* value, uint64_t* seq_found) const {
+  BlockIterator block_it(block, handle, block_format_);
+  /* The first record >= (key, seq) is the latest visible version of key. */
+  block_it.Seek(key, seq);
+  if (seq_found) *seq_found = 0;
+  if (!block_it.Valid()) return GetResult::kNotFound;
+  ParsedKey pkey(block_it.key());
+  if (pkey.user_key_ != key) return GetResult::kNotFound;
+  if (seq_found) *seq_found = pkey.seq_;
+  if (pkey.type_ == RecordType::Deletion) return GetResult::kDelete;
+  if (pkey.type_ == RecordType::Merge) return GetResult::kMerge;
+  if (pkey.type_ == RecordType::BlobIndex) {
+    auto index = BlobIndex::Decode(block_it.value());
+    auto blob_file = std::lower_bound(blob_files_.begin(), blob_files_.end(),
+        index.file_number_, [](const auto& file, uint64_t number) {
+          return file->GetNumber() < number;
+        });
+    wing_assert(blob_file != blob_files_.end() &&
+                    (*blob_file)->GetNumber() == index.file_number_,
+        "The blob file is not referenced by the SSTable");
+    (*blob_file)->Read(index.offset_, index.size_, value);
+    return GetResult::kFound;
+  }
+  *value = block_it.value();
+  return GetResult::kFound;
+}
+
+void SSTable::ReadBlocks(std::span<BlockRead> reads) {
+  /* The reads of the missing blocks, and the buffers they are read into. */
+  std::vector<ReadRequest> reqs;
+  std::vector<size_t> missed;
+  std::vector<std::string> contents;
+  std::vector<AlignedBuffer> bufs;
+  contents.reserve(reads.size());
+  bufs.reserve(reads.size());
+  for (size_t i = 0; i < reads.size(); i++) {
+    auto& r = reads[i];
+    auto sst = r.sst_;
+    if (r.reader_->file()->data() != nullptr) {
+      r.block_ = sst->ReadBlock(r.reader_, r.handle_);
+      continue;
+    }
+    char* data;
+    if (sst->cache_ != nullptr) {
+      if (auto cached = sst->cache_->get(sst->sst_info_.sst_id_, r.handle_);
+          cached) {
+        r.block_ = PinnedBlock(std::move(*cached));
+        continue;
       }
     }
-    block_it.Next();
+    auto stored_size = r.handle_.stored_size_;
+    if (sst->cache_ != nullptr && r.handle_.codec_ == BlockCodec::kNone) {
+      data = contents.emplace_back(stored_size, 0).data();
+    } else {
+      /* Compressed blocks are decompressed after they are read. */
+      data = bufs.emplace_back((stored_size + 4095) / 4096 * 4096, 4096)
+                 .data();
+    }
+    reqs.push_back(ReadRequest{
+        r.reader_->file(), data, stored_size, r.handle_.offset_});
+    missed.push_back(i);
+  }
+  ReadFile::MultiRead(reqs);
+  size_t content_id = 0, buf_id = 0;
+  for (auto i : missed) {
+    auto& r = reads[i];
+    auto sst = r.sst_;
+    if (r.handle_.codec_ != BlockCodec::kNone) {
+      r.block_ = sst->PinDecompressedBlock(r.handle_, bufs[buf_id++].data());
+    } else if (sst->cache_ != nullptr) {
+      r.block_ = PinnedBlock(sst->cache_->insert(sst->sst_info_.sst_id_,
+          r.handle_, std::move(contents[content_id++])));
+    } else {
+      r.block_ = PinnedBlock(std::move(bufs[buf_id++]));
+    }
   }
-  // std::cout << "False Positive with key: " << key << "\n";
-  if (seq_found) *seq_found = latest_seq;
-  return ret;
 }
 
-SSTableIterator SSTable::Seek(Slice key, uint64_t seq) {
-  SSTableIterator iter(this);
+PinnedBlock SSTable::ReadBlock(const std::shared_ptr<SSTableReader>& reader,
+    BlockHandle handle, bool fill_cache) {
+  auto file = reader->file();
+  if (file->data() != nullptr && handle.codec_ == BlockCodec::kNone) {
+    GetStatsContext()->total_read_bytes.fetch_add(
+        handle.size_, std::memory_order_relaxed);
+    return PinnedBlock(file->data() + handle.offset_, reader);
+  }
+  if (cache_ != nullptr) {
+    if (auto cached = cache_->get(sst_info_.sst_id_, handle); cached) {
+      return PinnedBlock(std::move(*cached));
+    }
+  }
+  if (handle.codec_ != BlockCodec::kNone) {
+    if (file->data() != nullptr) {
+      GetStatsContext()->total_read_bytes.fetch_add(
+          handle.stored_size_, std::memory_order_relaxed);
+      return PinDecompressedBlock(
+          handle, file->data() + handle.offset_, fill_cache);
+    }
+    AlignedBuffer buf((handle.stored_size_ + 4095) / 4096 * 4096, 4096);
+    file->Read(buf.data(), handle.stored_size_, handle.offset_);
+    return PinDecompressedBlock(handle, buf.data(), fill_cache);
+  }
+  if (cache_ == nullptr || !fill_cache) {
+    AlignedBuffer buf((handle.size_ + 4095) / 4096 * 4096, 4096);
+    file->Read(buf.data(), handle.size_, handle.offset_);
+    return PinnedBlock(std::move(buf));
+  }
+  std::string content(handle.size_, 0);
+  file->Read(content.data(), handle.size_, handle.offset_);
+  return PinnedBlock(
+      cache_->insert(sst_info_.sst_id_, handle, std::move(content)));
+}
+
+PinnedBlock SSTable::PinDecompressedBlock(
+    BlockHandle handle, const char* stored, bool fill_cache) {
+  Slice compressed(stored, handle.stored_size_);
+  if (cache_ == nullptr || !fill_cache) {
+    AlignedBuffer buf((handle.size_ + 63) / 64 * 64, 64);
+    DecompressBlock(handle.codec_, compressed, buf.data(), handle.size_);
+    return PinnedBlock(std::move(buf));
+  }
+  std::string content(handle.size_, 0);
+  DecompressBlock(handle.codec_, compressed, content.data(), handle.size_);
+  return PinnedBlock(
+      cache_->insert(sst_info_.sst_id_, handle, std::move(content)));
+}
+
+SSTableIterator SSTable::Seek(Slice key, uint64_t seq, bool fill_cache) {
+  SSTableIterator iter;
+  iter.sst_ = this;
+  iter.reader_ = GetReader();
+  iter.fill_cache_ = fill_cache;
   iter.Seek(key, seq);
   return iter;
 }
 
-SSTableIterator SSTable::Begin() {
-  SSTableIterator iter(this);
-  iter.SeekToFirst();
+SSTableIterator SSTable::Begin(bool fill_cache) {
+  return SSTableIterator(this, fill_cache);
+}
+
+SSTableIterator SSTable::SeekForPrev(
+    Slice key, uint64_t seq, bool fill_cache) {
+  SSTableIterator iter;
+  iter.sst_ = this;
+  iter.reader_ = GetReader();
+  iter.fill_cache_ = fill_cache;
+  iter.SeekForPrev(key, seq);
+  return iter;
+}
+
+SSTableIterator SSTable::Last(bool fill_cache) {
+  SSTableIterator iter;
+  iter.sst_ = this;
+  iter.reader_ = GetReader();
+  iter.fill_cache_ = fill_cache;
+  iter.SeekToLast();
   return iter;
 }
 
+void SSTableIterator::ReadBlock(size_t block_id) {
+  auto handle = reader_->IndexHandle(block_id);
+  block_ = sst_->ReadBlock(reader_, handle, fill_cache_);
+  block_it_ = BlockIterator(block_.data(), handle, sst_->block_format_);
+  block_id_ = block_id;
+}
+
 void SSTableIterator::Seek(Slice key, uint64_t seq) {
-  SeekToFirst();
-  const auto block_index = std::lower_bound(sst_->index_.begin(), sst_->index_.end(), key, [&](const IndexValue& index_value, const Slice& key) {
-    return ParsedKey(index_value.key_) < ParsedKey(key, seq, RecordType::Value);
-  });
-  if (block_index == sst_->index_.end()) {
-    // block_id_ = sst_->index_.size() - 1;
-    // FileReader fr(sst_->file_.get(), 2 * sst_->block_size_, sst_->index_[block_id_].block_.offset_);
-    // buf_ = AlignedBuffer(sst_->block_size_, 4096);
-    // fr.Read(buf_.data(), sst_->index_[block_id_].block_.size_);
-    // block_it_ = BlockIterator(buf_.data(), sst_->index_[block_id_].block_);
+  auto block_id = reader_->FindBlock(key, seq);
+  if (block_id == reader_->BlockCount()) {
+    SeekToFirst();
     return;
   }
-  block_id_ = block_index - sst_->index_.begin();
-  FileReader fr(sst_->file_.get(), 2 * sst_->block_size_, sst_->index_[block_id_].block_.offset_);
-  buf_ = AlignedBuffer(sst_->block_size_, 4096);
-  fr.Read(buf_.data(), sst_->index_[block_id_].block_.size_);
-  block_it_ = BlockIterator(buf_.data(), sst_->index_[block_id_].block_);
+  ReadBlock(block_id);
   block_it_.Seek(key, seq);
 }
 
 void SSTableIterator::SeekToFirst() {
-  FileReader fr = FileReader(sst_->file_.get(), 2 * sst_->block_size_, 0);
-  fr.Read(buf_.data(), sst_->index_[0].block_.size_);
-  block_it_ = BlockIterator(buf_.data(), sst_->index_[0].block_);
-  block_id_ = 0;
+  ReadBlock(0);
   block_it_.SeekToFirst();
 }
 
+void SSTableIterator::SeekToLast() {
+  ReadBlock(reader_->BlockCount() - 1);
+  block_it_.SeekToLast();
+}
+
+void SSTableIterator::SeekForPrev(Slice key, uint64_t seq) {
+  /* The first block whose largest key >= (key, seq). */
+  auto block_id = reader_->FindBlock(key, seq);
+  if (block_id == reader_->BlockCount()) {
+    SeekToLast();
+    return;
+  }
+  ReadBlock(block_id);
+  block_it_.SeekForPrev(key, seq);
+  /* All the records of the block may be larger. */
+  if (!block_it_.Valid() && block_id > 0) {
+    ReadBlock(block_id - 1);
+    block_it_.SeekToLast();
+  }
+}
+
 bool SSTableIterator::Valid() { return block_it_.Valid(); }
 
 Slice SSTableIterator::key() const { return block_it_.key(); }
@@ -135,22 +465,37 @@ Slice SSTableIterator::value() const { return block_it_.value(); }
 void SSTableIterator::Next() {
   block_it_.Next();
   if (block_it_.Valid()) return;
-  if (block_id_ >= sst_->index_.size() - 1) return;
-  block_id_++;
-  BlockHandle handle = sst_->index_[block_id_].block_;
-  FileReader fr(sst_->file_.get(), 2 * sst_->block_size_, handle.offset_);
-  buf_ = AlignedBuffer(sst_->block_size_, 4096);
-  fr.Read(buf_.data(), handle.size_);
-  block_it_ = BlockIterator(buf_.data(), handle);
+  if (block_id_ >= reader_->BlockCount() - 1) return;
+  ReadBlock(block_id_ + 1);
   block_it_.SeekToFirst();
 }
 
+void SSTableIterator::Prev() {
+  block_it_.Prev();
+  if (block_it_.Valid() || block_id_ == 0) return;
+  ReadBlock(block_id_ - 1);
+  block_it_.SeekToLast();
+}
+
 void SSTableBuilder::Append(ParsedKey key, Slice value) {
   utils::BloomFilter filter;
   if (!key_hashes_.size()) {
     smallest_key_ = InternalKey(key);
   }
   key_hashes_.push_back(filter.BloomHash(key.user_key_));
+  if (range_filter_prefix_length_ > 0) {
+    auto prefix = RangeFilterPrefix(key.user_key_, range_filter_prefix_length_);
+    if (prefix_hashes_.empty() || prefix != last_prefix_) {
+      prefix_hashes_.push_back(utils::BlockedBloomFilter::BloomHash(prefix));
+      last_prefix_ = std::move(prefix);
+    }
+  }
+  if (key.type_ == RecordType::BlobIndex) {
+    auto number = BlobIndex::Decode(value).file_number_;
+    if (blob_file_numbers_.empty() || blob_file_numbers_.back() != number) {
+      blob_file_numbers_.push_back(number);
+    }
+  }
   if (!block_builder_.Append(key, value)) {
     block_builder_.Finish();
     transfor_data_from_block_builder();
@@ -177,10 +522,17 @@ void SSTableBuilder::Finish() {
     writer_->AppendValue<BlockHandle>(index_value.block_);
   }
   std::string bloom_filter;
-  utils::BloomFilter filter;
-  filter.Create(count_, bloom_bits_per_key_, bloom_filter);
-  for (const auto& hash : key_hashes_){
-    filter.Add(hash, bloom_filter);
+  if (filter_format_ == utils::BloomFilterFormat::kBlocked) {
+    utils::BlockedBloomFilter::Create(
+        count_, bloom_bits_per_key_, bloom_filter);
+    for (const auto& hash : key_hashes_) {
+      utils::BlockedBloomFilter::Add(hash, bloom_filter);
+    }
+  } else {
+    utils::BloomFilter::Create(count_, bloom_bits_per_key_, bloom_filter);
+    for (const auto& hash : key_hashes_) {
+      utils::BloomFilter::Add(hash, bloom_filter);
+    }
   }
   writer_->AppendValue<size_t>(bloom_filter.size());
   writer_->AppendString(bloom_filter);
@@ -188,9 +540,55 @@ void SSTableBuilder::Finish() {
   writer_->AppendString(largest_key_.GetSlice());
   writer_->AppendValue<size_t>(smallest_key_.size());
   writer_->AppendString(smallest_key_.GetSlice());
+  if (range_filter_prefix_length_ > 0) {
+    std::string range_filter;
+    utils::BlockedBloomFilter::Create(
+        prefix_hashes_.size(), bloom_bits_per_key_, range_filter);
+    for (const auto& hash : prefix_hashes_) {
+      utils::BlockedBloomFilter::Add(hash, range_filter);
+    }
+    writer_->AppendValue<size_t>(range_filter_prefix_length_);
+    writer_->AppendValue<size_t>(range_filter.size());
+    writer_->AppendString(range_filter);
+  }
+  if (!blob_file_numbers_.empty()) {
+    std::sort(blob_file_numbers_.begin(), blob_file_numbers_.end());
+    blob_file_numbers_.erase(
+        std::unique(blob_file_numbers_.begin(), blob_file_numbers_.end()),
+        blob_file_numbers_.end());
+    writer_->AppendValue<size_t>(blob_file_numbers_.size());
+    for (auto number : blob_file_numbers_) {
+      writer_->AppendValue<uint64_t>(number);
+    }
+  }
+  if (!range_tombstones_.empty()) {
+    writer_->AppendValue<size_t>(range_tombstones_.size());
+    for (auto& tombstone : range_tombstones_) {
+      writer_->AppendValue<size_t>(tombstone.begin_.size());
+      writer_->AppendString(tombstone.begin_);
+      writer_->AppendValue<size_t>(tombstone.end_.size());
+      writer_->AppendString(tombstone.end_);
+      writer_->AppendValue<seq_t>(tombstone.seq_);
+    }
+  }
   writer_->AppendValue<size_t>(index_offset_);
   writer_->AppendValue<size_t>(bloom_filter_offset_ + 2 * sizeof(size_t));
   writer_->AppendValue<size_t>(count_);
+  uint64_t formats = kSSTHasBlockCodecs |
+                     static_cast<uint64_t>(filter_format_) << 4 |
+                     static_cast<uint64_t>(block_builder_.format());
+  if (range_filter_prefix_length_ > 0) {
+    formats |= kSSTHasRangeFilter;
+  }
+  if (!blob_file_numbers_.empty()) {
+    formats |= kSSTHasBlobRefs;
+  }
+  if (!range_tombstones_.empty()) {
+    formats |= kSSTHasRangeTombstones;
+  }
+  if (formats != 0) {
+    writer_->AppendValue<uint64_t>(kSSTFooterMagic | formats);
+  }
   writer_->Flush();
 }
 
@@ -200,6 +598,8 @@ void SSTableBuilder::transfor_data_from_block_builder() {
   index_value.key_ = block_builder_.largest_key;
   index_value.block_.count_ = block_builder_.count();
   index_value.block_.size_ = block_builder_.size();
+  index_value.block_.stored_size_ = block_builder_.stored_size();
+  index_value.block_.codec_ = block_builder_.stored_codec();
   index_value.block_.offset_ = current_block_offset_;
   index_data_.push_back(index_value);
 
@@ -207,10 +607,10 @@ void SSTableBuilder::transfor_data_from_block_builder() {
     largest_key_ = InternalKey(block_builder_.largest_key);
   // if (index_data_.size() <= 1 || block_builder_.smallest_key < ParsedKey(smallest_key_))
   //   smallest_key_ = InternalKey(block_builder_.smallest_key);
-  index_offset_ += block_builder_.size();
+  index_offset_ += block_builder_.stored_size();
   count_ += block_builder_.count();
-  current_block_offset_ += block_builder_.size();
-  bloom_filter_offset_ += block_builder_.size() + index_value.key_.size() + sizeof(BlockHandle) + sizeof(size_t);
+  current_block_offset_ += block_builder_.stored_size();
+  bloom_filter_offset_ += block_builder_.stored_size() + index_value.key_.size() + sizeof(BlockHandle) + sizeof(size_t);
 }
 
 }  // namespace lsm
@@ -1,9 +1,14 @@
 #pragma once
 
+#include <algorithm>
+#include <memory>
+#include <optional>
+#include <span>
 #include <string>
 #include <vector>
-#include <algorithm>
 
+#include "common/bloomfilter.hpp"
+#include "storage/lsm/blob.hpp"
 #include "storage/lsm/block.hpp"
 #include "storage/lsm/cache.hpp"
 #include "storage/lsm/common.hpp"
@@ -11,12 +16,114 @@
 #include "storage/lsm/format.hpp"
 #include "storage/lsm/iterator.hpp"
 #include "storage/lsm/options.hpp"
+#include "storage/lsm/range_tombstone.hpp"
 
 namespace wing {
 
 namespace lsm {
 
+class SSTable;
 class SSTableIterator;
+class SSTableReader;
+class TableCache;
+
+/**
+ * A data block read from an SSTable.
+ * If the SSTable is memory-mapped, it points to the block in the mapping.
+ * Otherwise, if the block cache is enabled, the block is pinned in the cache
+ * until it is destroyed. Otherwise, it owns the buffer of the block.
+ * Compressed blocks are decompressed before they are pinned or cached.
+ */
+class PinnedBlock {
+ public:
+  PinnedBlock() = default;
+
+  PinnedBlock(const char* mapped, std::shared_ptr<SSTableReader> reader)
+    : mapped_(mapped), reader_(std::move(reader)) {}
+
+  PinnedBlock(Cache::Handle handle) : handle_(std::move(handle)) {}
+
+  PinnedBlock(AlignedBuffer buf) : buf_(std::move(buf)) {}
+
+  const char* data() const {
+    if (mapped_ != nullptr) {
+      return mapped_;
+    }
+    return handle_ ? handle_->block().data() : buf_.data();
+  }
+
+ private:
+  /* It is valid as long as the reader, which owns the mapping, is alive. */
+  const char* mapped_{nullptr};
+  std::shared_ptr<SSTableReader> reader_;
+  std::optional<Cache::Handle> handle_;
+  AlignedBuffer buf_;
+};
+
+/* A data block to be read by SSTable::ReadBlocks. */
+struct BlockRead {
+  SSTable* sst_;
+  /* The reader of sst_, which is pinned until the block is read. */
+  std::shared_ptr<SSTableReader> reader_;
+  BlockHandle handle_;
+  /* The block, which is set by SSTable::ReadBlocks. */
+  PinnedBlock block_;
+};
+
+/**
+ * The parts of an SSTable which are only needed to read its data blocks: the
+ * file handle, the index block and the bloom filter. A reader is opened by
+ * SSTable::GetReader, and is kept open by the TableCache (see
+ * lsm/table_cache.hpp) until it is evicted. Iterators and blocks read from a
+ * memory-mapped file pin the reader, so an evicted reader is closed when
+ * they are destroyed.
+ *
+ * The index block is not decoded. It is searched in place, so a reader costs
+ * about the size of the index block and the bloom filter in the file.
+ */
+class SSTableReader {
+ public:
+  /**
+   * charge_cache: If it is not nullptr, the index block and the bloom filter
+   * are looked up in and inserted into it, like data blocks, and they are
+   * pinned in it until the reader is closed. Otherwise, the reader owns them.
+   */
+  SSTableReader(const SSTable& sst, Cache* charge_cache);
+
+  ReadFile* file() const { return file_.get(); }
+
+  /* The number of data blocks. */
+  size_t BlockCount() const { return block_count_; }
+
+  /* The largest key in the i-th data block. */
+  ParsedKey IndexKey(size_t i) const;
+
+  /* The handle of the i-th data block. */
+  BlockHandle IndexHandle(size_t i) const;
+
+  /**
+   * The index of the first data block whose largest key >= (key, seq), or
+   * BlockCount() if there is no such block.
+   */
+  size_t FindBlock(Slice key, seq_t seq) const;
+
+  /* Return false if the bloom filter shows that key is not in the SSTable. */
+  bool MayContain(Slice key) const;
+
+ private:
+  /* The offset of the i-th index entry in index_. */
+  size_t EntryOffset(size_t i) const;
+
+  std::unique_ptr<ReadFile> file_;
+  /* The index block and the bloom filter, see charge_cache. */
+  std::string_view index_, bloom_filter_;
+  std::string index_buf_, bloom_filter_buf_;
+  std::optional<Cache::Handle> index_handle_, bloom_filter_handle_;
+  size_t block_count_{0};
+  /* The size of the block handles in the index entries. */
+  size_t handle_size_;
+  utils::BloomFilterFormat filter_format_;
+};
 
 class SSTable {
  public:
@@ -26,8 +133,23 @@ class SSTable {
    * Below are global options (see lsm/options.hpp):
    * block_size: The size of data block in the SSTable
    * use_direct_io: Enable O_DIRECT or not.
+   * -----------------------
+   * cache: The block cache. Data blocks are looked up by (sst_id, offset) in
+   * the cache before reading the file. If it is nullptr, every block access
+   * reads the file.
+   * use_mmap: Map the file into memory. Data blocks are accessed in the
+   * mapping directly, without copying them or going through the cache.
+   * blob_files: The blob files which the values of type RecordType::BlobIndex
+   * are read from. The SSTable keeps the blob files it references open, so
+   * that they are not removed while it is alive.
+   * table_cache: The cache which keeps the readers open. If it is nullptr,
+   * the reader is opened in construction and kept open until destruction.
+   * Only the key range, the range filter, the blob file references and the
+   * range tombstones stay in memory for the lifetime of the SSTable.
    */
-  SSTable(SSTInfo sst_info, size_t block_size, bool use_direct_io);
+  SSTable(SSTInfo sst_info, size_t block_size, bool use_direct_io,
+      Cache* cache = nullptr, bool use_mmap = false,
+      BlobFileSet* blob_files = nullptr, TableCache* table_cache = nullptr);
 
   ~SSTable();
 
@@ -35,18 +157,58 @@ class SSTable {
    * Try to get the associated value of key with the sequence number <= seq.
    * If the record has type RecordType::Value, then it copies the value,
    * and returns GetResult::kFound
+   * If the record has type RecordType::BlobIndex, then it reads the value
+   * from the blob file, and returns GetResult::kFound
    * If the record has type RecordType::Deletion, then it does nothing to the
    * value, and returns GetResult::kDelete If there is no such record, it
    * returns GetResult::kNotFound.
+   * If the record has type RecordType::Merge, then it does nothing to the
+   * value, and returns GetResult::kMerge.
    * */
   GetResult Get(Slice key, uint64_t seq, std::string* value, uint64_t* seq_found = nullptr);
 
+  /* Return false if the bloom filter shows that key is not in the SSTable. */
+  bool MayContain(Slice key) const;
+
+  /**
+   * Return false if the key range or the range filter shows that no user key
+   * in [lower, upper] is in the SSTable. The range filter is a bloom filter
+   * of the key prefixes, and it is probed with every prefix between those of
+   * lower and upper, unless there are more than kMaxRangeFilterProbes.
+   */
+  bool MayContainRange(Slice lower, Slice upper) const;
+
+  /**
+   * Return the reader of the SSTable. It is opened if it is not in the table
+   * cache.
+   */
+  std::shared_ptr<SSTableReader> GetReader() const;
+
+  /* Same as Get, but it looks up the given data block, see FindBlock. */
+  GetResult GetFromBlock(const char* block, BlockHandle handle, Slice key,
+      uint64_t seq, std::string* value, uint64_t* seq_found = nullptr) const;
+
+  /**
+   * Read the data blocks of (possibly different) SSTables. The blocks which
+   * are not in the block cache or in the mapping are read by one
+   * ReadFile::MultiRead, so the reads overlap with each other. Then they are
+   * inserted into the block cache.
+   */
+  static void ReadBlocks(std::span<BlockRead> reads);
+
   /* Return an iterator positioned at the first record that is not smaller than
-   * (key, seq). */
-  SSTableIterator Seek(Slice key, uint64_t seq);
+   * (key, seq). If fill_cache is false, the blocks read by the iterator are not
+   * inserted into the block cache. */
+  SSTableIterator Seek(Slice key, uint64_t seq, bool fill_cache = true);
 
   /* Return an iterator positioned at the beginning of the SSTable */
-  SSTableIterator Begin();
+  SSTableIterator Begin(bool fill_cache = true);
+
+  /* Return an iterator positioned at the last record <= (key, seq). */
+  SSTableIterator SeekForPrev(Slice key, uint64_t seq, bool fill_cache = true);
+
+  /* Return an iterator positioned at the last record of the SSTable. */
+  SSTableIterator Last(bool fill_cache = true);
 
   /* The largest key of the SSTable. */
   ParsedKey GetLargestKey() const { return largest_key_; }
@@ -54,6 +216,14 @@ class SSTable {
   /* The smallest key of the SSTable. */
   ParsedKey GetSmallestKey() const { return smallest_key_; }
 
+  /**
+   * The range tombstones stored in the SSTable. They are not clipped to the
+   * key range of the SSTable.
+   */
+  const RangeTombstoneList& GetRangeTombstones() const {
+    return range_tombstones_;
+  }
+
   void SetCompactionInProcess(bool compaction_in_process) {
     compaction_in_process_ = compaction_in_process;
   }
@@ -66,32 +236,77 @@ class SSTable {
 
   const SSTInfo& GetSSTInfo() const { return sst_info_; }
 
+  /* The size of the bloom filter in bytes. */
+  size_t GetBloomFilterSize() const { return bloom_filter_size_; }
+
  private:
+  /**
+   * Read a data block from the mapping if the file is memory-mapped.
+   * Otherwise, read it through the block cache. If fill_cache is false, a
+   * block missing in the cache is read from the file without being inserted,
+   * so that long scans (e.g. compactions) do not evict hot blocks.
+   */
+  PinnedBlock ReadBlock(const std::shared_ptr<SSTableReader>& reader,
+      BlockHandle handle, bool fill_cache = true);
+
+  /**
+   * Decompress the block, whose stored bytes are read into stored, into the
+   * block cache, or into a buffer if fill_cache is false.
+   */
+  PinnedBlock PinDecompressedBlock(
+      BlockHandle handle, const char* stored, bool fill_cache = true);
+
   /* The information of SSTable. */
   SSTInfo sst_info_;
-  /* The file manager. */
-  std::unique_ptr<ReadFile> file_;
-  /* The index data, which is initialized in construction. */
-  std::vector<IndexValue> index_;
   /* The block size of the data block. */
   size_t block_size_;
+  /* How the reader opens the file. */
+  bool use_direct_io_;
+  bool use_mmap_;
+  /* The reader, if there is no table cache. */
+  std::shared_ptr<SSTableReader> reader_;
+  /* The table cache. It can be nullptr. */
+  TableCache* table_cache_{nullptr};
+  /* The offset and the size of the index block. */
+  size_t index_offset_{0};
+  size_t index_size_{0};
+  /* The size of the block handles in the index entries. */
+  size_t handle_size_{kLegacyBlockHandleSize};
+  /* The offset of the bloom filter. */
+  size_t bloom_filter_offset_{0};
   /* The key range of the SSTable, which is initialized in construction. */
   InternalKey smallest_key_, largest_key_;
   /* If it is picked as an input of a compaction task. */
   bool compaction_in_process_{false};
   /* If it is true, then the SSTable file will be removed in deconstrution. */
   bool remove_tag_{false};
-  /* The bloom filter buffer */
-  std::string bloom_filter_;
+  /* The size of the bloom filter. */
+  size_t bloom_filter_size_{0};
+  /* The format of the data blocks, which is read from the footer. */
+  BlockFormat block_format_{BlockFormat::kPlain};
+  /* The format of the bloom filter, which is read from the footer. */
+  utils::BloomFilterFormat filter_format_{utils::BloomFilterFormat::kStandard};
+  /* The bloom filter of the key prefixes. It is empty if there is none. */
+  std::string range_filter_;
+  /* The length of the key prefixes in the range filter. */
+  size_t range_filter_prefix_length_{0};
+  /* The block cache. It can be nullptr. */
+  Cache* cache_{nullptr};
+  /* The blob files referenced by the SSTable, sorted by their numbers. */
+  std::vector<std::shared_ptr<BlobFile>> blob_files_;
+  /* The range tombstones stored in the SSTable. */
+  RangeTombstoneList range_tombstones_;
 
   friend class SSTableIterator;
+  friend class SSTableReader;
 };
 
 class SSTableIterator final : public Iterator {
  public:
   SSTableIterator() = default;
 
-  SSTableIterator(SSTable* sst) : sst_(sst), buf_(sst->block_size_, 4096) {
+  SSTableIterator(SSTable* sst, bool fill_cache = true)
+    : sst_(sst), reader_(sst->GetReader()), fill_cache_(fill_cache) {
     SeekToFirst();
   }
 
@@ -101,6 +316,12 @@ class SSTableIterator final : public Iterator {
   /* Find the first record >= (user_key, seq) */
   void Seek(Slice key, uint64_t seq);
 
+  /* Move to the last record. */
+  void SeekToLast();
+
+  /* Find the last record <= (user_key, seq) */
+  void SeekForPrev(Slice key, uint64_t seq);
+
   bool Valid() override;
 
   Slice key() const override;
@@ -109,31 +330,65 @@ class SSTableIterator final : public Iterator {
 
   void Next() override;
 
+  void Prev() override;
+
   void BlockNext() { block_it_.Next(); }
 
+  /* Read the block_id-th data block and iterate over it. */
+  void ReadBlock(size_t block_id);
+
   /* The reference to the SSTable */
   SSTable* sst_{nullptr};
+  /* The reader of the SSTable, which stays open while the iterator is alive. */
+  std::shared_ptr<SSTableReader> reader_;
+  /* Whether the blocks read by the iterator are inserted into the cache. */
+  bool fill_cache_{true};
   /* Current data block id */
   size_t block_id_{0};
   offset_t record_id_{0};
   /* The block iterator of the current data block. */
   BlockIterator block_it_;
-  /* The buffer */
-  AlignedBuffer buf_;
+  /* The current data block. It stays pinned while the iterator is on it. */
+  PinnedBlock block_;
 };
 
 class SSTableBuilder {
  public:
+  /**
+   * block_restart_interval: The number of records between two restart points
+   * in a data block. If it is 0, the blocks are written in the
+   * BlockFormat::kPlain format.
+   * filter_format: The format of the bloom filter.
+   * range_filter_prefix_length: The length of the key prefixes in the range
+   * filter. If it is 0, there is no range filter.
+   * codec: The codec of the data blocks.
+   */
   SSTableBuilder(std::unique_ptr<FileWriter> writer, size_t block_size,
-      size_t bloom_bits_per_key)
+      size_t bloom_bits_per_key,
+      size_t block_restart_interval = kDefaultBlockRestartInterval,
+      utils::BloomFilterFormat filter_format =
+          utils::BloomFilterFormat::kBlocked,
+      size_t range_filter_prefix_length = 0,
+      BlockCodec codec = BlockCodec::kNone)
     : writer_(std::move(writer)),
-      block_builder_(block_size, writer_.get()),
-      bloom_bits_per_key_(bloom_bits_per_key) {}
+      block_builder_(
+          block_size, writer_.get(), block_restart_interval, codec),
+      bloom_bits_per_key_(bloom_bits_per_key),
+      filter_format_(filter_format),
+      range_filter_prefix_length_(range_filter_prefix_length) {}
 
   ~SSTableBuilder() = default;
 
   void Append(ParsedKey key, Slice value);
 
+  /**
+   * Store a range tombstone in the SSTable. It may cover keys out of the key
+   * range of the SSTable, and it does not count as a record.
+   */
+  void AddRangeTombstone(const RangeTombstone& tombstone) {
+    range_tombstones_.push_back(tombstone);
+  }
+
   void Finish();
 
   std::vector<IndexValue> GetIndexData() const { return index_data_; }
@@ -171,6 +426,18 @@ class SSTableBuilder {
   size_t bloom_filter_offset_{0};
   /* The number of bits per key in bloom filter */
   size_t bloom_bits_per_key_{0};
+  /* The format of bloom filter */
+  utils::BloomFilterFormat filter_format_;
+  /* The length of the key prefixes in the range filter */
+  size_t range_filter_prefix_length_{0};
+  /* hashes of the distinct key prefixes used to build the range filter */
+  std::vector<size_t> prefix_hashes_;
+  /* The prefix of the last appended key */
+  std::string last_prefix_;
+  /* The numbers of the blob files referenced by the records */
+  std::vector<uint64_t> blob_file_numbers_;
+  /* The range tombstones */
+  std::vector<RangeTombstone> range_tombstones_;
 
   void transfor_data_from_block_builder();
 };
@@ -13,11 +13,23 @@ struct StatsContext {
   std::atomic<uint64_t> total_write_bytes{0};
   /* Total bytes of flushed MemTable */
   std::atomic<uint64_t> total_input_bytes{0};
+  /* Total bytes written to the write-ahead log */
+  std::atomic<uint64_t> total_wal_bytes{0};
+  /* The number of fdatasync calls on the write-ahead log */
+  std::atomic<uint64_t> total_wal_syncs{0};
+  /* Total time (in microseconds) that writes are stopped */
+  std::atomic<uint64_t> write_stall_micros{0};
+  /* Total time (in microseconds) that writes are delayed to slow down */
+  std::atomic<uint64_t> write_delay_micros{0};
 
   void Reset() {
     total_read_bytes = 0;
     total_write_bytes = 0;
     total_input_bytes = 0;
+    total_wal_bytes = 0;
+    total_wal_syncs = 0;
+    write_stall_micros = 0;
+    write_delay_micros = 0;
   }
 };
 
@@ -0,0 +1,59 @@
+#include "storage/lsm/table_cache.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+std::shared_ptr<SSTableReader> TableCache::Get(const SSTable& sst) {
+  uint64_t sst_id = sst.GetSSTInfo().sst_id_;
+  {
+    std::unique_lock lock(mu_);
+    auto it = index_.find(sst_id);
+    if (it != index_.end()) {
+      lru_.splice(lru_.begin(), lru_, it->second);
+      return it->second->second;
+    }
+  }
+  /* Open the reader without holding the lock, since it reads the file. */
+  auto reader = std::make_shared<SSTableReader>(sst, charge_cache_);
+  /* The evicted readers are closed after the lock is released. */
+  std::vector<std::shared_ptr<SSTableReader>> evicted;
+  std::unique_lock lock(mu_);
+  auto [it, inserted] = index_.emplace(sst_id, lru_.end());
+  if (!inserted) {
+    /* Another thread has opened it. */
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return it->second->second;
+  }
+  lru_.emplace_front(sst_id, reader);
+  it->second = lru_.begin();
+  while (capacity_ > 0 && lru_.size() > capacity_) {
+    index_.erase(lru_.back().first);
+    evicted.push_back(std::move(lru_.back().second));
+    lru_.pop_back();
+  }
+  lock.unlock();
+  return reader;
+}
+
+void TableCache::Erase(uint64_t sst_id) {
+  std::shared_ptr<SSTableReader> reader;
+  std::unique_lock lock(mu_);
+  auto it = index_.find(sst_id);
+  if (it == index_.end()) {
+    return;
+  }
+  reader = std::move(it->second->second);
+  lru_.erase(it->second);
+  index_.erase(it);
+  lock.unlock();
+}
+
+size_t TableCache::size() {
+  std::unique_lock lock(mu_);
+  return lru_.size();
+}
+
+}  // namespace lsm
+
+}  // namespace wing
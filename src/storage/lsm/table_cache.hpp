@@ -0,0 +1,54 @@
+#pragma once
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "storage/lsm/cache.hpp"
+#include "storage/lsm/sst.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+/**
+ * An LRU cache of the open SSTable readers (see SSTableReader), which bounds
+ * the number of open files and the memory of the index blocks and the bloom
+ * filters. A reader is opened on a miss, and the least recently used one is
+ * closed when there are more than capacity readers. A closed reader which is
+ * still pinned, e.g. by an iterator, stays open until it is released.
+ */
+class TableCache {
+ public:
+  /**
+   * capacity: The maximum number of open readers. If it is 0, readers are
+   * never closed.
+   * charge_cache: The block cache which the index blocks and the bloom
+   * filters are charged to. If it is nullptr, they are owned by the readers.
+   */
+  TableCache(size_t capacity, Cache* charge_cache = nullptr)
+    : capacity_(capacity), charge_cache_(charge_cache) {}
+
+  /* Return the reader of sst, and open it if it is not in the cache. */
+  std::shared_ptr<SSTableReader> Get(const SSTable& sst);
+
+  /* Close the reader of the SSTable, which is called when it is removed. */
+  void Erase(uint64_t sst_id);
+
+  /* The number of open readers in the cache. */
+  size_t size();
+
+ private:
+  const size_t capacity_;
+  Cache* const charge_cache_;
+  std::mutex mu_;
+  /* The readers, from the most recently used to the least. */
+  std::list<std::pair<uint64_t, std::shared_ptr<SSTableReader>>> lru_;
+  std::unordered_map<uint64_t, decltype(lru_)::iterator> index_;
+};
+
+}  // namespace lsm
+
+}  // namespace wing
@@ -5,16 +5,46 @@ namespace wing {
 
 namespace lsm {
 
-bool Version::Get(std::string_view user_key, seq_t seq, std::string* value) {
+GetResult Version::Get(std::string_view user_key, seq_t seq,
+    std::string* value, seq_t* seq_found) {
+  if (seq_found) *seq_found = 0;
   for (auto& lev : levels_) {
-    GetResult res = lev.Get(user_key, seq, value);
-    if (res == GetResult::kFound) {
-      return true;
-    } else if (res == GetResult::kDelete) {
-      return false;
+    GetResult res = lev.Get(user_key, seq, value, seq_found);
+    if (res != GetResult::kNotFound) {
+      return res;
+    }
+  }
+  return GetResult::kNotFound;
+}
+
+void Version::MultiGet(std::span<const Slice> keys, seq_t seq,
+    std::span<GetResult> results, std::string* values) {
+  std::vector<size_t> ids;
+  std::vector<Slice> level_keys;
+  std::vector<GetResult> level_results;
+  std::vector<std::string> level_values;
+  for (auto& lev : levels_) {
+    ids.clear();
+    level_keys.clear();
+    for (size_t i = 0; i < keys.size(); i++) {
+      if (results[i] == GetResult::kNotFound) {
+        ids.push_back(i);
+        level_keys.push_back(keys[i]);
+      }
+    }
+    if (ids.empty()) {
+      return;
+    }
+    level_results.resize(ids.size());
+    level_values.resize(ids.size());
+    lev.MultiGet(level_keys, seq, level_results, level_values.data());
+    for (size_t j = 0; j < ids.size(); j++) {
+      results[ids[j]] = level_results[j];
+      if (level_results[j] == GetResult::kFound) {
+        values[ids[j]] = std::move(level_values[j]);
+      }
     }
   }
-  return false;
 }
 
 void Version::Append(
@@ -22,30 +52,88 @@ void Version::Append(
   while (levels_.size() <= level_id) {
     levels_.push_back(Level(levels_.size()));
   }
+  for (auto& run : sorted_runs) {
+    AddRangeTombstones(*run);
+  }
   levels_[level_id].Append(std::move(sorted_runs));
 }
 void Version::Append(uint32_t level_id, std::shared_ptr<SortedRun> sorted_run) {
   while (levels_.size() <= level_id) {
     levels_.push_back(Level(levels_.size()));
   }
+  AddRangeTombstones(*sorted_run);
   levels_[level_id].Append(std::move(sorted_run));
 }
 
-bool SuperVersion::Get(
+void Version::AddRangeTombstones(const SortedRun& run) {
+  for (auto& sst : run.GetSSTs()) {
+    range_tombstones_.Add(sst->GetRangeTombstones());
+  }
+}
+
+seq_t SuperVersion::MaxCoveringSeq(Slice user_key, seq_t seq) const {
+  auto ret = mt_->MaxCoveringSeq(user_key, seq);
+  for (auto& imm : *imms_) {
+    ret = std::max(ret, imm->MaxCoveringSeq(user_key, seq));
+  }
+  return std::max(
+      ret, version_->GetRangeTombstones().MaxCoveringSeq(user_key, seq));
+}
+
+RangeTombstoneList SuperVersion::GetRangeTombstones() const {
+  auto ret = mt_->GetRangeTombstones();
+  for (auto& imm : *imms_) {
+    ret.Add(imm->GetRangeTombstones());
+  }
+  ret.Add(version_->GetRangeTombstones());
+  return ret;
+}
+
+GetResult SuperVersion::Lookup(
     std::string_view user_key, seq_t seq, std::string* value) {
-  GetResult res = mt_->Get(user_key, seq, value);
+  /* The latest record is deleted if it is older than a range tombstone. */
+  auto tombstone_seq = MaxCoveringSeq(user_key, seq);
+  auto covered = [&](GetResult res, seq_t seq_found) {
+    return res != GetResult::kNotFound && seq_found <= tombstone_seq
+               ? GetResult::kDelete
+               : res;
+  };
+  seq_t seq_found = 0;
+  GetResult res = mt_->Get(user_key, seq, value, &seq_found);
   if (res != GetResult::kNotFound) {
-    if (res == GetResult::kDelete) return false;
-    return true;
+    return covered(res, seq_found);
   }
   for (auto& imm : *imms_) {
-    res = imm->Get(user_key, seq, value);
+    res = imm->Get(user_key, seq, value, &seq_found);
     if (res != GetResult::kNotFound) {
-      if (res == GetResult::kDelete) return false;
-      return true;
+      return covered(res, seq_found);
     }
   }
-  return version_->Get(user_key, seq, value);
+  res = version_->Get(user_key, seq, value, &seq_found);
+  return covered(res, seq_found);
+}
+
+std::vector<GetResult> SuperVersion::MultiGet(std::span<const Slice> keys,
+    seq_t seq, std::vector<std::string>* values) {
+  values->resize(keys.size());
+  std::vector<GetResult> results(keys.size(), GetResult::kNotFound);
+  for (size_t i = 0; i < keys.size(); i++) {
+    results[i] = mt_->Get(keys[i], seq, &(*values)[i]);
+    for (auto it = imms_->begin();
+         results[i] == GetResult::kNotFound && it != imms_->end(); ++it) {
+      results[i] = (*it)->Get(keys[i], seq, &(*values)[i]);
+    }
+  }
+  version_->MultiGet(keys, seq, results, values->data());
+  for (size_t i = 0; i < keys.size(); i++) {
+    /* A key covered by a range tombstone is looked up again by Lookup. */
+    if ((results[i] == GetResult::kFound ||
+            results[i] == GetResult::kMerge) &&
+        MaxCoveringSeq(keys[i], seq) > 0) {
+      results[i] = Lookup(keys[i], seq, &(*values)[i]);
+    }
+  }
+  return results;
 }
 
 std::string SuperVersion::ToString() const {
@@ -77,7 +165,40 @@ size_t SuperVersion::count_keys() {
 
 }
 
+SuperVersionIterator::SuperVersionIterator(SuperVersion* sv, Slice lower,
+    Slice upper, seq_t seq, bool fill_cache)
+  : sv_(sv), range_tombstones_(sv->GetRangeTombstones()) {
+  ParsedKey target(lower, seq, RecordType::Value);
+  auto seek_mt = [&](MemTable& mt) {
+    auto mt_it = mt.Seek(lower, seq);
+    if (mt_it.Valid() && ParsedKey(mt_it.key()) >= target) {
+      mt_its_.push_back(std::move(mt_it));
+    }
+  };
+  seek_mt(*sv_->GetMt());
+  for (auto& imm : *sv_->GetImms()) {
+    seek_mt(*imm);
+  }
+  for (auto& level : sv_->GetVersion()->GetLevels()) {
+    for (auto& run : level.GetRuns()) {
+      auto sst_it = run->SeekRange(lower, upper, seq, fill_cache);
+      if (sst_it && sst_it->Valid() && ParsedKey(sst_it->key()) >= target) {
+        sst_its_.push_back(std::move(*sst_it));
+      }
+    }
+  }
+  /* The vectors do not grow anymore, so the pointers stay valid. */
+  for (auto& mt_it : mt_its_) {
+    it_.Push(&mt_it);
+  }
+  for (auto& sst_it : sst_its_) {
+    it_.Push(&sst_it);
+  }
+  it_.Build();
+}
+
 void SuperVersionIterator::SeekToFirst() {
+  reverse_ = false;
   it_.Clear();
   for (auto& mt_it: mt_its_) {
     mt_it.SeekToFirst();
@@ -87,6 +208,7 @@ void SuperVersionIterator::SeekToFirst() {
     sst_it.SeekToFirst();
     it_.Push(&sst_it);
   }
+  it_.Build();
 }
 
 void SuperVersionIterator::Seek(Slice key, seq_t seq) {
@@ -102,6 +224,40 @@ void SuperVersionIterator::Seek(Slice key, seq_t seq) {
     if (sst_it.Valid() && ParsedKey(sst_it.key()) >= ParsedKey(key, seq, RecordType::Value))
       it_.Push(&sst_it);
   }
+  it_.Build();
+}
+
+void SuperVersionIterator::SeekToLast() {
+  reverse_ = true;
+  it_.Clear();
+  for (auto& mt_it : mt_its_) {
+    mt_it.SeekToLast();
+    it_.Push(&mt_it);
+  }
+  for (auto& sst_it : sst_its_) {
+    sst_it.SeekToLast();
+    it_.Push(&sst_it);
+  }
+  it_.Build(true);
+}
+
+void SuperVersionIterator::SeekForPrev(Slice key, seq_t seq) {
+  ParsedKey target(key, seq, RecordType::Value);
+  reverse_ = true;
+  it_.Clear();
+  for (auto& mt_it : mt_its_) {
+    mt_it.SeekForPrev(key, seq);
+    if (mt_it.Valid() && ParsedKey(mt_it.key()) <= target) {
+      it_.Push(&mt_it);
+    }
+  }
+  for (auto& sst_it : sst_its_) {
+    sst_it.SeekForPrev(key, seq);
+    if (sst_it.Valid() && ParsedKey(sst_it.key()) <= target) {
+      it_.Push(&sst_it);
+    }
+  }
+  it_.Build(true);
 }
 
 bool SuperVersionIterator::Valid() { return it_.Valid(); }
@@ -110,7 +266,23 @@ Slice SuperVersionIterator::key() const { return it_.key(); }
 
 Slice SuperVersionIterator::value() const { return it_.value(); }
 
-void SuperVersionIterator::Next() { it_.Next(); }
+void SuperVersionIterator::Next() {
+  if (reverse_) {
+    /* Position the children at the first record >= the current one. */
+    InternalKey current(it_.key());
+    Seek(current.user_key(), current.seq());
+  }
+  it_.Next();
+}
+
+void SuperVersionIterator::Prev() {
+  if (!reverse_) {
+    /* Position the children at the last record <= the current one. */
+    InternalKey current(it_.key());
+    SeekForPrev(current.user_key(), current.seq());
+  }
+  it_.Prev();
+}
 
 }  // namespace lsm
 
@@ -1,8 +1,8 @@
 #pragma once
 
 #include "storage/lsm/common.hpp"
-#include "storage/lsm/iterator_heap.hpp"
 #include "storage/lsm/level.hpp"
+#include "storage/lsm/loser_tree.hpp"
 #include "storage/lsm/memtable.hpp"
 #include "storage/lsm/sst.hpp"
 
@@ -12,16 +12,36 @@ namespace lsm {
 
 class Version {
  public:
-  Version(std::vector<Level>&& levels) : levels_(std::move(levels)) {}
+  Version(std::vector<Level>&& levels) : levels_(std::move(levels)) {
+    for (auto& level : levels_) {
+      for (auto& run : level.GetRuns()) {
+        AddRangeTombstones(*run);
+      }
+    }
+  }
 
   Version() = default;
 
-  // Return true if the GetResult is kFound
-  // Otherwise return false
-  bool Get(Slice user_key, seq_t seq, std::string* value);
+  // Return the GetResult of the latest record of user_key
+  // If seq_found is not nullptr, it is set to the sequence number of the
+  // latest record of user_key, or 0 if there is none.
+  GetResult Get(Slice user_key, seq_t seq, std::string* value,
+      seq_t* seq_found = nullptr);
+
+  /**
+   * Get the keys whose results[i] is GetResult::kNotFound level by level.
+   * In each level, the data blocks of the keys are read in one batch.
+   */
+  void MultiGet(std::span<const Slice> keys, seq_t seq,
+      std::span<GetResult> results, std::string* values);
 
   const std::vector<Level>& GetLevels() const { return levels_; }
 
+  /* The range tombstones of all the SSTables. */
+  const RangeTombstoneList& GetRangeTombstones() const {
+    return range_tombstones_;
+  }
+
   /**
    * Append sorted runs to the Level level_id
    * It will create new levels if level_id >= levels_.size()
@@ -36,7 +56,10 @@ class Version {
   void Append(uint32_t level_id, std::shared_ptr<SortedRun> sorted_run);
 
  private:
+  void AddRangeTombstones(const SortedRun& run);
+
   std::vector<Level> levels_;
+  RangeTombstoneList range_tombstones_;
 };
 
 class SuperVersionIterator;
@@ -58,7 +81,32 @@ class SuperVersion {
 
   // Return true if the GetResult is kFound
   // Otherwise return false
-  bool Get(Slice user_key, seq_t seq, std::string* value);
+  bool Get(Slice user_key, seq_t seq, std::string* value) {
+    return Lookup(user_key, seq, value) == GetResult::kFound;
+  }
+
+  /**
+   * Return the GetResult of the latest record of user_key, which is kDelete
+   * if it is deleted by a range tombstone. If it is kMerge, the operands are
+   * folded by DBImpl, which knows the merge operator.
+   */
+  GetResult Lookup(Slice user_key, seq_t seq, std::string* value);
+
+  /**
+   * The largest sequence number <= seq of the range tombstones covering
+   * user_key in the MemTables and the SSTables, or 0 if there are none.
+   */
+  seq_t MaxCoveringSeq(Slice user_key, seq_t seq) const;
+
+  /* All the range tombstones in the MemTables and the SSTables. */
+  RangeTombstoneList GetRangeTombstones() const;
+
+  /**
+   * Look up a batch of keys as Lookup does. (*values)[i] is the value of
+   * keys[i] if the returned result of keys[i] is GetResult::kFound.
+   */
+  std::vector<GetResult> MultiGet(std::span<const Slice> keys, seq_t seq,
+      std::vector<std::string>* values);
 
   std::string ToString() const;
 
@@ -74,7 +122,12 @@ class SuperVersion {
 
 class SuperVersionIterator final : public Iterator {
  public:
-  SuperVersionIterator(SuperVersion* sv) : sv_(sv) {
+  /**
+   * If fill_cache is false, the blocks read by the iterator are not inserted
+   * into the block cache, e.g. for long scans.
+   */
+  SuperVersionIterator(SuperVersion* sv, bool fill_cache = true)
+    : sv_(sv), range_tombstones_(sv->GetRangeTombstones()) {
     it_.Clear();
     auto mt = sv_->GetMt();
     auto mt_it = mt->Begin();
@@ -86,31 +139,65 @@ class SuperVersionIterator final : public Iterator {
     sst_its_.clear();
     for (auto& level: sv_->GetVersion()->GetLevels()) {
       for (auto& run: level.GetRuns()) {
-        auto sst_it = run->Begin();
+        auto sst_it = run->Begin(fill_cache);
         if (sst_it.Valid()) sst_its_.push_back(std::move(sst_it));
       }
     }
   }
 
+  /**
+   * An iterator positioned at the first record >= (lower, seq), which is
+   * only used to read the user keys in [lower, upper]. The sorted runs
+   * without such keys (see SortedRun::SeekRange) are not read at all, so
+   * records beyond upper may be missing.
+   */
+  SuperVersionIterator(SuperVersion* sv, Slice lower, Slice upper, seq_t seq,
+      bool fill_cache = true);
+
   /* Move the the beginning */
   void SeekToFirst();
 
   /* Find the first record >= (user_key, seq) */
   void Seek(Slice key, seq_t seq);
 
+  /* Move to the last record. */
+  void SeekToLast();
+
+  /* Find the last record <= (user_key, seq) */
+  void SeekForPrev(Slice key, seq_t seq);
+
   bool Valid() override;
 
   Slice key() const override;
 
   Slice value() const override;
 
+  /**
+   * Next and Prev can be mixed. When the direction changes, all the children
+   * are positioned again around the current record.
+   */
   void Next() override;
 
+  void Prev() override;
+
+  /**
+   * The range tombstones of the superversion. The iterator returns the
+   * records covered by them, which are skipped by the reader (see
+   * RangeTombstoneList::Covers).
+   */
+  const RangeTombstoneList& GetRangeTombstones() const {
+    return range_tombstones_;
+  }
+
  private:
   /* The referenced superversion */
   SuperVersion* sv_;
+  /* The range tombstones, copied when the iterator is created. */
+  RangeTombstoneList range_tombstones_;
   /* The iterators */
-  IteratorHeap<Iterator> it_;
+  LoserTree<Iterator> it_;
+  /* Whether it_ is built in reverse, i.e. it moves by Prev. */
+  bool reverse_{false};
   /* The memtable iterators */
   std::vector<MemTableIterator> mt_its_;
   /* The sorted run iterators */
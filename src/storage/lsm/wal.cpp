@@ -0,0 +1,178 @@
+#include "storage/lsm/wal.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <filesystem>
+
+#include "common/exception.hpp"
+#include "common/murmurhash.hpp"
+#include "storage/lsm/stats.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+namespace {
+
+constexpr size_t kLogHeaderSize = sizeof(uint32_t) * 2;
+
+uint32_t LogChecksum(const char* data, size_t n) {
+  return static_cast<uint32_t>(utils::Hash(data, n, 0x20240717));
+}
+
+constexpr size_t kLogEntryHeaderSize =
+    sizeof(RecordType) + sizeof(seq_t) + sizeof(offset_t) * 2;
+
+/* Reserve the header and the count. Return the position of the header. */
+size_t BeginRecord(std::string* rep) {
+  size_t header_pos = rep->size();
+  rep->resize(header_pos + kLogHeaderSize + sizeof(uint32_t));
+  return header_pos;
+}
+
+void AppendEntry(std::string* rep, ParsedKey key, Slice value) {
+  offset_t key_size = key.user_key_.size();
+  offset_t value_size = value.size();
+  rep->append(reinterpret_cast<const char*>(&key.type_), sizeof(RecordType));
+  rep->append(reinterpret_cast<const char*>(&key.seq_), sizeof(seq_t));
+  rep->append(reinterpret_cast<const char*>(&key_size), sizeof(offset_t));
+  rep->append(key.user_key_);
+  rep->append(reinterpret_cast<const char*>(&value_size), sizeof(offset_t));
+  rep->append(value);
+}
+
+void FinishRecord(std::string* rep, size_t header_pos, uint32_t count) {
+  char* payload = rep->data() + header_pos + kLogHeaderSize;
+  uint32_t payload_size = rep->size() - header_pos - kLogHeaderSize;
+  memcpy(payload, &count, sizeof(uint32_t));
+  uint32_t checksum = LogChecksum(payload, payload_size);
+  memcpy(rep->data() + header_pos, &payload_size, sizeof(uint32_t));
+  memcpy(rep->data() + header_pos + sizeof(uint32_t), &checksum,
+      sizeof(uint32_t));
+}
+
+}  // namespace
+
+LogWriter::LogWriter(const std::string& filename, bool sync)
+  : filename_(filename), sync_(sync) {
+  auto flag = O_WRONLY | O_CREAT | O_TRUNC;
+#if defined(__MINGW64__)
+  flag |= O_BINARY;
+#endif
+  fd_ = ::open(filename.c_str(), flag, 0644);
+  if (fd_ < 0) {
+    throw DBException("::open file {} error! Error: {}", filename, errno);
+  }
+}
+
+LogWriter::~LogWriter() { ::close(fd_); }
+
+void LogWriter::EncodeRecord(std::string* rep, ParsedKey key, Slice value) {
+  size_t header_pos = BeginRecord(rep);
+  AppendEntry(rep, key, value);
+  FinishRecord(rep, header_pos, 1);
+}
+
+void LogWriter::EncodeBatch(
+    std::string* rep, const WriteBatch& batch, seq_t seq) {
+  size_t header_pos = BeginRecord(rep);
+  for (size_t i = 0; i < batch.Count(); i++) {
+    auto record = batch.Get(i);
+    AppendEntry(
+        rep, ParsedKey(record.key_, seq + i, record.type_), record.value_);
+  }
+  FinishRecord(rep, header_pos, batch.Count());
+}
+
+void LogWriter::AddRecords(Slice records) {
+  const char* data = records.data();
+  size_t n = records.size();
+  while (n > 0) {
+    ssize_t ret = ::write(fd_, data, n);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw DBException("::write Error! Error: {}", errno);
+    }
+    data += ret;
+    n -= ret;
+  }
+  size_ += records.size();
+  GetStatsContext()->total_wal_bytes.fetch_add(
+      records.size(), std::memory_order_relaxed);
+  if (sync_) {
+#if defined(__linux__)
+    int ret = ::fdatasync(fd_);
+#elif defined(__MINGW64__)
+    int ret = ::_commit(fd_);
+#endif
+    if (ret < 0) {
+      throw DBException("::fdatasync Error! Error: {}", errno);
+    }
+    GetStatsContext()->total_wal_syncs.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+LogReader::LogReader(const std::string& filename) {
+  size_t size = std::filesystem::file_size(filename);
+  data_.resize(size);
+  if (size > 0) {
+    ReadFile(filename, false).Read(data_.data(), size, 0);
+  }
+}
+
+bool LogReader::ReadRecord(ParsedKey* key, Slice* value) {
+  while (remaining_ == 0) {
+    if (offset_ + kLogHeaderSize > data_.size()) {
+      return false;
+    }
+    uint32_t payload_size, checksum;
+    memcpy(&payload_size, data_.data() + offset_, sizeof(uint32_t));
+    memcpy(&checksum, data_.data() + offset_ + sizeof(uint32_t),
+        sizeof(uint32_t));
+    const char* payload = data_.data() + offset_ + kLogHeaderSize;
+    if (offset_ + kLogHeaderSize + payload_size > data_.size() ||
+        payload_size < sizeof(uint32_t) ||
+        LogChecksum(payload, payload_size) != checksum) {
+      return false;
+    }
+    memcpy(&remaining_, payload, sizeof(uint32_t));
+    entry_ = payload + sizeof(uint32_t);
+    end_ = payload + payload_size;
+    offset_ += kLogHeaderSize + payload_size;
+  }
+  const char* ptr = entry_;
+  RecordType type;
+  seq_t seq;
+  offset_t key_size, value_size;
+  if (ptr + kLogEntryHeaderSize > end_) {
+    return false;
+  }
+  memcpy(&type, ptr, sizeof(RecordType));
+  ptr += sizeof(RecordType);
+  memcpy(&seq, ptr, sizeof(seq_t));
+  ptr += sizeof(seq_t);
+  memcpy(&key_size, ptr, sizeof(offset_t));
+  ptr += sizeof(offset_t);
+  Slice user_key(ptr, key_size);
+  ptr += key_size;
+  if (ptr + sizeof(offset_t) > end_) {
+    return false;
+  }
+  memcpy(&value_size, ptr, sizeof(offset_t));
+  ptr += sizeof(offset_t);
+  if (ptr + value_size > end_) {
+    return false;
+  }
+  *key = ParsedKey(user_key, seq, type);
+  *value = Slice(ptr, value_size);
+  entry_ = ptr + value_size;
+  remaining_ -= 1;
+  return true;
+}
+
+}  // namespace lsm
+
+}  // namespace wing
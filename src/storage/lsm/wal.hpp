@@ -0,0 +1,98 @@
+#pragma once
+
+#include <string>
+
+#include "storage/lsm/common.hpp"
+#include "storage/lsm/format.hpp"
+#include "storage/lsm/write_batch.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+/**
+ * The write-ahead log (WAL) of a MemTable.
+ *
+ * Each MemTable owns one log file, which is removed after the MemTable is
+ * flushed. A record in the log is stored as
+ * | payload size (uint32_t) | checksum (uint32_t) | payload |
+ * and the payload is
+ * | count (uint32_t) | entry 1 | ... | entry count |
+ * where an entry is
+ * | type | seq | key size (offset_t) | key | value size (offset_t) | value |
+ * A record holds a single Put/Del or a whole WriteBatch, so a batch is
+ * recovered either completely or not at all.
+ * A torn record at the tail of the log (e.g. the process crashes in the middle
+ * of a write) is detected by its size or checksum and ignored in recovery.
+ */
+class LogWriter {
+ public:
+  /**
+   * filename: The path of the log file. It is created or truncated.
+   * sync: Whether it calls fdatasync after each AddRecords.
+   */
+  LogWriter(const std::string& filename, bool sync);
+
+  ~LogWriter();
+
+  LogWriter(const LogWriter&) = delete;
+  LogWriter(LogWriter&&) = delete;
+  LogWriter& operator=(const LogWriter&) = delete;
+  LogWriter& operator=(LogWriter&&) = delete;
+
+  /* Encode a record and append it to the end of rep. */
+  static void EncodeRecord(std::string* rep, ParsedKey key, Slice value);
+
+  /**
+   * Encode a batch as one record and append it to the end of rep.
+   * The i-th entry of the batch has the sequence number seq + i.
+   */
+  static void EncodeBatch(std::string* rep, const WriteBatch& batch, seq_t seq);
+
+  /**
+   * Write encoded records (see EncodeRecord) to the file using one write
+   * system call, and sync the file if sync is enabled.
+   */
+  void AddRecords(Slice records);
+
+  /* The total size of the log file. */
+  size_t size() const { return size_; }
+
+ private:
+  int fd_;
+  std::string filename_;
+  bool sync_;
+  size_t size_{0};
+};
+
+class LogReader {
+ public:
+  /* Read the whole log file into memory. */
+  LogReader(const std::string& filename);
+
+  /**
+   * Read the next entry. The returned key and value reference the buffer of
+   * the reader. Return false if it reaches the end of the log or a broken
+   * record.
+   */
+  bool ReadRecord(ParsedKey* key, Slice* value);
+
+ private:
+  std::string data_;
+  /* The offset of the next record. */
+  size_t offset_{0};
+  /* The next entry in the current record, and the end of the record. */
+  const char* entry_{nullptr};
+  const char* end_{nullptr};
+  /* The number of entries left in the current record. */
+  uint32_t remaining_{0};
+};
+
+/* The path of the log file with the log number. */
+inline std::string LogFileName(std::string_view db_path, size_t number) {
+  return fmt::format("{}/{}.log", db_path, number);
+}
+
+}  // namespace lsm
+
+}  // namespace wing
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "storage/lsm/format.hpp"
+
+namespace wing {
+
+namespace lsm {
+
+/**
+ * A batch of Put/Del/Merge/DeleteRange records which are applied atomically by
+ * DBImpl::Write.
+ * The records in a batch get consecutive sequence numbers in the order they
+ * are added, so a later record of the same key overwrites an earlier one.
+ * The keys and values are copied into the batch.
+ */
+class WriteBatch {
+ public:
+  struct Record {
+    RecordType type_;
+    Slice key_;
+    Slice value_;
+  };
+
+  void Put(Slice key, Slice value) { Add(RecordType::Value, key, value); }
+
+  void Del(Slice key) { Add(RecordType::Deletion, key, Slice()); }
+
+  /* Merge the operand into the value of key. See DBImpl::Merge. */
+  void Merge(Slice key, Slice operand) {
+    Add(RecordType::Merge, key, operand);
+  }
+
+  /* Delete the keys in [begin, end). See DBImpl::DeleteRange. */
+  void DeleteRange(Slice begin, Slice end) {
+    Add(RecordType::RangeDeletion, begin, end);
+  }
+
+  /* The number of records. */
+  size_t Count() const { return records_.size(); }
+
+  bool Empty() const { return records_.empty(); }
+
+  /* The total size of keys and values. */
+  size_t size() const { return rep_.size(); }
+
+  Record Get(size_t i) const {
+    const auto& r = records_[i];
+    return Record{r.type_, Slice(rep_.data() + r.offset_, r.key_size_),
+        Slice(rep_.data() + r.offset_ + r.key_size_, r.value_size_)};
+  }
+
+  void Clear() {
+    rep_.clear();
+    records_.clear();
+  }
+
+ private:
+  /* The key and the value are stored contiguously in rep_ from offset_. */
+  struct RecordIndex {
+    RecordType type_;
+    size_t offset_;
+    offset_t key_size_;
+    offset_t value_size_;
+  };
+
+  void Add(RecordType type, Slice key, Slice value) {
+    records_.push_back(RecordIndex{type, rep_.size(),
+        static_cast<offset_t>(key.size()),
+        static_cast<offset_t>(value.size())});
+    rep_.append(key);
+    rep_.append(value);
+  }
+
+  std::string rep_;
+  std::vector<RecordIndex> records_;
+};
+
+}  // namespace lsm
+
+}  // namespace wing
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <functional>
 #include <memory>
+#include <span>
+#include <string_view>
 #include <vector>
 
 #include "catalog/schema.hpp"
@@ -34,6 +37,32 @@ class ModifyHandle {
   virtual bool Delete(std::string_view key) = 0;
   virtual bool Insert(std::string_view key, std::string_view value) = 0;
   virtual bool Update(std::string_view key, std::string_view new_value) = 0;
+  /**
+   * Insert a batch of (key, value) pairs. Return false if a key exists.
+   * By default it calls Insert for each pair and stops at the first failure.
+   * A storage can override it to insert the batch at once.
+   */
+  virtual bool InsertBatch(
+      const std::vector<std::pair<std::string_view, std::string_view>>& kvs) {
+    for (auto& [key, value] : kvs) {
+      if (!Insert(key, value)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  /* Whether Merge is supported. By default it is not. */
+  virtual bool SupportsMerge() const { return false; }
+  /**
+   * Merge the operand into the value of key without reading it. The value
+   * and the operand start with an INT64 counter, e.g. the refcounts of
+   * foreign keys (see FKChecker), and the counter of the operand is added to
+   * that of the value. The rest of the value is kept. If the key does not
+   * exist, the operand is inserted. Return false if it is not supported.
+   */
+  virtual bool Merge(std::string_view key, std::string_view operand) {
+    return false;
+  }
 };
 
 /**
@@ -53,6 +82,18 @@ class SearchHandle {
   virtual ~SearchHandle() = default;
   virtual void Init() = 0;
   virtual const uint8_t* Search(std::string_view key) = 0;
+  /**
+   * Search a batch of keys. f(i, row) is called for each keys[i], where row is
+   * the result of Search(keys[i]) and is only valid in the call.
+   * By default it calls Search for each key. A storage can override it to
+   * overlap the lookups.
+   */
+  virtual void MultiSearch(std::span<const std::string_view> keys,
+      const std::function<void(size_t, const uint8_t*)>& f) {
+    for (size_t i = 0; i < keys.size(); i++) {
+      f(i, Search(keys[i]));
+    }
+  }
 };
 
 class Storage {
@@ -641,6 +641,43 @@ TEST(BasicTest, ForeignKey) {
   std::filesystem::remove_all("__tmp3");
 }
 
+TEST(BasicTest, ForeignKeyBatchInsert) {
+  using namespace wing;
+#define CHECKT(str) EXPECT_TRUE(db->Execute(str).Valid());
+#define CHECKF(str) EXPECT_FALSE(db->Execute(str).Valid());
+  // The LSM refcount tables are updated by merge operands, and the others
+  // are read and updated.
+  for (auto backend : {"lsm", "memory"}) {
+    std::filesystem::remove_all("__tmp4");
+    auto options = wing_test_options;
+    options.storage_backend_name = backend;
+    auto db = std::make_unique<wing::Instance>("__tmp4", options);
+    CHECKT("create table A(a varchar(50) primary key, c float64);");
+    CHECKT("insert into A values ('x3', 1.5), ('y4', 2.5), ('z5', 3.5);");
+    CHECKT(
+        "create table C(a varchar(50) foreign key references A(a), c int64, b "
+        "varchar(20));");
+    CHECKT("insert into C values ('x3', 1, 'a'), ('x3', 2, 'b'), "
+           "('y4', 3, 'c');");
+    CHECKT("insert into C values ('x3', 4, 'd');");
+    // 'a3' is not in A, so nothing is inserted.
+    CHECKF("insert into C values ('z5', 5, 'e'), ('a3', 6, 'f');");
+    CHECKT("delete from A where a = 'z5';");
+    CHECKF("delete from A where a = 'x3';");
+    CHECKF("delete from A;");
+    // The refcount of 'x3' is 3, and it goes back to 0.
+    CHECKT("delete from C where c = 1;");
+    CHECKT("delete from C where c = 2;");
+    CHECKF("delete from A where a = 'x3';");
+    CHECKT("delete from C where c = 4;");
+    CHECKT("delete from A where a = 'x3';");
+    CHECKF("delete from A where a = 'y4';");
+  }
+#undef CHECKT
+#undef CHECKF
+  std::filesystem::remove_all("__tmp4");
+}
+
 TEST(ConcurrencyToolTest, ThreadPool) {
   wing::ThreadPool pool(16);
   std::atomic<double> sum = 0;
@@ -674,3 +711,26 @@ TEST(UtilsTest, BloomFilter) {
   DB_INFO("{}", fp / (double)N);
   ASSERT_TRUE(fp / (double)N <= 0.01);
 }
+
+TEST(UtilsTest, BlockedBloomFilter) {
+  std::string bf;
+  size_t N = 1e5;
+  wing::utils::BlockedBloomFilter::Create(N, 10, bf);
+  auto kv = wing::wing_testing::GenKVData(0x202403212006, 2 * N, 10, 9);
+  for (uint32_t i = 0; i < N; i++) {
+    wing::utils::BlockedBloomFilter::Add(kv[i].key(), bf);
+  }
+  for (uint32_t i = 0; i < N; i++) {
+    ASSERT_TRUE(wing::utils::BlockedBloomFilter::Find(kv[i].key(), bf));
+  }
+  size_t fp = 0;
+  for (uint32_t i = N; i < 2 * N; i++) {
+    auto hash = wing::utils::BlockedBloomFilter::BloomHash(kv[i].key());
+    bool found = wing::utils::BlockedBloomFilter::Find(hash, bf);
+    /* The SIMD probe must agree with the scalar one. */
+    ASSERT_EQ(found, wing::utils::BlockedBloomFilter::FindScalar(hash, bf));
+    fp += found;
+  }
+  DB_INFO("{}", fp / (double)N);
+  ASSERT_TRUE(fp / (double)N <= 0.02);
+}
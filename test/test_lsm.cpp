@@ -1,14 +1,18 @@
 #include "common/stopwatch.hpp"
 #include "gtest/gtest.h"
 #include "storage/lsm/block.hpp"
+#include "storage/lsm/bloom_policy.hpp"
 #include "storage/lsm/compaction_job.hpp"
+#include "storage/lsm/compression.hpp"
 #include "storage/lsm/file.hpp"
 #include "storage/lsm/iterator_heap.hpp"
 #include "storage/lsm/level.hpp"
+#include "storage/lsm/loser_tree.hpp"
 #include "storage/lsm/lsm.hpp"
 #include "storage/lsm/memtable.hpp"
 #include "storage/lsm/sst.hpp"
 #include "storage/lsm/stats.hpp"
+#include "storage/lsm/table_cache.hpp"
 #include "storage/lsm/version.hpp"
 #include "test.hpp"
 
@@ -80,6 +84,57 @@ TEST(LSMTest, MemTableSmallTest) {
     f.get();
 }
 
+TEST(LSMTest, MemTableConcurrentInsertTest) {
+  size_t n = 20000, TH = 4;
+  std::vector<std::vector<CompressedKVPair>> kvs;
+  for (uint32_t i = 0; i < TH; i++) {
+    kvs.push_back(GenKVData(0x202407191513 + i, n, 13, 29));
+  }
+  for (bool use_skiplist : {true, false}) {
+    MemTable t(use_skiplist);
+    std::atomic<bool> stop{false};
+    /* A reader scans the MemTable while it is being written. */
+    auto reader = std::async([&]() {
+      while (!stop) {
+        std::optional<ParsedKey> last;
+        for (auto it = t.Begin(); use_skiplist && it.Valid(); it.Next()) {
+          ParsedKey key(it.key());
+          if (last) ASSERT_TRUE(*last < key);
+          last = key;
+        }
+      }
+    });
+    std::vector<std::future<void>> pool;
+    for (uint32_t i = 0; i < TH; i++) {
+      pool.push_back(std::async([&, id = i]() {
+        for (uint32_t j = 0; j < n; j++) {
+          /* Each thread has its own sequence numbers. */
+          t.Put(kvs[id][j].key(), j * TH + id + 1, kvs[id][j].value());
+        }
+      }));
+    }
+    for (auto& f : pool) f.get();
+    stop = true;
+    reader.get();
+    size_t count = 0;
+    std::optional<ParsedKey> last;
+    for (auto it = t.Begin(); it.Valid(); it.Next(), count++) {
+      ParsedKey key(it.key());
+      if (last) ASSERT_TRUE(*last < key);
+      last = key;
+    }
+    ASSERT_EQ(count, n * TH);
+    for (uint32_t i = 0; i < TH; i++) {
+      for (uint32_t j = 0; j < n; j++) {
+        std::string value;
+        ASSERT_EQ(t.Get(kvs[i][j].key(), j * TH + i + 1, &value),
+            GetResult::kFound);
+        ASSERT_EQ(value, kvs[i][j].value());
+      }
+    }
+  }
+}
+
 TEST(LSMTest, FileWriterTest) {
   FileWriter writer(
       std::make_unique<SeqWriteFile>("__tmpLSMFileWriterTest", false), 4096);
@@ -214,6 +269,449 @@ TEST(LSMTest, SSTableTest) {
   std::remove("__tmpLSMSSTableTest");
 }
 
+TEST(LSMTest, SSTableBlockFormatTest) {
+  /* Keys with long shared prefixes, each of which has 3 versions. */
+  uint32_t N = 2e4, V = 3;
+  std::vector<std::string> keys;
+  for (uint32_t i = 0; i < N; i++) {
+    keys.push_back(fmt::format("customer#{:08}#order#{:06}", i / 10, i));
+  }
+  auto value = [](uint32_t i, seq_t seq) {
+    return fmt::format("{}-{}", i, seq);
+  };
+  /* kPlain is the format written by older versions. */
+  std::vector<size_t> sizes;
+  for (size_t interval : {0, 1, 16}) {
+    std::string filename = "__tmpLSMSSTableBlockFormatTest";
+    SSTableBuilder builder(
+        std::make_unique<FileWriter>(
+            std::make_unique<SeqWriteFile>(filename, false), 4096),
+        4096, 10, interval);
+    for (uint32_t i = 0; i < N; i++) {
+      for (seq_t seq = 2 * V; seq > 0; seq -= 2) {
+        builder.Append(
+            ParsedKey(keys[i], seq, RecordType::Value), value(i, seq));
+      }
+    }
+    builder.Finish();
+    sizes.push_back(builder.size());
+    SSTInfo info;
+    info.count_ = N * V;
+    info.size_ = builder.size();
+    info.filename_ = filename;
+    info.index_offset_ = builder.GetIndexOffset();
+    info.bloom_filter_offset_ = builder.GetBloomFilterOffset();
+    info.sst_id_ = 0;
+    SSTable sst(info, 4096, false);
+    for (uint32_t i = 0; i < N; i++) {
+      std::string v;
+      uint64_t seq_found;
+      ASSERT_EQ(sst.Get(keys[i], 1, &v), GetResult::kNotFound);
+      for (seq_t seq = 2; seq <= 2 * V + 1; seq++) {
+        seq_t expected = std::min<seq_t>(seq / 2 * 2, 2 * V);
+        ASSERT_EQ(sst.Get(keys[i], seq, &v, &seq_found), GetResult::kFound);
+        ASSERT_EQ(seq_found, expected);
+        ASSERT_EQ(v, value(i, expected));
+      }
+      ASSERT_EQ(sst.Get(keys[i] + "#", 10, &v), GetResult::kNotFound);
+    }
+    for (uint32_t i = 0; i < N; i += 97) {
+      auto it = sst.Seek(keys[i], 3);
+      ASSERT_TRUE(it.Valid());
+      ASSERT_EQ(ParsedKey(it.key()).user_key_, keys[i]);
+      ASSERT_EQ(ParsedKey(it.key()).seq_, 2);
+      it.Next();
+      for (uint32_t j = i + 1; j < N && j < i + 100; j++) {
+        for (seq_t seq = 2 * V; seq > 0; seq -= 2) {
+          ASSERT_TRUE(it.Valid());
+          ASSERT_EQ(ParsedKey(it.key()).user_key_, keys[j]);
+          ASSERT_EQ(ParsedKey(it.key()).seq_, seq);
+          ASSERT_EQ(it.value(), value(j, seq));
+          it.Next();
+        }
+      }
+    }
+    std::remove(filename.c_str());
+  }
+  DB_INFO("SSTable sizes: plain {}, interval 1 {}, interval 16 {}", sizes[0],
+      sizes[1], sizes[2]);
+  ASSERT_LT(sizes[2], sizes[0]);
+}
+
+TEST(LSMTest, SSTableBloomFilterFormatTest) {
+  uint32_t N = 2e4;
+  auto key = [](uint32_t i) { return fmt::format("key{:08}", i); };
+  /* kStandard with kPlain blocks is the format written by older versions. */
+  for (auto filter_format : {wing::utils::BloomFilterFormat::kStandard,
+           wing::utils::BloomFilterFormat::kBlocked}) {
+    for (size_t interval : {0, 16}) {
+      std::string filename = "__tmpLSMSSTableBloomFilterFormatTest";
+      SSTableBuilder builder(
+          std::make_unique<FileWriter>(
+              std::make_unique<SeqWriteFile>(filename, false), 4096),
+          4096, 10, interval, filter_format);
+      for (uint32_t i = 0; i < N; i++) {
+        builder.Append(ParsedKey(key(2 * i), 1, RecordType::Value), key(i));
+      }
+      builder.Finish();
+      SSTInfo info;
+      info.count_ = N;
+      info.size_ = builder.size();
+      info.filename_ = filename;
+      info.index_offset_ = builder.GetIndexOffset();
+      info.bloom_filter_offset_ = builder.GetBloomFilterOffset();
+      info.sst_id_ = 0;
+      SSTable sst(info, 4096, false);
+      size_t fp = 0;
+      for (uint32_t i = 0; i < N; i++) {
+        std::string v;
+        ASSERT_TRUE(sst.MayContain(key(2 * i)));
+        ASSERT_EQ(sst.Get(key(2 * i), 1, &v), GetResult::kFound);
+        ASSERT_EQ(v, key(i));
+        fp += sst.MayContain(key(2 * i + 1));
+        ASSERT_EQ(sst.Get(key(2 * i + 1), 1, &v), GetResult::kNotFound);
+      }
+      DB_INFO("filter format {}, interval {}: false positive rate {}",
+          static_cast<int>(filter_format), interval, fp / (double)N);
+      ASSERT_LE(fp / (double)N, 0.02);
+      std::remove(filename.c_str());
+    }
+  }
+}
+
+TEST(LSMTest, SSTableRangeFilterTest) {
+  /* The prefixes "keyXXXXXX" cover 100 consecutive numbers. */
+  uint32_t N = 1e4;
+  auto key = [](uint32_t i) { return fmt::format("key{:08}", i); };
+  std::string filename = "__tmpLSMSSTableRangeFilterTest";
+  SSTableBuilder builder(std::make_unique<FileWriter>(
+                             std::make_unique<SeqWriteFile>(filename, false),
+                             4096),
+      4096, 10, kDefaultBlockRestartInterval,
+      wing::utils::BloomFilterFormat::kBlocked, 9);
+  for (uint32_t i = 0; i < N; i++) {
+    builder.Append(ParsedKey(key(i * 1000), 1, RecordType::Value), "v");
+  }
+  builder.Finish();
+  SSTInfo info;
+  info.count_ = N;
+  info.size_ = builder.size();
+  info.filename_ = filename;
+  info.index_offset_ = builder.GetIndexOffset();
+  info.bloom_filter_offset_ = builder.GetBloomFilterOffset();
+  info.sst_id_ = 0;
+  SSTable sst(info, 4096, false);
+  ASSERT_FALSE(sst.MayContainRange("a", "b"));
+  ASSERT_FALSE(sst.MayContainRange(key(N * 1000), key(N * 2000)));
+  std::mt19937_64 rgen(0x202410172000);
+  size_t empty = 0, fp = 0;
+  for (uint32_t i = 0; i < 1e4; i++) {
+    uint32_t lower = rgen() % (N * 1000), upper = lower + rgen() % 300;
+    bool may_contain = sst.MayContainRange(key(lower), key(upper));
+    if ((lower + 999) / 1000 <= upper / 1000) {
+      ASSERT_TRUE(may_contain);
+    } else if ((lower / 100 * 100 + 999) / 1000 > upper / 100 * 100 / 1000) {
+      /* No key has the same prefix as a key in the range. */
+      empty += 1;
+      fp += may_contain;
+    }
+  }
+  DB_INFO("False positive rate of ranges without the prefixes of the keys: {}",
+      fp / (double)empty);
+  ASSERT_LE(fp / (double)empty, 0.1);
+  std::remove(filename.c_str());
+}
+
+TEST(LSMTest, BlockCodecTest) {
+  std::mt19937_64 rgen(0x202410171800);
+  std::vector<std::string> blocks;
+  /* Random bytes, repeated text, increasing integers, and short blocks. */
+  blocks.emplace_back(4096, 0);
+  for (auto& c : blocks.back()) c = rgen();
+  blocks.emplace_back();
+  for (uint32_t i = 0; i < 300; i++) {
+    blocks.back() += fmt::format("key{:08}value{}", i, i % 7);
+  }
+  blocks.emplace_back();
+  for (uint32_t i = 0; i < 1000; i++) {
+    uint32_t x = 1000000 + i * 3;
+    blocks.back().append(reinterpret_cast<char*>(&x), sizeof(x));
+  }
+  blocks.back() += "abc";
+  blocks.emplace_back("aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa");
+  blocks.emplace_back("");
+  for (auto codec : {BlockCodec::kLZ, BlockCodec::kDeltaFOR}) {
+    for (auto& block : blocks) {
+      std::string compressed;
+      if (!CompressBlock(codec, block, &compressed)) {
+        continue;
+      }
+      ASSERT_LT(compressed.size(), block.size());
+      std::string out(block.size(), 0);
+      DecompressBlock(codec, compressed, out.data(), out.size());
+      ASSERT_EQ(out, block);
+    }
+  }
+  std::string compressed;
+  ASSERT_FALSE(CompressBlock(BlockCodec::kLZ, blocks[0], &compressed));
+  ASSERT_TRUE(CompressBlock(BlockCodec::kLZ, blocks[1], &compressed));
+  ASSERT_TRUE(CompressBlock(BlockCodec::kDeltaFOR, blocks[2], &compressed));
+  ASSERT_LT(compressed.size(), blocks[2].size() / 10);
+}
+
+TEST(LSMTest, SSTableCompressionTest) {
+  uint32_t N = 2e4;
+  auto key = [](uint32_t i) { return fmt::format("key{:08}", i); };
+  auto value = [](uint32_t i) { return fmt::format("value{:08}", i % 100); };
+  std::string filename = "__tmpLSMSSTableCompressionTest";
+  size_t raw_size = 0;
+  Cache cache(CacheOptions{.capacity = 1 << 20, .num_shard_bits = 2});
+  for (auto codec : {BlockCodec::kNone, BlockCodec::kLZ}) {
+    SSTableBuilder builder(
+        std::make_unique<FileWriter>(
+            std::make_unique<SeqWriteFile>(filename, false), 4096),
+        4096, 10, kDefaultBlockRestartInterval,
+        wing::utils::BloomFilterFormat::kBlocked, 0, codec);
+    for (uint32_t i = 0; i < N; i++) {
+      builder.Append(ParsedKey(key(i), 1, RecordType::Value), value(i));
+    }
+    builder.Finish();
+    SSTInfo info;
+    info.count_ = N;
+    info.size_ = builder.size();
+    info.filename_ = filename;
+    info.index_offset_ = builder.GetIndexOffset();
+    info.bloom_filter_offset_ = builder.GetBloomFilterOffset();
+    info.sst_id_ = static_cast<size_t>(codec);
+    if (codec == BlockCodec::kNone) {
+      raw_size = info.size_;
+    } else {
+      ASSERT_LT(info.size_, raw_size / 2);
+    }
+    for (bool use_mmap : {false, true}) {
+      SSTable sst(info, 4096, false, &cache, use_mmap);
+      std::string v;
+      for (uint32_t i = 0; i < N; i += 7) {
+        ASSERT_EQ(sst.Get(key(i), 1, &v), GetResult::kFound);
+        ASSERT_EQ(v, value(i));
+      }
+      auto it = sst.Begin();
+      for (uint32_t i = 0; i < N; i++) {
+        ASSERT_TRUE(it.Valid());
+        ASSERT_EQ(ParsedKey(it.key()).user_key_, key(i));
+        ASSERT_EQ(it.value(), value(i));
+        it.Next();
+      }
+      ASSERT_FALSE(it.Valid());
+    }
+    std::remove(filename.c_str());
+  }
+}
+
+TEST(LSMTest, BlockCacheTest) {
+  const size_t block_size = 4096, capacity = 64 * block_size;
+  Cache cache(CacheOptions{.capacity = capacity, .num_shard_bits = 2});
+  auto block = [&](size_t i) {
+    BlockHandle handle;
+    handle.offset_ = i * block_size;
+    handle.size_ = block_size;
+    handle.count_ = 1;
+    return handle;
+  };
+  auto content = [&](size_t i) {
+    return std::string(block_size, 'a' + i % 26);
+  };
+  /* A hot block that is hit repeatedly */
+  cache.insert(0, block(0), content(0));
+  ASSERT_TRUE(cache.get(0, block(0)).has_value());
+  /* A pinned block cannot be evicted. */
+  auto pinned = cache.insert(0, block(1), content(1));
+  /* A long scan inserts a lot of blocks, and each of them is used only once. */
+  for (size_t i = 2; i < 100 * capacity / block_size; i++) {
+    cache.insert(0, block(i), content(i));
+    ASSERT_TRUE(cache.get(0, block(0)).has_value());
+  }
+  ASSERT_EQ(pinned.block(), content(1));
+  auto handle = cache.get(0, block(1));
+  ASSERT_TRUE(handle.has_value());
+  ASSERT_EQ(handle->block(), content(1));
+  /* Inserting an existing block returns the cached one. */
+  auto dup = cache.insert(0, block(1), content(2));
+  ASSERT_EQ(dup.block(), content(1));
+  /* Concurrent lookups and insertions */
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < 4; t++) {
+    threads.emplace_back([&, t]() {
+      std::mt19937_64 rgen(t);
+      for (size_t i = 0; i < 100000; i++) {
+        size_t id = rgen() % (2 * capacity / block_size);
+        auto h = cache.get(1, block(id));
+        if (!h.has_value()) {
+          h = cache.insert(1, block(id), content(id));
+        }
+        ASSERT_EQ(h->block(), content(id));
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+}
+
+TEST(LSMTest, SSTableBlockCacheTest) {
+  SSTableBuilder builder(
+      std::make_unique<FileWriter>(
+          std::make_unique<SeqWriteFile>("__tmpLSMSSTableCacheTest", false),
+          4096),
+      4096, 10);
+  uint32_t klen = 9, vlen = 13, N = 1e4;
+  auto kv =
+      GenKVDataWithRandomLen(0x202407181102, N, {klen - 1, klen}, {1, vlen});
+  std::sort(kv.begin(), kv.end());
+  for (uint32_t i = 0; i < N; i++) {
+    builder.Append(ParsedKey(kv[i].key(), 1, RecordType::Value), kv[i].value());
+  }
+  builder.Finish();
+  SSTInfo info;
+  info.count_ = N;
+  info.size_ = builder.size();
+  info.filename_ = "__tmpLSMSSTableCacheTest";
+  info.index_offset_ = builder.GetIndexOffset();
+  info.bloom_filter_offset_ = builder.GetBloomFilterOffset();
+  info.sst_id_ = 0;
+  /* The cache is large enough to hold all the data blocks. */
+  Cache cache(
+      CacheOptions{.capacity = 2 * builder.size(), .num_shard_bits = 0});
+  {
+    SSTable sst(info, 4096, false, &cache);
+    /* A scan that does not fill the cache reads the file every time. */
+    for (int round = 0; round < 2; round++) {
+      auto read_bytes = GetStatsContext()->total_read_bytes.load();
+      auto it = sst.Begin(false);
+      for (uint32_t i = 0; i < N; i++, it.Next()) {
+        ASSERT_TRUE(it.Valid());
+      }
+      ASSERT_GE(GetStatsContext()->total_read_bytes.load() - read_bytes,
+          info.size_ / 2);
+    }
+    for (uint32_t i = 0; i < N; i++) {
+      std::string value;
+      ASSERT_EQ(sst.Get(kv[i].key(), 1, &value), GetResult::kFound);
+      ASSERT_EQ(value, kv[i].value());
+    }
+    /* All the blocks are cached, so it does not read the file again. */
+    auto read_bytes = GetStatsContext()->total_read_bytes.load();
+    for (uint32_t i = 0; i < N; i++) {
+      std::string value;
+      ASSERT_EQ(sst.Get(kv[i].key(), 1, &value), GetResult::kFound);
+      ASSERT_EQ(value, kv[i].value());
+    }
+    auto it = sst.Begin();
+    for (uint32_t i = 0; i < N; i++) {
+      ASSERT_TRUE(it.Valid());
+      ASSERT_EQ(ParsedKey(it.key()).user_key_, kv[i].key());
+      ASSERT_EQ(it.value(), kv[i].value());
+      it.Next();
+    }
+    ASSERT_FALSE(it.Valid());
+    ASSERT_EQ(GetStatsContext()->total_read_bytes.load(), read_bytes);
+  }
+  /* A cache smaller than one block still works. */
+  {
+    Cache small_cache(CacheOptions{.capacity = 1024});
+    SSTable sst(info, 4096, false, &small_cache);
+    for (uint32_t i = 0; i < N; i += 7) {
+      std::string value;
+      ASSERT_EQ(sst.Get(kv[i].key(), 1, &value), GetResult::kFound);
+      ASSERT_EQ(value, kv[i].value());
+    }
+  }
+  /* A memory-mapped SSTable reads blocks from the mapping, not the cache. */
+  {
+    Cache mmap_cache(
+        CacheOptions{.capacity = 2 * builder.size(), .num_shard_bits = 0});
+    SSTable sst(info, 4096, false, &mmap_cache, true);
+    for (uint32_t i = 0; i < N; i++) {
+      std::string value;
+      ASSERT_EQ(sst.Get(kv[i].key(), 1, &value), GetResult::kFound);
+      ASSERT_EQ(value, kv[i].value());
+    }
+    for (uint32_t i = 0; i < N; i += 97) {
+      auto it = sst.Seek(kv[i].key(), 1);
+      for (uint32_t j = i; j < N && j < i + 100; j++, it.Next()) {
+        ASSERT_TRUE(it.Valid());
+        ASSERT_EQ(ParsedKey(it.key()).user_key_, kv[j].key());
+        ASSERT_EQ(it.value(), kv[j].value());
+      }
+    }
+    /* Nothing was inserted into the cache. */
+    SSTable sst_pread(info, 4096, false, &mmap_cache);
+    auto read_bytes = GetStatsContext()->total_read_bytes.load();
+    std::string value;
+    ASSERT_EQ(sst_pread.Get(kv[0].key(), 1, &value), GetResult::kFound);
+    ASSERT_GT(GetStatsContext()->total_read_bytes.load(), read_bytes);
+  }
+  std::remove("__tmpLSMSSTableCacheTest");
+}
+
+TEST(LSMTest, TableCacheTest) {
+  uint32_t klen = 9, vlen = 13, N = 2e3, T = 8;
+  auto kv = GenKVDataWithRandomLen(
+      0x202410171530, N * T, {klen - 1, klen}, {1, vlen});
+  std::sort(kv.begin(), kv.end());
+  std::vector<SSTInfo> infos;
+  for (uint32_t t = 0; t < T; t++) {
+    auto filename = fmt::format("__tmpLSMTableCacheTest{}", t);
+    SSTableBuilder builder(
+        std::make_unique<FileWriter>(
+            std::make_unique<SeqWriteFile>(filename, false), 4096),
+        4096, 10);
+    for (uint32_t i = t * N; i < (t + 1) * N; i++) {
+      builder.Append(
+          ParsedKey(kv[i].key(), 1, RecordType::Value), kv[i].value());
+    }
+    builder.Finish();
+    SSTInfo info;
+    info.count_ = N;
+    info.size_ = builder.size();
+    info.filename_ = filename;
+    info.index_offset_ = builder.GetIndexOffset();
+    info.bloom_filter_offset_ = builder.GetBloomFilterOffset();
+    info.sst_id_ = t;
+    infos.push_back(info);
+  }
+  for (bool charge : {false, true}) {
+    Cache cache(CacheOptions{.capacity = 1 << 20, .num_shard_bits = 0});
+    TableCache table_cache(3, charge ? &cache : nullptr);
+    {
+      SortedRun run(infos, 4096, false, &cache, false, nullptr, &table_cache);
+      /* The readers are opened by the first reads. */
+      ASSERT_EQ(table_cache.size(), 0);
+      for (uint32_t i = 0; i < N * T; i++) {
+        std::string value;
+        ASSERT_EQ(run.Get(kv[i].key(), 1, &value), GetResult::kFound);
+        ASSERT_EQ(value, kv[i].value());
+        ASSERT_LE(table_cache.size(), 3);
+      }
+      /* An iterator keeps its reader open after it is evicted. */
+      auto it = run.Begin();
+      for (uint32_t t = 1; t < T; t++) {
+        std::string value;
+        run.Get(kv[t * N].key(), 1, &value);
+      }
+      for (uint32_t i = 0; i < N * T; i++, it.Next()) {
+        ASSERT_TRUE(it.Valid());
+        ASSERT_EQ(ParsedKey(it.key()).user_key_, kv[i].key());
+        ASSERT_EQ(it.value(), kv[i].value());
+      }
+      ASSERT_FALSE(it.Valid());
+    }
+    /* The readers are closed with the SSTables. */
+    ASSERT_EQ(table_cache.size(), 0);
+  }
+  for (auto& info : infos) {
+    std::remove(info.filename_.c_str());
+  }
+}
+
 TEST(LSMTest, SortedRunTest) {
   uint32_t klen = 9, vlen = 13, N = 3e6, fileN = 10;
   auto kv =
@@ -354,6 +852,68 @@ TEST(LSMTest, IteratorHeapTest) {
   }
 }
 
+TEST(LSMTest, LoserTreeTest) {
+  /**
+   * Memtable t covers the keys in [t * 1000, t * 1000 + 2000), so the tables
+   * overlap pairwise and each has a run of keys which no other one has.
+   * Table 5 is empty.
+   */
+  uint32_t T = 6, M = 2000;
+  std::mt19937_64 rgen(0x202410172110);
+  std::vector<std::unique_ptr<MemTable>> mts;
+  std::vector<std::tuple<std::string, seq_t, std::string>> records;
+  std::vector<size_t> counts(T);
+  seq_t seq = 0;
+  for (uint32_t t = 0; t < T; t++) {
+    mts.push_back(std::make_unique<MemTable>());
+    for (uint32_t i = 0; t + 1 < T && i < M; i++) {
+      if (rgen() % 3 == 0) {
+        continue;
+      }
+      auto key = fmt::format("key{:08}", t * 1000 + i);
+      auto value = fmt::format("value{}", rgen());
+      mts.back()->Put(key, ++seq, value);
+      records.emplace_back(key, seq, value);
+      counts[t] += 1;
+    }
+  }
+  std::sort(records.begin(), records.end(), [](auto& a, auto& b) {
+    return ParsedKey(std::get<0>(a), std::get<1>(a), RecordType::Value) <
+           ParsedKey(std::get<0>(b), std::get<1>(b), RecordType::Value);
+  });
+  std::vector<MemTableIterator> mt_its;
+  for (auto& mt : mts) {
+    mt_its.push_back(mt->Begin());
+  }
+  LoserTree<MemTableIterator> tree;
+  for (auto& it : mt_its) {
+    tree.Push(&it);
+  }
+  tree.Build();
+  for (auto& [key, seq, value] : records) {
+    ASSERT_TRUE(tree.Valid());
+    ParsedKey pkey(tree.key());
+    ASSERT_EQ(pkey.user_key_, key);
+    ASSERT_EQ(pkey.seq_, seq);
+    ASSERT_EQ(tree.value(), value);
+    tree.Next();
+  }
+  ASSERT_FALSE(tree.Valid());
+  /* No children, and one child. */
+  LoserTree<MemTableIterator> empty;
+  empty.Build();
+  ASSERT_FALSE(empty.Valid());
+  auto it = mts[0]->Begin();
+  LoserTree<MemTableIterator> single;
+  single.Push(&it);
+  single.Build();
+  size_t count = 0;
+  for (; single.Valid(); single.Next()) {
+    count += 1;
+  }
+  ASSERT_EQ(count, counts[0]);
+}
+
 TEST(LSMTest, SuperVersionTest) {
   auto mt = std::make_shared<MemTable>();
   auto imms = std::make_shared<std::vector<std::shared_ptr<MemTable>>>();
@@ -987,6 +1547,1372 @@ TEST(LSMTest, LSMSaveTest) {
   std::filesystem::remove_all(options.db_path);
 }
 
+TEST(LSMTest, LSMWALRecoveryTest) {
+  uint32_t TH = 4;
+  Options options;
+  options.db_path = "__tmpLSMWALRecoveryTest/";
+  std::string crash_path = "__tmpLSMWALRecoveryTestCrash/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::remove_all(crash_path);
+  std::filesystem::create_directories(options.db_path);
+  uint32_t klen = 10, vlen = 130, N = 1e4;
+  std::vector<std::vector<CompressedKVPair>> kvs;
+  for (uint32_t i = 0; i < TH; i++) {
+    kvs.push_back(GenKVDataWithRandomLen(
+        0x202407171530 + i, N, {klen - 1, klen}, {1, vlen}));
+  }
+  {
+    auto lsm = DBImpl::Create(options);
+    std::vector<std::thread> pool;
+    for (uint32_t i = 0; i < TH; i++) {
+      pool.emplace_back([&, id = i]() {
+        for (uint32_t j = 0; j < N; j++) {
+          lsm->Put(kvs[id][j].key(), kvs[id][j].value());
+        }
+        for (uint32_t j = 0; j < N; j += 2) {
+          lsm->Del(kvs[id][j].key());
+        }
+      });
+    }
+    for (auto& t : pool)
+      t.join();
+    /* Nothing is flushed. Copy the directory to simulate a crash. */
+    ASSERT_EQ(lsm->GetSV()->GetImms()->size(), 0);
+    std::filesystem::copy(options.db_path, crash_path);
+  }
+  {
+    options.db_path = crash_path;
+    options.create_new = false;
+    auto lsm = DBImpl::Create(options);
+    for (uint32_t i = 0; i < TH; i++) {
+      for (uint32_t j = 0; j < N; j++) {
+        std::string value;
+        if (j % 2 == 0) {
+          ASSERT_FALSE(lsm->Get(kvs[i][j].key(), &value));
+        } else {
+          ASSERT_TRUE(lsm->Get(kvs[i][j].key(), &value));
+          ASSERT_EQ(value, kvs[i][j].value());
+        }
+      }
+    }
+    ASSERT_EQ(lsm->CurrentSeq(), TH * (N + N / 2));
+  }
+  std::filesystem::remove_all("__tmpLSMWALRecoveryTest/");
+  std::filesystem::remove_all(crash_path);
+}
+
+TEST(LSMTest, LSMWALFlushRecoveryTest) {
+  Options options;
+  options.sync_wal = true;
+  options.db_path = "__tmpLSMWALFlushRecoveryTest/";
+  std::string crash_path = "__tmpLSMWALFlushRecoveryTestCrash/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::remove_all(crash_path);
+  std::filesystem::create_directories(options.db_path);
+  auto key = [](uint32_t i) { return fmt::format("key{:08}", i); };
+  uint32_t N = 2000;
+  {
+    auto lsm = DBImpl::Create(options);
+    for (uint32_t i = 0; i < N; i++) {
+      lsm->Put(key(i), "flushed");
+    }
+    lsm->FlushAll();
+    lsm->WaitForFlushAndCompaction();
+    /* The log of the flushed records is removed. */
+    size_t logs = 0;
+    for (auto& entry : std::filesystem::directory_iterator(options.db_path)) {
+      logs += entry.path().extension() == ".log";
+    }
+    ASSERT_EQ(logs, 1);
+    for (uint32_t i = 0; i < N; i += 2) {
+      lsm->Put(key(i), "logged");
+    }
+    /* It is not saved. Copy the directory to simulate a crash. */
+    std::filesystem::copy(options.db_path, crash_path);
+  }
+  options.db_path = crash_path;
+  options.create_new = false;
+  auto lsm = DBImpl::Create(options);
+  std::string value;
+  for (uint32_t i = 0; i < N; i++) {
+    ASSERT_TRUE(lsm->Get(key(i), &value));
+    ASSERT_EQ(value, i % 2 == 0 ? "logged" : "flushed");
+  }
+  lsm.reset();
+  std::filesystem::remove_all("__tmpLSMWALFlushRecoveryTest/");
+  std::filesystem::remove_all(crash_path);
+}
+
+TEST(LSMTest, LSMWriteBatchTest) {
+  uint32_t TH = 4;
+  Options options;
+  options.db_path = "__tmpLSMWriteBatchTest/";
+  std::string crash_path = "__tmpLSMWriteBatchTestCrash/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::remove_all(crash_path);
+  std::filesystem::create_directories(options.db_path);
+  uint32_t klen = 10, vlen = 130, N = 1e4, B = 10;
+  std::vector<std::vector<CompressedKVPair>> kvs;
+  for (uint32_t i = 0; i < TH; i++) {
+    kvs.push_back(GenKVDataWithRandomLen(
+        0x202407181030 + i, N, {klen - 1, klen}, {1, vlen}));
+  }
+  {
+    auto lsm = DBImpl::Create(options);
+    /* A later record of the same key overwrites an earlier one. */
+    WriteBatch batch;
+    batch.Put("a", "1");
+    batch.Put("b", "2");
+    batch.Del("a");
+    batch.Put("b", "3");
+    lsm->Write(batch);
+    ASSERT_EQ(lsm->CurrentSeq(), batch.Count());
+    std::string value;
+    ASSERT_FALSE(lsm->Get("a", &value));
+    ASSERT_TRUE(lsm->Get("b", &value));
+    ASSERT_EQ(value, "3");
+    batch.Clear();
+    batch.Del("b");
+    lsm->Write(batch);
+    ASSERT_FALSE(lsm->Get("b", &value));
+
+    std::vector<std::thread> pool;
+    for (uint32_t i = 0; i < TH; i++) {
+      pool.emplace_back([&, id = i]() {
+        WriteBatch batch;
+        for (uint32_t j = 0; j < N; j++) {
+          batch.Put(kvs[id][j].key(), kvs[id][j].value());
+          if (j % 2 == 0) {
+            batch.Del(kvs[id][j].key());
+          }
+          if ((j + 1) % B == 0) {
+            lsm->Write(batch);
+            batch.Clear();
+          }
+        }
+      });
+    }
+    for (auto& t : pool)
+      t.join();
+    ASSERT_EQ(lsm->GetSV()->GetImms()->size(), 0);
+    std::filesystem::copy(options.db_path, crash_path);
+  }
+  {
+    options.db_path = crash_path;
+    options.create_new = false;
+    auto lsm = DBImpl::Create(options);
+    for (uint32_t i = 0; i < TH; i++) {
+      for (uint32_t j = 0; j < N; j++) {
+        std::string value;
+        if (j % 2 == 0) {
+          ASSERT_FALSE(lsm->Get(kvs[i][j].key(), &value));
+        } else {
+          ASSERT_TRUE(lsm->Get(kvs[i][j].key(), &value));
+          ASSERT_EQ(value, kvs[i][j].value());
+        }
+      }
+    }
+    ASSERT_EQ(lsm->CurrentSeq(), 5 + TH * (N + N / 2));
+  }
+  std::filesystem::remove_all("__tmpLSMWriteBatchTest/");
+  std::filesystem::remove_all(crash_path);
+}
+
+TEST(LSMTest, LSMMultiGetTest) {
+  /* ReadFile::MultiRead returns the same data as ReadFile::Read. */
+  {
+    std::string filename = "__tmpLSMMultiReadTest";
+    std::mt19937_64 rgen(0x202407191021);
+    std::string content(1 << 20, 0);
+    for (auto& c : content) {
+      c = rgen();
+    }
+    {
+      FileWriter writer(std::make_unique<SeqWriteFile>(filename, false), 4096);
+      writer.AppendString(content);
+    }
+    ReadFile file(filename, false);
+    std::vector<std::string> bufs(300);
+    std::vector<ReadRequest> reqs;
+    for (auto& buf : bufs) {
+      offset_t offset = rgen() % content.size();
+      buf.resize(std::min<size_t>(rgen() % 8192 + 1, content.size() - offset));
+      reqs.push_back(ReadRequest{&file, buf.data(), buf.size(), offset});
+    }
+    ReadFile::MultiRead(reqs);
+    for (auto& req : reqs) {
+      ASSERT_EQ(Slice(req.data_, req.n_), content.substr(req.offset_, req.n_));
+    }
+    std::remove(filename.c_str());
+  }
+  Options options;
+  options.compaction_strategy_name = "leveled";
+  options.sst_file_size = 1 << 18;
+  options.write_buffer_size = 1 << 18;
+  options.db_path = "__tmpLSMMultiGetTest/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::create_directories(options.db_path);
+  auto lsm = DBImpl::Create(options);
+  uint32_t klen = 10, vlen = 130, N = 2e5;
+  auto kv =
+      GenKVDataWithRandomLen(0x202407191022, N, {klen - 1, klen}, {1, vlen});
+  for (uint32_t i = 0; i < N; i++) {
+    lsm->Put(kv[i].key(), kv[i].value());
+  }
+  /* Overwrite and delete some keys, so they have versions in many levels. */
+  for (uint32_t i = 0; i < N; i += 3) {
+    lsm->Put(kv[i].key(), "v" + std::to_string(i));
+  }
+  for (uint32_t i = 0; i < N; i += 5) {
+    lsm->Del(kv[i].key());
+  }
+  lsm->WaitForFlushAndCompaction();
+  auto missing =
+      GenKVDataWithRandomLen(0x202407191023, N, {klen - 1, klen}, {1, vlen});
+  std::mt19937_64 rgen(0x202407191024);
+  for (uint32_t round = 0; round < 200; round++) {
+    std::vector<Slice> keys;
+    for (uint32_t j = 0; j < 64; j++) {
+      keys.push_back(rgen() % 4 ? Slice(kv[rgen() % N].key())
+                                : Slice(missing[rgen() % N].key()));
+    }
+    std::vector<std::string> values;
+    auto found = lsm->MultiGet(keys, &values);
+    ASSERT_EQ(found.size(), keys.size());
+    for (uint32_t j = 0; j < keys.size(); j++) {
+      std::string value;
+      ASSERT_EQ(found[j], lsm->Get(keys[j], &value));
+      if (found[j]) {
+        ASSERT_EQ(values[j], value);
+      }
+    }
+  }
+  lsm.reset();
+  std::filesystem::remove_all(options.db_path);
+}
+
+TEST(LSMTest, LSMSubcompactionTest) {
+  uint32_t klen = 10, vlen = 100, N = 3e5;
+  auto kv =
+      GenKVDataWithRandomLen(0x202410170921, N, {klen - 1, klen}, {1, vlen});
+  std::map<std::string, std::string> answer;
+  for (size_t subcompactions : {1, 4}) {
+    Options options;
+    options.sst_file_size = 1 << 18;
+    options.compaction_size_ratio = 4;
+    options.max_subcompactions = subcompactions;
+    options.db_path = "__tmpLSMSubcompactionTest/";
+    std::filesystem::remove_all(options.db_path);
+    std::filesystem::create_directories(options.db_path);
+    auto lsm = DBImpl::Create(options);
+    for (uint32_t i = 0; i < N; i++) {
+      lsm->Put(kv[i].key(), kv[i].value());
+      /* Overwrite or delete some earlier keys. */
+      if (i % 3 == 0) {
+        lsm->Put(kv[i / 2].key(), kv[i].value());
+      } else if (i % 7 == 0) {
+        lsm->Del(kv[i / 3].key());
+      }
+    }
+    lsm->FlushAll();
+    lsm->WaitForFlushAndCompaction();
+    /* The SSTables of a sorted run do not overlap. */
+    auto sv = lsm->GetSV();
+    for (auto& level : sv->GetVersion()->GetLevels()) {
+      for (auto& run : level.GetRuns()) {
+        auto& ssts = run->GetSSTs();
+        for (size_t i = 1; i < ssts.size(); i++) {
+          ASSERT_LT(ssts[i - 1]->GetLargestKey().user_key_,
+              ssts[i]->GetSmallestKey().user_key_);
+        }
+      }
+    }
+    sv.reset();
+    std::map<std::string, std::string> result;
+    for (auto it = lsm->Begin(); it.Valid(); it.Next()) {
+      result.emplace(it.key(), it.value());
+    }
+    if (subcompactions == 1) {
+      answer = std::move(result);
+    } else {
+      ASSERT_EQ(result, answer);
+    }
+    ASSERT_TRUE(SanityCheck(lsm.get()));
+    lsm.reset();
+    std::filesystem::remove_all(options.db_path);
+  }
+}
+
+TEST(LSMTest, LSMBackgroundWorkersTest) {
+  uint32_t TH = 4, klen = 10, vlen = 100, N = 1e5;
+  std::vector<std::vector<CompressedKVPair>> kvs;
+  for (uint32_t i = 0; i < TH; i++) {
+    kvs.push_back(GenKVDataWithRandomLen(
+        0x202410171523 + i, N, {klen - 1, klen}, {1, vlen}));
+  }
+  for (auto strategy : {"leveled", "lazyleveling"}) {
+    Options options;
+    options.sst_file_size = 1 << 17;
+    options.compaction_size_ratio = 3;
+    options.compaction_strategy_name = strategy;
+    options.max_background_flushes = 4;
+    options.max_background_compactions = 4;
+    options.db_path = "__tmpLSMBackgroundWorkersTest/";
+    std::filesystem::remove_all(options.db_path);
+    std::filesystem::create_directories(options.db_path);
+    auto lsm = DBImpl::Create(options);
+    std::vector<std::thread> pool;
+    for (uint32_t i = 0; i < TH; i++) {
+      pool.emplace_back([&, id = i]() {
+        for (uint32_t j = 0; j < N; j++) {
+          lsm->Put(kvs[id][j].key(), kvs[id][j].value());
+        }
+      });
+    }
+    for (auto& t : pool)
+      t.join();
+    lsm->FlushAll();
+    lsm->WaitForFlushAndCompaction();
+    /* The value of a key put by several threads is not checked. */
+    std::map<std::string, std::string> answer;
+    std::set<std::string> dup;
+    for (uint32_t i = 0; i < TH; i++) {
+      for (uint32_t j = 0; j < N; j++) {
+        if (!answer.emplace(kvs[i][j].key(), kvs[i][j].value()).second) {
+          dup.insert(kvs[i][j].key());
+        }
+      }
+    }
+    for (auto& [key, value] : answer) {
+      std::string result;
+      ASSERT_TRUE(lsm->Get(key, &result));
+      if (!dup.count(key)) {
+        ASSERT_EQ(result, value);
+      }
+    }
+    auto it = lsm->Begin();
+    for (auto& [key, value] : answer) {
+      ASSERT_TRUE(it.Valid());
+      ASSERT_EQ(it.key(), key);
+      if (!dup.count(key)) {
+        ASSERT_EQ(it.value(), value);
+      }
+      it.Next();
+    }
+    ASSERT_FALSE(it.Valid());
+    ASSERT_TRUE(SanityCheck(lsm.get()));
+    lsm.reset();
+    std::filesystem::remove_all(options.db_path);
+  }
+}
+
+TEST(LSMTest, LSMWriteStallTest) {
+  Options options;
+  options.sst_file_size = 1 << 16;
+  options.level0_compaction_trigger = 2;
+  options.level0_slowdown_writes_trigger = 3;
+  options.level0_stop_writes_trigger = 5;
+  /* Writes are delayed whenever Level 0 needs a compaction. */
+  options.soft_pending_compaction_bytes_limit = 1;
+  options.delayed_write_rate = 4 << 20;
+  options.db_path = "__tmpLSMWriteStallTest/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::create_directories(options.db_path);
+  GetStatsContext()->Reset();
+  uint32_t klen = 10, vlen = 50, N = 1e5;
+  auto kv =
+      GenKVDataWithRandomLen(0x202410171740, N, {klen - 1, klen}, {1, vlen});
+  auto lsm = DBImpl::Create(options);
+  for (uint32_t i = 0; i < N; i++) {
+    lsm->Put(kv[i].key(), kv[i].value());
+  }
+  lsm->FlushAll();
+  lsm->WaitForFlushAndCompaction();
+  DB_INFO("Write stall: {}us, write delay: {}us",
+      GetStatsContext()->write_stall_micros.load(),
+      GetStatsContext()->write_delay_micros.load());
+  ASSERT_GT(GetStatsContext()->write_delay_micros.load(), 0);
+  /* Compactions have caught up, so writes are not delayed anymore. */
+  auto sv = lsm->GetSV();
+  ASSERT_LT(sv->GetVersion()->GetLevels()[0].GetRuns().size(),
+      options.level0_slowdown_writes_trigger);
+  sv.reset();
+  for (uint32_t i = 0; i < N; i++) {
+    std::string value;
+    ASSERT_TRUE(lsm->Get(kv[i].key(), &value));
+  }
+  lsm.reset();
+  std::filesystem::remove_all(options.db_path);
+}
+
+TEST(LSMTest, BloomBitsAllocationTest) {
+  Options options;
+  options.bloom_bits_per_key_per_level = {16, 12, 8};
+  Version version;
+  ASSERT_EQ(BloomBitsPerKey(options, version, 0, 100), 16);
+  ASSERT_EQ(BloomBitsPerKey(options, version, 2, 100), 8);
+  ASSERT_EQ(BloomBitsPerKey(options, version, 5, 100), 8);
+  /* Level 0 has 4 runs, and the size ratio of the other levels is 10. */
+  std::vector<size_t> entries = {40000, 100000, 1000000, 10000000};
+  std::vector<size_t> runs = {4, 1, 1, 1};
+  double total = 0;
+  for (auto n : entries) {
+    total += n;
+  }
+  auto bits = AllocateBloomBits(entries, runs, total * 10);
+  double memory = 0, cost = 0, uniform_cost = 0;
+  for (size_t i = 0; i < entries.size(); i++) {
+    memory += bits[i] * entries[i];
+    cost += runs[i] * std::exp(-bits[i] * std::log(2) * std::log(2));
+    uniform_cost += runs[i] * std::exp(-10 * std::log(2) * std::log(2));
+    if (i > 1) {
+      ASSERT_LT(bits[i], bits[i - 1]);
+    }
+  }
+  DB_INFO("Bits per key: {}, {}, {}, {}. Expected false positives: {} "
+          "(uniform: {})",
+      bits[0], bits[1], bits[2], bits[3], cost, uniform_cost);
+  ASSERT_NEAR(memory, total * 10, total * 0.01);
+  ASSERT_LT(cost, uniform_cost / 2);
+}
+
+TEST(LSMTest, LSMBloomFilterBudgetTest) {
+  Options options;
+  options.sst_file_size = 1 << 18;
+  options.level0_compaction_trigger = 2;
+  options.bloom_filter_memory_budget = 64 << 10;
+  options.db_path = "__tmpLSMBloomFilterBudgetTest/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::create_directories(options.db_path);
+  uint32_t klen = 10, vlen = 50, N = 2e5;
+  auto kv =
+      GenKVDataWithRandomLen(0x202410171830, N, {klen - 1, klen}, {1, vlen});
+  auto lsm = DBImpl::Create(options);
+  for (uint32_t i = 0; i < N; i++) {
+    lsm->Put(kv[i].key(), kv[i].value());
+  }
+  lsm->FlushAll();
+  lsm->WaitForFlushAndCompaction();
+  auto sv = lsm->GetSV();
+  size_t filter_size = 0;
+  for (auto& level : sv->GetVersion()->GetLevels()) {
+    size_t level_size = 0, level_count = 0;
+    for (auto& run : level.GetRuns()) {
+      for (auto& sst : run->GetSSTs()) {
+        level_size += sst->GetBloomFilterSize();
+        level_count += sst->GetSSTInfo().count_;
+      }
+    }
+    DB_INFO("{} records, {} bytes of bloom filters", level_count, level_size);
+    filter_size += level_size;
+  }
+  sv.reset();
+  ASSERT_LE(filter_size, options.bloom_filter_memory_budget * 1.5);
+  for (uint32_t i = 0; i < N; i++) {
+    std::string value;
+    ASSERT_TRUE(lsm->Get(kv[i].key(), &value));
+  }
+  lsm.reset();
+  std::filesystem::remove_all(options.db_path);
+}
+
+TEST(LSMTest, LSMRangeSeekTest) {
+  Options options;
+  options.sst_file_size = 1 << 16;
+  options.write_buffer_size = 1 << 16;
+  options.range_filter_prefix_length = 9;
+  options.db_path = "__tmpLSMRangeSeekTest/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::create_directories(options.db_path);
+  auto lsm = DBImpl::Create(options);
+  auto key = [](uint32_t i) { return fmt::format("key{:08}", i); };
+  uint32_t N = 1e5;
+  std::map<std::string, std::string> ans;
+  std::mt19937_64 rgen(0x202410172010);
+  /* Sparse keys, with overwrites and deletions in newer sorted runs. */
+  for (uint32_t i = 0; i < N; i++) {
+    auto k = key(rgen() % (N * 100));
+    if (rgen() % 8 == 0) {
+      lsm->Del(k);
+      ans.erase(k);
+    } else {
+      auto v = fmt::format("{}", i);
+      lsm->Put(k, v);
+      ans[k] = v;
+    }
+  }
+  auto check = [&]() {
+    for (uint32_t i = 0; i < 2000; i++) {
+      uint32_t lower = rgen() % (N * 100), upper = lower + rgen() % 500;
+      auto it = lsm->Seek(key(lower), key(upper));
+      auto ans_it = ans.lower_bound(key(lower));
+      for (; ans_it != ans.end() && ans_it->first <= key(upper); ++ans_it) {
+        ASSERT_TRUE(it.Valid());
+        ASSERT_EQ(it.key(), ans_it->first);
+        ASSERT_EQ(it.value(), ans_it->second);
+        it.Next();
+      }
+      ASSERT_FALSE(it.Valid());
+    }
+  };
+  check();
+  lsm->FlushAll();
+  lsm->WaitForFlushAndCompaction();
+  check();
+  lsm.reset();
+  std::filesystem::remove_all(options.db_path);
+}
+
+TEST(LSMTest, LSMReverseScanTest) {
+  Options options;
+  options.sst_file_size = 1 << 16;
+  options.write_buffer_size = 1 << 16;
+  options.db_path = "__tmpLSMReverseScanTest/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::create_directories(options.db_path);
+  auto lsm = DBImpl::Create(options);
+  auto key = [](uint32_t i) { return fmt::format("key{:08}", i); };
+  uint32_t N = 3e4;
+  std::map<std::string, std::string> ans;
+  std::mt19937_64 rgen(0x202410172011);
+  for (uint32_t i = 0; i < N; i++) {
+    auto k = key(rgen() % N);
+    if (rgen() % 8 == 0) {
+      lsm->Del(k);
+      ans.erase(k);
+    } else {
+      auto v = fmt::format("{}", i);
+      lsm->Put(k, v);
+      ans[k] = v;
+    }
+  }
+  lsm->DeleteRange(key(1000), key(2000));
+  ans.erase(ans.lower_bound(key(1000)), ans.lower_bound(key(2000)));
+  auto check = [&]() {
+    auto it = lsm->Last();
+    for (auto ans_it = ans.rbegin(); ans_it != ans.rend(); ++ans_it) {
+      ASSERT_TRUE(it.Valid());
+      ASSERT_EQ(it.key(), ans_it->first);
+      ASSERT_EQ(it.value(), ans_it->second);
+      it.Prev();
+    }
+    ASSERT_FALSE(it.Valid());
+    for (uint32_t i = 0; i < 200; i++) {
+      auto k = key(rgen() % N);
+      auto seek_it = lsm->SeekForPrev(k);
+      auto ans_it = ans.upper_bound(k);
+      if (ans_it == ans.begin()) {
+        ASSERT_FALSE(seek_it.Valid());
+        continue;
+      }
+      --ans_it;
+      ASSERT_TRUE(seek_it.Valid());
+      ASSERT_EQ(seek_it.key(), ans_it->first);
+      /* Change the direction. */
+      if (std::next(ans_it) != ans.end()) {
+        seek_it.Next();
+        ASSERT_TRUE(seek_it.Valid());
+        ASSERT_EQ(seek_it.key(), std::next(ans_it)->first);
+        seek_it.Prev();
+        ASSERT_TRUE(seek_it.Valid());
+        ASSERT_EQ(seek_it.key(), ans_it->first);
+      }
+      uint32_t lower = rgen() % N, upper = lower + rgen() % 500;
+      auto range_it = lsm->Seek(key(lower), key(upper));
+      range_it.SeekToLast();
+      auto range_ans = ans.upper_bound(key(upper));
+      while (range_ans != ans.begin() &&
+             std::prev(range_ans)->first >= key(lower)) {
+        --range_ans;
+        ASSERT_TRUE(range_it.Valid());
+        ASSERT_EQ(range_it.key(), range_ans->first);
+        ASSERT_EQ(range_it.value(), range_ans->second);
+        range_it.Prev();
+      }
+      ASSERT_FALSE(range_it.Valid());
+    }
+  };
+  check();
+  lsm->FlushAll();
+  lsm->WaitForFlushAndCompaction();
+  check();
+  lsm.reset();
+  std::filesystem::remove_all(options.db_path);
+}
+
+TEST(LSMTest, LSMPartitionScanTest) {
+  Options options;
+  options.sst_file_size = 1 << 16;
+  options.write_buffer_size = 1 << 16;
+  options.db_path = "__tmpLSMPartitionScanTest/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::create_directories(options.db_path);
+  auto lsm = DBImpl::Create(options);
+  auto key = [](uint32_t i) { return fmt::format("key{:08}", i); };
+  uint32_t N = 50000;
+  std::map<std::string, std::string> ans;
+  std::mt19937_64 rgen(0x202410172012);
+  for (uint32_t i = 0; i < N; i++) {
+    auto k = key(rgen() % N);
+    auto v = fmt::format("{}", i);
+    lsm->Put(k, v);
+    ans[k] = v;
+  }
+  lsm->FlushAll();
+  lsm->WaitForFlushAndCompaction();
+  auto its = lsm->PartitionScan(4);
+  /* Writes after the partitions are created are not seen by them. */
+  lsm->Put(key(N), "new");
+  ASSERT_EQ(its.size(), 4);
+  std::vector<std::vector<std::pair<std::string, std::string>>> parts(4);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < its.size(); i++) {
+    threads.emplace_back([&, i]() {
+      for (auto& it = its[i]; it.Valid(); it.Next()) {
+        parts[i].emplace_back(it.key(), it.value());
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  auto ans_it = ans.begin();
+  for (auto& part : parts) {
+    /* The SSTables have about the same size. */
+    ASSERT_GT(part.size(), ans.size() / 8);
+    for (auto& [k, v] : part) {
+      ASSERT_TRUE(ans_it != ans.end());
+      ASSERT_EQ(k, ans_it->first);
+      ASSERT_EQ(v, ans_it->second);
+      ++ans_it;
+    }
+  }
+  ASSERT_TRUE(ans_it == ans.end());
+  /* A range is split in the same way. */
+  auto range_its = lsm->PartitionScan(3, key(N / 4), key(N / 2));
+  ans_it = ans.lower_bound(key(N / 4));
+  for (auto& it : range_its) {
+    for (; it.Valid(); it.Next()) {
+      ASSERT_EQ(it.key(), ans_it->first);
+      ++ans_it;
+    }
+  }
+  ASSERT_TRUE(ans_it == ans.upper_bound(key(N / 2)));
+  lsm.reset();
+  std::filesystem::remove_all(options.db_path);
+}
+
+TEST(LSMTest, LSMIngestTest) {
+  Options options;
+  options.sst_file_size = 1 << 16;
+  options.write_buffer_size = 1 << 16;
+  options.create_new = true;
+  options.db_path = "__tmpLSMIngestTest/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::create_directories(options.db_path);
+  auto key = [](uint32_t i) { return fmt::format("key{:08}", i); };
+  auto value = [](uint32_t i) { return fmt::format("value{}", i); };
+  uint32_t N = 20000;
+  /* It is called with the first key while the records are ingested. */
+  std::function<void(uint32_t)> on_first = [](uint32_t) {};
+  auto ingest = [&](DBImpl* lsm, uint32_t begin, uint32_t end) {
+    std::string k, v;
+    return lsm->Ingest([&, first = begin](Slice* key_out, Slice* value_out) {
+      if (begin == first) {
+        on_first(begin);
+      }
+      if (begin == end) {
+        return false;
+      }
+      k = key(begin);
+      v = value(begin);
+      begin += 1;
+      *key_out = k;
+      *value_out = v;
+      return true;
+    });
+  };
+  {
+    auto lsm = DBImpl::Create(options);
+    for (uint32_t i = 0; i < N; i++) {
+      lsm->Put(key(i), value(i));
+    }
+    lsm->FlushAll();
+    lsm->WaitForFlushAndCompaction();
+    size_t levels = lsm->GetSV()->GetVersion()->GetLevels().size();
+    ASSERT_GT(levels, 1);
+    /* A snapshot taken while ingesting does not see the records. */
+    const Snapshot* snapshot = nullptr;
+    on_first = [&](uint32_t) { snapshot = lsm->GetSnapshot(); };
+    /* The keys after the existing ones go to the last level. */
+    ASSERT_TRUE(ingest(lsm.get(), N, 3 * N));
+    std::string v;
+    ASSERT_FALSE(lsm->Get(key(N), &v, snapshot));
+    ASSERT_TRUE(lsm->Get(key(N), &v));
+    lsm->ReleaseSnapshot(snapshot);
+    auto& new_levels = lsm->GetSV()->GetVersion()->GetLevels();
+    ASSERT_EQ(new_levels.size(), levels);
+    ASSERT_EQ(new_levels.back().GetRuns().size(), 1);
+    ASSERT_EQ(new_levels.back().GetRuns()[0]->GetLargestKey().user_key_,
+        key(3 * N - 1));
+    /* The keys overlapping the last level go to Level 0, and are rebuilt. */
+    ASSERT_TRUE(ingest(lsm.get(), 0, 100));
+    /**
+     * The keys in the MemTable are overwritten by the ingested records, which
+     * are older than a write made while ingesting.
+     */
+    lsm->Put(key(3 * N + 10), "old");
+    std::thread writer;
+    on_first = [&](uint32_t) {
+      writer = std::thread([&]() { lsm->Put(key(3 * N + 20), "new"); });
+    };
+    ASSERT_FALSE(ingest(lsm.get(), 3 * N, 4 * N));
+    writer.join();
+    on_first = [](uint32_t) {};
+    ASSERT_THROW(
+        lsm->Ingest([&](Slice* key_out, Slice* value_out) {
+          static int count = 0;
+          *key_out = count++ == 0 ? "b" : "a";
+          *value_out = "";
+          return count <= 2;
+        }),
+        wing::DBException);
+    lsm->FlushAll();
+    lsm->WaitForFlushAndCompaction();
+  }
+  options.create_new = false;
+  auto lsm = DBImpl::Create(options);
+  std::string v;
+  for (uint32_t i = 0; i < 4 * N; i++) {
+    ASSERT_TRUE(lsm->Get(key(i), &v));
+    ASSERT_EQ(v, i == 3 * N + 20 ? "new" : value(i));
+  }
+  uint32_t count = 0;
+  for (auto it = lsm->Begin(); it.Valid(); it.Next()) {
+    ASSERT_EQ(it.key(), key(count));
+    count += 1;
+  }
+  ASSERT_EQ(count, 4 * N);
+  lsm.reset();
+  std::filesystem::remove_all(options.db_path);
+  /* The manifest keeps the sequence number of an ingestion. */
+  std::string crash_path = "__tmpLSMIngestTestCrash/";
+  std::filesystem::remove_all(crash_path);
+  std::filesystem::create_directories(options.db_path);
+  options.create_new = true;
+  {
+    auto lsm = DBImpl::Create(options);
+    ASSERT_TRUE(ingest(lsm.get(), 0, 1000));
+    ASSERT_EQ(lsm->CurrentSeq(), 1);
+    /* It is not saved. Copy the directory to simulate a crash. */
+    std::filesystem::copy(options.db_path, crash_path);
+  }
+  options.db_path = crash_path;
+  options.create_new = false;
+  lsm = DBImpl::Create(options);
+  ASSERT_EQ(lsm->CurrentSeq(), 1);
+  lsm->Put(key(1000), value(1000));
+  for (uint32_t i = 0; i <= 1000; i++) {
+    ASSERT_TRUE(lsm->Get(key(i), &v));
+    ASSERT_EQ(v, value(i));
+  }
+  lsm.reset();
+  std::filesystem::remove_all("__tmpLSMIngestTest/");
+  std::filesystem::remove_all(crash_path);
+}
+
+TEST(LSMTest, LSMBlobTest) {
+  Options options;
+  options.sst_file_size = 1 << 16;
+  options.write_buffer_size = 1 << 18;
+  options.min_blob_size = 256;
+  options.blob_file_size = 1 << 20;
+  options.create_new = true;
+  options.db_path = "__tmpLSMBlobTest/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::create_directories(options.db_path);
+  auto lsm = DBImpl::Create(options);
+  auto key = [](uint32_t i) { return fmt::format("key{:08}", i); };
+  uint32_t N = 2000;
+  std::vector<std::string> ans(N);
+  std::mt19937_64 rgen(0x202410171530);
+  /* Mix small and large values, and overwrite every key a few times. */
+  for (uint32_t round = 0; round < 8; round++) {
+    for (uint32_t i = 0; i < N; i++) {
+      ans[i] = std::string(rgen() % 2 ? 1024 : 16, 'a' + (i + round) % 26);
+      ans[i] += fmt::format("{}", round);
+      lsm->Put(key(i), ans[i]);
+    }
+  }
+  auto check = [&]() {
+    std::string value;
+    for (uint32_t i = 0; i < N; i++) {
+      ASSERT_TRUE(lsm->Get(key(i), &value));
+      ASSERT_EQ(value, ans[i]);
+    }
+    auto it = lsm->Begin();
+    for (uint32_t i = 0; i < N; i++) {
+      ASSERT_TRUE(it.Valid());
+      ASSERT_EQ(it.key(), key(i));
+      ASSERT_EQ(it.value(), ans[i]);
+      it.Next();
+    }
+    ASSERT_FALSE(it.Valid());
+  };
+  auto blob_bytes = [&]() {
+    size_t bytes = 0;
+    for (auto& entry : std::filesystem::directory_iterator(options.db_path)) {
+      if (entry.path().extension() == ".blob") {
+        bytes += entry.file_size();
+      }
+    }
+    return bytes;
+  };
+  check();
+  lsm->FlushAll();
+  lsm->WaitForFlushAndCompaction();
+  check();
+  /* Compactions drop the old values, so most blob files are removed. */
+  size_t live_bytes = 0;
+  for (auto& value : ans) {
+    live_bytes += value.size() >= options.min_blob_size ? value.size() : 0;
+  }
+  ASSERT_GT(blob_bytes(), 0);
+  ASSERT_LT(blob_bytes(), 4 * live_bytes);
+  lsm->Save();
+  lsm.reset();
+  options.create_new = false;
+  lsm = DBImpl::Create(options);
+  check();
+  lsm.reset();
+  std::filesystem::remove_all(options.db_path);
+}
+
+TEST(LSMTest, LSMCompressionTest) {
+  Options options;
+  options.sst_file_size = 1 << 16;
+  options.write_buffer_size = 1 << 16;
+  options.compression_per_level = {
+      BlockCodec::kNone, BlockCodec::kDeltaFOR, BlockCodec::kLZ};
+  options.db_path = "__tmpLSMCompressionTest/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::create_directories(options.db_path);
+  auto lsm = DBImpl::Create(options);
+  auto key = [](uint32_t i) { return fmt::format("key{:08}", i); };
+  uint32_t N = 1e5;
+  std::vector<std::string> ans(N);
+  std::mt19937_64 rgen(0x202410171830);
+  for (uint32_t i = 0; i < N; i++) {
+    uint32_t k = rgen() % N;
+    ans[k] = fmt::format("value{:08}", i % 1000);
+    lsm->Put(key(k), ans[k]);
+  }
+  lsm->FlushAll();
+  lsm->WaitForFlushAndCompaction();
+  std::string value;
+  for (uint32_t i = 0; i < N; i++) {
+    ASSERT_EQ(lsm->Get(key(i), &value), !ans[i].empty());
+    if (!ans[i].empty()) {
+      ASSERT_EQ(value, ans[i]);
+    }
+  }
+  auto it = lsm->Begin();
+  for (uint32_t i = 0; i < N; i++) {
+    if (ans[i].empty()) continue;
+    ASSERT_TRUE(it.Valid());
+    ASSERT_EQ(it.key(), key(i));
+    ASSERT_EQ(it.value(), ans[i]);
+    it.Next();
+  }
+  ASSERT_FALSE(it.Valid());
+  lsm.reset();
+  std::filesystem::remove_all(options.db_path);
+}
+
+TEST(LSMTest, CompactionRangeTombstoneTest) {
+  auto filegen = std::make_unique<FileNameGenerator>(
+      "__tmpCompactionRangeTombstoneTest", 0);
+  auto key = [](uint32_t i) { return fmt::format("key{:08}", i); };
+  uint32_t N = 10000;
+  MemTable mt;
+  for (uint32_t i = 0; i < N; i++) {
+    mt.Put(key(i), i + 1, fmt::format("value{}", i));
+  }
+  mt.DeleteRange(key(1000), key(3000), N + 1);
+  /* The records written after the tombstone are kept. */
+  mt.Put(key(2000), N + 2, "new");
+  {
+    CompactionJob worker(filegen.get(), 4096, 1 << 16, 16384, 10, false);
+    auto ssts = worker.Run(mt.Begin(), std::nullopt, mt.GetRangeTombstones());
+    SortedRun run(ssts, 4096, false);
+    size_t count = 0;
+    for (auto& sst : run.GetSSTs()) {
+      count += sst->GetSSTInfo().count_;
+    }
+    ASSERT_EQ(count, N - 2000 + 1);
+    auto& tombstones = run.GetSSTs().back()->GetRangeTombstones();
+    ASSERT_EQ(tombstones.GetTombstones().size(), 1);
+    ASSERT_EQ(tombstones.MaxCoveringSeq(key(1000), N + 1), N + 1);
+    ASSERT_EQ(tombstones.MaxCoveringSeq(key(3000), N + 1), 0);
+    std::string value;
+    ASSERT_EQ(run.Get(key(1500), N + 2, &value), GetResult::kNotFound);
+    ASSERT_EQ(run.Get(key(2000), N + 2, &value), GetResult::kFound);
+    ASSERT_EQ(value, "new");
+    run.SetRemoveTag(true);
+  }
+  /* A subcompaction without records keeps its part of the tombstone. */
+  {
+    CompactionJob worker(filegen.get(), 4096, 1 << 16, 16384, 10, false);
+    auto tombstones =
+        mt.GetRangeTombstones().Clip(key(1500), std::string(key(1600)));
+    auto it = mt.Seek(key(1500), N + 2);
+    auto ssts = worker.Run(it, key(1600), tombstones);
+    SortedRun run(ssts, 4096, false);
+    ASSERT_EQ(run.GetSSTs().size(), 1);
+    ASSERT_EQ(run.GetSSTs()[0]->GetSmallestKey().user_key_, key(1500));
+    auto& clipped = run.GetSSTs()[0]->GetRangeTombstones();
+    ASSERT_EQ(clipped.MaxCoveringSeq(key(1500), N + 1), N + 1);
+    ASSERT_EQ(clipped.MaxCoveringSeq(key(1600), N + 1), 0);
+    run.SetRemoveTag(true);
+  }
+}
+
+TEST(LSMTest, LSMDeleteRangeTest) {
+  Options options;
+  options.sst_file_size = 1 << 16;
+  options.write_buffer_size = 1 << 16;
+  options.db_path = "__tmpLSMDeleteRangeTest/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::create_directories(options.db_path);
+  auto lsm = DBImpl::Create(options);
+  auto key = [](uint32_t i) { return fmt::format("key{:08}", i); };
+  auto value = [](uint32_t i) { return fmt::format("value{}", i); };
+  uint32_t N = 20000;
+  std::vector<bool> live(N, true);
+  for (uint32_t i = 0; i < N; i++) {
+    lsm->Put(key(i), value(i));
+  }
+  lsm->FlushAll();
+  lsm->WaitForFlushAndCompaction();
+  auto check = [&]() {
+    std::vector<std::string> keys;
+    std::string v;
+    for (uint32_t i = 0; i < N; i++) {
+      ASSERT_EQ(lsm->Get(key(i), &v), live[i]);
+      if (live[i]) {
+        ASSERT_EQ(v, value(i));
+      }
+      keys.push_back(key(i));
+    }
+    std::vector<Slice> slices(keys.begin(), keys.end());
+    std::vector<std::string> values;
+    auto found = lsm->MultiGet(slices, &values);
+    for (uint32_t i = 0; i < N; i++) {
+      ASSERT_EQ(found[i], live[i]);
+    }
+    auto it = lsm->Begin();
+    for (uint32_t i = 0; i < N; i++) {
+      if (!live[i]) continue;
+      ASSERT_TRUE(it.Valid());
+      ASSERT_EQ(it.key(), key(i));
+      ASSERT_EQ(it.value(), value(i));
+      it.Next();
+    }
+    ASSERT_FALSE(it.Valid());
+    auto range_it = lsm->Seek(key(900), key(5100));
+    for (uint32_t i = 900; i <= 5100; i++) {
+      if (!live[i]) continue;
+      ASSERT_TRUE(range_it.Valid());
+      ASSERT_EQ(range_it.key(), key(i));
+      range_it.Next();
+    }
+    ASSERT_FALSE(range_it.Valid());
+  };
+  auto erase = [&](uint32_t begin, uint32_t end) {
+    std::fill(live.begin() + begin, live.begin() + end, false);
+  };
+  lsm->DeleteRange(key(1000), key(5000));
+  erase(1000, 5000);
+  lsm->Put(key(2000), value(2000));
+  live[2000] = true;
+  WriteBatch batch;
+  batch.DeleteRange(key(8000), key(12000));
+  batch.Put(key(9000), value(9000));
+  lsm->Write(batch);
+  erase(8000, 12000);
+  live[9000] = true;
+  check();
+  lsm->FlushAll();
+  lsm->WaitForFlushAndCompaction();
+  check();
+  /* Rewrite the other keys, so compactions merge the covered records. */
+  for (uint32_t round = 0; round < 3; round++) {
+    for (uint32_t i = 0; i < N; i++) {
+      if (live[i]) {
+        lsm->Put(key(i), value(i));
+      }
+    }
+  }
+  lsm->FlushAll();
+  lsm->WaitForFlushAndCompaction();
+  check();
+  lsm->Save();
+  lsm.reset();
+  options.create_new = false;
+  lsm = DBImpl::Create(options);
+  check();
+  lsm.reset();
+  std::filesystem::remove_all(options.db_path);
+}
+
+TEST(LSMTest, LSMDeleteRangeDropTest) {
+  Options options;
+  options.sst_file_size = 1 << 16;
+  options.write_buffer_size = 1 << 16;
+  options.level0_compaction_trigger = 1;
+  options.db_path = "__tmpLSMDeleteRangeDropTest/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::create_directories(options.db_path);
+  auto lsm = DBImpl::Create(options);
+  auto key = [](uint32_t i) { return fmt::format("key{:08}", i); };
+  uint32_t N = 2000;
+  auto count = [&]() {
+    auto& tombstones = lsm->GetSV()->GetVersion()->GetRangeTombstones();
+    return tombstones.GetTombstones().size();
+  };
+  auto put_all = [&]() {
+    for (uint32_t i = 0; i < N; i++) {
+      if (i < 500 || i >= 1500) {
+        lsm->Put(key(i), "value");
+      }
+    }
+    lsm->FlushAll();
+  };
+  for (uint32_t i = 0; i < N; i++) {
+    lsm->Put(key(i), "old");
+  }
+  lsm->FlushAll();
+  auto snapshot = lsm->GetSnapshot();
+  lsm->DeleteRange(key(500), key(1500));
+  put_all();
+  put_all();
+  lsm->WaitForFlushAndCompaction();
+  /* The snapshot still sees the deleted records. */
+  ASSERT_GT(count(), 0);
+  std::string v;
+  ASSERT_TRUE(lsm->Get(key(1000), &v, snapshot));
+  ASSERT_EQ(v, "old");
+  lsm->ReleaseSnapshot(snapshot);
+  /* The next compaction into the last level drops the tombstone. */
+  put_all();
+  put_all();
+  lsm->WaitForFlushAndCompaction();
+  ASSERT_EQ(lsm->GetSV()->GetVersion()->GetLevels().size(), 2);
+  ASSERT_EQ(count(), 0);
+  for (uint32_t i = 0; i < N; i++) {
+    bool live = i < 500 || i >= 1500;
+    ASSERT_EQ(lsm->Get(key(i), &v), live);
+  }
+  lsm.reset();
+  std::filesystem::remove_all(options.db_path);
+}
+
+TEST(LSMTest, CompactionSnapshotTest) {
+  auto filegen =
+      std::make_unique<FileNameGenerator>("__tmpCompactionSnapshotTest", 0);
+  auto key = [](uint32_t i) { return fmt::format("key{:08}", i); };
+  uint32_t N = 1000;
+  MemTable mt;
+  /* Key i has versions with sequence numbers 1, 3, 5 and 7. */
+  for (seq_t seq = 1; seq <= 7; seq += 2) {
+    for (uint32_t i = 0; i < N; i++) {
+      mt.Put(key(i), seq, fmt::format("value{}", seq));
+    }
+  }
+  /* The keys except key 0 are deleted at 8. */
+  mt.DeleteRange(key(1), key(N), 8);
+  CompactionJob worker(filegen.get(), 4096, 1 << 16, 16384, 10, false, 16,
+      wing::utils::BloomFilterFormat::kBlocked, 0, BlockCodec::kNone,
+      nullptr, {2, 4});
+  auto ssts = worker.Run(mt.Begin(), std::nullopt, mt.GetRangeTombstones());
+  SortedRun run(ssts, 4096, false);
+  auto it = run.Begin();
+  for (uint32_t i = 0; i < N; i++) {
+    /* Snapshots 2 and 4 see versions 1 and 3. Version 5 is hidden. */
+    std::vector<seq_t> seqs = {3, 1};
+    if (i == 0) {
+      seqs = {7, 3, 1};
+    }
+    for (auto seq : seqs) {
+      ASSERT_TRUE(it.Valid());
+      ASSERT_EQ(ParsedKey(it.key()).user_key_, key(i));
+      ASSERT_EQ(ParsedKey(it.key()).seq_, seq);
+      it.Next();
+    }
+  }
+  ASSERT_FALSE(it.Valid());
+  run.SetRemoveTag(true);
+}
+
+TEST(LSMTest, LSMSnapshotTest) {
+  Options options;
+  options.sst_file_size = 1 << 16;
+  options.write_buffer_size = 1 << 16;
+  options.db_path = "__tmpLSMSnapshotTest/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::create_directories(options.db_path);
+  auto lsm = DBImpl::Create(options);
+  auto key = [](uint32_t i) { return fmt::format("key{:08}", i); };
+  auto value = [](uint32_t i, uint32_t round) {
+    return fmt::format("value{}-{}", i, round);
+  };
+  uint32_t N = 10000;
+  for (uint32_t i = 0; i < N; i++) {
+    lsm->Put(key(i), value(i, 0));
+  }
+  auto snapshot = lsm->GetSnapshot();
+  /* Overwrite and delete the keys, and let compactions merge them. */
+  for (uint32_t round = 1; round <= 4; round++) {
+    for (uint32_t i = 0; i < N; i++) {
+      if (i % 3 == 0) {
+        lsm->Del(key(i));
+      } else {
+        lsm->Put(key(i), value(i, round));
+      }
+    }
+    lsm->FlushAll();
+  }
+  lsm->DeleteRange(key(0), key(N / 2));
+  lsm->FlushAll();
+  lsm->WaitForFlushAndCompaction();
+  auto check = [&](const Snapshot* s, auto&& expected) {
+    std::string v;
+    std::vector<std::string> keys;
+    for (uint32_t i = 0; i < N; i++) {
+      auto ans = expected(i);
+      ASSERT_EQ(lsm->Get(key(i), &v, s), ans.has_value());
+      if (ans) {
+        ASSERT_EQ(v, *ans);
+      }
+      keys.push_back(key(i));
+    }
+    std::vector<Slice> slices(keys.begin(), keys.end());
+    std::vector<std::string> values;
+    auto found = lsm->MultiGet(slices, &values, s);
+    auto it = lsm->Begin(true, s);
+    for (uint32_t i = 0; i < N; i++) {
+      auto ans = expected(i);
+      ASSERT_EQ(found[i], ans.has_value());
+      if (!ans) continue;
+      ASSERT_EQ(values[i], *ans);
+      ASSERT_TRUE(it.Valid());
+      ASSERT_EQ(it.key(), key(i));
+      ASSERT_EQ(it.value(), *ans);
+      it.Next();
+    }
+    ASSERT_FALSE(it.Valid());
+  };
+  check(snapshot, [&](uint32_t i) -> std::optional<std::string> {
+    return value(i, 0);
+  });
+  auto latest = [&](uint32_t i) -> std::optional<std::string> {
+    if (i < N / 2 || i % 3 == 0) {
+      return std::nullopt;
+    }
+    return value(i, 4);
+  };
+  check(nullptr, latest);
+  lsm->ReleaseSnapshot(snapshot);
+  check(nullptr, latest);
+  lsm.reset();
+  std::filesystem::remove_all(options.db_path);
+}
+
+/* Concatenation is associative. */
+class AppendOperator : public MergeOperator {
+ public:
+  void Merge(
+      Slice existing, Slice operand, std::string* result) const override {
+    result->assign(existing);
+    result->append(operand);
+  }
+};
+
+TEST(LSMTest, LSMMergeTest) {
+  Options options;
+  options.sst_file_size = 1 << 16;
+  options.write_buffer_size = 1 << 16;
+  options.db_path = "__tmpLSMMergeTest/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::create_directories(options.db_path);
+  ASSERT_THROW(DBImpl::Create(options)->Merge("a", "b"), wing::DBException);
+  options.merge_operator = std::make_shared<AppendOperator>();
+  auto lsm = DBImpl::Create(options);
+  auto key = [](uint32_t i) { return fmt::format("key{:08}", i); };
+  uint32_t N = 10000;
+  std::vector<std::optional<std::string>> ans(N);
+  for (uint32_t i = 0; i < N; i += 4) {
+    lsm->Put(key(i), "v");
+    ans[i] = "v";
+  }
+  auto snapshot = lsm->GetSnapshot();
+  auto old_ans = ans;
+  /* Merge operands on values, deletions and missing keys. */
+  for (uint32_t round = 1; round <= 6; round++) {
+    for (uint32_t i = 0; i < N; i++) {
+      if (round == 3 && i % 7 == 3) {
+        lsm->Del(key(i));
+        ans[i].reset();
+      } else if (i % 5 != 4) {
+        auto operand = fmt::format("{}", round);
+        lsm->Merge(key(i), operand);
+        ans[i] = ans[i].value_or("") + operand;
+      }
+    }
+    if (round == 4) {
+      lsm->DeleteRange(key(N / 4), key(N / 3));
+      for (uint32_t i = N / 4; i < N / 3; i++) {
+        ans[i].reset();
+      }
+    }
+    lsm->FlushAll();
+  }
+  /* These stay in the MemTable. */
+  for (uint32_t i = 0; i < N; i += 10) {
+    lsm->Merge(key(i), "m");
+    ans[i] = ans[i].value_or("") + "m";
+  }
+  auto check = [&](DBImpl* lsm, const Snapshot* s,
+                   const std::vector<std::optional<std::string>>& ans) {
+    std::string v;
+    std::vector<std::string> keys;
+    for (uint32_t i = 0; i < N; i++) {
+      ASSERT_EQ(lsm->Get(key(i), &v, s), ans[i].has_value());
+      if (ans[i]) {
+        ASSERT_EQ(v, *ans[i]);
+      }
+      keys.push_back(key(i));
+    }
+    std::vector<Slice> slices(keys.begin(), keys.end());
+    std::vector<std::string> values;
+    auto found = lsm->MultiGet(slices, &values, s);
+    auto it = lsm->Begin(true, s);
+    for (uint32_t i = 0; i < N; i++) {
+      ASSERT_EQ(found[i], ans[i].has_value());
+      if (!ans[i]) continue;
+      ASSERT_EQ(values[i], *ans[i]);
+      ASSERT_TRUE(it.Valid());
+      ASSERT_EQ(it.key(), key(i));
+      ASSERT_EQ(it.value(), *ans[i]);
+      it.Next();
+    }
+    ASSERT_FALSE(it.Valid());
+    auto rit = lsm->Last(true, s);
+    for (uint32_t i = N; i-- > 0;) {
+      if (!ans[i]) continue;
+      ASSERT_TRUE(rit.Valid());
+      ASSERT_EQ(rit.key(), key(i));
+      ASSERT_EQ(rit.value(), *ans[i]);
+      rit.Prev();
+    }
+    ASSERT_FALSE(rit.Valid());
+  };
+  check(lsm.get(), snapshot, old_ans);
+  check(lsm.get(), nullptr, ans);
+  lsm->ReleaseSnapshot(snapshot);
+  lsm->WaitForFlushAndCompaction();
+  check(lsm.get(), nullptr, ans);
+  lsm.reset();
+  options.create_new = false;
+  lsm = DBImpl::Create(options);
+  check(lsm.get(), nullptr, ans);
+  lsm.reset();
+  std::filesystem::remove_all(options.db_path);
+}
+
+TEST(LSMTest, LSMMergeLiveTombstoneTest) {
+  /**
+   * The operands are compacted below a newer tombstone, which is not among
+   * the inputs, e.g. it is in Level 0 while Level 1 is compacted into Level 2.
+   */
+  MemTable mt;
+  mt.Merge("k1", 1, "a");
+  mt.Merge("k2", 3, "b");
+  mt.Merge("k2", 7, "c");
+  RangeTombstoneList tombstones;
+  tombstones.Add(RangeTombstone{"a", "z", 5});
+  auto filegen =
+      std::make_unique<FileNameGenerator>("__tmpLSMMergeLiveTombstoneTest", 0);
+  AppendOperator merge_operator;
+  CompactionJob worker(filegen.get(), 4096, 1 << 20, 1 << 20, 10, false,
+      kDefaultBlockRestartInterval, wing::utils::BloomFilterFormat::kBlocked,
+      0, BlockCodec::kNone, nullptr, {}, &merge_operator);
+  worker.SetLiveTombstones(tombstones);
+  auto ssts = worker.Run(mt.Begin());
+  SortedRun run(ssts, 4096, false);
+  auto it = run.Begin();
+  /* The deleted operand is kept, since the tombstone still hides it. */
+  ASSERT_TRUE(it.Valid());
+  ASSERT_EQ(ParsedKey(it.key()).user_key_, "k1");
+  ASSERT_EQ(ParsedKey(it.key()).type_, RecordType::Merge);
+  ASSERT_EQ(it.value(), "a");
+  it.Next();
+  /* The newer operand is not folded with the deleted one. */
+  ASSERT_TRUE(it.Valid());
+  ASSERT_EQ(ParsedKey(it.key()).user_key_, "k2");
+  ASSERT_EQ(ParsedKey(it.key()).seq_, 7);
+  ASSERT_EQ(ParsedKey(it.key()).type_, RecordType::Value);
+  ASSERT_EQ(it.value(), "c");
+  it.Next();
+  ASSERT_FALSE(it.Valid());
+  run.SetRemoveTag(true);
+}
+
+TEST(LSMTest, LSMManifestRecoveryTest) {
+  Options options;
+  options.sst_file_size = 1 << 16;
+  options.write_buffer_size = 1 << 16;
+  options.manifest_checkpoint_interval = 4;
+  options.db_path = "__tmpLSMManifestRecoveryTest/";
+  std::string crash_path = "__tmpLSMManifestRecoveryTestCrash/";
+  std::filesystem::remove_all(options.db_path);
+  std::filesystem::remove_all(crash_path);
+  std::filesystem::create_directories(options.db_path);
+  auto key = [](uint32_t i) { return fmt::format("key{:08}", i); };
+  uint32_t N = 20000;
+  std::vector<std::string> ans(N);
+  std::mt19937_64 rgen(0x202410190930);
+  {
+    auto lsm = DBImpl::Create(options);
+    for (uint32_t round = 0; round < 3; round++) {
+      for (uint32_t i = 0; i < N; i++) {
+        uint32_t k = rgen() % N;
+        ans[k] = fmt::format("value{}-{}", k, round);
+        lsm->Put(key(k), ans[k]);
+      }
+      lsm->FlushAll();
+    }
+    lsm->WaitForFlushAndCompaction();
+    /* The flushed logs are removed. Copy the directory to simulate a crash. */
+    ASSERT_GT(lsm->GetSV()->GetVersion()->GetLevels().size(), 1);
+    std::filesystem::copy(options.db_path, crash_path);
+  }
+  options.db_path = crash_path;
+  options.create_new = false;
+  for (uint32_t reopen = 0; reopen < 2; reopen++) {
+    auto lsm = DBImpl::Create(options);
+    std::string value;
+    for (uint32_t i = 0; i < N; i++) {
+      ASSERT_EQ(lsm->Get(key(i), &value), !ans[i].empty());
+      if (!ans[i].empty()) {
+        ASSERT_EQ(value, ans[i]);
+      }
+    }
+  }
+  std::filesystem::remove_all(crash_path);
+  std::filesystem::remove_all("__tmpLSMManifestRecoveryTest/");
+}
+
 TEST(LSMTest, LSMBigScanTest) {
   Options options;
   options.compaction_strategy_name = "leveled";